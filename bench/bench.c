@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include "bench.h"
+
+/*
+ * Runs every benchmark against keys and values generated from a single
+ * configuration, and writes one result per benchmark as either CSV or JSON.
+ * Each benchmark times only the region between bench_resume and bench_pause,
+ * and the fastest of the repetitions is reported.
+ */
+
+#define BKTHOMPS_BENCH_ZIPF_EXPONENT 0.99
+
+struct bench_config bench_config = {100000, 8, 8, 5, BENCH_RANDOM, NULL};
+
+char *bench_keys = NULL;
+char *bench_values = NULL;
+char *bench_scratch = NULL;
+
+static const char *const distribution_names[] = {"sequential", "random",
+                                                 "zipf"};
+
+static bk_bool output_json = BK_FALSE;
+static bk_bool output_first = BK_TRUE;
+static clock_t started;
+static clock_t elapsed;
+static unsigned long random_state = 2463534242UL;
+
+/*
+ * A 32-bit xorshift generator, so that every platform sees the same keys.
+ */
+static unsigned long bench_random(void)
+{
+    random_state ^= (random_state << 13) & 0xFFFFFFFFUL;
+    random_state ^= random_state >> 17;
+    random_state ^= (random_state << 5) & 0xFFFFFFFFUL;
+    return random_state;
+}
+
+/*
+ * Stores the number big-endian in the last bytes of the element, so that
+ * comparing elements byte by byte orders them numerically.
+ */
+static void bench_encode(char *const element, const size_t size,
+                         unsigned long number)
+{
+    size_t i;
+    memset(element, 0, size);
+    for (i = size; i > 0 && number; i--) {
+        element[i - 1] = (char) (number & 0xFF);
+        number >>= 8;
+    }
+}
+
+/*
+ * Draws ranks from a Zipfian distribution over count items, then scatters the
+ * ranks so that the hottest keys are not also the smallest ones.
+ */
+static bk_bool bench_zipf(unsigned long *const numbers, const size_t count)
+{
+    size_t i;
+    double total = 0;
+    double *const cumulative = malloc(count * sizeof(double));
+    if (!cumulative) {
+        return BK_FALSE;
+    }
+    for (i = 0; i < count; i++) {
+        total += 1.0 / pow((double) (i + 1), BKTHOMPS_BENCH_ZIPF_EXPONENT);
+        cumulative[i] = total;
+    }
+    for (i = 0; i < count; i++) {
+        const double target = total * (double) bench_random() / 4294967296.0;
+        size_t low = 0;
+        size_t high = count - 1;
+        while (low < high) {
+            const size_t mid = low + (high - low) / 2;
+            if (cumulative[mid] <= target) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        numbers[i] = (low * 2654435761UL) & 0xFFFFFFFFUL;
+    }
+    free(cumulative);
+    return BK_TRUE;
+}
+
+static bk_bool bench_generate(void)
+{
+    size_t i;
+    const size_t count = bench_config.count;
+    unsigned long *const numbers = malloc(count * sizeof(unsigned long));
+    if (!numbers) {
+        return BK_FALSE;
+    }
+    switch (bench_config.distribution) {
+    case BENCH_SEQUENTIAL:
+        for (i = 0; i < count; i++) {
+            numbers[i] = i;
+        }
+        break;
+    case BENCH_RANDOM:
+        for (i = 0; i < count; i++) {
+            numbers[i] = bench_random();
+        }
+        break;
+    case BENCH_ZIPF:
+        if (!bench_zipf(numbers, count)) {
+            free(numbers);
+            return BK_FALSE;
+        }
+        break;
+    }
+    bench_keys = malloc(count * bench_config.key_size);
+    bench_values = malloc(count * bench_config.value_size);
+    bench_scratch = malloc(bench_config.key_size > bench_config.value_size
+                           ? bench_config.key_size : bench_config.value_size);
+    if (!bench_keys || !bench_values || !bench_scratch) {
+        free(numbers);
+        free(bench_keys);
+        free(bench_values);
+        free(bench_scratch);
+        bench_keys = NULL;
+        bench_values = NULL;
+        bench_scratch = NULL;
+        return BK_FALSE;
+    }
+    for (i = 0; i < count; i++) {
+        bench_encode(bench_keys + i * bench_config.key_size,
+                     bench_config.key_size, numbers[i]);
+        bench_encode(bench_values + i * bench_config.value_size,
+                     bench_config.value_size, i);
+    }
+    free(numbers);
+    return BK_TRUE;
+}
+
+int bench_compare(const void *const one, const void *const two)
+{
+    return memcmp(one, two, bench_config.key_size);
+}
+
+/*
+ * The 32-bit FNV-1a hash of the key bytes.
+ */
+unsigned long bench_hash(const void *const key)
+{
+    size_t i;
+    const unsigned char *const bytes = key;
+    unsigned long hash = 2166136261UL;
+    for (i = 0; i < bench_config.key_size; i++) {
+        hash ^= bytes[i];
+        hash = (hash * 16777619UL) & 0xFFFFFFFFUL;
+    }
+    return hash;
+}
+
+/**
+ * Stops the benchmarks if a setup step failed. Unlike assert, this check is
+ * kept when the benchmarks are built with NDEBUG, so that a failed setup is
+ * never timed as if it had succeeded.
+ *
+ * @param error the result of the setup step
+ */
+void bench_require(const bk_err error)
+{
+    if (error != BK_OK) {
+        fprintf(stderr, "benchmark setup failed with error %d\n", error);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Starts timing the benchmark which is currently running.
+ */
+void bench_resume(void)
+{
+    started = clock();
+}
+
+/**
+ * Stops timing the benchmark which is currently running, so that setup and
+ * teardown work is not measured.
+ */
+void bench_pause(void)
+{
+    elapsed += clock() - started;
+}
+
+/**
+ * Runs the benchmark the configured number of times unless it is filtered out,
+ * and writes the fastest run. Every benchmark performs bench_config.count
+ * operations while it is being timed.
+ *
+ * @param name     the name of the benchmark
+ * @param function the benchmark to run
+ */
+void bench_run(const char *const name, void (*const function)(void))
+{
+    int i;
+    clock_t best = 0;
+    double total_ns;
+    if (bench_config.filter && !strstr(name, bench_config.filter)) {
+        return;
+    }
+    for (i = 0; i < bench_config.repetitions; i++) {
+        elapsed = 0;
+        function();
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    total_ns = (double) best * 1e9 / CLOCKS_PER_SEC;
+    if (output_json) {
+        printf("%s\n    {\"name\": \"%s\", \"iterations\": %lu, "
+               "\"cpu_time\": %.3f, \"time_unit\": \"ns\"}",
+               output_first ? "" : ",", name,
+               (unsigned long) bench_config.count,
+               total_ns / (double) bench_config.count);
+    } else {
+        printf("%s,%s,%lu,%lu,%lu,%d,%.0f,%.3f\n", name,
+               distribution_names[bench_config.distribution],
+               (unsigned long) bench_config.count,
+               (unsigned long) bench_config.key_size,
+               (unsigned long) bench_config.value_size,
+               bench_config.repetitions, total_ns,
+               total_ns / (double) bench_config.count);
+    }
+    output_first = BK_FALSE;
+}
+
+static bk_bool bench_parse_size(const char *const text, size_t *const size)
+{
+    char *end;
+    const unsigned long parsed = strtoul(text, &end, 10);
+    if (*end != '\0' || parsed == 0) {
+        return BK_FALSE;
+    }
+    *size = (size_t) parsed;
+    return BK_TRUE;
+}
+
+static bk_bool bench_parse_argument(const char *const argument)
+{
+    size_t repetitions;
+    if (strncmp(argument, "--count=", 8) == 0) {
+        return bench_parse_size(argument + 8, &bench_config.count);
+    }
+    if (strncmp(argument, "--key_size=", 11) == 0) {
+        return bench_parse_size(argument + 11, &bench_config.key_size);
+    }
+    if (strncmp(argument, "--value_size=", 13) == 0) {
+        return bench_parse_size(argument + 13, &bench_config.value_size);
+    }
+    if (strncmp(argument, "--repetitions=", 14) == 0) {
+        if (!bench_parse_size(argument + 14, &repetitions)) {
+            return BK_FALSE;
+        }
+        bench_config.repetitions = (int) repetitions;
+        return BK_TRUE;
+    }
+    if (strncmp(argument, "--filter=", 9) == 0) {
+        bench_config.filter = argument + 9;
+        return BK_TRUE;
+    }
+    if (strcmp(argument, "--format=csv") == 0) {
+        output_json = BK_FALSE;
+        return BK_TRUE;
+    }
+    if (strcmp(argument, "--format=json") == 0) {
+        output_json = BK_TRUE;
+        return BK_TRUE;
+    }
+    if (strcmp(argument, "--distribution=sequential") == 0) {
+        bench_config.distribution = BENCH_SEQUENTIAL;
+        return BK_TRUE;
+    }
+    if (strcmp(argument, "--distribution=random") == 0) {
+        bench_config.distribution = BENCH_RANDOM;
+        return BK_TRUE;
+    }
+    if (strcmp(argument, "--distribution=zipf") == 0) {
+        bench_config.distribution = BENCH_ZIPF;
+        return BK_TRUE;
+    }
+    return BK_FALSE;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (!bench_parse_argument(argv[i])) {
+            fprintf(stderr, "usage: %s [--count=N] [--key_size=N] "
+                            "[--value_size=N] [--repetitions=N] "
+                            "[--distribution=sequential|random|zipf] "
+                            "[--format=csv|json] [--filter=NAME]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!bench_generate()) {
+        fprintf(stderr, "could not allocate %lu elements\n",
+                (unsigned long) bench_config.count);
+        return 1;
+    }
+    if (output_json) {
+        printf("{\n  \"context\": {\"distribution\": \"%s\", \"count\": %lu, "
+               "\"key_size\": %lu, \"value_size\": %lu, \"repetitions\": %d},"
+               "\n  \"benchmarks\": [",
+               distribution_names[bench_config.distribution],
+               (unsigned long) bench_config.count,
+               (unsigned long) bench_config.key_size,
+               (unsigned long) bench_config.value_size,
+               bench_config.repetitions);
+    } else {
+        printf("name,distribution,count,key_size,value_size,repetitions,"
+               "total_ns,ns_per_op\n");
+    }
+    bench_vector();
+    bench_deque();
+    bench_map();
+    bench_btree_map();
+    bench_unordered_map();
+    bench_priority_queue();
+    if (output_json) {
+        printf("\n  ]\n}\n");
+    }
+    free(bench_keys);
+    free(bench_values);
+    free(bench_scratch);
+    return 0;
+}
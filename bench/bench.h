@@ -0,0 +1,47 @@
+#ifndef CONTAINERS_BENCH_H
+#define CONTAINERS_BENCH_H
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "../src/include/_bk_defines.h"
+
+enum bench_distribution {
+    BENCH_SEQUENTIAL,
+    BENCH_RANDOM,
+    BENCH_ZIPF
+};
+
+struct bench_config {
+    size_t count;
+    size_t key_size;
+    size_t value_size;
+    int repetitions;
+    enum bench_distribution distribution;
+    const char *filter;
+};
+
+extern struct bench_config bench_config;
+
+/* The generated keys and values, each bench_config.count elements long. */
+extern char *bench_keys;
+extern char *bench_values;
+/* Scratch space large enough for either a key or a value. */
+extern char *bench_scratch;
+
+int bench_compare(const void *const one, const void *const two);
+unsigned long bench_hash(const void *const key);
+
+void bench_require(bk_err error);
+void bench_resume(void);
+void bench_pause(void);
+void bench_run(const char *name, void (*function)(void));
+
+void bench_vector(void);
+void bench_deque(void);
+void bench_map(void);
+void bench_btree_map(void);
+void bench_unordered_map(void);
+void bench_priority_queue(void);
+
+#endif /* CONTAINERS_BENCH_H */
@@ -0,0 +1,122 @@
+#include "bench.h"
+#include "../src/include/btree_map.h"
+
+static btree_map bench_btree_map_init(const size_t node_size)
+{
+    btree_map me;
+    if (node_size == 0) {
+        me = btree_map_init(bench_config.key_size, bench_config.value_size,
+                            bench_compare);
+    } else {
+        me = btree_map_init_ex(bench_config.key_size, bench_config.value_size,
+                               bench_compare, node_size, NULL);
+    }
+    assert(me);
+    return me;
+}
+
+static void bench_btree_map_put_sized(const size_t node_size)
+{
+    size_t i;
+    btree_map me = bench_btree_map_init(node_size);
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        btree_map_put(me, bench_keys + i * bench_config.key_size,
+                      bench_values + i * bench_config.value_size);
+    }
+    bench_pause();
+    assert(!btree_map_is_empty(me));
+    btree_map_destroy(me);
+}
+
+static void bench_btree_map_get_sized(const size_t node_size)
+{
+    size_t i;
+    btree_map me = bench_btree_map_init(node_size);
+    for (i = 0; i < bench_config.count; i++) {
+        bench_require(btree_map_put(
+                me, bench_keys + i * bench_config.key_size,
+                bench_values + i * bench_config.value_size));
+    }
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        btree_map_get(bench_scratch, me,
+                      bench_keys + i * bench_config.key_size);
+    }
+    bench_pause();
+    btree_map_destroy(me);
+}
+
+static void bench_btree_map_put(void)
+{
+    bench_btree_map_put_sized(0);
+}
+
+static void bench_btree_map_get(void)
+{
+    bench_btree_map_get_sized(0);
+}
+
+static void bench_btree_map_put_4096(void)
+{
+    bench_btree_map_put_sized(4096);
+}
+
+static void bench_btree_map_get_4096(void)
+{
+    bench_btree_map_get_sized(4096);
+}
+
+/*
+ * Removes every key, which merges the nodes back together as they empty out.
+ */
+static void bench_btree_map_remove(void)
+{
+    size_t i;
+    btree_map me = bench_btree_map_init(0);
+    for (i = 0; i < bench_config.count; i++) {
+        bench_require(btree_map_put(
+                me, bench_keys + i * bench_config.key_size,
+                bench_values + i * bench_config.value_size));
+    }
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        btree_map_remove(me, bench_keys + i * bench_config.key_size);
+    }
+    bench_pause();
+    assert(btree_map_is_empty(me));
+    btree_map_destroy(me);
+}
+
+static void bench_btree_map_iter(void)
+{
+    struct btree_map_iter iter;
+    size_t visited = 0;
+    void *key;
+    void *value;
+    btree_map me = bench_btree_map_init(0);
+    size_t i;
+    for (i = 0; i < bench_config.count; i++) {
+        bench_require(btree_map_put(
+                me, bench_keys + i * bench_config.key_size,
+                bench_values + i * bench_config.value_size));
+    }
+    bench_resume();
+    btree_map_iter_init(&iter, me);
+    while (btree_map_iter_next(&key, &value, &iter)) {
+        visited++;
+    }
+    bench_pause();
+    assert(visited == btree_map_size(me));
+    btree_map_destroy(me);
+}
+
+void bench_btree_map(void)
+{
+    bench_run("btree_map_put", bench_btree_map_put);
+    bench_run("btree_map_get", bench_btree_map_get);
+    bench_run("btree_map_put_4096", bench_btree_map_put_4096);
+    bench_run("btree_map_get_4096", bench_btree_map_get_4096);
+    bench_run("btree_map_remove", bench_btree_map_remove);
+    bench_run("btree_map_iter", bench_btree_map_iter);
+}
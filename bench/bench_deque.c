@@ -0,0 +1,40 @@
+#include "bench.h"
+#include "../src/include/deque.h"
+
+static void bench_deque_push_back(void)
+{
+    size_t i;
+    deque me = deque_init(bench_config.value_size);
+    assert(me);
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        deque_push_back(me, bench_values + i * bench_config.value_size);
+    }
+    bench_pause();
+    assert(deque_size(me) == bench_config.count);
+    deque_destroy(me);
+}
+
+static void bench_deque_pop_front(void)
+{
+    size_t i;
+    deque me = deque_init(bench_config.value_size);
+    assert(me);
+    for (i = 0; i < bench_config.count; i++) {
+        bench_require(deque_push_back(
+                me, bench_values + i * bench_config.value_size));
+    }
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        deque_pop_front(bench_scratch, me);
+    }
+    bench_pause();
+    assert(deque_is_empty(me));
+    deque_destroy(me);
+}
+
+void bench_deque(void)
+{
+    bench_run("deque_push_back", bench_deque_push_back);
+    bench_run("deque_pop_front", bench_deque_pop_front);
+}
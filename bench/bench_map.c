@@ -0,0 +1,172 @@
+#include "bench.h"
+#include "../src/include/map.h"
+
+static void bench_map_put(void)
+{
+    size_t i;
+    map me = map_init(bench_config.key_size, bench_config.value_size,
+                      bench_compare);
+    assert(me);
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        map_put(me, bench_keys + i * bench_config.key_size,
+                bench_values + i * bench_config.value_size);
+    }
+    bench_pause();
+    assert(!map_is_empty(me));
+    map_destroy(me);
+}
+
+/*
+ * The same as map_put, but with the subtree sizes kept up to date as well.
+ */
+static void bench_map_put_order_statistics(void)
+{
+    size_t i;
+    map me = map_init(bench_config.key_size, bench_config.value_size,
+                      bench_compare);
+    assert(me);
+    bench_require(map_use_order_statistics(me));
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        map_put(me, bench_keys + i * bench_config.key_size,
+                bench_values + i * bench_config.value_size);
+    }
+    bench_pause();
+    assert(!map_is_empty(me));
+    map_destroy(me);
+}
+
+static void bench_map_get(void)
+{
+    size_t i;
+    map me = map_init(bench_config.key_size, bench_config.value_size,
+                      bench_compare);
+    assert(me);
+    for (i = 0; i < bench_config.count; i++) {
+        bench_require(map_put(me, bench_keys + i * bench_config.key_size,
+                              bench_values + i * bench_config.value_size));
+    }
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        map_get(bench_scratch, me, bench_keys + i * bench_config.key_size);
+    }
+    bench_pause();
+    map_destroy(me);
+}
+
+/*
+ * The same as the get benchmark, but the keys are compared as plain old data
+ * rather than with the comparator.
+ */
+static void bench_map_get_pod(void)
+{
+    size_t i;
+    map me = map_init_pod(bench_config.key_size, bench_config.value_size);
+    assert(me);
+    for (i = 0; i < bench_config.count; i++) {
+        bench_require(map_put(me, bench_keys + i * bench_config.key_size,
+                              bench_values + i * bench_config.value_size));
+    }
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        map_get(bench_scratch, me, bench_keys + i * bench_config.key_size);
+    }
+    bench_pause();
+    map_destroy(me);
+}
+
+static map bench_map_filled(const bk_bool order_statistics)
+{
+    size_t i;
+    map me = map_init(bench_config.key_size, bench_config.value_size,
+                      bench_compare);
+    assert(me);
+    if (order_statistics) {
+        bench_require(map_use_order_statistics(me));
+    }
+    for (i = 0; i < bench_config.count; i++) {
+        bench_require(map_put(me, bench_keys + i * bench_config.key_size,
+                              bench_values + i * bench_config.value_size));
+    }
+    return me;
+}
+
+/*
+ * Walks every key in order by searching for the next higher key each time,
+ * which is how a range had to be scanned before there were iterators.
+ */
+static void bench_map_walk_higher(void)
+{
+    size_t visited = 0;
+    void *key;
+    map me = bench_map_filled(BK_FALSE);
+    bench_resume();
+    for (key = map_first(me); key; key = map_higher(me, key)) {
+        visited++;
+    }
+    bench_pause();
+    assert(visited == map_size(me));
+    map_destroy(me);
+}
+
+static void bench_map_iter(void)
+{
+    struct map_iter iter;
+    size_t visited = 0;
+    void *key;
+    void *value;
+    map me = bench_map_filled(BK_FALSE);
+    bench_resume();
+    map_iter_init(&iter, me);
+    while (map_iter_next(&key, &value, &iter)) {
+        visited++;
+    }
+    bench_pause();
+    assert(visited == map_size(me));
+    map_destroy(me);
+}
+
+/*
+ * Looks up keys by their position, spread over the whole map.
+ */
+static void bench_map_select(void)
+{
+    size_t i;
+    size_t found = 0;
+    map me = bench_map_filled(BK_TRUE);
+    const size_t size = map_size(me);
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        found += map_select(me, i * 7919 % size) != NULL;
+    }
+    bench_pause();
+    assert(found == bench_config.count);
+    map_destroy(me);
+}
+
+static void bench_map_rank(void)
+{
+    size_t i;
+    size_t total = 0;
+    map me = bench_map_filled(BK_TRUE);
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        total += map_rank(me, bench_keys + i * bench_config.key_size);
+    }
+    bench_pause();
+    assert(total <= bench_config.count * map_size(me));
+    map_destroy(me);
+}
+
+void bench_map(void)
+{
+    bench_run("map_put", bench_map_put);
+    bench_run("map_put_order_statistics", bench_map_put_order_statistics);
+    bench_run("map_get", bench_map_get);
+    bench_run("map_get_pod", bench_map_get_pod);
+    bench_run("map_walk_higher", bench_map_walk_higher);
+    bench_run("map_iter", bench_map_iter);
+    bench_run("map_select", bench_map_select);
+    bench_run("map_rank", bench_map_rank);
+}
@@ -0,0 +1,42 @@
+#include "bench.h"
+#include "../src/include/priority_queue.h"
+
+static void bench_priority_queue_push(void)
+{
+    size_t i;
+    priority_queue me = priority_queue_init(bench_config.key_size,
+                                            bench_compare);
+    assert(me);
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        priority_queue_push(me, bench_keys + i * bench_config.key_size);
+    }
+    bench_pause();
+    assert(priority_queue_size(me) == bench_config.count);
+    priority_queue_destroy(me);
+}
+
+static void bench_priority_queue_pop(void)
+{
+    size_t i;
+    priority_queue me = priority_queue_init(bench_config.key_size,
+                                            bench_compare);
+    assert(me);
+    for (i = 0; i < bench_config.count; i++) {
+        bench_require(priority_queue_push(
+                me, bench_keys + i * bench_config.key_size));
+    }
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        priority_queue_pop(bench_scratch, me);
+    }
+    bench_pause();
+    assert(priority_queue_is_empty(me));
+    priority_queue_destroy(me);
+}
+
+void bench_priority_queue(void)
+{
+    bench_run("priority_queue_push", bench_priority_queue_push);
+    bench_run("priority_queue_pop", bench_priority_queue_pop);
+}
@@ -0,0 +1,260 @@
+#include "bench.h"
+#include "../src/include/unordered_map.h"
+
+#define BKTHOMPS_BENCH_CHURN_ROUNDS 20
+
+static void bench_unordered_map_put(void)
+{
+    size_t i;
+    unordered_map me = unordered_map_init(bench_config.key_size,
+                                          bench_config.value_size, bench_hash,
+                                          bench_compare);
+    assert(me);
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        unordered_map_put(me, bench_keys + i * bench_config.key_size,
+                          bench_values + i * bench_config.value_size);
+    }
+    bench_pause();
+    assert(!unordered_map_is_empty(me));
+    unordered_map_destroy(me);
+}
+
+/*
+ * The same as the put benchmark, but each resize is spread over the puts which
+ * follow it, rather than done by the put which triggers it.
+ */
+static void bench_unordered_map_put_incremental(void)
+{
+    size_t i;
+    unordered_map me = unordered_map_init(bench_config.key_size,
+                                          bench_config.value_size, bench_hash,
+                                          bench_compare);
+    assert(me);
+    unordered_map_set_incremental_rehash(me, BK_TRUE);
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        unordered_map_put(me, bench_keys + i * bench_config.key_size,
+                          bench_values + i * bench_config.value_size);
+    }
+    bench_pause();
+    assert(!unordered_map_is_empty(me));
+    unordered_map_destroy(me);
+}
+
+/*
+ * The same as the put benchmark, but every key-value pair is added by a single
+ * call, which sizes the table once up front.
+ */
+static void bench_unordered_map_put_all(void)
+{
+    unordered_map me = unordered_map_init(bench_config.key_size,
+                                          bench_config.value_size, bench_hash,
+                                          bench_compare);
+    assert(me);
+    bench_resume();
+    unordered_map_put_all(me, bench_keys, bench_values, bench_config.count);
+    bench_pause();
+    assert(!unordered_map_is_empty(me));
+    unordered_map_destroy(me);
+}
+
+/*
+ * Counts the occurrences of each key, which is the insert-or-update pattern
+ * that emplace does with a single probe.
+ */
+static void bench_unordered_map_emplace(void)
+{
+    size_t i;
+    unordered_map me = unordered_map_init(bench_config.key_size,
+                                          bench_config.value_size, bench_hash,
+                                          bench_compare);
+    assert(me);
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        char *const count = unordered_map_emplace(
+                me, bench_keys + i * bench_config.key_size, NULL);
+        count[0]++;
+    }
+    bench_pause();
+    assert(!unordered_map_is_empty(me));
+    unordered_map_destroy(me);
+}
+
+static void bench_unordered_map_get(void)
+{
+    size_t i;
+    unordered_map me = unordered_map_init(bench_config.key_size,
+                                          bench_config.value_size, bench_hash,
+                                          bench_compare);
+    assert(me);
+    for (i = 0; i < bench_config.count; i++) {
+        bench_require(unordered_map_put(
+                me, bench_keys + i * bench_config.key_size,
+                bench_values + i * bench_config.value_size));
+    }
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        unordered_map_get(bench_scratch, me,
+                          bench_keys + i * bench_config.key_size);
+    }
+    bench_pause();
+    unordered_map_destroy(me);
+}
+
+/*
+ * The same as the get benchmark, but the keys are looked up a batch at a time,
+ * so that the cache misses of the keys in each batch overlap.
+ */
+static void bench_unordered_map_get_batch(void)
+{
+    size_t i;
+    char *const values = malloc(bench_config.count * bench_config.value_size);
+    unordered_map me = unordered_map_init(bench_config.key_size,
+                                          bench_config.value_size, bench_hash,
+                                          bench_compare);
+    assert(me && values);
+    for (i = 0; i < bench_config.count; i++) {
+        bench_require(unordered_map_put(
+                me, bench_keys + i * bench_config.key_size,
+                bench_values + i * bench_config.value_size));
+    }
+    bench_resume();
+    unordered_map_get_batch(values, NULL, me, bench_keys, bench_config.count);
+    bench_pause();
+    free(values);
+    unordered_map_destroy(me);
+}
+
+static void bench_unordered_map_count_entry(const void *const key,
+                                            void *const value,
+                                            void *const context)
+{
+    (void) key;
+    (void) value;
+    (*(size_t *) context)++;
+}
+
+static unordered_map bench_unordered_map_filled(void)
+{
+    size_t i;
+    unordered_map me = unordered_map_init(bench_config.key_size,
+                                          bench_config.value_size, bench_hash,
+                                          bench_compare);
+    assert(me);
+    for (i = 0; i < bench_config.count; i++) {
+        bench_require(unordered_map_put(
+                me, bench_keys + i * bench_config.key_size,
+                bench_values + i * bench_config.value_size));
+    }
+    return me;
+}
+
+static void bench_unordered_map_iter(void)
+{
+    struct unordered_map_iter iter;
+    void *key;
+    void *value;
+    size_t visited = 0;
+    unordered_map me = bench_unordered_map_filled();
+    bench_resume();
+    unordered_map_iter_init(&iter, me);
+    while (unordered_map_iter_next(&key, &value, &iter)) {
+        visited++;
+    }
+    bench_pause();
+    assert(visited == unordered_map_size(me));
+    unordered_map_destroy(me);
+}
+
+static void bench_unordered_map_for_each(void)
+{
+    size_t visited = 0;
+    unordered_map me = bench_unordered_map_filled();
+    bench_resume();
+    unordered_map_for_each(me, bench_unordered_map_count_entry, &visited);
+    bench_pause();
+    assert(visited == unordered_map_size(me));
+    unordered_map_destroy(me);
+}
+
+/*
+ * Keeps half of the keys in the unordered map, and slides that window across
+ * all of the keys by removing the oldest key and adding a new one. Each step is
+ * one remove and one put, and the table neither grows nor shrinks.
+ */
+static void bench_unordered_map_churn_window(unordered_map me,
+                                             const size_t steps)
+{
+    const size_t count = bench_config.count;
+    const size_t window = count / 2;
+    size_t i;
+    for (i = 0; i < steps; i++) {
+        unordered_map_remove(me, bench_keys + (i % count)
+                                 * bench_config.key_size);
+        unordered_map_put(me,
+                          bench_keys + ((i + window) % count)
+                          * bench_config.key_size,
+                          bench_values + (i % count) * bench_config.value_size);
+    }
+}
+
+static unordered_map bench_unordered_map_churn_init(void)
+{
+    size_t i;
+    unordered_map me = unordered_map_init(bench_config.key_size,
+                                          bench_config.value_size, bench_hash,
+                                          bench_compare);
+    assert(me);
+    for (i = 0; i < bench_config.count / 2; i++) {
+        bench_require(unordered_map_put(
+                me, bench_keys + i * bench_config.key_size,
+                bench_values + i * bench_config.value_size));
+    }
+    return me;
+}
+
+static void bench_unordered_map_churn(void)
+{
+    unordered_map me = bench_unordered_map_churn_init();
+    bench_resume();
+    bench_unordered_map_churn_window(me, bench_config.count);
+    bench_pause();
+    unordered_map_destroy(me);
+}
+
+/*
+ * Looks up every key after many rounds of churn, which would show any decay in
+ * lookup latency from the removals. Comparing it with the get benchmark shows
+ * whether probe lengths stay stable; raise the count to churn for longer.
+ */
+static void bench_unordered_map_get_after_churn(void)
+{
+    size_t i;
+    unordered_map me = bench_unordered_map_churn_init();
+    bench_unordered_map_churn_window(me, BKTHOMPS_BENCH_CHURN_ROUNDS
+                                         * bench_config.count);
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        unordered_map_get(bench_scratch, me,
+                          bench_keys + i * bench_config.key_size);
+    }
+    bench_pause();
+    unordered_map_destroy(me);
+}
+
+void bench_unordered_map(void)
+{
+    bench_run("unordered_map_put", bench_unordered_map_put);
+    bench_run("unordered_map_put_incremental",
+              bench_unordered_map_put_incremental);
+    bench_run("unordered_map_put_all", bench_unordered_map_put_all);
+    bench_run("unordered_map_emplace", bench_unordered_map_emplace);
+    bench_run("unordered_map_get", bench_unordered_map_get);
+    bench_run("unordered_map_get_batch", bench_unordered_map_get_batch);
+    bench_run("unordered_map_iter", bench_unordered_map_iter);
+    bench_run("unordered_map_for_each", bench_unordered_map_for_each);
+    bench_run("unordered_map_churn", bench_unordered_map_churn);
+    bench_run("unordered_map_get_after_churn",
+              bench_unordered_map_get_after_churn);
+}
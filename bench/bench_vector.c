@@ -0,0 +1,21 @@
+#include "bench.h"
+#include "../src/include/vector.h"
+
+static void bench_vector_add_last(void)
+{
+    size_t i;
+    vector me = vector_init(bench_config.value_size);
+    assert(me);
+    bench_resume();
+    for (i = 0; i < bench_config.count; i++) {
+        vector_add_last(me, bench_values + i * bench_config.value_size);
+    }
+    bench_pause();
+    assert(vector_size(me) == bench_config.count);
+    vector_destroy(me);
+}
+
+void bench_vector(void)
+{
+    bench_run("vector_add_last", bench_vector_add_last);
+}
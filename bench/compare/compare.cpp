@@ -0,0 +1,265 @@
+/*
+ * Runs identical workloads through the map and unordered_map of this library
+ * and through std::map and std::unordered_map, so that the performance gap
+ * between them is documented. This is optional, and is only built by
+ * make bench_compare when a C++ compiler is present.
+ *
+ * Every workload runs in a child process, so that the peak resident set size
+ * which is reported belongs to that workload alone.
+ */
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include "../../src/include/map.h"
+#include "../../src/include/unordered_map.h"
+}
+
+typedef unsigned long long key_type;
+typedef unsigned long long value_type;
+typedef std::chrono::steady_clock steady_clock;
+
+/*
+ * The same hash is used by every hash table, so that only the tables differ.
+ */
+static unsigned long compare_mix(key_type key)
+{
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+    key ^= key >> 33;
+    return (unsigned long) key;
+}
+
+struct compare_hasher {
+    size_t operator()(const key_type key) const
+    {
+        return compare_mix(key);
+    }
+};
+
+static unsigned long bk_hash(const void *const key)
+{
+    key_type copy;
+    std::memcpy(&copy, key, sizeof(key_type));
+    return compare_mix(copy);
+}
+
+static int bk_compare(const void *const one, const void *const two)
+{
+    key_type a;
+    key_type b;
+    std::memcpy(&a, one, sizeof(key_type));
+    std::memcpy(&b, two, sizeof(key_type));
+    return (a > b) - (a < b);
+}
+
+/*
+ * Each adapter exposes put and get over one container, so that a workload can
+ * be written once for all of them.
+ */
+struct bk_map_adapter {
+    map me;
+    bk_map_adapter() : me(map_init(sizeof(key_type), sizeof(value_type),
+                                   bk_compare)) {}
+    ~bk_map_adapter() { map_destroy(me); }
+    void put(key_type key, value_type value) { map_put(me, &key, &value); }
+    bool get(key_type key, value_type *value)
+    {
+        return map_get(value, me, &key) == BK_TRUE;
+    }
+};
+
+struct bk_unordered_map_adapter {
+    unordered_map me;
+    bk_unordered_map_adapter()
+        : me(unordered_map_init(sizeof(key_type), sizeof(value_type), bk_hash,
+                                bk_compare)) {}
+    ~bk_unordered_map_adapter() { unordered_map_destroy(me); }
+    void put(key_type key, value_type value)
+    {
+        unordered_map_put(me, &key, &value);
+    }
+    bool get(key_type key, value_type *value)
+    {
+        return unordered_map_get(value, me, &key) == BK_TRUE;
+    }
+};
+
+template <typename container>
+struct std_adapter {
+    container me;
+    void put(key_type key, value_type value) { me[key] = value; }
+    bool get(key_type key, value_type *value)
+    {
+        typename container::const_iterator found = me.find(key);
+        if (found == me.end()) {
+            return false;
+        }
+        *value = found->second;
+        return true;
+    }
+};
+
+typedef std_adapter<std::map<key_type, value_type> > std_map_adapter;
+typedef std_adapter<std::unordered_map<key_type, value_type, compare_hasher> >
+    std_unordered_map_adapter;
+
+struct compare_result {
+    double ops_per_second;
+    double p50_ns;
+    double p99_ns;
+    long peak_rss_kb;
+};
+
+static std::vector<key_type> compare_keys(size_t count)
+{
+    std::vector<key_type> keys(count);
+    key_type state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < count; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        keys[i] = state;
+    }
+    return keys;
+}
+
+static long compare_peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static double compare_percentile(std::vector<double> &latencies, double at)
+{
+    const size_t index = (size_t) (at * (double) (latencies.size() - 1));
+    std::nth_element(latencies.begin(), latencies.begin() + index,
+                     latencies.end());
+    return latencies[index];
+}
+
+/*
+ * Times the whole workload once for throughput, then runs it again on a fresh
+ * container while timing each operation for the latency percentiles. The
+ * per-operation timings include the overhead of reading the clock.
+ */
+template <typename adapter>
+static compare_result compare_run(const std::string &workload,
+                                  const std::vector<key_type> &keys)
+{
+    compare_result result;
+    std::vector<double> latencies(keys.size());
+    const long baseline_rss_kb = compare_peak_rss_kb();
+    volatile value_type sink = 0;
+    value_type value;
+    for (int pass = 0; pass < 2; pass++) {
+        adapter container;
+        if (workload == "get") {
+            for (size_t i = 0; i < keys.size(); i++) {
+                container.put(keys[i], i);
+            }
+        }
+        const steady_clock::time_point start = steady_clock::now();
+        for (size_t i = 0; i < keys.size(); i++) {
+            steady_clock::time_point op_start;
+            if (pass == 1) {
+                op_start = steady_clock::now();
+            }
+            if (workload == "put") {
+                container.put(keys[i], i);
+            } else if (container.get(keys[i], &value)) {
+                sink = sink + value;
+            }
+            if (pass == 1) {
+                latencies[i] = std::chrono::duration<double, std::nano>(
+                    steady_clock::now() - op_start).count();
+            }
+        }
+        if (pass == 0) {
+            const double seconds = std::chrono::duration<double>(
+                steady_clock::now() - start).count();
+            result.ops_per_second = (double) keys.size() / seconds;
+        }
+    }
+    result.p50_ns = compare_percentile(latencies, 0.50);
+    result.p99_ns = compare_percentile(latencies, 0.99);
+    result.peak_rss_kb = compare_peak_rss_kb() - baseline_rss_kb;
+    return result;
+}
+
+static compare_result compare_dispatch(const std::string &container,
+                                       const std::string &workload,
+                                       const std::vector<key_type> &keys)
+{
+    if (container == "bk_map") {
+        return compare_run<bk_map_adapter>(workload, keys);
+    }
+    if (container == "std_map") {
+        return compare_run<std_map_adapter>(workload, keys);
+    }
+    if (container == "bk_unordered_map") {
+        return compare_run<bk_unordered_map_adapter>(workload, keys);
+    }
+    return compare_run<std_unordered_map_adapter>(workload, keys);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const containers[] = {"bk_map", "std_map",
+                                             "bk_unordered_map",
+                                             "std_unordered_map"};
+    static const char *const workloads[] = {"put", "get"};
+    size_t count = 1000000;
+    if (argc > 1) {
+        count = std::strtoul(argv[1], NULL, 10);
+        if (count == 0) {
+            std::fprintf(stderr, "usage: %s [count]\n", argv[0]);
+            return 1;
+        }
+    }
+    std::printf("container,workload,count,ops_per_second,p50_ns,p99_ns,"
+                "peak_rss_kb\n");
+    std::fflush(stdout);
+    for (size_t i = 0; i < sizeof(containers) / sizeof(containers[0]); i++) {
+        for (size_t j = 0; j < sizeof(workloads) / sizeof(workloads[0]); j++) {
+            int status;
+            const pid_t child = fork();
+            if (child < 0) {
+                std::perror("fork");
+                return 1;
+            }
+            if (child == 0) {
+                const std::vector<key_type> keys = compare_keys(count);
+                const compare_result result =
+                    compare_dispatch(containers[i], workloads[j], keys);
+                std::printf("%s,%s,%lu,%.0f,%.1f,%.1f,%ld\n", containers[i],
+                            workloads[j], (unsigned long) count,
+                            result.ops_per_second, result.p50_ns,
+                            result.p99_ns, result.peak_rss_kb);
+                std::fflush(stdout);
+                _exit(0);
+            }
+            if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status)
+                || WEXITSTATUS(status) != 0) {
+                std::fprintf(stderr, "%s %s failed\n", containers[i],
+                             workloads[j]);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
@@ -26,7 +26,40 @@
 static const size_t book_keeping_size = sizeof(size_t);
 static const size_t arr_size_offset = 0;
 static const size_t data_size_offset = sizeof(size_t);
-static const size_t data_ptr_offset = 2 * sizeof(size_t);
+static const size_t allocator_offset = 2 * sizeof(size_t);
+static const size_t data_ptr_offset =
+        2 * sizeof(size_t) + sizeof(struct bk_allocator);
+
+/*
+ * Used when the array is initialized without an allocator. Its function
+ * pointers are all NULL, which means memory is managed by the standard library.
+ */
+static const struct bk_allocator array_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the array.
+ */
+static void *array_allocate(const struct bk_allocator *const allocator,
+                            const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Frees memory with the allocator of the array.
+ */
+static void array_deallocate(const struct bk_allocator *const allocator,
+                             void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
 
 /**
  * Initializes an array.
@@ -40,23 +73,51 @@ static const size_t data_ptr_offset = 2 * sizeof(size_t);
  *         allocation error
  */
 array array_init(const size_t element_count, const size_t data_size)
+{
+    return array_init_with_allocator(element_count, data_size, NULL);
+}
+
+/**
+ * Initializes an array, which manages its memory with the given allocator.
+ *
+ * @param element_count the number of elements in the array; must not be
+ *                      negative
+ * @param data_size     the size of each element in the array; must be positive
+ * @param allocator     the allocator which manages the memory of the array, or
+ *                      NULL to use the standard library; if not NULL, its
+ *                      allocate and deallocate functions must not be NULL
+ *
+ * @return the newly-initialized array, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+array array_init_with_allocator(const size_t element_count,
+                                const size_t data_size,
+                                const struct bk_allocator *allocator)
 {
     char *init;
     if (data_size == 0) {
         return NULL;
     }
+    if (!allocator) {
+        allocator = &array_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
+        return NULL;
+    }
     if (element_count * data_size / data_size != element_count) {
         return NULL;
     }
     if (data_ptr_offset + element_count * data_size < data_ptr_offset) {
         return NULL;
     }
-    init = malloc(data_ptr_offset + element_count * data_size);
+    init = array_allocate(allocator,
+                          data_ptr_offset + element_count * data_size);
     if (!init) {
         return NULL;
     }
     memcpy(init + arr_size_offset, &element_count, book_keeping_size);
     memcpy(init + data_size_offset, &data_size, book_keeping_size);
+    memcpy(init + allocator_offset, allocator, sizeof(struct bk_allocator));
     memset(init + data_ptr_offset, 0, element_count * data_size);
     return init;
 }
@@ -212,6 +273,11 @@ bk_err array_get(void *const data, array me, const size_t index)
  */
 array array_destroy(array me)
 {
-    free(me);
+    struct bk_allocator allocator;
+    if (!me) {
+        return NULL;
+    }
+    memcpy(&allocator, me + allocator_offset, sizeof(struct bk_allocator));
+    array_deallocate(&allocator, me);
     return NULL;
 }
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2017-2025 Bailey Thompson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <limits.h>
+#include <string.h>
+#include "include/bk_hash.h"
+
+/*
+ * The byte hash follows xxHash. The key is consumed a word at a time with a
+ * multiply and a rotate, and the result is finished with an avalanche so that
+ * every bit of the key affects every bit of the hash. If unsigned long is wider
+ * than 32 bits, the 64-bit variant is used, otherwise the 32-bit one is.
+ */
+#if ULONG_MAX > 0xFFFFFFFFUL
+#define BKTHOMPS_HASH_64
+#endif
+
+#ifdef BKTHOMPS_HASH_64
+#define BKTHOMPS_HASH_BITS 64
+#define BKTHOMPS_HASH_PRIME_1 0x9E3779B185EBCA87UL
+#define BKTHOMPS_HASH_PRIME_2 0xC2B2AE3D27D4EB4FUL
+#define BKTHOMPS_HASH_PRIME_3 0x165667B19E3779F9UL
+#define BKTHOMPS_HASH_PRIME_4 0x85EBCA77C2B2AE63UL
+#define BKTHOMPS_HASH_PRIME_5 0x27D4EB2F165667C5UL
+#else
+#define BKTHOMPS_HASH_BITS 32
+#define BKTHOMPS_HASH_PRIME_1 0x9E3779B1UL
+#define BKTHOMPS_HASH_PRIME_2 0x85EBCA77UL
+#define BKTHOMPS_HASH_PRIME_3 0xC2B2AE3DUL
+#define BKTHOMPS_HASH_PRIME_4 0x27D4EB2FUL
+#define BKTHOMPS_HASH_PRIME_5 0x165667B1UL
+#endif
+
+static unsigned long bk_hash_rotate(const unsigned long value, const int bits)
+{
+    return (value << bits) | (value >> (BKTHOMPS_HASH_BITS - bits));
+}
+
+/*
+ * Reads four bytes as a little-endian number, so that the hash of the same key
+ * is the same on every platform. Compilers turn this into a single load.
+ */
+static unsigned long bk_hash_read32(const unsigned char *const bytes)
+{
+    return (unsigned long) bytes[0] | (unsigned long) bytes[1] << 8
+           | (unsigned long) bytes[2] << 16 | (unsigned long) bytes[3] << 24;
+}
+
+#ifdef BKTHOMPS_HASH_64
+
+static unsigned long bk_hash_read64(const unsigned char *const bytes)
+{
+    return bk_hash_read32(bytes) | bk_hash_read32(bytes + 4) << 32;
+}
+
+/*
+ * The splitmix64 finalizer, which spreads each bit of the value over the whole
+ * hash.
+ */
+static unsigned long bk_hash_mix(unsigned long value)
+{
+    value += 0x9E3779B97F4A7C15UL;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9UL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBUL;
+    return value ^ (value >> 31);
+}
+
+static unsigned long bk_hash_avalanche(unsigned long hash)
+{
+    hash ^= hash >> 33;
+    hash *= BKTHOMPS_HASH_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= BKTHOMPS_HASH_PRIME_3;
+    return hash ^ (hash >> 32);
+}
+
+static unsigned long bk_hash_long_bytes(const unsigned char *bytes,
+                                        size_t size)
+{
+    unsigned long hash = BKTHOMPS_HASH_PRIME_5 + (unsigned long) size;
+    while (size >= 8) {
+        unsigned long word = bk_hash_read64(bytes);
+        word *= BKTHOMPS_HASH_PRIME_2;
+        word = bk_hash_rotate(word, 31) * BKTHOMPS_HASH_PRIME_1;
+        hash ^= word;
+        hash = bk_hash_rotate(hash, 27) * BKTHOMPS_HASH_PRIME_1
+               + BKTHOMPS_HASH_PRIME_4;
+        bytes += 8;
+        size -= 8;
+    }
+    if (size >= 4) {
+        hash ^= bk_hash_read32(bytes) * BKTHOMPS_HASH_PRIME_1;
+        hash = bk_hash_rotate(hash, 23) * BKTHOMPS_HASH_PRIME_2
+               + BKTHOMPS_HASH_PRIME_3;
+        bytes += 4;
+        size -= 4;
+    }
+    while (size > 0) {
+        hash ^= *bytes * BKTHOMPS_HASH_PRIME_5;
+        hash = bk_hash_rotate(hash, 11) * BKTHOMPS_HASH_PRIME_1;
+        bytes++;
+        size--;
+    }
+    return bk_hash_avalanche(hash);
+}
+
+#else
+
+/*
+ * The murmur3 finalizer, which spreads each bit of the value over the whole
+ * hash.
+ */
+static unsigned long bk_hash_mix(unsigned long value)
+{
+    value ^= value >> 16;
+    value *= 0x85EBCA6BUL;
+    value ^= value >> 13;
+    value *= 0xC2B2AE35UL;
+    return value ^ (value >> 16);
+}
+
+static unsigned long bk_hash_avalanche(unsigned long hash)
+{
+    hash ^= hash >> 15;
+    hash *= BKTHOMPS_HASH_PRIME_2;
+    hash ^= hash >> 13;
+    hash *= BKTHOMPS_HASH_PRIME_3;
+    return hash ^ (hash >> 16);
+}
+
+static unsigned long bk_hash_long_bytes(const unsigned char *bytes,
+                                        size_t size)
+{
+    unsigned long hash = BKTHOMPS_HASH_PRIME_5 + (unsigned long) size;
+    while (size >= 4) {
+        hash += bk_hash_read32(bytes) * BKTHOMPS_HASH_PRIME_3;
+        hash = bk_hash_rotate(hash, 17) * BKTHOMPS_HASH_PRIME_4;
+        bytes += 4;
+        size -= 4;
+    }
+    while (size > 0) {
+        hash += *bytes * BKTHOMPS_HASH_PRIME_5;
+        hash = bk_hash_rotate(hash, 11) * BKTHOMPS_HASH_PRIME_1;
+        bytes++;
+        size--;
+    }
+    return bk_hash_avalanche(hash);
+}
+
+#endif /* BKTHOMPS_HASH_64 */
+
+/**
+ * Hashes the specified number of bytes of the key. Keys of four or eight bytes
+ * are hashed as integers, and other sizes with a variant of xxHash. This is the
+ * hash which the unordered containers use when they are initialized with a
+ * NULL hash.
+ *
+ * @param key  the key to hash
+ * @param size the number of bytes of the key
+ *
+ * @return the hash of the key
+ */
+unsigned long bk_hash_bytes(const void *const key, const size_t size)
+{
+    if (size == 4) {
+        return bk_hash_int32(key);
+    }
+    if (size == 8) {
+        return bk_hash_int64(key);
+    }
+    return bk_hash_long_bytes(key, size);
+}
+
+/**
+ * Hashes a four-byte integer key, such as an int on most platforms.
+ *
+ * @param key the key to hash
+ *
+ * @return the hash of the key
+ */
+unsigned long bk_hash_int32(const void *const key)
+{
+    return bk_hash_mix(bk_hash_read32(key));
+}
+
+/**
+ * Hashes an eight-byte integer key, such as a long on most 64-bit platforms.
+ *
+ * @param key the key to hash
+ *
+ * @return the hash of the key
+ */
+unsigned long bk_hash_int64(const void *const key)
+{
+#ifdef BKTHOMPS_HASH_64
+    return bk_hash_mix(bk_hash_read64(key));
+#else
+    const unsigned char *const bytes = key;
+    return bk_hash_mix(bk_hash_read32(bytes)
+                       ^ bk_hash_mix(bk_hash_read32(bytes + 4)));
+#endif
+}
+
+/**
+ * Hashes a key which holds a NUL-terminated string, such as a char array. Only
+ * the characters before the terminator are hashed, so the bytes after it may
+ * be anything.
+ *
+ * @param key the key to hash
+ *
+ * @return the hash of the key
+ */
+unsigned long bk_hash_string(const void *const key)
+{
+    return bk_hash_long_bytes(key, strlen(key));
+}
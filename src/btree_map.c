@@ -0,0 +1,1206 @@
+/*
+ * Copyright (c) 2017-2025 Bailey Thompson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "include/btree_map.h"
+
+#define BKTHOMPS_BTREE_MAP_NODE_SIZE 512
+#define BKTHOMPS_BTREE_MAP_MIN_CAPACITY 3
+
+/*
+ * Every node is node_size bytes and starts with the number of keys in it. A
+ * leaf then links to the leaves before and after it, and holds its keys side by
+ * side followed by their values. An inner node holds its separating keys side
+ * by side followed by one more child than it has keys. Each of these arrays is
+ * padded so that its elements are aligned. All the keys in the subtree of a
+ * child are lower than the separating key which follows the child, and at least
+ * as high as the one which precedes it.
+ */
+struct internal_btree_map {
+    size_t size;
+    size_t key_size;
+    size_t value_size;
+    size_t height;
+    size_t leaf_capacity;
+    size_t inner_capacity;
+    size_t node_size;
+    int (*comparator)(const void *const one, const void *const two);
+    char *root;
+    size_t leaf_key_offset;
+    size_t leaf_value_offset;
+    size_t inner_key_offset;
+    size_t inner_child_offset;
+    struct bk_allocator allocator;
+};
+
+static const size_t ptr_size = sizeof(char *);
+static const size_t count_size = sizeof(size_t);
+
+static const size_t leaf_prev_offset = sizeof(size_t);
+static const size_t leaf_next_offset = sizeof(size_t) + sizeof(char *);
+static const size_t leaf_header_size = sizeof(size_t) + 2 * sizeof(char *);
+static const size_t inner_header_size = sizeof(size_t);
+
+/*
+ * C89 has no name for the strictest alignment which a fundamental type may
+ * need, so it is found from where a union of those types lands after a char.
+ */
+union btree_map_max_align {
+    long l;
+    double d;
+    long double ld;
+    void *p;
+    void (*f)(void);
+};
+
+struct btree_map_align_probe {
+    char c;
+    union btree_map_max_align u;
+};
+
+static const size_t max_alignment = offsetof(struct btree_map_align_probe, u);
+
+/*
+ * Used when the btree_map is initialized without an allocator. Its function
+ * pointers are all NULL, which means memory is managed by the standard library.
+ */
+static const struct bk_allocator btree_map_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the btree_map.
+ */
+static void *btree_map_allocate(const struct bk_allocator *const allocator,
+                                const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Frees memory with the allocator of the btree_map.
+ */
+static void btree_map_deallocate(const struct bk_allocator *const allocator,
+                                 void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+ * Gets the alignment which an object of the specified size may need. The size
+ * of a type is a multiple of its alignment, which is a power of two, so the
+ * largest power of two which divides the size is enough, up to the strictest
+ * alignment of any type.
+ */
+static size_t btree_map_alignment(const size_t size)
+{
+    size_t alignment = 1;
+    while (alignment < max_alignment && size % (2 * alignment) == 0) {
+        alignment *= 2;
+    }
+    return alignment;
+}
+
+/*
+ * Places an array of count elements of the size at the offset, rounded up so
+ * that the elements are aligned. Gets where the array ends, or zero if it does
+ * not fit in a size_t.
+ */
+static size_t btree_map_array(const size_t offset, const size_t size,
+                              const size_t count, size_t *const start)
+{
+    const size_t alignment = btree_map_alignment(size);
+    const size_t padding = (alignment - offset % alignment) % alignment;
+    if (offset + padding < offset
+        || size > ((size_t) -1 - offset - padding) / count) {
+        return 0;
+    }
+    *start = offset + padding;
+    return *start + count * size;
+}
+
+/*
+ * Lays out a leaf which holds the capacity of key-value pairs, and gets its
+ * size, or zero if it is too large.
+ */
+static size_t btree_map_leaf_layout(const size_t key_size,
+                                    const size_t value_size,
+                                    const size_t capacity,
+                                    size_t *const key_offset,
+                                    size_t *const value_offset)
+{
+    const size_t keys_end = btree_map_array(leaf_header_size, key_size,
+                                            capacity, key_offset);
+    if (keys_end == 0) {
+        return 0;
+    }
+    return btree_map_array(keys_end, value_size, capacity, value_offset);
+}
+
+/*
+ * Lays out an inner node which holds the capacity of separating keys, and gets
+ * its size, or zero if it is too large.
+ */
+static size_t btree_map_inner_layout(const size_t key_size,
+                                     const size_t capacity,
+                                     size_t *const key_offset,
+                                     size_t *const child_offset)
+{
+    const size_t keys_end = btree_map_array(inner_header_size, key_size,
+                                            capacity, key_offset);
+    if (keys_end == 0) {
+        return 0;
+    }
+    return btree_map_array(keys_end, ptr_size, capacity + 1, child_offset);
+}
+
+/*
+ * Determines the size of the smallest node which fits the minimum number of
+ * keys in both a leaf and an inner node, or zero if it is too large.
+ */
+static size_t btree_map_min_node_size(const size_t key_size,
+                                      const size_t value_size)
+{
+    size_t key_offset;
+    size_t value_offset;
+    size_t child_offset;
+    const size_t leaf_size =
+            btree_map_leaf_layout(key_size, value_size,
+                                  BKTHOMPS_BTREE_MAP_MIN_CAPACITY, &key_offset,
+                                  &value_offset);
+    const size_t inner_size =
+            btree_map_inner_layout(key_size, BKTHOMPS_BTREE_MAP_MIN_CAPACITY,
+                                   &key_offset, &child_offset);
+    if (leaf_size == 0 || inner_size == 0) {
+        return 0;
+    }
+    return leaf_size > inner_size ? leaf_size : inner_size;
+}
+
+/*
+ * Fits as many key-value pairs into a leaf, and as many separating keys into an
+ * inner node, as the node size allows, and lays the nodes out accordingly. The
+ * node size must be at least the smallest node size.
+ */
+static void btree_map_layout(struct internal_btree_map *const me,
+                             const size_t node_size)
+{
+    size_t leaf_capacity = (node_size - leaf_header_size)
+                           / (me->key_size + me->value_size);
+    size_t inner_capacity = (node_size - inner_header_size - ptr_size)
+                            / (me->key_size + ptr_size);
+    size_t size;
+    for (;;) {
+        size = btree_map_leaf_layout(me->key_size, me->value_size,
+                                     leaf_capacity, &me->leaf_key_offset,
+                                     &me->leaf_value_offset);
+        if (size != 0 && size <= node_size) {
+            break;
+        }
+        leaf_capacity--;
+    }
+    for (;;) {
+        size = btree_map_inner_layout(me->key_size, inner_capacity,
+                                      &me->inner_key_offset,
+                                      &me->inner_child_offset);
+        if (size != 0 && size <= node_size) {
+            break;
+        }
+        inner_capacity--;
+    }
+    me->leaf_capacity = leaf_capacity;
+    me->inner_capacity = inner_capacity;
+}
+
+/**
+ * Initializes a btree_map, with nodes of the default size.
+ *
+ * @param key_size   the size of each key in the btree_map; must be positive
+ * @param value_size the size of each value in the btree_map; must be positive
+ * @param comparator the comparator function used for key ordering; must not be
+ *                   NULL
+ *
+ * @return the newly-initialized btree_map, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+btree_map btree_map_init(const size_t key_size, const size_t value_size,
+                         int (*const comparator)(const void *const,
+                                                 const void *const))
+{
+    size_t node_size = btree_map_min_node_size(key_size, value_size);
+    if (node_size < BKTHOMPS_BTREE_MAP_NODE_SIZE) {
+        node_size = BKTHOMPS_BTREE_MAP_NODE_SIZE;
+    }
+    return btree_map_init_ex(key_size, value_size, comparator, node_size,
+                             NULL);
+}
+
+/**
+ * Initializes a btree_map with nodes of the given size, which manages its
+ * memory with the given allocator. Larger nodes make the tree shallower and
+ * searches faster, but make putting and removing slower, since every key after
+ * the one which is put or removed is moved within its node. Nodes of a few
+ * cache lines up to a page, such as from 256 to 4096 bytes, work well.
+ *
+ * @param key_size   the size of each key in the btree_map; must be positive
+ * @param value_size the size of each value in the btree_map; must be positive
+ * @param comparator the comparator function used for key ordering; must not be
+ *                   NULL
+ * @param node_size  the size of each node in bytes; must fit at least three
+ *                   key-value pairs along with the links of the node
+ * @param allocator  the allocator which manages the memory of the btree_map,
+ *                   or NULL to use the standard library; if not NULL, its
+ *                   allocate and deallocate functions must not be NULL
+ *
+ * @return the newly-initialized btree_map, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+btree_map btree_map_init_ex(const size_t key_size, const size_t value_size,
+                            int (*const comparator)(const void *const,
+                                                    const void *const),
+                            const size_t node_size,
+                            const struct bk_allocator *allocator)
+{
+    struct internal_btree_map *init;
+    size_t min_node_size;
+    if (key_size == 0 || value_size == 0 || !comparator) {
+        return NULL;
+    }
+    if (!allocator) {
+        allocator = &btree_map_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
+        return NULL;
+    }
+    min_node_size = btree_map_min_node_size(key_size, value_size);
+    if (min_node_size == 0 || node_size < min_node_size) {
+        return NULL;
+    }
+    init = btree_map_allocate(allocator, sizeof *init);
+    if (!init) {
+        return NULL;
+    }
+    init->allocator = *allocator;
+    init->size = 0;
+    init->key_size = key_size;
+    init->value_size = value_size;
+    init->height = 0;
+    btree_map_layout(init, node_size);
+    init->node_size = node_size;
+    init->comparator = comparator;
+    init->root = NULL;
+    return init;
+}
+
+/**
+ * Gets the size of the btree_map.
+ *
+ * @param me the btree_map to check
+ *
+ * @return the size of the btree_map
+ */
+size_t btree_map_size(btree_map me)
+{
+    return me->size;
+}
+
+/**
+ * Determines whether or not the btree_map is empty.
+ *
+ * @param me the btree_map to check
+ *
+ * @return BK_TRUE if the btree_map is empty, otherwise BK_FALSE
+ */
+bk_bool btree_map_is_empty(btree_map me)
+{
+    return btree_map_size(me) == 0;
+}
+
+/*
+ * Gets the number of keys in the node.
+ */
+static size_t btree_map_count(const char *const node)
+{
+    size_t count;
+    memcpy(&count, node, count_size);
+    return count;
+}
+
+/*
+ * Sets the number of keys in the node.
+ */
+static void btree_map_store_count(char *const node, const size_t count)
+{
+    memcpy(node, &count, count_size);
+}
+
+/*
+ * Gets the key at the index of the node, which is a leaf if it is at level one
+ * and an inner node otherwise.
+ */
+static char *btree_map_key(btree_map me, char *const node, const size_t level,
+                           const size_t index)
+{
+    if (level == 1) {
+        return node + me->leaf_key_offset + index * me->key_size;
+    }
+    return node + me->inner_key_offset + index * me->key_size;
+}
+
+/*
+ * Gets the value at the index of the leaf.
+ */
+static char *btree_map_value(btree_map me, char *const leaf,
+                             const size_t index)
+{
+    return leaf + me->leaf_value_offset + index * me->value_size;
+}
+
+/*
+ * Gets the address of the child pointer at the index of the inner node.
+ */
+static char *btree_map_child_slot(btree_map me, char *const node,
+                                  const size_t index)
+{
+    return node + me->inner_child_offset + index * ptr_size;
+}
+
+/*
+ * Gets the child at the index of the inner node.
+ */
+static char *btree_map_child(btree_map me, char *const node,
+                             const size_t index)
+{
+    char *child;
+    memcpy(&child, btree_map_child_slot(me, node, index), ptr_size);
+    return child;
+}
+
+/*
+ * Sets the child at the index of the inner node.
+ */
+static void btree_map_store_child(btree_map me, char *const node,
+                                  const size_t index, char *const child)
+{
+    memcpy(btree_map_child_slot(me, node, index), &child, ptr_size);
+}
+
+/*
+ * Gets the leaf which is linked before or after the leaf.
+ */
+static char *btree_map_link(char *const leaf, const size_t offset)
+{
+    char *link;
+    memcpy(&link, leaf + offset, ptr_size);
+    return link;
+}
+
+/*
+ * Sets the leaf which is linked before or after the leaf.
+ */
+static void btree_map_store_link(char *const leaf, const size_t offset,
+                                 char *const link)
+{
+    memcpy(leaf + offset, &link, ptr_size);
+}
+
+/*
+ * Determines whether the node at the level has as many keys as it can hold.
+ */
+static bk_bool btree_map_is_full(btree_map me, char *const node,
+                                 const size_t level)
+{
+    const size_t capacity =
+            level == 1 ? me->leaf_capacity : me->inner_capacity;
+    return btree_map_count(node) == capacity;
+}
+
+/*
+ * Gets the least number of keys which a node at the level, other than the
+ * root, must hold. Splitting a full node and merging two of the smallest nodes
+ * both keep to it.
+ */
+static size_t btree_map_min_count(btree_map me, const size_t level)
+{
+    if (level == 1) {
+        return me->leaf_capacity / 2;
+    }
+    return (me->inner_capacity - 1) / 2;
+}
+
+/*
+ * Searches the keys of the node with a binary search, and returns the index of
+ * the first key which is higher than the key, or which is at least as high as
+ * the key if is_strict is false.
+ */
+static size_t btree_map_search(btree_map me, char *const node,
+                               const size_t level, const void *const key,
+                               const bk_bool is_strict)
+{
+    const char *const keys = btree_map_key(me, node, level, 0);
+    size_t low = 0;
+    size_t high = btree_map_count(node);
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        const int compare = me->comparator(keys + mid * me->key_size, key);
+        if (compare < 0 || (is_strict && compare == 0)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * Finds the leaf which would hold the key.
+ */
+static char *btree_map_find_leaf(btree_map me, const void *const key)
+{
+    char *node = me->root;
+    size_t level;
+    for (level = me->height; level > 1; level--) {
+        node = btree_map_child(me, node,
+                               btree_map_search(me, node, level, key, BK_TRUE));
+    }
+    return node;
+}
+
+/*
+ * Moves count keys, and the values or children which go with them, within or
+ * between nodes of the same level. Inner nodes move the child which follows
+ * each key.
+ */
+static void btree_map_move(btree_map me, char *const destination,
+                           const size_t destination_index,
+                           char *const source, const size_t source_index,
+                           const size_t count, const size_t level)
+{
+    memmove(btree_map_key(me, destination, level, destination_index),
+            btree_map_key(me, source, level, source_index),
+            count * me->key_size);
+    if (level == 1) {
+        memmove(btree_map_value(me, destination, destination_index),
+                btree_map_value(me, source, source_index),
+                count * me->value_size);
+    } else {
+        memmove(btree_map_child_slot(me, destination, destination_index + 1),
+                btree_map_child_slot(me, source, source_index + 1),
+                count * ptr_size);
+    }
+}
+
+/*
+ * Splits the full child at the index of the inner node in two, and puts the
+ * key which separates the two halves into the inner node, which must not be
+ * full. A leaf copies its first key of the upper half up, whereas an inner
+ * node moves its middle key up.
+ */
+static bk_err btree_map_split_child(btree_map me, char *const node,
+                                    const size_t index, const size_t level)
+{
+    char *const child = btree_map_child(me, node, index);
+    const size_t child_level = level - 1;
+    const size_t count = btree_map_count(child);
+    const size_t keep = count / 2;
+    const size_t node_count = btree_map_count(node);
+    char *separator;
+    char *const sibling = btree_map_allocate(&me->allocator, me->node_size);
+    if (!sibling) {
+        return -BK_ENOMEM;
+    }
+    if (child_level == 1) {
+        char *const next = btree_map_link(child, leaf_next_offset);
+        btree_map_move(me, sibling, 0, child, keep, count - keep, child_level);
+        btree_map_store_count(sibling, count - keep);
+        btree_map_store_link(sibling, leaf_prev_offset, child);
+        btree_map_store_link(sibling, leaf_next_offset, next);
+        if (next) {
+            btree_map_store_link(next, leaf_prev_offset, sibling);
+        }
+        btree_map_store_link(child, leaf_next_offset, sibling);
+        separator = btree_map_key(me, sibling, child_level, 0);
+    } else {
+        btree_map_store_child(me, sibling, 0,
+                              btree_map_child(me, child, keep + 1));
+        btree_map_move(me, sibling, 0, child, keep + 1, count - keep - 1,
+                       child_level);
+        btree_map_store_count(sibling, count - keep - 1);
+        separator = btree_map_key(me, child, child_level, keep);
+    }
+    btree_map_store_count(child, keep);
+    btree_map_move(me, node, index + 1, node, index, node_count - index,
+                   level);
+    memcpy(btree_map_key(me, node, level, index), separator, me->key_size);
+    btree_map_store_child(me, node, index + 1, sibling);
+    btree_map_store_count(node, node_count + 1);
+    return BK_OK;
+}
+
+/*
+ * Makes the tree one level taller when the root is full, so that there is
+ * always room to split the nodes on the way down.
+ */
+static bk_err btree_map_grow(btree_map me)
+{
+    char *const root = btree_map_allocate(&me->allocator, me->node_size);
+    if (!root) {
+        return -BK_ENOMEM;
+    }
+    btree_map_store_count(root, 0);
+    btree_map_store_child(me, root, 0, me->root);
+    if (btree_map_split_child(me, root, 0, me->height + 1) != BK_OK) {
+        btree_map_deallocate(&me->allocator, root);
+        return -BK_ENOMEM;
+    }
+    me->root = root;
+    me->height++;
+    return BK_OK;
+}
+
+/**
+ * Adds a key-value pair to the btree_map. If the btree_map already contains the
+ * key, the value is updated to the new value. The pointer to the key and value
+ * being passed in should point to the key and value type which this btree_map
+ * holds. For example, if this btree_map holds integer keys and values, the key
+ * and value pointer should be a pointer to an integer. Since the key and value
+ * are being copied, the pointer only has to be valid when this function is
+ * called. Full nodes are split on the way down, so the tree is never walked
+ * back up.
+ *
+ * @param me    the btree_map to add to
+ * @param key   the key to add
+ * @param value the value to add
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_ENOMEM if out of memory
+ */
+bk_err btree_map_put(btree_map me, void *const key, void *const value)
+{
+    char *node;
+    size_t level;
+    size_t index;
+    size_t count;
+    if (!me->root) {
+        char *const root = btree_map_allocate(&me->allocator, me->node_size);
+        if (!root) {
+            return -BK_ENOMEM;
+        }
+        btree_map_store_count(root, 0);
+        btree_map_store_link(root, leaf_prev_offset, NULL);
+        btree_map_store_link(root, leaf_next_offset, NULL);
+        me->root = root;
+        me->height = 1;
+    } else if (btree_map_is_full(me, me->root, me->height)
+               && btree_map_grow(me) != BK_OK) {
+        return -BK_ENOMEM;
+    }
+    node = me->root;
+    for (level = me->height; level > 1; level--) {
+        index = btree_map_search(me, node, level, key, BK_TRUE);
+        if (btree_map_is_full(me, btree_map_child(me, node, index),
+                              level - 1)) {
+            if (btree_map_split_child(me, node, index, level) != BK_OK) {
+                return -BK_ENOMEM;
+            }
+            if (me->comparator(btree_map_key(me, node, level, index), key)
+                <= 0) {
+                index++;
+            }
+        }
+        node = btree_map_child(me, node, index);
+    }
+    index = btree_map_search(me, node, 1, key, BK_FALSE);
+    count = btree_map_count(node);
+    if (index < count
+        && me->comparator(btree_map_key(me, node, 1, index), key) == 0) {
+        memcpy(btree_map_value(me, node, index), value, me->value_size);
+        return BK_OK;
+    }
+    btree_map_move(me, node, index + 1, node, index, count - index, 1);
+    memcpy(btree_map_key(me, node, 1, index), key, me->key_size);
+    memcpy(btree_map_value(me, node, index), value, me->value_size);
+    btree_map_store_count(node, count + 1);
+    me->size++;
+    return BK_OK;
+}
+
+/*
+ * Gets the value of the key, or NULL if the btree_map does not contain it.
+ */
+static char *btree_map_find_value(btree_map me, const void *const key)
+{
+    char *leaf;
+    size_t index;
+    if (!me->root) {
+        return NULL;
+    }
+    leaf = btree_map_find_leaf(me, key);
+    index = btree_map_search(me, leaf, 1, key, BK_FALSE);
+    if (index == btree_map_count(leaf)
+        || me->comparator(btree_map_key(me, leaf, 1, index), key) != 0) {
+        return NULL;
+    }
+    return btree_map_value(me, leaf, index);
+}
+
+/**
+ * Gets the value associated with a key in the btree_map. The pointer to the key
+ * being passed in and the value being obtained should point to the key and
+ * value types which this btree_map holds. For example, if this btree_map holds
+ * integer keys and values, the key and value pointers should be a pointer to an
+ * integer. Since the key and value are being copied, the pointer only has to be
+ * valid when this function is called.
+ *
+ * @param value the value to copy to
+ * @param me    the btree_map to get from
+ * @param key   the key to search for
+ *
+ * @return BK_TRUE if the btree_map contained the key-value pair, otherwise
+ *         BK_FALSE
+ */
+bk_bool btree_map_get(void *const value, btree_map me, void *const key)
+{
+    const char *const found = btree_map_find_value(me, key);
+    if (!found) {
+        return BK_FALSE;
+    }
+    memcpy(value, found, me->value_size);
+    return BK_TRUE;
+}
+
+/**
+ * Gets a pointer to the value associated with a key in the btree_map, so that
+ * the value can be read or modified in place without copying it or looking the
+ * key up a second time. The key itself must not be modified. The value is
+ * aligned for its type, so it may be accessed through a pointer of that type.
+ * Key-value pairs move within and between nodes as the tree changes shape, so
+ * the pointer is invalidated by any put or remove, and by clear.
+ *
+ * @param me  the btree_map to get from
+ * @param key the key to search for
+ *
+ * @return a pointer to the value, or NULL if the btree_map does not contain the
+ *         key
+ */
+void *btree_map_get_ptr(btree_map me, void *const key)
+{
+    return btree_map_find_value(me, key);
+}
+
+/**
+ * Determines if the btree_map contains the specified key. The pointer to the
+ * key being passed in should point to the key type which this btree_map holds.
+ * For example, if this btree_map holds key integers, the key pointer should be
+ * a pointer to an integer. Since the key is being copied, the pointer only has
+ * to be valid when this function is called.
+ *
+ * @param me  the btree_map to check for the key
+ * @param key the key to check
+ *
+ * @return BK_TRUE if the btree_map contained the key, otherwise BK_FALSE
+ */
+bk_bool btree_map_contains(btree_map me, void *const key)
+{
+    return btree_map_find_value(me, key) != NULL;
+}
+
+/*
+ * Moves the last key of the left sibling of the child at the index into the
+ * child, through the separating key of the inner node if they are inner nodes.
+ */
+static void btree_map_borrow_left(btree_map me, char *const node,
+                                  const size_t index, const size_t level)
+{
+    const size_t child_level = level - 1;
+    char *const child = btree_map_child(me, node, index);
+    char *const sibling = btree_map_child(me, node, index - 1);
+    const size_t child_count = btree_map_count(child);
+    const size_t sibling_count = btree_map_count(sibling);
+    char *const separator = btree_map_key(me, node, level, index - 1);
+    btree_map_move(me, child, 1, child, 0, child_count, child_level);
+    if (child_level == 1) {
+        btree_map_move(me, child, 0, sibling, sibling_count - 1, 1,
+                       child_level);
+        memcpy(separator, btree_map_key(me, child, child_level, 0),
+               me->key_size);
+    } else {
+        btree_map_store_child(me, child, 1, btree_map_child(me, child, 0));
+        memcpy(btree_map_key(me, child, child_level, 0), separator,
+               me->key_size);
+        btree_map_store_child(me, child, 0,
+                              btree_map_child(me, sibling, sibling_count));
+        memcpy(separator,
+               btree_map_key(me, sibling, child_level, sibling_count - 1),
+               me->key_size);
+    }
+    btree_map_store_count(child, child_count + 1);
+    btree_map_store_count(sibling, sibling_count - 1);
+}
+
+/*
+ * Moves the first key of the right sibling of the child at the index into the
+ * child, through the separating key of the inner node if they are inner nodes.
+ */
+static void btree_map_borrow_right(btree_map me, char *const node,
+                                   const size_t index, const size_t level)
+{
+    const size_t child_level = level - 1;
+    char *const child = btree_map_child(me, node, index);
+    char *const sibling = btree_map_child(me, node, index + 1);
+    const size_t child_count = btree_map_count(child);
+    const size_t sibling_count = btree_map_count(sibling);
+    char *const separator = btree_map_key(me, node, level, index);
+    if (child_level == 1) {
+        btree_map_move(me, child, child_count, sibling, 0, 1, child_level);
+        btree_map_move(me, sibling, 0, sibling, 1, sibling_count - 1,
+                       child_level);
+        memcpy(separator, btree_map_key(me, sibling, child_level, 0),
+               me->key_size);
+    } else {
+        memcpy(btree_map_key(me, child, child_level, child_count), separator,
+               me->key_size);
+        btree_map_store_child(me, child, child_count + 1,
+                              btree_map_child(me, sibling, 0));
+        memcpy(separator, btree_map_key(me, sibling, child_level, 0),
+               me->key_size);
+        btree_map_store_child(me, sibling, 0, btree_map_child(me, sibling, 1));
+        btree_map_move(me, sibling, 0, sibling, 1, sibling_count - 1,
+                       child_level);
+    }
+    btree_map_store_count(child, child_count + 1);
+    btree_map_store_count(sibling, sibling_count - 1);
+}
+
+/*
+ * Merges the child after the index of the inner node into the child at the
+ * index, and frees it. Inner nodes take the separating key down with them.
+ */
+static void btree_map_merge(btree_map me, char *const node, const size_t index,
+                            const size_t level)
+{
+    const size_t child_level = level - 1;
+    const size_t node_count = btree_map_count(node);
+    char *const child = btree_map_child(me, node, index);
+    char *const sibling = btree_map_child(me, node, index + 1);
+    size_t child_count = btree_map_count(child);
+    const size_t sibling_count = btree_map_count(sibling);
+    if (child_level == 1) {
+        char *const next = btree_map_link(sibling, leaf_next_offset);
+        btree_map_store_link(child, leaf_next_offset, next);
+        if (next) {
+            btree_map_store_link(next, leaf_prev_offset, child);
+        }
+    } else {
+        memcpy(btree_map_key(me, child, child_level, child_count),
+               btree_map_key(me, node, level, index), me->key_size);
+        child_count++;
+        btree_map_store_child(me, child, child_count,
+                              btree_map_child(me, sibling, 0));
+    }
+    btree_map_move(me, child, child_count, sibling, 0, sibling_count,
+                   child_level);
+    btree_map_store_count(child, child_count + sibling_count);
+    btree_map_move(me, node, index, node, index + 1, node_count - index - 1,
+                   level);
+    btree_map_store_count(node, node_count - 1);
+    btree_map_deallocate(&me->allocator, sibling);
+}
+
+/*
+ * Makes sure the child at the index of the inner node holds more than the least
+ * number of keys, so that a key can be removed from its subtree. It borrows a
+ * key from a sibling which can spare one, or otherwise merges with a sibling.
+ * Returns the index of the child which now covers the keys of the child.
+ */
+static size_t btree_map_fill_child(btree_map me, char *const node,
+                                   const size_t index, const size_t level)
+{
+    const size_t min_count = btree_map_min_count(me, level - 1);
+    if (btree_map_count(btree_map_child(me, node, index)) > min_count) {
+        return index;
+    }
+    if (index > 0
+        && btree_map_count(btree_map_child(me, node, index - 1)) > min_count) {
+        btree_map_borrow_left(me, node, index, level);
+        return index;
+    }
+    if (index < btree_map_count(node)
+        && btree_map_count(btree_map_child(me, node, index + 1)) > min_count) {
+        btree_map_borrow_right(me, node, index, level);
+        return index;
+    }
+    if (index > 0) {
+        btree_map_merge(me, node, index - 1, level);
+        return index - 1;
+    }
+    btree_map_merge(me, node, index, level);
+    return index;
+}
+
+/*
+ * Makes the tree one level shorter when the root has run out of keys, or frees
+ * the root when the btree_map is empty.
+ */
+static void btree_map_shrink(btree_map me)
+{
+    char *const root = me->root;
+    if (btree_map_count(root) > 0) {
+        return;
+    }
+    if (me->height == 1) {
+        me->root = NULL;
+    } else {
+        me->root = btree_map_child(me, root, 0);
+    }
+    me->height--;
+    btree_map_deallocate(&me->allocator, root);
+}
+
+/**
+ * Removes the key-value pair from the btree_map if it contains it. The pointer
+ * to the key being passed in should point to the key type which this btree_map
+ * holds. For example, if this btree_map holds key integers, the key pointer
+ * should be a pointer to an integer. Since the key is being copied, the pointer
+ * only has to be valid when this function is called. Small nodes are filled up
+ * on the way down, so the tree is never walked back up.
+ *
+ * @param me  the btree_map to remove an element from
+ * @param key the key to remove
+ *
+ * @return BK_TRUE if the btree_map contained the key-value pair, otherwise
+ *         BK_FALSE
+ */
+bk_bool btree_map_remove(btree_map me, void *const key)
+{
+    char *node = me->root;
+    size_t level;
+    size_t index;
+    size_t count;
+    bk_bool is_found;
+    if (!node) {
+        return BK_FALSE;
+    }
+    for (level = me->height; level > 1; level--) {
+        index = btree_map_search(me, node, level, key, BK_TRUE);
+        index = btree_map_fill_child(me, node, index, level);
+        node = btree_map_child(me, node, index);
+    }
+    index = btree_map_search(me, node, 1, key, BK_FALSE);
+    count = btree_map_count(node);
+    is_found = index < count
+               && me->comparator(btree_map_key(me, node, 1, index), key) == 0;
+    if (is_found) {
+        btree_map_move(me, node, index, node, index + 1, count - index - 1, 1);
+        btree_map_store_count(node, count - 1);
+        me->size--;
+    }
+    btree_map_shrink(me);
+    return is_found;
+}
+
+/*
+ * Gets the leaf at the lowest or highest end of the btree_map, or NULL if it is
+ * empty.
+ */
+static char *btree_map_end_leaf(btree_map me, const bk_bool is_highest)
+{
+    char *node = me->root;
+    size_t level;
+    if (!node) {
+        return NULL;
+    }
+    for (level = me->height; level > 1; level--) {
+        node = btree_map_child(me, node,
+                               is_highest ? btree_map_count(node) : 0);
+    }
+    return node;
+}
+
+/*
+ * Finds the position of the first key which is higher than the key, or which
+ * is at least as high as the key if is_strict is false. The leaf is set to
+ * NULL if there is no such key.
+ */
+static void btree_map_seek(btree_map me, const void *const key,
+                           const bk_bool is_strict, char **const leaf,
+                           size_t *const index)
+{
+    *index = 0;
+    if (!me->root) {
+        *leaf = NULL;
+        return;
+    }
+    *leaf = btree_map_find_leaf(me, key);
+    *index = btree_map_search(me, *leaf, 1, key, is_strict);
+    if (*index == btree_map_count(*leaf)) {
+        *leaf = btree_map_link(*leaf, leaf_next_offset);
+        *index = 0;
+    }
+}
+
+/*
+ * Gets the key at the position, or NULL if there is none.
+ */
+static void *btree_map_key_at(btree_map me, char *const leaf,
+                              const size_t index)
+{
+    if (!leaf) {
+        return NULL;
+    }
+    return btree_map_key(me, leaf, 1, index);
+}
+
+/*
+ * Gets the key just before the position of the first key which is higher than
+ * the key, or which is at least as high as the key if is_strict is false.
+ */
+static void *btree_map_key_before(btree_map me, const void *const key,
+                                  const bk_bool is_strict)
+{
+    char *leaf;
+    size_t index;
+    btree_map_seek(me, key, is_strict, &leaf, &index);
+    if (!leaf) {
+        leaf = btree_map_end_leaf(me, BK_TRUE);
+        index = leaf ? btree_map_count(leaf) : 0;
+    }
+    if (index == 0) {
+        leaf = leaf ? btree_map_link(leaf, leaf_prev_offset) : NULL;
+        index = leaf ? btree_map_count(leaf) : 0;
+    }
+    return btree_map_key_at(me, leaf, index - 1);
+}
+
+/**
+ * Returns the first (lowest) key in this btree_map. The returned key is a
+ * pointer to the internally stored key, which should not be modified, and
+ * which is only valid until the btree_map is next changed.
+ *
+ * @param me the btree_map to get the key from
+ *
+ * @return the lowest key in this btree_map, or NULL if it is empty
+ */
+void *btree_map_first(btree_map me)
+{
+    return btree_map_key_at(me, btree_map_end_leaf(me, BK_FALSE), 0);
+}
+
+/**
+ * Returns the last (highest) key in this btree_map. The returned key is a
+ * pointer to the internally stored key, which should not be modified, and
+ * which is only valid until the btree_map is next changed.
+ *
+ * @param me the btree_map to get the key from
+ *
+ * @return the highest key in this btree_map, or NULL if it is empty
+ */
+void *btree_map_last(btree_map me)
+{
+    char *const leaf = btree_map_end_leaf(me, BK_TRUE);
+    if (!leaf) {
+        return NULL;
+    }
+    return btree_map_key_at(me, leaf, btree_map_count(leaf) - 1);
+}
+
+/**
+ * Returns the key which is strictly lower than the comparison key. Meaning that
+ * the highest key which is lower than the key used for comparison is returned.
+ *
+ * @param me  the btree_map to get the lower key from
+ * @param key the key to use for comparison
+ *
+ * @return the key which is strictly lower, or NULL if it does not exist
+ */
+void *btree_map_lower(btree_map me, void *const key)
+{
+    return btree_map_key_before(me, key, BK_FALSE);
+}
+
+/**
+ * Returns the key which is strictly higher than the comparison key. Meaning
+ * that the lowest key which is higher than the key used for comparison is
+ * returned.
+ *
+ * @param me  the btree_map to get the higher key from
+ * @param key the key to use for comparison
+ *
+ * @return the key which is strictly higher, or NULL if it does not exist
+ */
+void *btree_map_higher(btree_map me, void *const key)
+{
+    char *leaf;
+    size_t index;
+    btree_map_seek(me, key, BK_TRUE, &leaf, &index);
+    return btree_map_key_at(me, leaf, index);
+}
+
+/**
+ * Returns the key which is the floor of the comparison key. Meaning that the
+ * the highest key which is lower or equal to the key used for comparison is
+ * returned.
+ *
+ * @param me  the btree_map to get the floor key from
+ * @param key the key to use for comparison
+ *
+ * @return the key which is the floor, or NULL if it does not exist
+ */
+void *btree_map_floor(btree_map me, void *const key)
+{
+    return btree_map_key_before(me, key, BK_TRUE);
+}
+
+/**
+ * Returns the key which is the ceiling of the comparison key. Meaning that the
+ * the lowest key which is higher or equal to the key used for comparison is
+ * returned.
+ *
+ * @param me  the btree_map to get the ceiling key from
+ * @param key the key to use for comparison
+ *
+ * @return the key which is the ceiling, or NULL if it does not exist
+ */
+void *btree_map_ceiling(btree_map me, void *const key)
+{
+    char *leaf;
+    size_t index;
+    btree_map_seek(me, key, BK_FALSE, &leaf, &index);
+    return btree_map_key_at(me, leaf, index);
+}
+
+/**
+ * Starts an in-order iteration over the btree_map at its lowest key. Each step
+ * moves along a leaf, or follows the link to the next leaf, so walking k
+ * key-value pairs takes O(k) time. Unlike with a map, the key-value pairs move
+ * around within and between the nodes as the btree_map is changed, so putting
+ * or removing any key invalidates the iterator.
+ *
+ * @param iter the iterator to set up
+ * @param me   the btree_map to iterate over
+ */
+void btree_map_iter_init(struct btree_map_iter *const iter, btree_map me)
+{
+    iter->map = me;
+    iter->leaf = btree_map_end_leaf(me, BK_FALSE);
+    iter->index = 0;
+}
+
+/**
+ * Starts an in-order iteration over the btree_map at the lowest key which is
+ * higher or equal to the given key.
+ *
+ * @param iter the iterator to set up
+ * @param me   the btree_map to iterate over
+ * @param key  the key to start at
+ */
+void btree_map_iter_init_at(struct btree_map_iter *const iter, btree_map me,
+                            void *const key)
+{
+    iter->map = me;
+    btree_map_seek(me, key, BK_FALSE, &iter->leaf, &iter->index);
+}
+
+/**
+ * Gets the key-value pair which the iterator is at, and then moves the iterator
+ * to the next higher key. The key and the value point to where they are stored.
+ * The key must not be modified, but the value may be.
+ *
+ * @param key   set to the key of the key-value pair
+ * @param value set to the value of the key-value pair, unless it is NULL
+ * @param iter  the iterator to advance
+ *
+ * @return BK_TRUE if there was a key-value pair, otherwise BK_FALSE
+ */
+bk_bool btree_map_iter_next(void **const key, void **const value,
+                            struct btree_map_iter *const iter)
+{
+    char *const leaf = iter->leaf;
+    if (!leaf) {
+        return BK_FALSE;
+    }
+    *key = btree_map_key(iter->map, leaf, 1, iter->index);
+    if (value) {
+        *value = btree_map_value(iter->map, leaf, iter->index);
+    }
+    iter->index++;
+    if (iter->index == btree_map_count(leaf)) {
+        iter->leaf = btree_map_link(leaf, leaf_next_offset);
+        iter->index = 0;
+    }
+    return BK_TRUE;
+}
+
+/*
+ * Frees the subtree of the node, which is at the level.
+ */
+static void btree_map_free_nodes(btree_map me, char *const node,
+                                 const size_t level)
+{
+    if (level > 1) {
+        size_t i;
+        for (i = 0; i <= btree_map_count(node); i++) {
+            btree_map_free_nodes(me, btree_map_child(me, node, i), level - 1);
+        }
+    }
+    btree_map_deallocate(&me->allocator, node);
+}
+
+/**
+ * Clears the key-value pairs from the btree_map.
+ *
+ * @param me the btree_map to clear
+ */
+void btree_map_clear(btree_map me)
+{
+    if (me->root) {
+        btree_map_free_nodes(me, me->root, me->height);
+    }
+    me->root = NULL;
+    me->height = 0;
+    me->size = 0;
+}
+
+/**
+ * Frees the btree_map memory. Performing further operations after calling this
+ * function results in undefined behavior. Freeing NULL is legal, and causes no
+ * operation to be performed.
+ *
+ * @param me the btree_map to free from memory
+ *
+ * @return NULL
+ */
+btree_map btree_map_destroy(btree_map me)
+{
+    if (me) {
+        btree_map_clear(me);
+        btree_map_deallocate(&me->allocator, me);
+    }
+    return NULL;
+}
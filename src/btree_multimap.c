@@ -0,0 +1,1486 @@
+/*
+ * Copyright (c) 2017-2025 Bailey Thompson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "include/btree_multimap.h"
+
+#define BKTHOMPS_BTREE_MULTIMAP_NODE_SIZE 512
+#define BKTHOMPS_BTREE_MULTIMAP_MIN_CAPACITY 3
+
+/*
+ * The key-value pairs are ordered by key and then by value, and a pair which is
+ * put more than once is kept once along with how many times it occurs. Each
+ * pair is kept as its key followed by its value, padded so that both of them
+ * are aligned, and is what the keys of the nodes below are.
+ *
+ * Every node is node_size bytes and starts with the number of keys in it. A
+ * leaf then links to the leaves before and after it, and holds its keys side by
+ * side followed by how many times each of them occurs. An inner node holds its
+ * separating keys side by side followed by one more child than it has keys.
+ * Each of these arrays is padded so that its elements are aligned. All the keys
+ * in the subtree of a child are lower than the separating key which follows the
+ * child, and at least as high as the one which precedes it.
+ */
+struct internal_btree_multimap {
+    size_t size;
+    size_t key_size;
+    size_t value_size;
+    size_t pair_size;
+    size_t value_offset;
+    size_t height;
+    size_t leaf_capacity;
+    size_t inner_capacity;
+    size_t node_size;
+    int (*key_comparator)(const void *const one, const void *const two);
+    int (*value_ordering)(const void *const one, const void *const two);
+    char *root;
+    size_t leaf_pair_offset;
+    size_t leaf_occurrences_offset;
+    size_t inner_pair_offset;
+    size_t inner_child_offset;
+    char *iterate_leaf;
+    size_t iterate_index;
+    size_t iterate_occurrence;
+    char *pair_copy;
+    struct bk_allocator allocator;
+};
+
+static const size_t ptr_size = sizeof(char *);
+static const size_t count_size = sizeof(size_t);
+
+static const size_t leaf_prev_offset = sizeof(size_t);
+static const size_t leaf_next_offset = sizeof(size_t) + sizeof(char *);
+static const size_t leaf_header_size = sizeof(size_t) + 2 * sizeof(char *);
+static const size_t inner_header_size = sizeof(size_t);
+
+/*
+ * C89 has no name for the strictest alignment which a fundamental type may
+ * need, so it is found from where a union of those types lands after a char.
+ */
+union btree_multimap_max_align {
+    long l;
+    double d;
+    long double ld;
+    void *p;
+    void (*f)(void);
+};
+
+struct btree_multimap_align_probe {
+    char c;
+    union btree_multimap_max_align u;
+};
+
+static const size_t max_alignment =
+        offsetof(struct btree_multimap_align_probe, u);
+
+/*
+ * Used when the btree_multimap is initialized without an allocator. Its
+ * function pointers are all NULL, which means memory is managed by the standard
+ * library.
+ */
+static const struct bk_allocator btree_multimap_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the btree_multimap.
+ */
+static void *btree_multimap_allocate(const struct bk_allocator *const allocator,
+                                     const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Frees memory with the allocator of the btree_multimap.
+ */
+static void
+btree_multimap_deallocate(const struct bk_allocator *const allocator,
+                          void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+ * Gets the alignment which an object of the specified size may need. The size
+ * of a type is a multiple of its alignment, which is a power of two, so the
+ * largest power of two which divides the size is enough, up to the strictest
+ * alignment of any type.
+ */
+static size_t btree_multimap_alignment(const size_t size)
+{
+    size_t alignment = 1;
+    while (alignment < max_alignment && size % (2 * alignment) == 0) {
+        alignment *= 2;
+    }
+    return alignment;
+}
+
+/*
+ * Places an array of count elements of the size at the offset, rounded up so
+ * that the elements are aligned. Gets where the array ends, or zero if it does
+ * not fit in a size_t.
+ */
+static size_t btree_multimap_array(const size_t offset, const size_t size,
+                                   const size_t count, size_t *const start)
+{
+    const size_t alignment = btree_multimap_alignment(size);
+    const size_t padding = (alignment - offset % alignment) % alignment;
+    if (offset + padding < offset
+        || size > ((size_t) -1 - offset - padding) / count) {
+        return 0;
+    }
+    *start = offset + padding;
+    return *start + count * size;
+}
+
+/*
+ * Lays out a key-value pair, with the value after the key, and gets its size,
+ * or zero if it is too large. The size is padded so that the key and the value
+ * of every pair in an array are aligned.
+ */
+static size_t btree_multimap_pair_layout(const size_t key_size,
+                                         const size_t value_size,
+                                         size_t *const value_offset)
+{
+    const size_t key_alignment = btree_multimap_alignment(key_size);
+    const size_t value_alignment = btree_multimap_alignment(value_size);
+    const size_t alignment =
+            key_alignment > value_alignment ? key_alignment : value_alignment;
+    const size_t value_end = btree_multimap_array(key_size, value_size, 1,
+                                                  value_offset);
+    const size_t padding = (alignment - value_end % alignment) % alignment;
+    if (value_end == 0 || value_end + padding < value_end) {
+        return 0;
+    }
+    return value_end + padding;
+}
+
+/*
+ * Lays out a leaf which holds the capacity of key-value pairs, and gets its
+ * size, or zero if it is too large.
+ */
+static size_t btree_multimap_leaf_layout(const size_t pair_size,
+                                         const size_t capacity,
+                                         size_t *const pair_offset,
+                                         size_t *const occurrences_offset)
+{
+    const size_t pairs_end = btree_multimap_array(leaf_header_size, pair_size,
+                                                  capacity, pair_offset);
+    if (pairs_end == 0) {
+        return 0;
+    }
+    return btree_multimap_array(pairs_end, count_size, capacity,
+                                occurrences_offset);
+}
+
+/*
+ * Lays out an inner node which holds the capacity of separating key-value
+ * pairs, and gets its size, or zero if it is too large.
+ */
+static size_t btree_multimap_inner_layout(const size_t pair_size,
+                                          const size_t capacity,
+                                          size_t *const pair_offset,
+                                          size_t *const child_offset)
+{
+    const size_t pairs_end = btree_multimap_array(inner_header_size, pair_size,
+                                                  capacity, pair_offset);
+    if (pairs_end == 0) {
+        return 0;
+    }
+    return btree_multimap_array(pairs_end, ptr_size, capacity + 1,
+                                child_offset);
+}
+
+/*
+ * Determines the size of the smallest node which fits the minimum number of
+ * key-value pairs in both a leaf and an inner node, or zero if it is too large.
+ */
+static size_t btree_multimap_min_node_size(const size_t pair_size)
+{
+    size_t pair_offset;
+    size_t occurrences_offset;
+    size_t child_offset;
+    const size_t leaf_size =
+            btree_multimap_leaf_layout(pair_size,
+                                       BKTHOMPS_BTREE_MULTIMAP_MIN_CAPACITY,
+                                       &pair_offset, &occurrences_offset);
+    const size_t inner_size =
+            btree_multimap_inner_layout(pair_size,
+                                        BKTHOMPS_BTREE_MULTIMAP_MIN_CAPACITY,
+                                        &pair_offset, &child_offset);
+    if (pair_size == 0 || leaf_size == 0 || inner_size == 0) {
+        return 0;
+    }
+    return leaf_size > inner_size ? leaf_size : inner_size;
+}
+
+/*
+ * Fits as many key-value pairs into a leaf, and as many separating pairs into
+ * an inner node, as the node size allows, and lays the nodes out accordingly.
+ * The node size must be at least the smallest node size.
+ */
+static void btree_multimap_layout(struct internal_btree_multimap *const me,
+                                  const size_t node_size)
+{
+    size_t leaf_capacity = (node_size - leaf_header_size)
+                           / (me->pair_size + count_size);
+    size_t inner_capacity = (node_size - inner_header_size - ptr_size)
+                            / (me->pair_size + ptr_size);
+    size_t size;
+    for (;;) {
+        size = btree_multimap_leaf_layout(me->pair_size, leaf_capacity,
+                                          &me->leaf_pair_offset,
+                                          &me->leaf_occurrences_offset);
+        if (size != 0 && size <= node_size) {
+            break;
+        }
+        leaf_capacity--;
+    }
+    for (;;) {
+        size = btree_multimap_inner_layout(me->pair_size, inner_capacity,
+                                           &me->inner_pair_offset,
+                                           &me->inner_child_offset);
+        if (size != 0 && size <= node_size) {
+            break;
+        }
+        inner_capacity--;
+    }
+    me->leaf_capacity = leaf_capacity;
+    me->inner_capacity = inner_capacity;
+}
+
+/**
+ * Initializes a btree_multimap, with nodes of the default size.
+ *
+ * @param key_size       the size of each key in the btree_multimap; must be
+ *                       positive
+ * @param value_size     the size of each value in the btree_multimap; must be
+ *                       positive
+ * @param key_comparator the key comparator function; must not be NULL
+ * @param value_ordering the value comparator function, which must be a strict
+ *                       ordering of the values rather than only an equality
+ *                       test, since the values of each key are sorted by it;
+ *                       must not be NULL
+ *
+ * @return the newly-initialized btree_multimap, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+btree_multimap
+btree_multimap_init(const size_t key_size, const size_t value_size,
+                    int (*const key_comparator)(const void *const,
+                                                const void *const),
+                    int (*const value_ordering)(const void *const,
+                                                const void *const))
+{
+    size_t value_offset;
+    const size_t pair_size = btree_multimap_pair_layout(key_size, value_size,
+                                                        &value_offset);
+    size_t node_size = btree_multimap_min_node_size(pair_size);
+    if (node_size < BKTHOMPS_BTREE_MULTIMAP_NODE_SIZE) {
+        node_size = BKTHOMPS_BTREE_MULTIMAP_NODE_SIZE;
+    }
+    return btree_multimap_init_ex(key_size, value_size, key_comparator,
+                                  value_ordering, node_size, NULL);
+}
+
+/**
+ * Initializes a btree_multimap with nodes of the given size, which manages its
+ * memory with the given allocator. Larger nodes make the tree shallower and
+ * searches faster, but make putting and removing slower, since every key-value
+ * pair after the one which is put or removed is moved within its node. Nodes
+ * of a few cache lines up to a page, such as from 256 to 4096 bytes, work well.
+ *
+ * @param key_size       the size of each key in the btree_multimap; must be
+ *                       positive
+ * @param value_size     the size of each value in the btree_multimap; must be
+ *                       positive
+ * @param key_comparator the key comparator function; must not be NULL
+ * @param value_ordering the value comparator function, which must be a strict
+ *                       ordering of the values rather than only an equality
+ *                       test, since the values of each key are sorted by it;
+ *                       must not be NULL
+ * @param node_size      the size of each node in bytes; must fit at least three
+ *                       key-value pairs and their counts along with the links
+ *                       of the node
+ * @param allocator      the allocator which manages the memory of the
+ *                       btree_multimap, or NULL to use the standard library;
+ *                       if not NULL, its allocate and deallocate functions
+ *                       must not be NULL
+ *
+ * @return the newly-initialized btree_multimap, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+btree_multimap
+btree_multimap_init_ex(const size_t key_size, const size_t value_size,
+                       int (*const key_comparator)(const void *const,
+                                                   const void *const),
+                       int (*const value_ordering)(const void *const,
+                                                   const void *const),
+                       const size_t node_size,
+                       const struct bk_allocator *allocator)
+{
+    struct internal_btree_multimap *init;
+    size_t value_offset;
+    size_t pair_size;
+    size_t min_node_size;
+    if (key_size == 0 || value_size == 0 || !key_comparator
+        || !value_ordering) {
+        return NULL;
+    }
+    if (!allocator) {
+        allocator = &btree_multimap_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
+        return NULL;
+    }
+    pair_size = btree_multimap_pair_layout(key_size, value_size,
+                                           &value_offset);
+    min_node_size = btree_multimap_min_node_size(pair_size);
+    if (min_node_size == 0 || node_size < min_node_size) {
+        return NULL;
+    }
+    init = btree_multimap_allocate(allocator, sizeof *init);
+    if (!init) {
+        return NULL;
+    }
+    init->pair_copy = btree_multimap_allocate(allocator, pair_size);
+    if (!init->pair_copy) {
+        btree_multimap_deallocate(allocator, init);
+        return NULL;
+    }
+    init->allocator = *allocator;
+    init->size = 0;
+    init->key_size = key_size;
+    init->value_size = value_size;
+    init->pair_size = pair_size;
+    init->value_offset = value_offset;
+    init->height = 0;
+    btree_multimap_layout(init, node_size);
+    init->node_size = node_size;
+    init->key_comparator = key_comparator;
+    init->value_ordering = value_ordering;
+    init->root = NULL;
+    init->iterate_leaf = NULL;
+    init->iterate_index = 0;
+    init->iterate_occurrence = 0;
+    return init;
+}
+
+/**
+ * Gets the size of the btree_multimap, which counts each key-value pair as
+ * many times as it was put.
+ *
+ * @param me the btree_multimap to check
+ *
+ * @return the size of the btree_multimap
+ */
+size_t btree_multimap_size(btree_multimap me)
+{
+    return me->size;
+}
+
+/**
+ * Determines whether or not the btree_multimap is empty.
+ *
+ * @param me the btree_multimap to check
+ *
+ * @return BK_TRUE if the btree_multimap is empty, otherwise BK_FALSE
+ */
+bk_bool btree_multimap_is_empty(btree_multimap me)
+{
+    return btree_multimap_size(me) == 0;
+}
+
+/*
+ * Gets the number of keys in the node.
+ */
+static size_t btree_multimap_pair_count(const char *const node)
+{
+    size_t count;
+    memcpy(&count, node, count_size);
+    return count;
+}
+
+/*
+ * Sets the number of keys in the node.
+ */
+static void btree_multimap_store_pair_count(char *const node,
+                                            const size_t count)
+{
+    memcpy(node, &count, count_size);
+}
+
+/*
+ * Gets the key at the index of the node, which is a leaf if it is at level one
+ * and an inner node otherwise.
+ */
+static char *btree_multimap_pair(btree_multimap me, char *const node,
+                                 const size_t level, const size_t index)
+{
+    if (level == 1) {
+        return node + me->leaf_pair_offset + index * me->pair_size;
+    }
+    return node + me->inner_pair_offset + index * me->pair_size;
+}
+
+/*
+ * Gets the address of the number of times the key-value pair at the index of
+ * the leaf occurs.
+ */
+static char *btree_multimap_occurrences_slot(btree_multimap me,
+                                             char *const leaf,
+                                             const size_t index)
+{
+    return leaf + me->leaf_occurrences_offset + index * count_size;
+}
+
+/*
+ * Gets the number of times the key-value pair at the index of the leaf occurs.
+ */
+static size_t btree_multimap_occurrences(btree_multimap me, char *const leaf,
+                                         const size_t index)
+{
+    size_t occurrences;
+    memcpy(&occurrences, btree_multimap_occurrences_slot(me, leaf, index),
+           count_size);
+    return occurrences;
+}
+
+/*
+ * Sets the number of times the key-value pair at the index of the leaf occurs.
+ */
+static void btree_multimap_store_occurrences(btree_multimap me,
+                                             char *const leaf,
+                                             const size_t index,
+                                             const size_t occurrences)
+{
+    memcpy(btree_multimap_occurrences_slot(me, leaf, index), &occurrences,
+           count_size);
+}
+
+/*
+ * Gets the address of the child pointer at the index of the inner node.
+ */
+static char *btree_multimap_child_slot(btree_multimap me, char *const node,
+                                       const size_t index)
+{
+    return node + me->inner_child_offset + index * ptr_size;
+}
+
+/*
+ * Gets the child at the index of the inner node.
+ */
+static char *btree_multimap_child(btree_multimap me, char *const node,
+                                  const size_t index)
+{
+    char *child;
+    memcpy(&child, btree_multimap_child_slot(me, node, index), ptr_size);
+    return child;
+}
+
+/*
+ * Sets the child at the index of the inner node.
+ */
+static void btree_multimap_store_child(btree_multimap me, char *const node,
+                                       const size_t index, char *const child)
+{
+    memcpy(btree_multimap_child_slot(me, node, index), &child, ptr_size);
+}
+
+/*
+ * Gets the leaf which is linked before or after the leaf.
+ */
+static char *btree_multimap_link(char *const leaf, const size_t offset)
+{
+    char *link;
+    memcpy(&link, leaf + offset, ptr_size);
+    return link;
+}
+
+/*
+ * Sets the leaf which is linked before or after the leaf.
+ */
+static void btree_multimap_store_link(char *const leaf, const size_t offset,
+                                      char *const link)
+{
+    memcpy(leaf + offset, &link, ptr_size);
+}
+
+/*
+ * Determines whether the node at the level has as many keys as it can hold.
+ */
+static bk_bool btree_multimap_is_full(btree_multimap me, char *const node,
+                                      const size_t level)
+{
+    const size_t capacity =
+            level == 1 ? me->leaf_capacity : me->inner_capacity;
+    return btree_multimap_pair_count(node) == capacity;
+}
+
+/*
+ * Gets the least number of keys which a node at the level, other than the
+ * root, must hold. Splitting a full node and merging two of the smallest nodes
+ * both keep to it.
+ */
+static size_t btree_multimap_min_count(btree_multimap me, const size_t level)
+{
+    if (level == 1) {
+        return me->leaf_capacity / 2;
+    }
+    return (me->inner_capacity - 1) / 2;
+}
+
+/*
+ * Compares the key-value pair with the key, and then with the value if their
+ * keys are equal. Only the keys are compared if the value is NULL, so that all
+ * the pairs of a key are equal to it.
+ */
+static int btree_multimap_compare(btree_multimap me, const char *const pair,
+                                  const void *const key,
+                                  const void *const value)
+{
+    const int compare = me->key_comparator(pair, key);
+    if (compare != 0 || !value) {
+        return compare;
+    }
+    return me->value_ordering(pair + me->value_offset, value);
+}
+
+/*
+ * Searches the keys of the node with a binary search, and returns the index of
+ * the first key-value pair which is higher than the key and value, or which is
+ * at least as high as them if is_strict is false. Only the keys are compared if
+ * the value is NULL.
+ */
+static size_t btree_multimap_search(btree_multimap me, char *const node,
+                                    const size_t level, const void *const key,
+                                    const void *const value,
+                                    const bk_bool is_strict)
+{
+    const char *const pairs = btree_multimap_pair(me, node, level, 0);
+    size_t low = 0;
+    size_t high = btree_multimap_pair_count(node);
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        const int compare = btree_multimap_compare(
+                me, pairs + mid * me->pair_size, key, value);
+        if (compare < 0 || (is_strict && compare == 0)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * Finds the leaf which would hold the key and value, or the leaf in which the
+ * search for the first pair which is higher than the key, or at least as high
+ * as it if is_strict is false, starts if the value is NULL.
+ */
+static char *btree_multimap_find_leaf(btree_multimap me, const void *const key,
+                                      const void *const value,
+                                      const bk_bool is_strict)
+{
+    char *node = me->root;
+    size_t level;
+    for (level = me->height; level > 1; level--) {
+        node = btree_multimap_child(me, node,
+                                    btree_multimap_search(me, node, level, key,
+                                                          value, is_strict));
+    }
+    return node;
+}
+
+/*
+ * Moves count keys, and the counts or children which go with them, within or
+ * between nodes of the same level. Inner nodes move the child which follows
+ * each key.
+ */
+static void btree_multimap_move(btree_multimap me, char *const destination,
+                                const size_t destination_index,
+                                char *const source, const size_t source_index,
+                                const size_t count, const size_t level)
+{
+    memmove(btree_multimap_pair(me, destination, level, destination_index),
+            btree_multimap_pair(me, source, level, source_index),
+            count * me->pair_size);
+    if (level == 1) {
+        memmove(btree_multimap_occurrences_slot(me, destination,
+                                                destination_index),
+                btree_multimap_occurrences_slot(me, source, source_index),
+                count * count_size);
+    } else {
+        memmove(btree_multimap_child_slot(me, destination,
+                                          destination_index + 1),
+                btree_multimap_child_slot(me, source, source_index + 1),
+                count * ptr_size);
+    }
+}
+
+/*
+ * Splits the full child at the index of the inner node in two, and puts the
+ * key which separates the two halves into the inner node, which must not be
+ * full. A leaf copies its first key of the upper half up, whereas an inner
+ * node moves its middle key up.
+ */
+static bk_err btree_multimap_split_child(btree_multimap me, char *const node,
+                                         const size_t index, const size_t level)
+{
+    char *const child = btree_multimap_child(me, node, index);
+    const size_t child_level = level - 1;
+    const size_t count = btree_multimap_pair_count(child);
+    const size_t keep = count / 2;
+    const size_t node_count = btree_multimap_pair_count(node);
+    char *separator;
+    char *const sibling = btree_multimap_allocate(&me->allocator,
+                                                  me->node_size);
+    if (!sibling) {
+        return -BK_ENOMEM;
+    }
+    if (child_level == 1) {
+        char *const next = btree_multimap_link(child, leaf_next_offset);
+        btree_multimap_move(me, sibling, 0, child, keep, count - keep,
+                            child_level);
+        btree_multimap_store_pair_count(sibling, count - keep);
+        btree_multimap_store_link(sibling, leaf_prev_offset, child);
+        btree_multimap_store_link(sibling, leaf_next_offset, next);
+        if (next) {
+            btree_multimap_store_link(next, leaf_prev_offset, sibling);
+        }
+        btree_multimap_store_link(child, leaf_next_offset, sibling);
+        separator = btree_multimap_pair(me, sibling, child_level, 0);
+    } else {
+        btree_multimap_store_child(me, sibling, 0,
+                                   btree_multimap_child(me, child, keep + 1));
+        btree_multimap_move(me, sibling, 0, child, keep + 1, count - keep - 1,
+                            child_level);
+        btree_multimap_store_pair_count(sibling, count - keep - 1);
+        separator = btree_multimap_pair(me, child, child_level, keep);
+    }
+    btree_multimap_store_pair_count(child, keep);
+    btree_multimap_move(me, node, index + 1, node, index, node_count - index,
+                        level);
+    memcpy(btree_multimap_pair(me, node, level, index), separator,
+           me->pair_size);
+    btree_multimap_store_child(me, node, index + 1, sibling);
+    btree_multimap_store_pair_count(node, node_count + 1);
+    return BK_OK;
+}
+
+/*
+ * Makes the tree one level taller when the root is full, so that there is
+ * always room to split the nodes on the way down.
+ */
+static bk_err btree_multimap_grow(btree_multimap me)
+{
+    char *const root = btree_multimap_allocate(&me->allocator, me->node_size);
+    if (!root) {
+        return -BK_ENOMEM;
+    }
+    btree_multimap_store_pair_count(root, 0);
+    btree_multimap_store_child(me, root, 0, me->root);
+    if (btree_multimap_split_child(me, root, 0, me->height + 1) != BK_OK) {
+        btree_multimap_deallocate(&me->allocator, root);
+        return -BK_ENOMEM;
+    }
+    me->root = root;
+    me->height++;
+    return BK_OK;
+}
+
+/**
+ * Adds a key-value pair to the btree_multimap. The pointer to the key and value
+ * being passed in should point to the key and value type which this
+ * btree_multimap holds. For example, if this btree_multimap holds integer keys
+ * and values, the key and value pointer should be a pointer to an integer.
+ * Since the key and value are being copied, the pointer only has to be valid
+ * when this function is called. A key-value pair which the btree_multimap
+ * already contains, according to both comparators, is not copied again, but
+ * counted once more. Full nodes are split on the way down, so the tree is never
+ * walked back up.
+ *
+ * @param me    the btree_multimap to add to
+ * @param key   the key to add
+ * @param value the value to add
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_ENOMEM if out of memory
+ */
+bk_err btree_multimap_put(btree_multimap me, void *const key,
+                          void *const value)
+{
+    char *node;
+    size_t level;
+    size_t index;
+    size_t count;
+    if (!me->root) {
+        char *const root = btree_multimap_allocate(&me->allocator,
+                                                   me->node_size);
+        if (!root) {
+            return -BK_ENOMEM;
+        }
+        btree_multimap_store_pair_count(root, 0);
+        btree_multimap_store_link(root, leaf_prev_offset, NULL);
+        btree_multimap_store_link(root, leaf_next_offset, NULL);
+        me->root = root;
+        me->height = 1;
+    } else if (btree_multimap_is_full(me, me->root, me->height)
+               && btree_multimap_grow(me) != BK_OK) {
+        return -BK_ENOMEM;
+    }
+    node = me->root;
+    for (level = me->height; level > 1; level--) {
+        index = btree_multimap_search(me, node, level, key, value, BK_TRUE);
+        if (btree_multimap_is_full(me, btree_multimap_child(me, node, index),
+                                   level - 1)) {
+            if (btree_multimap_split_child(me, node, index, level) != BK_OK) {
+                return -BK_ENOMEM;
+            }
+            if (btree_multimap_compare(
+                    me, btree_multimap_pair(me, node, level, index), key, value)
+                <= 0) {
+                index++;
+            }
+        }
+        node = btree_multimap_child(me, node, index);
+    }
+    index = btree_multimap_search(me, node, 1, key, value, BK_FALSE);
+    count = btree_multimap_pair_count(node);
+    if (index < count
+        && btree_multimap_compare(me, btree_multimap_pair(me, node, 1, index),
+                                  key, value) == 0) {
+        const size_t occurrences = btree_multimap_occurrences(me, node, index);
+        btree_multimap_store_occurrences(me, node, index, occurrences + 1);
+        me->size++;
+        return BK_OK;
+    }
+    btree_multimap_move(me, node, index + 1, node, index, count - index, 1);
+    memcpy(btree_multimap_pair(me, node, 1, index), key, me->key_size);
+    memcpy(btree_multimap_pair(me, node, 1, index) + me->value_offset, value,
+           me->value_size);
+    btree_multimap_store_occurrences(me, node, index, 1);
+    btree_multimap_store_pair_count(node, count + 1);
+    me->size++;
+    return BK_OK;
+}
+
+/*
+ * Finds the position of the first key-value pair which is higher than the key
+ * and value, or which is at least as high as them if is_strict is false. Only
+ * the keys are compared if the value is NULL. The leaf is set to NULL if there
+ * is no such pair.
+ */
+static void btree_multimap_seek(btree_multimap me, const void *const key,
+                                const void *const value,
+                                const bk_bool is_strict, char **const leaf,
+                                size_t *const index)
+{
+    *index = 0;
+    if (!me->root) {
+        *leaf = NULL;
+        return;
+    }
+    *leaf = btree_multimap_find_leaf(me, key, value, is_strict);
+    *index = btree_multimap_search(me, *leaf, 1, key, value, is_strict);
+    if (*index == btree_multimap_pair_count(*leaf)) {
+        *leaf = btree_multimap_link(*leaf, leaf_next_offset);
+        *index = 0;
+    }
+}
+
+/*
+ * Finds the position of the first key-value pair of the key, or of the
+ * key-value pair itself if the value is not NULL. The leaf is set to NULL if
+ * the btree_multimap does not contain it.
+ */
+static void btree_multimap_find(btree_multimap me, const void *const key,
+                                const void *const value, char **const leaf,
+                                size_t *const index)
+{
+    btree_multimap_seek(me, key, value, BK_FALSE, leaf, index);
+    if (*leaf
+        && btree_multimap_compare(me, btree_multimap_pair(me, *leaf, 1, *index),
+                                  key, value) != 0) {
+        *leaf = NULL;
+    }
+}
+
+/*
+ * Moves the position to the next key-value pair, which is either further along
+ * the leaf or at the start of the next leaf.
+ */
+static void btree_multimap_step(char **const leaf, size_t *const index)
+{
+    (*index)++;
+    if (*index == btree_multimap_pair_count(*leaf)) {
+        *leaf = btree_multimap_link(*leaf, leaf_next_offset);
+        *index = 0;
+    }
+}
+
+/**
+ * Creates the iterator for the specified key. To iterate over the values, keep
+ * getting the next value. Between starting and iterations, the btree_multimap
+ * must not be mutated. The pointer to the key being passed in should point to
+ * the key type which this btree_multimap holds. For example, if this
+ * btree_multimap holds key integers, the key pointer should be a pointer to an
+ * integer. Since the key is being copied, the pointer only has to be valid when
+ * this function is called. The values come in the order of the value ordering,
+ * not in the order in which they were put, and a value which was put more than
+ * once comes that many times.
+ *
+ * @param me  the btree_multimap to start the iterator for
+ * @param key the key to start the iterator for
+ */
+void btree_multimap_get_start(btree_multimap me, void *const key)
+{
+    btree_multimap_find(me, key, NULL, &me->iterate_leaf, &me->iterate_index);
+    me->iterate_occurrence = 0;
+}
+
+/**
+ * Iterates over the values for the specified key. Must be called after starting
+ * the iterator. The btree_multimap must not be mutated between start and
+ * iterations. The pointer to the value being obtained should point to the value
+ * type which this btree_multimap holds. For example, if this btree_multimap
+ * holds value integers, the value pointer should be a pointer to an integer.
+ * Since the value is being copied, the pointer only has to be valid when this
+ * function is called.
+ *
+ * @param value the value to be copied to from iteration
+ * @param me    the btree_multimap to iterate over
+ *
+ * @return BK_TRUE if there exist more values for the key which is being
+ *         iterated over, otherwise BK_FALSE
+ */
+bk_bool btree_multimap_get_next(void *const value, btree_multimap me)
+{
+    char *const leaf = me->iterate_leaf;
+    const char *pair;
+    if (!leaf) {
+        return BK_FALSE;
+    }
+    pair = btree_multimap_pair(me, leaf, 1, me->iterate_index);
+    memcpy(value, pair + me->value_offset, me->value_size);
+    me->iterate_occurrence++;
+    if (me->iterate_occurrence
+        < btree_multimap_occurrences(me, leaf, me->iterate_index)) {
+        return BK_TRUE;
+    }
+    me->iterate_occurrence = 0;
+    btree_multimap_step(&me->iterate_leaf, &me->iterate_index);
+    if (me->iterate_leaf
+        && me->key_comparator(btree_multimap_pair(me, me->iterate_leaf, 1,
+                                                  me->iterate_index),
+                              pair) != 0) {
+        me->iterate_leaf = NULL;
+    }
+    return BK_TRUE;
+}
+
+/**
+ * Determines the number of times the key appears in the btree_multimap. The
+ * pointer to the key being passed in should point to the key type which this
+ * btree_multimap holds. For example, if this btree_multimap holds key integers,
+ * the key pointer should be a pointer to an integer. Since the key is being
+ * copied, the pointer only has to be valid when this function is called.
+ *
+ * @param me  the btree_multimap to check for the key
+ * @param key the key to check
+ *
+ * @return the number of times the key appears in the btree_multimap
+ */
+size_t btree_multimap_count(btree_multimap me, void *const key)
+{
+    char *leaf;
+    size_t index;
+    size_t count = 0;
+    btree_multimap_find(me, key, NULL, &leaf, &index);
+    while (leaf
+           && me->key_comparator(btree_multimap_pair(me, leaf, 1, index), key)
+              == 0) {
+        count += btree_multimap_occurrences(me, leaf, index);
+        btree_multimap_step(&leaf, &index);
+    }
+    return count;
+}
+
+/**
+ * Determines if the btree_multimap contains the specified key. The pointer to
+ * the key being passed in should point to the key type which this
+ * btree_multimap holds. For example, if this btree_multimap holds key integers,
+ * the key pointer should be a pointer to an integer. Since the key is being
+ * copied, the pointer only has to be valid when this function is called.
+ *
+ * @param me  the btree_multimap to check for the key
+ * @param key the key to check
+ *
+ * @return BK_TRUE if the btree_multimap contained the key, otherwise BK_FALSE
+ */
+bk_bool btree_multimap_contains(btree_multimap me, void *const key)
+{
+    char *leaf;
+    size_t index;
+    btree_multimap_find(me, key, NULL, &leaf, &index);
+    return leaf != NULL;
+}
+
+/*
+ * Moves the last key of the left sibling of the child at the index into the
+ * child, through the separating key of the inner node if they are inner nodes.
+ */
+static void btree_multimap_borrow_left(btree_multimap me, char *const node,
+                                       const size_t index, const size_t level)
+{
+    const size_t child_level = level - 1;
+    char *const child = btree_multimap_child(me, node, index);
+    char *const sibling = btree_multimap_child(me, node, index - 1);
+    const size_t child_count = btree_multimap_pair_count(child);
+    const size_t sibling_count = btree_multimap_pair_count(sibling);
+    char *const separator = btree_multimap_pair(me, node, level, index - 1);
+    btree_multimap_move(me, child, 1, child, 0, child_count, child_level);
+    if (child_level == 1) {
+        btree_multimap_move(me, child, 0, sibling, sibling_count - 1, 1,
+                            child_level);
+        memcpy(separator, btree_multimap_pair(me, child, child_level, 0),
+               me->pair_size);
+    } else {
+        btree_multimap_store_child(me, child, 1,
+                                   btree_multimap_child(me, child, 0));
+        memcpy(btree_multimap_pair(me, child, child_level, 0), separator,
+               me->pair_size);
+        btree_multimap_store_child(me, child, 0,
+                                   btree_multimap_child(me, sibling,
+                                                        sibling_count));
+        memcpy(separator,
+               btree_multimap_pair(me, sibling, child_level, sibling_count - 1),
+               me->pair_size);
+    }
+    btree_multimap_store_pair_count(child, child_count + 1);
+    btree_multimap_store_pair_count(sibling, sibling_count - 1);
+}
+
+/*
+ * Moves the first key of the right sibling of the child at the index into the
+ * child, through the separating key of the inner node if they are inner nodes.
+ */
+static void btree_multimap_borrow_right(btree_multimap me, char *const node,
+                                        const size_t index, const size_t level)
+{
+    const size_t child_level = level - 1;
+    char *const child = btree_multimap_child(me, node, index);
+    char *const sibling = btree_multimap_child(me, node, index + 1);
+    const size_t child_count = btree_multimap_pair_count(child);
+    const size_t sibling_count = btree_multimap_pair_count(sibling);
+    char *const separator = btree_multimap_pair(me, node, level, index);
+    if (child_level == 1) {
+        btree_multimap_move(me, child, child_count, sibling, 0, 1, child_level);
+        btree_multimap_move(me, sibling, 0, sibling, 1, sibling_count - 1,
+                            child_level);
+        memcpy(separator, btree_multimap_pair(me, sibling, child_level, 0),
+               me->pair_size);
+    } else {
+        memcpy(btree_multimap_pair(me, child, child_level, child_count),
+               separator, me->pair_size);
+        btree_multimap_store_child(me, child, child_count + 1,
+                                   btree_multimap_child(me, sibling, 0));
+        memcpy(separator, btree_multimap_pair(me, sibling, child_level, 0),
+               me->pair_size);
+        btree_multimap_store_child(me, sibling, 0,
+                                   btree_multimap_child(me, sibling, 1));
+        btree_multimap_move(me, sibling, 0, sibling, 1, sibling_count - 1,
+                            child_level);
+    }
+    btree_multimap_store_pair_count(child, child_count + 1);
+    btree_multimap_store_pair_count(sibling, sibling_count - 1);
+}
+
+/*
+ * Merges the child after the index of the inner node into the child at the
+ * index, and frees it. Inner nodes take the separating key down with them.
+ */
+static void btree_multimap_merge(btree_multimap me, char *const node,
+                                 const size_t index, const size_t level)
+{
+    const size_t child_level = level - 1;
+    const size_t node_count = btree_multimap_pair_count(node);
+    char *const child = btree_multimap_child(me, node, index);
+    char *const sibling = btree_multimap_child(me, node, index + 1);
+    size_t child_count = btree_multimap_pair_count(child);
+    const size_t sibling_count = btree_multimap_pair_count(sibling);
+    if (child_level == 1) {
+        char *const next = btree_multimap_link(sibling, leaf_next_offset);
+        btree_multimap_store_link(child, leaf_next_offset, next);
+        if (next) {
+            btree_multimap_store_link(next, leaf_prev_offset, child);
+        }
+    } else {
+        memcpy(btree_multimap_pair(me, child, child_level, child_count),
+               btree_multimap_pair(me, node, level, index), me->pair_size);
+        child_count++;
+        btree_multimap_store_child(me, child, child_count,
+                                   btree_multimap_child(me, sibling, 0));
+    }
+    btree_multimap_move(me, child, child_count, sibling, 0, sibling_count,
+                        child_level);
+    btree_multimap_store_pair_count(child, child_count + sibling_count);
+    btree_multimap_move(me, node, index, node, index + 1,
+                        node_count - index - 1, level);
+    btree_multimap_store_pair_count(node, node_count - 1);
+    btree_multimap_deallocate(&me->allocator, sibling);
+}
+
+/*
+ * Makes sure the child at the index of the inner node holds more than the least
+ * number of keys, so that a key can be removed from its subtree. It borrows a
+ * key from a sibling which can spare one, or otherwise merges with a sibling.
+ * Returns the index of the child which now covers the keys of the child.
+ */
+static size_t btree_multimap_fill_child(btree_multimap me, char *const node,
+                                        const size_t index, const size_t level)
+{
+    const size_t min_count = btree_multimap_min_count(me, level - 1);
+    if (btree_multimap_pair_count(btree_multimap_child(me, node, index))
+        > min_count) {
+        return index;
+    }
+    if (index > 0
+        && btree_multimap_pair_count(btree_multimap_child(me, node, index - 1))
+           > min_count) {
+        btree_multimap_borrow_left(me, node, index, level);
+        return index;
+    }
+    if (index < btree_multimap_pair_count(node)
+        && btree_multimap_pair_count(btree_multimap_child(me, node, index + 1))
+           > min_count) {
+        btree_multimap_borrow_right(me, node, index, level);
+        return index;
+    }
+    if (index > 0) {
+        btree_multimap_merge(me, node, index - 1, level);
+        return index - 1;
+    }
+    btree_multimap_merge(me, node, index, level);
+    return index;
+}
+
+/*
+ * Makes the tree one level shorter when the root has run out of keys, or frees
+ * the root when the btree_multimap is empty.
+ */
+static void btree_multimap_shrink(btree_multimap me)
+{
+    char *const root = me->root;
+    if (btree_multimap_pair_count(root) > 0) {
+        return;
+    }
+    if (me->height == 1) {
+        me->root = NULL;
+    } else {
+        me->root = btree_multimap_child(me, root, 0);
+    }
+    me->height--;
+    btree_multimap_deallocate(&me->allocator, root);
+}
+
+/*
+ * Removes the key-value pair from the btree_multimap however many times it
+ * occurs, and gets how many times that was. Small nodes are filled up on the
+ * way down, so the tree is never walked back up.
+ */
+static size_t btree_multimap_remove_pair(btree_multimap me,
+                                         const void *const key,
+                                         const void *const value)
+{
+    char *node = me->root;
+    size_t level;
+    size_t index;
+    size_t count;
+    size_t occurrences = 0;
+    for (level = me->height; level > 1; level--) {
+        index = btree_multimap_search(me, node, level, key, value, BK_TRUE);
+        index = btree_multimap_fill_child(me, node, index, level);
+        node = btree_multimap_child(me, node, index);
+    }
+    index = btree_multimap_search(me, node, 1, key, value, BK_FALSE);
+    count = btree_multimap_pair_count(node);
+    if (index < count
+        && btree_multimap_compare(me, btree_multimap_pair(me, node, 1, index),
+                                  key, value) == 0) {
+        occurrences = btree_multimap_occurrences(me, node, index);
+        btree_multimap_move(me, node, index, node, index + 1,
+                            count - index - 1, 1);
+        btree_multimap_store_pair_count(node, count - 1);
+        me->size -= occurrences;
+    }
+    btree_multimap_shrink(me);
+    return occurrences;
+}
+
+/**
+ * Removes the key-value pair from the btree_multimap if it contains it. The
+ * pointer to the key and value being passed in should point to the key and
+ * value type which this btree_multimap holds. For example, if this
+ * btree_multimap holds integer keys and values, the key and value pointer
+ * should be a pointer to an integer. Since the key and value are being copied,
+ * the pointer only has to be valid when this function is called. The tree only
+ * changes shape once the last occurrence of the key-value pair is removed.
+ *
+ * @param me    the btree_multimap to remove a key from
+ * @param key   the key to remove
+ * @param value the value to remove
+ *
+ * @return BK_TRUE if the btree_multimap contained the key, otherwise BK_FALSE
+ */
+bk_bool btree_multimap_remove(btree_multimap me, void *const key,
+                              void *const value)
+{
+    char *leaf;
+    size_t index;
+    size_t occurrences;
+    btree_multimap_find(me, key, value, &leaf, &index);
+    if (!leaf) {
+        return BK_FALSE;
+    }
+    occurrences = btree_multimap_occurrences(me, leaf, index);
+    if (occurrences == 1) {
+        btree_multimap_remove_pair(me, key, value);
+        return BK_TRUE;
+    }
+    btree_multimap_store_occurrences(me, leaf, index, occurrences - 1);
+    me->size--;
+    return BK_TRUE;
+}
+
+/**
+ * Removes all the key-value pairs from the btree_multimap specified by the key.
+ * The pointer to the key being passed in should point to the key type which
+ * this btree_multimap holds. For example, if this btree_multimap holds key
+ * integers, the key pointer should be a pointer to an integer. Since the key is
+ * being copied, the pointer only has to be valid when this function is called.
+ *
+ * @param me  the btree_multimap to remove a key-value pair from
+ * @param key the key to remove
+ *
+ * @return BK_TRUE if the btree_multimap contained the key, otherwise BK_FALSE
+ */
+bk_bool btree_multimap_remove_all(btree_multimap me, void *const key)
+{
+    bk_bool is_found = BK_FALSE;
+    for (;;) {
+        char *leaf;
+        size_t index;
+        btree_multimap_find(me, key, NULL, &leaf, &index);
+        if (!leaf) {
+            return is_found;
+        }
+        /*
+         * The pairs move around as the nodes on the way down are filled up, so
+         * the pair which is being searched for is copied out of the tree.
+         */
+        memcpy(me->pair_copy, btree_multimap_pair(me, leaf, 1, index),
+               me->pair_size);
+        btree_multimap_remove_pair(me, me->pair_copy,
+                                   me->pair_copy + me->value_offset);
+        is_found = BK_TRUE;
+    }
+}
+
+/*
+ * Gets the leaf at the lowest or highest end of the btree_multimap, or NULL if
+ * it is empty.
+ */
+static char *btree_multimap_end_leaf(btree_multimap me,
+                                     const bk_bool is_highest)
+{
+    char *node = me->root;
+    size_t level;
+    if (!node) {
+        return NULL;
+    }
+    for (level = me->height; level > 1; level--) {
+        node = btree_multimap_child(me, node,
+                                    is_highest ? btree_multimap_pair_count(node)
+                                               : 0);
+    }
+    return node;
+}
+
+/*
+ * Gets the key at the position, or NULL if there is none.
+ */
+static void *btree_multimap_key_at(btree_multimap me, char *const leaf,
+                                   const size_t index)
+{
+    if (!leaf) {
+        return NULL;
+    }
+    return btree_multimap_pair(me, leaf, 1, index);
+}
+
+/*
+ * Gets the key just before the position of the first key which is higher than
+ * the key, or which is at least as high as the key if is_strict is false.
+ */
+static void *btree_multimap_key_before(btree_multimap me, const void *const key,
+                                       const bk_bool is_strict)
+{
+    char *leaf;
+    size_t index;
+    btree_multimap_seek(me, key, NULL, is_strict, &leaf, &index);
+    if (!leaf) {
+        leaf = btree_multimap_end_leaf(me, BK_TRUE);
+        index = leaf ? btree_multimap_pair_count(leaf) : 0;
+    }
+    if (index == 0) {
+        leaf = leaf ? btree_multimap_link(leaf, leaf_prev_offset) : NULL;
+        index = leaf ? btree_multimap_pair_count(leaf) : 0;
+    }
+    return btree_multimap_key_at(me, leaf, index - 1);
+}
+
+/**
+ * Returns the first (lowest) key in this btree_multimap. The returned key is a
+ * pointer to the internally stored key, which should not be modified, and
+ * which is only valid until the btree_multimap is next changed.
+ *
+ * @param me the btree_multimap to get the key from
+ *
+ * @return the lowest key in this btree_multimap, or NULL if it is empty
+ */
+void *btree_multimap_first(btree_multimap me)
+{
+    return btree_multimap_key_at(me, btree_multimap_end_leaf(me, BK_FALSE), 0);
+}
+
+/**
+ * Returns the last (highest) key in this btree_multimap. The returned key is a
+ * pointer to the internally stored key, which should not be modified, and
+ * which is only valid until the btree_multimap is next changed.
+ *
+ * @param me the btree_multimap to get the key from
+ *
+ * @return the highest key in this btree_multimap, or NULL if it is empty
+ */
+void *btree_multimap_last(btree_multimap me)
+{
+    char *const leaf = btree_multimap_end_leaf(me, BK_TRUE);
+    if (!leaf) {
+        return NULL;
+    }
+    return btree_multimap_key_at(me, leaf, btree_multimap_pair_count(leaf) - 1);
+}
+
+/**
+ * Returns the key which is strictly lower than the comparison key. Meaning that
+ * the highest key which is lower than the key used for comparison is returned.
+ *
+ * @param me  the btree_multimap to get the lower key from
+ * @param key the key to use for comparison
+ *
+ * @return the key which is strictly lower, or NULL if it does not exist
+ */
+void *btree_multimap_lower(btree_multimap me, void *const key)
+{
+    return btree_multimap_key_before(me, key, BK_FALSE);
+}
+
+/**
+ * Returns the key which is strictly higher than the comparison key. Meaning
+ * that the lowest key which is higher than the key used for comparison is
+ * returned.
+ *
+ * @param me  the btree_multimap to get the higher key from
+ * @param key the key to use for comparison
+ *
+ * @return the key which is strictly higher, or NULL if it does not exist
+ */
+void *btree_multimap_higher(btree_multimap me, void *const key)
+{
+    char *leaf;
+    size_t index;
+    btree_multimap_seek(me, key, NULL, BK_TRUE, &leaf, &index);
+    return btree_multimap_key_at(me, leaf, index);
+}
+
+/**
+ * Returns the key which is the floor of the comparison key. Meaning that the
+ * the highest key which is lower or equal to the key used for comparison is
+ * returned.
+ *
+ * @param me  the btree_multimap to get the floor key from
+ * @param key the key to use for comparison
+ *
+ * @return the key which is the floor, or NULL if it does not exist
+ */
+void *btree_multimap_floor(btree_multimap me, void *const key)
+{
+    return btree_multimap_key_before(me, key, BK_TRUE);
+}
+
+/**
+ * Returns the key which is the ceiling of the comparison key. Meaning that the
+ * the lowest key which is higher or equal to the key used for comparison is
+ * returned.
+ *
+ * @param me  the btree_multimap to get the ceiling key from
+ * @param key the key to use for comparison
+ *
+ * @return the key which is the ceiling, or NULL if it does not exist
+ */
+void *btree_multimap_ceiling(btree_multimap me, void *const key)
+{
+    char *leaf;
+    size_t index;
+    btree_multimap_seek(me, key, NULL, BK_FALSE, &leaf, &index);
+    return btree_multimap_key_at(me, leaf, index);
+}
+
+/**
+ * Starts an in-order iteration over the btree_multimap at its lowest key. Each
+ * step moves along a leaf, or follows the link to the next leaf, so walking k
+ * key-value pairs takes O(k) time. Unlike with a multimap, the key-value pairs
+ * move around within and between the nodes as the btree_multimap is changed, so
+ * putting or removing any key invalidates the iterator.
+ *
+ * @param iter the iterator to set up
+ * @param me   the btree_multimap to iterate over
+ */
+void btree_multimap_iter_init(struct btree_multimap_iter *const iter,
+                              btree_multimap me)
+{
+    iter->map = me;
+    iter->leaf = btree_multimap_end_leaf(me, BK_FALSE);
+    iter->index = 0;
+    iter->occurrence = 0;
+}
+
+/**
+ * Starts an in-order iteration over the btree_multimap at the first key-value
+ * pair of the lowest key which is higher or equal to the given key.
+ *
+ * @param iter the iterator to set up
+ * @param me   the btree_multimap to iterate over
+ * @param key  the key to start at
+ */
+void btree_multimap_iter_init_at(struct btree_multimap_iter *const iter,
+                                 btree_multimap me, void *const key)
+{
+    iter->map = me;
+    btree_multimap_seek(me, key, NULL, BK_FALSE, &iter->leaf, &iter->index);
+    iter->occurrence = 0;
+}
+
+/**
+ * Gets the key-value pair which the iterator is at, and then moves the iterator
+ * to the next key-value pair. The pairs of a key come in the order of the value
+ * comparator, and a pair which was put more than once comes that many times.
+ * The key and the value point to where they are stored, and must not be
+ * modified, since the pairs are ordered by both.
+ *
+ * @param key   set to the key of the key-value pair
+ * @param value set to the value of the key-value pair, unless it is NULL
+ * @param iter  the iterator to advance
+ *
+ * @return BK_TRUE if there was a key-value pair, otherwise BK_FALSE
+ */
+bk_bool btree_multimap_iter_next(void **const key, void **const value,
+                                 struct btree_multimap_iter *const iter)
+{
+    char *const leaf = iter->leaf;
+    char *pair;
+    if (!leaf) {
+        return BK_FALSE;
+    }
+    pair = btree_multimap_pair(iter->map, leaf, 1, iter->index);
+    *key = pair;
+    if (value) {
+        *value = pair + iter->map->value_offset;
+    }
+    iter->occurrence++;
+    if (iter->occurrence
+        == btree_multimap_occurrences(iter->map, leaf, iter->index)) {
+        iter->occurrence = 0;
+        btree_multimap_step(&iter->leaf, &iter->index);
+    }
+    return BK_TRUE;
+}
+
+/*
+ * Frees the subtree of the node, which is at the level.
+ */
+static void btree_multimap_free_nodes(btree_multimap me, char *const node,
+                                      const size_t level)
+{
+    if (level > 1) {
+        size_t i;
+        for (i = 0; i <= btree_multimap_pair_count(node); i++) {
+            btree_multimap_free_nodes(me, btree_multimap_child(me, node, i),
+                                      level - 1);
+        }
+    }
+    btree_multimap_deallocate(&me->allocator, node);
+}
+
+/**
+ * Clears the key-value pairs from the btree_multimap.
+ *
+ * @param me the btree_multimap to clear
+ */
+void btree_multimap_clear(btree_multimap me)
+{
+    if (me->root) {
+        btree_multimap_free_nodes(me, me->root, me->height);
+    }
+    me->root = NULL;
+    me->height = 0;
+    me->size = 0;
+    me->iterate_leaf = NULL;
+}
+
+/**
+ * Frees the btree_multimap memory. Performing further operations after calling
+ * this function results in undefined behavior. Freeing NULL is legal, and
+ * causes no operation to be performed.
+ *
+ * @param me the btree_multimap to free from memory
+ *
+ * @return NULL
+ */
+btree_multimap btree_multimap_destroy(btree_multimap me)
+{
+    if (me) {
+        btree_multimap_clear(me);
+        btree_multimap_deallocate(&me->allocator, me->pair_copy);
+        btree_multimap_deallocate(&me->allocator, me);
+    }
+    return NULL;
+}
@@ -0,0 +1,1273 @@
+/*
+ * Copyright (c) 2017-2025 Bailey Thompson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "include/btree_multiset.h"
+
+#define BKTHOMPS_BTREE_MULTISET_NODE_SIZE 512
+#define BKTHOMPS_BTREE_MULTISET_MIN_CAPACITY 3
+
+/*
+ * Every node is node_size bytes and starts with the number of keys in it. A
+ * leaf then links to the leaves before and after it, and holds its distinct
+ * keys side by side followed by how many times each of them occurs. An inner
+ * node holds its separating keys side by side followed by one more child than
+ * it has keys. Each of these arrays is padded so that its elements are aligned.
+ * All the keys in the subtree of a child are lower than the separating key
+ * which follows the child, and at least as high as the one which precedes it.
+ */
+struct internal_btree_multiset {
+    size_t size;
+    size_t key_size;
+    size_t height;
+    size_t leaf_capacity;
+    size_t inner_capacity;
+    size_t node_size;
+    int (*comparator)(const void *const one, const void *const two);
+    char *root;
+    size_t leaf_key_offset;
+    size_t leaf_occurrences_offset;
+    size_t inner_key_offset;
+    size_t inner_child_offset;
+    struct bk_allocator allocator;
+};
+
+static const size_t ptr_size = sizeof(char *);
+static const size_t count_size = sizeof(size_t);
+
+static const size_t leaf_prev_offset = sizeof(size_t);
+static const size_t leaf_next_offset = sizeof(size_t) + sizeof(char *);
+static const size_t leaf_header_size = sizeof(size_t) + 2 * sizeof(char *);
+static const size_t inner_header_size = sizeof(size_t);
+
+/*
+ * C89 has no name for the strictest alignment which a fundamental type may
+ * need, so it is found from where a union of those types lands after a char.
+ */
+union btree_multiset_max_align {
+    long l;
+    double d;
+    long double ld;
+    void *p;
+    void (*f)(void);
+};
+
+struct btree_multiset_align_probe {
+    char c;
+    union btree_multiset_max_align u;
+};
+
+static const size_t max_alignment =
+        offsetof(struct btree_multiset_align_probe, u);
+
+/*
+ * Used when the btree_multiset is initialized without an allocator. Its
+ * function pointers are all NULL, which means memory is managed by the standard
+ * library.
+ */
+static const struct bk_allocator btree_multiset_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the btree_multiset.
+ */
+static void *btree_multiset_allocate(const struct bk_allocator *const allocator,
+                                     const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Frees memory with the allocator of the btree_multiset.
+ */
+static void
+btree_multiset_deallocate(const struct bk_allocator *const allocator,
+                          void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+ * Gets the alignment which an object of the specified size may need. The size
+ * of a type is a multiple of its alignment, which is a power of two, so the
+ * largest power of two which divides the size is enough, up to the strictest
+ * alignment of any type.
+ */
+static size_t btree_multiset_alignment(const size_t size)
+{
+    size_t alignment = 1;
+    while (alignment < max_alignment && size % (2 * alignment) == 0) {
+        alignment *= 2;
+    }
+    return alignment;
+}
+
+/*
+ * Places an array of count elements of the size at the offset, rounded up so
+ * that the elements are aligned. Gets where the array ends, or zero if it does
+ * not fit in a size_t.
+ */
+static size_t btree_multiset_array(const size_t offset, const size_t size,
+                                   const size_t count, size_t *const start)
+{
+    const size_t alignment = btree_multiset_alignment(size);
+    const size_t padding = (alignment - offset % alignment) % alignment;
+    if (offset + padding < offset
+        || size > ((size_t) -1 - offset - padding) / count) {
+        return 0;
+    }
+    *start = offset + padding;
+    return *start + count * size;
+}
+
+/*
+ * Lays out a leaf which holds the capacity of distinct keys, and gets its size,
+ * or zero if it is too large.
+ */
+static size_t btree_multiset_leaf_layout(const size_t key_size,
+                                         const size_t capacity,
+                                         size_t *const key_offset,
+                                         size_t *const occurrences_offset)
+{
+    const size_t keys_end = btree_multiset_array(leaf_header_size, key_size,
+                                                 capacity, key_offset);
+    if (keys_end == 0) {
+        return 0;
+    }
+    return btree_multiset_array(keys_end, count_size, capacity,
+                                occurrences_offset);
+}
+
+/*
+ * Lays out an inner node which holds the capacity of separating keys, and gets
+ * its size, or zero if it is too large.
+ */
+static size_t btree_multiset_inner_layout(const size_t key_size,
+                                          const size_t capacity,
+                                          size_t *const key_offset,
+                                          size_t *const child_offset)
+{
+    const size_t keys_end = btree_multiset_array(inner_header_size, key_size,
+                                                 capacity, key_offset);
+    if (keys_end == 0) {
+        return 0;
+    }
+    return btree_multiset_array(keys_end, ptr_size, capacity + 1, child_offset);
+}
+
+/*
+ * Determines the size of the smallest node which fits the minimum number of
+ * keys in both a leaf and an inner node, or zero if it is too large.
+ */
+static size_t btree_multiset_min_node_size(const size_t key_size)
+{
+    size_t key_offset;
+    size_t occurrences_offset;
+    size_t child_offset;
+    const size_t leaf_size =
+            btree_multiset_leaf_layout(key_size,
+                                       BKTHOMPS_BTREE_MULTISET_MIN_CAPACITY,
+                                       &key_offset, &occurrences_offset);
+    const size_t inner_size =
+            btree_multiset_inner_layout(key_size,
+                                        BKTHOMPS_BTREE_MULTISET_MIN_CAPACITY,
+                                        &key_offset, &child_offset);
+    if (leaf_size == 0 || inner_size == 0) {
+        return 0;
+    }
+    return leaf_size > inner_size ? leaf_size : inner_size;
+}
+
+/*
+ * Fits as many distinct keys into a leaf, and as many separating keys into an
+ * inner node, as the node size allows, and lays the nodes out accordingly. The
+ * node size must be at least the smallest node size.
+ */
+static void btree_multiset_layout(struct internal_btree_multiset *const me,
+                                  const size_t node_size)
+{
+    size_t leaf_capacity = (node_size - leaf_header_size)
+                           / (me->key_size + count_size);
+    size_t inner_capacity = (node_size - inner_header_size - ptr_size)
+                            / (me->key_size + ptr_size);
+    size_t size;
+    for (;;) {
+        size = btree_multiset_leaf_layout(me->key_size, leaf_capacity,
+                                          &me->leaf_key_offset,
+                                          &me->leaf_occurrences_offset);
+        if (size != 0 && size <= node_size) {
+            break;
+        }
+        leaf_capacity--;
+    }
+    for (;;) {
+        size = btree_multiset_inner_layout(me->key_size, inner_capacity,
+                                           &me->inner_key_offset,
+                                           &me->inner_child_offset);
+        if (size != 0 && size <= node_size) {
+            break;
+        }
+        inner_capacity--;
+    }
+    me->leaf_capacity = leaf_capacity;
+    me->inner_capacity = inner_capacity;
+}
+
+/**
+ * Initializes a btree_multiset, with nodes of the default size.
+ *
+ * @param key_size   the size of each key in the btree_multiset; must be
+ *                   positive
+ * @param comparator the comparator function used for key ordering; must not be
+ *                   NULL
+ *
+ * @return the newly-initialized btree_multiset, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+btree_multiset btree_multiset_init(const size_t key_size,
+                                   int (*const comparator)(const void *const,
+                                                           const void *const))
+{
+    size_t node_size = btree_multiset_min_node_size(key_size);
+    if (node_size < BKTHOMPS_BTREE_MULTISET_NODE_SIZE) {
+        node_size = BKTHOMPS_BTREE_MULTISET_NODE_SIZE;
+    }
+    return btree_multiset_init_ex(key_size, comparator, node_size, NULL);
+}
+
+/**
+ * Initializes a btree_multiset with nodes of the given size, which manages its
+ * memory with the given allocator. Larger nodes make the tree shallower and
+ * searches faster, but make putting and removing slower, since every key after
+ * the one which is put or removed is moved within its node. Nodes of a few
+ * cache lines up to a page, such as from 256 to 4096 bytes, work well.
+ *
+ * @param key_size   the size of each key in the btree_multiset; must be
+ *                   positive
+ * @param comparator the comparator function used for key ordering; must not be
+ *                   NULL
+ * @param node_size  the size of each node in bytes; must fit at least three
+ *                   keys and their counts along with the links of the node
+ * @param allocator  the allocator which manages the memory of the
+ *                   btree_multiset, or NULL to use the standard library; if
+ *                   not NULL, its allocate and deallocate functions must not be
+ *                   NULL
+ *
+ * @return the newly-initialized btree_multiset, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+btree_multiset
+btree_multiset_init_ex(const size_t key_size,
+                       int (*const comparator)(const void *const,
+                                               const void *const),
+                       const size_t node_size,
+                       const struct bk_allocator *allocator)
+{
+    struct internal_btree_multiset *init;
+    size_t min_node_size;
+    if (key_size == 0 || !comparator) {
+        return NULL;
+    }
+    if (!allocator) {
+        allocator = &btree_multiset_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
+        return NULL;
+    }
+    min_node_size = btree_multiset_min_node_size(key_size);
+    if (min_node_size == 0 || node_size < min_node_size) {
+        return NULL;
+    }
+    init = btree_multiset_allocate(allocator, sizeof *init);
+    if (!init) {
+        return NULL;
+    }
+    init->allocator = *allocator;
+    init->size = 0;
+    init->key_size = key_size;
+    init->height = 0;
+    btree_multiset_layout(init, node_size);
+    init->node_size = node_size;
+    init->comparator = comparator;
+    init->root = NULL;
+    return init;
+}
+
+/**
+ * Gets the size of the btree_multiset, which counts each occurrence of a key.
+ *
+ * @param me the btree_multiset to check
+ *
+ * @return the size of the btree_multiset
+ */
+size_t btree_multiset_size(btree_multiset me)
+{
+    return me->size;
+}
+
+/**
+ * Determines whether or not the btree_multiset is empty.
+ *
+ * @param me the btree_multiset to check
+ *
+ * @return BK_TRUE if the btree_multiset is empty, otherwise BK_FALSE
+ */
+bk_bool btree_multiset_is_empty(btree_multiset me)
+{
+    return btree_multiset_size(me) == 0;
+}
+
+/*
+ * Gets the number of keys in the node.
+ */
+static size_t btree_multiset_key_count(const char *const node)
+{
+    size_t count;
+    memcpy(&count, node, count_size);
+    return count;
+}
+
+/*
+ * Sets the number of keys in the node.
+ */
+static void btree_multiset_store_key_count(char *const node, const size_t count)
+{
+    memcpy(node, &count, count_size);
+}
+
+/*
+ * Gets the key at the index of the node, which is a leaf if it is at level one
+ * and an inner node otherwise.
+ */
+static char *btree_multiset_key(btree_multiset me, char *const node,
+                                const size_t level, const size_t index)
+{
+    if (level == 1) {
+        return node + me->leaf_key_offset + index * me->key_size;
+    }
+    return node + me->inner_key_offset + index * me->key_size;
+}
+
+/*
+ * Gets the address of the number of times the key at the index of the leaf
+ * occurs.
+ */
+static char *btree_multiset_occurrences_slot(btree_multiset me,
+                                             char *const leaf,
+                                             const size_t index)
+{
+    return leaf + me->leaf_occurrences_offset + index * count_size;
+}
+
+/*
+ * Gets the number of times the key at the index of the leaf occurs.
+ */
+static size_t btree_multiset_occurrences(btree_multiset me, char *const leaf,
+                                         const size_t index)
+{
+    size_t occurrences;
+    memcpy(&occurrences, btree_multiset_occurrences_slot(me, leaf, index),
+           count_size);
+    return occurrences;
+}
+
+/*
+ * Sets the number of times the key at the index of the leaf occurs.
+ */
+static void btree_multiset_store_occurrences(btree_multiset me,
+                                             char *const leaf,
+                                             const size_t index,
+                                             const size_t occurrences)
+{
+    memcpy(btree_multiset_occurrences_slot(me, leaf, index), &occurrences,
+           count_size);
+}
+
+/*
+ * Gets the address of the child pointer at the index of the inner node.
+ */
+static char *btree_multiset_child_slot(btree_multiset me, char *const node,
+                                       const size_t index)
+{
+    return node + me->inner_child_offset + index * ptr_size;
+}
+
+/*
+ * Gets the child at the index of the inner node.
+ */
+static char *btree_multiset_child(btree_multiset me, char *const node,
+                                  const size_t index)
+{
+    char *child;
+    memcpy(&child, btree_multiset_child_slot(me, node, index), ptr_size);
+    return child;
+}
+
+/*
+ * Sets the child at the index of the inner node.
+ */
+static void btree_multiset_store_child(btree_multiset me, char *const node,
+                                       const size_t index, char *const child)
+{
+    memcpy(btree_multiset_child_slot(me, node, index), &child, ptr_size);
+}
+
+/*
+ * Gets the leaf which is linked before or after the leaf.
+ */
+static char *btree_multiset_link(char *const leaf, const size_t offset)
+{
+    char *link;
+    memcpy(&link, leaf + offset, ptr_size);
+    return link;
+}
+
+/*
+ * Sets the leaf which is linked before or after the leaf.
+ */
+static void btree_multiset_store_link(char *const leaf, const size_t offset,
+                                      char *const link)
+{
+    memcpy(leaf + offset, &link, ptr_size);
+}
+
+/*
+ * Determines whether the node at the level has as many keys as it can hold.
+ */
+static bk_bool btree_multiset_is_full(btree_multiset me, char *const node,
+                                      const size_t level)
+{
+    const size_t capacity =
+            level == 1 ? me->leaf_capacity : me->inner_capacity;
+    return btree_multiset_key_count(node) == capacity;
+}
+
+/*
+ * Gets the least number of keys which a node at the level, other than the
+ * root, must hold. Splitting a full node and merging two of the smallest nodes
+ * both keep to it.
+ */
+static size_t btree_multiset_min_count(btree_multiset me, const size_t level)
+{
+    if (level == 1) {
+        return me->leaf_capacity / 2;
+    }
+    return (me->inner_capacity - 1) / 2;
+}
+
+/*
+ * Searches the keys of the node with a binary search, and returns the index of
+ * the first key which is higher than the key, or which is at least as high as
+ * the key if is_strict is false.
+ */
+static size_t btree_multiset_search(btree_multiset me, char *const node,
+                                    const size_t level, const void *const key,
+                                    const bk_bool is_strict)
+{
+    const char *const keys = btree_multiset_key(me, node, level, 0);
+    size_t low = 0;
+    size_t high = btree_multiset_key_count(node);
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        const int compare = me->comparator(keys + mid * me->key_size, key);
+        if (compare < 0 || (is_strict && compare == 0)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * Finds the leaf which would hold the key.
+ */
+static char *btree_multiset_find_leaf(btree_multiset me, const void *const key)
+{
+    char *node = me->root;
+    size_t level;
+    for (level = me->height; level > 1; level--) {
+        node = btree_multiset_child(me, node,
+                                    btree_multiset_search(me, node, level, key,
+                                                          BK_TRUE));
+    }
+    return node;
+}
+
+/*
+ * Moves count keys, and the counts or children which go with them, within or
+ * between nodes of the same level. Inner nodes move the child which follows
+ * each key.
+ */
+static void btree_multiset_move(btree_multiset me, char *const destination,
+                                const size_t destination_index,
+                                char *const source, const size_t source_index,
+                                const size_t count, const size_t level)
+{
+    memmove(btree_multiset_key(me, destination, level, destination_index),
+            btree_multiset_key(me, source, level, source_index),
+            count * me->key_size);
+    if (level == 1) {
+        memmove(btree_multiset_occurrences_slot(me, destination,
+                                                destination_index),
+                btree_multiset_occurrences_slot(me, source, source_index),
+                count * count_size);
+    } else {
+        memmove(btree_multiset_child_slot(me, destination,
+                                          destination_index + 1),
+                btree_multiset_child_slot(me, source, source_index + 1),
+                count * ptr_size);
+    }
+}
+
+/*
+ * Splits the full child at the index of the inner node in two, and puts the
+ * key which separates the two halves into the inner node, which must not be
+ * full. A leaf copies its first key of the upper half up, whereas an inner
+ * node moves its middle key up.
+ */
+static bk_err btree_multiset_split_child(btree_multiset me, char *const node,
+                                         const size_t index, const size_t level)
+{
+    char *const child = btree_multiset_child(me, node, index);
+    const size_t child_level = level - 1;
+    const size_t count = btree_multiset_key_count(child);
+    const size_t keep = count / 2;
+    const size_t node_count = btree_multiset_key_count(node);
+    char *separator;
+    char *const sibling = btree_multiset_allocate(&me->allocator,
+                                                  me->node_size);
+    if (!sibling) {
+        return -BK_ENOMEM;
+    }
+    if (child_level == 1) {
+        char *const next = btree_multiset_link(child, leaf_next_offset);
+        btree_multiset_move(me, sibling, 0, child, keep, count - keep,
+                            child_level);
+        btree_multiset_store_key_count(sibling, count - keep);
+        btree_multiset_store_link(sibling, leaf_prev_offset, child);
+        btree_multiset_store_link(sibling, leaf_next_offset, next);
+        if (next) {
+            btree_multiset_store_link(next, leaf_prev_offset, sibling);
+        }
+        btree_multiset_store_link(child, leaf_next_offset, sibling);
+        separator = btree_multiset_key(me, sibling, child_level, 0);
+    } else {
+        btree_multiset_store_child(me, sibling, 0,
+                                   btree_multiset_child(me, child, keep + 1));
+        btree_multiset_move(me, sibling, 0, child, keep + 1, count - keep - 1,
+                            child_level);
+        btree_multiset_store_key_count(sibling, count - keep - 1);
+        separator = btree_multiset_key(me, child, child_level, keep);
+    }
+    btree_multiset_store_key_count(child, keep);
+    btree_multiset_move(me, node, index + 1, node, index, node_count - index,
+                        level);
+    memcpy(btree_multiset_key(me, node, level, index), separator, me->key_size);
+    btree_multiset_store_child(me, node, index + 1, sibling);
+    btree_multiset_store_key_count(node, node_count + 1);
+    return BK_OK;
+}
+
+/*
+ * Makes the tree one level taller when the root is full, so that there is
+ * always room to split the nodes on the way down.
+ */
+static bk_err btree_multiset_grow(btree_multiset me)
+{
+    char *const root = btree_multiset_allocate(&me->allocator, me->node_size);
+    if (!root) {
+        return -BK_ENOMEM;
+    }
+    btree_multiset_store_key_count(root, 0);
+    btree_multiset_store_child(me, root, 0, me->root);
+    if (btree_multiset_split_child(me, root, 0, me->height + 1) != BK_OK) {
+        btree_multiset_deallocate(&me->allocator, root);
+        return -BK_ENOMEM;
+    }
+    me->root = root;
+    me->height++;
+    return BK_OK;
+}
+
+/**
+ * Adds a key to the btree_multiset. The pointer to the key being passed in
+ * should point to the key type which this btree_multiset holds. For example, if
+ * this btree_multiset holds key integers, the key pointer should be a pointer
+ * to an integer. Since the key is being copied, the pointer only has to be
+ * valid when this function is called. Each distinct key is stored once along
+ * with how many times it occurs, and full nodes are split on the way down, so
+ * the tree is never walked back up.
+ *
+ * @param me  the btree_multiset to add to
+ * @param key the key to add
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_ENOMEM if out of memory
+ */
+bk_err btree_multiset_put(btree_multiset me, void *const key)
+{
+    char *node;
+    size_t level;
+    size_t index;
+    size_t count;
+    if (!me->root) {
+        char *const root = btree_multiset_allocate(&me->allocator,
+                                                   me->node_size);
+        if (!root) {
+            return -BK_ENOMEM;
+        }
+        btree_multiset_store_key_count(root, 0);
+        btree_multiset_store_link(root, leaf_prev_offset, NULL);
+        btree_multiset_store_link(root, leaf_next_offset, NULL);
+        me->root = root;
+        me->height = 1;
+    } else if (btree_multiset_is_full(me, me->root, me->height)
+               && btree_multiset_grow(me) != BK_OK) {
+        return -BK_ENOMEM;
+    }
+    node = me->root;
+    for (level = me->height; level > 1; level--) {
+        index = btree_multiset_search(me, node, level, key, BK_TRUE);
+        if (btree_multiset_is_full(me, btree_multiset_child(me, node, index),
+                                   level - 1)) {
+            if (btree_multiset_split_child(me, node, index, level) != BK_OK) {
+                return -BK_ENOMEM;
+            }
+            if (me->comparator(btree_multiset_key(me, node, level, index), key)
+                <= 0) {
+                index++;
+            }
+        }
+        node = btree_multiset_child(me, node, index);
+    }
+    index = btree_multiset_search(me, node, 1, key, BK_FALSE);
+    count = btree_multiset_key_count(node);
+    if (index < count
+        && me->comparator(btree_multiset_key(me, node, 1, index), key) == 0) {
+        const size_t occurrences = btree_multiset_occurrences(me, node, index);
+        btree_multiset_store_occurrences(me, node, index, occurrences + 1);
+        me->size++;
+        return BK_OK;
+    }
+    btree_multiset_move(me, node, index + 1, node, index, count - index, 1);
+    memcpy(btree_multiset_key(me, node, 1, index), key, me->key_size);
+    btree_multiset_store_occurrences(me, node, index, 1);
+    btree_multiset_store_key_count(node, count + 1);
+    me->size++;
+    return BK_OK;
+}
+
+/*
+ * Gets the address of the number of times the key occurs, or NULL if the
+ * btree_multiset does not contain it.
+ */
+static char *btree_multiset_find_occurrences(btree_multiset me,
+                                             const void *const key)
+{
+    char *leaf;
+    size_t index;
+    if (!me->root) {
+        return NULL;
+    }
+    leaf = btree_multiset_find_leaf(me, key);
+    index = btree_multiset_search(me, leaf, 1, key, BK_FALSE);
+    if (index == btree_multiset_key_count(leaf)
+        || me->comparator(btree_multiset_key(me, leaf, 1, index), key) != 0) {
+        return NULL;
+    }
+    return btree_multiset_occurrences_slot(me, leaf, index);
+}
+
+/**
+ * Determines the count of a specific key in the btree_multiset. The pointer to
+ * the key being passed in should point to the key type which this
+ * btree_multiset holds. For example, if this btree_multiset holds key integers,
+ * the key pointer should be a pointer to an integer. Since the key is being
+ * copied, the pointer only has to be valid when this function is called.
+ *
+ * @param me  the btree_multiset to check for the count
+ * @param key the key to check
+ *
+ * @return the count of a specific key in the btree_multiset
+ */
+size_t btree_multiset_count(btree_multiset me, void *const key)
+{
+    const char *const found = btree_multiset_find_occurrences(me, key);
+    size_t occurrences;
+    if (!found) {
+        return 0;
+    }
+    memcpy(&occurrences, found, count_size);
+    return occurrences;
+}
+
+/**
+ * Determines if the btree_multiset contains the specified key. The pointer to
+ * the key being passed in should point to the key type which this
+ * btree_multiset holds. For example, if this btree_multiset holds key integers,
+ * the key pointer should be a pointer to an integer. Since the key is being
+ * copied, the pointer only has to be valid when this function is called.
+ *
+ * @param me  the btree_multiset to check for the key
+ * @param key the key to check
+ *
+ * @return BK_TRUE if the btree_multiset contained the key, otherwise BK_FALSE
+ */
+bk_bool btree_multiset_contains(btree_multiset me, void *const key)
+{
+    return btree_multiset_find_occurrences(me, key) != NULL;
+}
+
+/*
+ * Moves the last key of the left sibling of the child at the index into the
+ * child, through the separating key of the inner node if they are inner nodes.
+ */
+static void btree_multiset_borrow_left(btree_multiset me, char *const node,
+                                       const size_t index, const size_t level)
+{
+    const size_t child_level = level - 1;
+    char *const child = btree_multiset_child(me, node, index);
+    char *const sibling = btree_multiset_child(me, node, index - 1);
+    const size_t child_count = btree_multiset_key_count(child);
+    const size_t sibling_count = btree_multiset_key_count(sibling);
+    char *const separator = btree_multiset_key(me, node, level, index - 1);
+    btree_multiset_move(me, child, 1, child, 0, child_count, child_level);
+    if (child_level == 1) {
+        btree_multiset_move(me, child, 0, sibling, sibling_count - 1, 1,
+                            child_level);
+        memcpy(separator, btree_multiset_key(me, child, child_level, 0),
+               me->key_size);
+    } else {
+        btree_multiset_store_child(me, child, 1,
+                                   btree_multiset_child(me, child, 0));
+        memcpy(btree_multiset_key(me, child, child_level, 0), separator,
+               me->key_size);
+        btree_multiset_store_child(me, child, 0,
+                                   btree_multiset_child(me, sibling,
+                                                        sibling_count));
+        memcpy(separator,
+               btree_multiset_key(me, sibling, child_level, sibling_count - 1),
+               me->key_size);
+    }
+    btree_multiset_store_key_count(child, child_count + 1);
+    btree_multiset_store_key_count(sibling, sibling_count - 1);
+}
+
+/*
+ * Moves the first key of the right sibling of the child at the index into the
+ * child, through the separating key of the inner node if they are inner nodes.
+ */
+static void btree_multiset_borrow_right(btree_multiset me, char *const node,
+                                        const size_t index, const size_t level)
+{
+    const size_t child_level = level - 1;
+    char *const child = btree_multiset_child(me, node, index);
+    char *const sibling = btree_multiset_child(me, node, index + 1);
+    const size_t child_count = btree_multiset_key_count(child);
+    const size_t sibling_count = btree_multiset_key_count(sibling);
+    char *const separator = btree_multiset_key(me, node, level, index);
+    if (child_level == 1) {
+        btree_multiset_move(me, child, child_count, sibling, 0, 1, child_level);
+        btree_multiset_move(me, sibling, 0, sibling, 1, sibling_count - 1,
+                            child_level);
+        memcpy(separator, btree_multiset_key(me, sibling, child_level, 0),
+               me->key_size);
+    } else {
+        memcpy(btree_multiset_key(me, child, child_level, child_count),
+               separator, me->key_size);
+        btree_multiset_store_child(me, child, child_count + 1,
+                                   btree_multiset_child(me, sibling, 0));
+        memcpy(separator, btree_multiset_key(me, sibling, child_level, 0),
+               me->key_size);
+        btree_multiset_store_child(me, sibling, 0,
+                                   btree_multiset_child(me, sibling, 1));
+        btree_multiset_move(me, sibling, 0, sibling, 1, sibling_count - 1,
+                            child_level);
+    }
+    btree_multiset_store_key_count(child, child_count + 1);
+    btree_multiset_store_key_count(sibling, sibling_count - 1);
+}
+
+/*
+ * Merges the child after the index of the inner node into the child at the
+ * index, and frees it. Inner nodes take the separating key down with them.
+ */
+static void btree_multiset_merge(btree_multiset me, char *const node,
+                                 const size_t index, const size_t level)
+{
+    const size_t child_level = level - 1;
+    const size_t node_count = btree_multiset_key_count(node);
+    char *const child = btree_multiset_child(me, node, index);
+    char *const sibling = btree_multiset_child(me, node, index + 1);
+    size_t child_count = btree_multiset_key_count(child);
+    const size_t sibling_count = btree_multiset_key_count(sibling);
+    if (child_level == 1) {
+        char *const next = btree_multiset_link(sibling, leaf_next_offset);
+        btree_multiset_store_link(child, leaf_next_offset, next);
+        if (next) {
+            btree_multiset_store_link(next, leaf_prev_offset, child);
+        }
+    } else {
+        memcpy(btree_multiset_key(me, child, child_level, child_count),
+               btree_multiset_key(me, node, level, index), me->key_size);
+        child_count++;
+        btree_multiset_store_child(me, child, child_count,
+                                   btree_multiset_child(me, sibling, 0));
+    }
+    btree_multiset_move(me, child, child_count, sibling, 0, sibling_count,
+                        child_level);
+    btree_multiset_store_key_count(child, child_count + sibling_count);
+    btree_multiset_move(me, node, index, node, index + 1,
+                        node_count - index - 1, level);
+    btree_multiset_store_key_count(node, node_count - 1);
+    btree_multiset_deallocate(&me->allocator, sibling);
+}
+
+/*
+ * Makes sure the child at the index of the inner node holds more than the least
+ * number of keys, so that a key can be removed from its subtree. It borrows a
+ * key from a sibling which can spare one, or otherwise merges with a sibling.
+ * Returns the index of the child which now covers the keys of the child.
+ */
+static size_t btree_multiset_fill_child(btree_multiset me, char *const node,
+                                        const size_t index, const size_t level)
+{
+    const size_t min_count = btree_multiset_min_count(me, level - 1);
+    if (btree_multiset_key_count(btree_multiset_child(me, node, index))
+        > min_count) {
+        return index;
+    }
+    if (index > 0
+        && btree_multiset_key_count(btree_multiset_child(me, node, index - 1))
+           > min_count) {
+        btree_multiset_borrow_left(me, node, index, level);
+        return index;
+    }
+    if (index < btree_multiset_key_count(node)
+        && btree_multiset_key_count(btree_multiset_child(me, node, index + 1))
+           > min_count) {
+        btree_multiset_borrow_right(me, node, index, level);
+        return index;
+    }
+    if (index > 0) {
+        btree_multiset_merge(me, node, index - 1, level);
+        return index - 1;
+    }
+    btree_multiset_merge(me, node, index, level);
+    return index;
+}
+
+/*
+ * Makes the tree one level shorter when the root has run out of keys, or frees
+ * the root when the btree_multiset is empty.
+ */
+static void btree_multiset_shrink(btree_multiset me)
+{
+    char *const root = me->root;
+    if (btree_multiset_key_count(root) > 0) {
+        return;
+    }
+    if (me->height == 1) {
+        me->root = NULL;
+    } else {
+        me->root = btree_multiset_child(me, root, 0);
+    }
+    me->height--;
+    btree_multiset_deallocate(&me->allocator, root);
+}
+
+/*
+ * Removes every occurrence of the key from the btree_multiset, and gets how
+ * many there were. Small nodes are filled up on the way down, so the tree is
+ * never walked back up.
+ */
+static size_t btree_multiset_remove_key(btree_multiset me,
+                                        const void *const key)
+{
+    char *node = me->root;
+    size_t level;
+    size_t index;
+    size_t count;
+    size_t occurrences = 0;
+    for (level = me->height; level > 1; level--) {
+        index = btree_multiset_search(me, node, level, key, BK_TRUE);
+        index = btree_multiset_fill_child(me, node, index, level);
+        node = btree_multiset_child(me, node, index);
+    }
+    index = btree_multiset_search(me, node, 1, key, BK_FALSE);
+    count = btree_multiset_key_count(node);
+    if (index < count
+        && me->comparator(btree_multiset_key(me, node, 1, index), key) == 0) {
+        occurrences = btree_multiset_occurrences(me, node, index);
+        btree_multiset_move(me, node, index, node, index + 1,
+                            count - index - 1, 1);
+        btree_multiset_store_key_count(node, count - 1);
+        me->size -= occurrences;
+    }
+    btree_multiset_shrink(me);
+    return occurrences;
+}
+
+/**
+ * Removes a key from the btree_multiset if it contains it. The pointer to the
+ * key being passed in should point to the key type which this btree_multiset
+ * holds. For example, if this btree_multiset holds key integers, the key
+ * pointer should be a pointer to an integer. Since the key is being copied, the
+ * pointer only has to be valid when this function is called. The tree only
+ * changes shape once the last occurrence of the key is removed.
+ *
+ * @param me  the btree_multiset to remove a key from
+ * @param key the key to remove
+ *
+ * @return BK_TRUE if the btree_multiset contained the key, otherwise BK_FALSE
+ */
+bk_bool btree_multiset_remove(btree_multiset me, void *const key)
+{
+    char *const found = btree_multiset_find_occurrences(me, key);
+    size_t occurrences;
+    if (!found) {
+        return BK_FALSE;
+    }
+    memcpy(&occurrences, found, count_size);
+    if (occurrences == 1) {
+        btree_multiset_remove_key(me, key);
+        return BK_TRUE;
+    }
+    occurrences--;
+    memcpy(found, &occurrences, count_size);
+    me->size--;
+    return BK_TRUE;
+}
+
+/**
+ * Removes all the occurrences of a specified key in the btree_multiset. The
+ * pointer to the key being passed in should point to the key type which this
+ * btree_multiset holds. For example, if this btree_multiset holds key integers,
+ * the key pointer should be a pointer to an integer. Since the key is being
+ * copied, the pointer only has to be valid when this function is called.
+ *
+ * @param me  the btree_multiset to remove a key from
+ * @param key the key to remove
+ *
+ * @return BK_TRUE if the btree_multiset contained the key, otherwise BK_FALSE
+ */
+bk_bool btree_multiset_remove_all(btree_multiset me, void *const key)
+{
+    if (!me->root) {
+        return BK_FALSE;
+    }
+    return btree_multiset_remove_key(me, key) > 0;
+}
+
+/*
+ * Gets the leaf at the lowest or highest end of the btree_multiset, or NULL if
+ * it is empty.
+ */
+static char *btree_multiset_end_leaf(btree_multiset me,
+                                     const bk_bool is_highest)
+{
+    char *node = me->root;
+    size_t level;
+    if (!node) {
+        return NULL;
+    }
+    for (level = me->height; level > 1; level--) {
+        node = btree_multiset_child(me, node,
+                                    is_highest ? btree_multiset_key_count(node)
+                                               : 0);
+    }
+    return node;
+}
+
+/*
+ * Finds the position of the first key which is higher than the key, or which
+ * is at least as high as the key if is_strict is false. The leaf is set to
+ * NULL if there is no such key.
+ */
+static void btree_multiset_seek(btree_multiset me, const void *const key,
+                                const bk_bool is_strict, char **const leaf,
+                                size_t *const index)
+{
+    *index = 0;
+    if (!me->root) {
+        *leaf = NULL;
+        return;
+    }
+    *leaf = btree_multiset_find_leaf(me, key);
+    *index = btree_multiset_search(me, *leaf, 1, key, is_strict);
+    if (*index == btree_multiset_key_count(*leaf)) {
+        *leaf = btree_multiset_link(*leaf, leaf_next_offset);
+        *index = 0;
+    }
+}
+
+/*
+ * Gets the key at the position, or NULL if there is none.
+ */
+static void *btree_multiset_key_at(btree_multiset me, char *const leaf,
+                                   const size_t index)
+{
+    if (!leaf) {
+        return NULL;
+    }
+    return btree_multiset_key(me, leaf, 1, index);
+}
+
+/*
+ * Gets the key just before the position of the first key which is higher than
+ * the key, or which is at least as high as the key if is_strict is false.
+ */
+static void *btree_multiset_key_before(btree_multiset me, const void *const key,
+                                       const bk_bool is_strict)
+{
+    char *leaf;
+    size_t index;
+    btree_multiset_seek(me, key, is_strict, &leaf, &index);
+    if (!leaf) {
+        leaf = btree_multiset_end_leaf(me, BK_TRUE);
+        index = leaf ? btree_multiset_key_count(leaf) : 0;
+    }
+    if (index == 0) {
+        leaf = leaf ? btree_multiset_link(leaf, leaf_prev_offset) : NULL;
+        index = leaf ? btree_multiset_key_count(leaf) : 0;
+    }
+    return btree_multiset_key_at(me, leaf, index - 1);
+}
+
+/**
+ * Returns the first (lowest) key in this btree_multiset. The returned key is a
+ * pointer to the internally stored key, which should not be modified, and
+ * which is only valid until the btree_multiset is next changed.
+ *
+ * @param me the btree_multiset to get the key from
+ *
+ * @return the lowest key in this btree_multiset, or NULL if it is empty
+ */
+void *btree_multiset_first(btree_multiset me)
+{
+    return btree_multiset_key_at(me, btree_multiset_end_leaf(me, BK_FALSE), 0);
+}
+
+/**
+ * Returns the last (highest) key in this btree_multiset. The returned key is a
+ * pointer to the internally stored key, which should not be modified, and
+ * which is only valid until the btree_multiset is next changed.
+ *
+ * @param me the btree_multiset to get the key from
+ *
+ * @return the highest key in this btree_multiset, or NULL if it is empty
+ */
+void *btree_multiset_last(btree_multiset me)
+{
+    char *const leaf = btree_multiset_end_leaf(me, BK_TRUE);
+    if (!leaf) {
+        return NULL;
+    }
+    return btree_multiset_key_at(me, leaf, btree_multiset_key_count(leaf) - 1);
+}
+
+/**
+ * Returns the key which is strictly lower than the comparison key. Meaning that
+ * the highest key which is lower than the key used for comparison is returned.
+ *
+ * @param me  the btree_multiset to get the lower key from
+ * @param key the key to use for comparison
+ *
+ * @return the key which is strictly lower, or NULL if it does not exist
+ */
+void *btree_multiset_lower(btree_multiset me, void *const key)
+{
+    return btree_multiset_key_before(me, key, BK_FALSE);
+}
+
+/**
+ * Returns the key which is strictly higher than the comparison key. Meaning
+ * that the lowest key which is higher than the key used for comparison is
+ * returned.
+ *
+ * @param me  the btree_multiset to get the higher key from
+ * @param key the key to use for comparison
+ *
+ * @return the key which is strictly higher, or NULL if it does not exist
+ */
+void *btree_multiset_higher(btree_multiset me, void *const key)
+{
+    char *leaf;
+    size_t index;
+    btree_multiset_seek(me, key, BK_TRUE, &leaf, &index);
+    return btree_multiset_key_at(me, leaf, index);
+}
+
+/**
+ * Returns the key which is the floor of the comparison key. Meaning that the
+ * the highest key which is lower or equal to the key used for comparison is
+ * returned.
+ *
+ * @param me  the btree_multiset to get the floor key from
+ * @param key the key to use for comparison
+ *
+ * @return the key which is the floor, or NULL if it does not exist
+ */
+void *btree_multiset_floor(btree_multiset me, void *const key)
+{
+    return btree_multiset_key_before(me, key, BK_TRUE);
+}
+
+/**
+ * Returns the key which is the ceiling of the comparison key. Meaning that the
+ * the lowest key which is higher or equal to the key used for comparison is
+ * returned.
+ *
+ * @param me  the btree_multiset to get the ceiling key from
+ * @param key the key to use for comparison
+ *
+ * @return the key which is the ceiling, or NULL if it does not exist
+ */
+void *btree_multiset_ceiling(btree_multiset me, void *const key)
+{
+    char *leaf;
+    size_t index;
+    btree_multiset_seek(me, key, BK_FALSE, &leaf, &index);
+    return btree_multiset_key_at(me, leaf, index);
+}
+
+/**
+ * Starts an in-order iteration over the btree_multiset at its lowest key. Each
+ * step moves along a leaf, or follows the link to the next leaf, so walking k
+ * distinct keys takes O(k) time. Unlike with a multiset, the keys move around
+ * within and between the nodes as the btree_multiset is changed, so putting or
+ * removing any key invalidates the iterator.
+ *
+ * @param iter the iterator to set up
+ * @param me   the btree_multiset to iterate over
+ */
+void btree_multiset_iter_init(struct btree_multiset_iter *const iter,
+                              btree_multiset me)
+{
+    iter->set = me;
+    iter->leaf = btree_multiset_end_leaf(me, BK_FALSE);
+    iter->index = 0;
+}
+
+/**
+ * Starts an in-order iteration over the btree_multiset at the lowest key which
+ * is higher or equal to the given key.
+ *
+ * @param iter the iterator to set up
+ * @param me   the btree_multiset to iterate over
+ * @param key  the key to start at
+ */
+void btree_multiset_iter_init_at(struct btree_multiset_iter *const iter,
+                                 btree_multiset me, void *const key)
+{
+    iter->set = me;
+    btree_multiset_seek(me, key, BK_FALSE, &iter->leaf, &iter->index);
+}
+
+/**
+ * Gets the key which the iterator is at, and then moves the iterator to the
+ * next higher key. The key points to where it is stored, and must not be
+ * modified.
+ *
+ * @param key   set to the key
+ * @param count set to the number of times the key is in the btree_multiset,
+ *              unless it is NULL
+ * @param iter  the iterator to advance
+ *
+ * @return BK_TRUE if there was a key, otherwise BK_FALSE
+ */
+bk_bool btree_multiset_iter_next(void **const key, size_t *const count,
+                                 struct btree_multiset_iter *const iter)
+{
+    char *const leaf = iter->leaf;
+    if (!leaf) {
+        return BK_FALSE;
+    }
+    *key = btree_multiset_key(iter->set, leaf, 1, iter->index);
+    if (count) {
+        *count = btree_multiset_occurrences(iter->set, leaf, iter->index);
+    }
+    iter->index++;
+    if (iter->index == btree_multiset_key_count(leaf)) {
+        iter->leaf = btree_multiset_link(leaf, leaf_next_offset);
+        iter->index = 0;
+    }
+    return BK_TRUE;
+}
+
+/*
+ * Frees the subtree of the node, which is at the level.
+ */
+static void btree_multiset_free_nodes(btree_multiset me, char *const node,
+                                      const size_t level)
+{
+    if (level > 1) {
+        size_t i;
+        for (i = 0; i <= btree_multiset_key_count(node); i++) {
+            btree_multiset_free_nodes(me, btree_multiset_child(me, node, i),
+                                      level - 1);
+        }
+    }
+    btree_multiset_deallocate(&me->allocator, node);
+}
+
+/**
+ * Clears the keys from the btree_multiset.
+ *
+ * @param me the btree_multiset to clear
+ */
+void btree_multiset_clear(btree_multiset me)
+{
+    if (me->root) {
+        btree_multiset_free_nodes(me, me->root, me->height);
+    }
+    me->root = NULL;
+    me->height = 0;
+    me->size = 0;
+}
+
+/**
+ * Frees the btree_multiset memory. Performing further operations after calling
+ * this function results in undefined behavior. Freeing NULL is legal, and
+ * causes no operation to be performed.
+ *
+ * @param me the btree_multiset to free from memory
+ *
+ * @return NULL
+ */
+btree_multiset btree_multiset_destroy(btree_multiset me)
+{
+    if (me) {
+        btree_multiset_clear(me);
+        btree_multiset_deallocate(&me->allocator, me);
+    }
+    return NULL;
+}
@@ -28,6 +28,13 @@
 #define BKTHOMPS_DEQUE_INITIAL_BLOCK_COUNT 8
 #define BKTHOMPS_DEQUE_RESIZE_RATIO 1.5
 
+#ifdef BK_STATS
+#define BKTHOMPS_DEQUE_STAT(me, counter, amount) \
+    ((me)->stats.counter += (amount))
+#else
+#define BKTHOMPS_DEQUE_STAT(me, counter, amount) ((void) 0)
+#endif
+
 struct internal_deque {
     size_t data_size;
     size_t block_size;
@@ -37,8 +44,93 @@ struct internal_deque {
     size_t alloc_block_start;
     size_t alloc_block_end;
     char **data;
+#ifdef BK_STATS
+    struct bk_stats stats;
+#endif
+    struct bk_allocator allocator;
 };
 
+/*
+ * Used when the deque is initialized without an allocator. Its function
+ * pointers are all NULL, which means memory is managed by the standard library.
+ */
+static const struct bk_allocator deque_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the deque.
+ */
+static void *deque_allocate(const struct bk_allocator *const allocator,
+                            const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Resizes memory with the allocator of the deque. If the allocator cannot
+ * resize memory, a new block is allocated and the old block is copied into it.
+ */
+static void *deque_reallocate(const struct bk_allocator *const allocator,
+                              void *const ptr, const size_t old_size,
+                              const size_t size)
+{
+    void *temp;
+    if (!allocator->allocate) {
+        return realloc(ptr, size);
+    }
+    if (allocator->reallocate) {
+        return allocator->reallocate(allocator->context, ptr, size);
+    }
+    temp = allocator->allocate(allocator->context, size);
+    if (!temp) {
+        return NULL;
+    }
+    memcpy(temp, ptr, old_size < size ? old_size : size);
+    allocator->deallocate(allocator->context, ptr);
+    return temp;
+}
+
+/*
+ * Frees memory with the allocator of the deque.
+ */
+static void deque_deallocate(const struct bk_allocator *const allocator,
+                             void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+ * Allocates a block of elements for the deque.
+ */
+static char *deque_allocate_block(deque me)
+{
+    BKTHOMPS_DEQUE_STAT(me, block_allocations, 1);
+    BKTHOMPS_DEQUE_STAT(me, bytes_allocated, me->block_size * me->data_size);
+    return deque_allocate(&me->allocator, me->block_size * me->data_size);
+}
+
+/*
+ * Resizes the array of block references of the deque, keeping the references
+ * which are already in it.
+ */
+static char **deque_resize_blocks(deque me, const size_t block_count)
+{
+    char **const temp = deque_reallocate(&me->allocator, me->data,
+                                         me->block_count * sizeof(char *),
+                                         block_count * sizeof(char *));
+    BKTHOMPS_DEQUE_STAT(me, bytes_allocated, block_count * sizeof(char *));
+    if (temp) {
+        BKTHOMPS_DEQUE_STAT(me, resizes, 1);
+    }
+    return temp;
+}
+
 /**
  * Initializes a deque.
  *
@@ -49,23 +141,51 @@ struct internal_deque {
  *         allocation error
  */
 deque deque_init(const size_t data_size)
+{
+    return deque_init_with_allocator(data_size, NULL);
+}
+
+/**
+ * Initializes a deque, which manages its memory with the given allocator.
+ *
+ * @param data_size the size of each element in the deque; must be positive
+ * @param allocator the allocator which manages the memory of the deque, or NULL
+ *                  to use the standard library; if not NULL, its allocate and
+ *                  deallocate functions must not be NULL
+ *
+ * @return the newly-initialized deque, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+deque deque_init_with_allocator(const size_t data_size,
+                                const struct bk_allocator *allocator)
 {
     struct internal_deque *init;
     char *block;
     if (data_size == 0) {
         return NULL;
     }
-    init = malloc(sizeof *init);
+    if (!allocator) {
+        allocator = &deque_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
+        return NULL;
+    }
+    init = deque_allocate(allocator, sizeof *init);
     if (!init) {
         return NULL;
     }
+    init->allocator = *allocator;
+#ifdef BK_STATS
+    memset(&init->stats, 0, sizeof init->stats);
+#endif
+    BKTHOMPS_DEQUE_STAT(init, bytes_allocated, sizeof *init);
     init->data_size = data_size;
     init->block_size = BKTHOMPS_DEQUE_MAX_BLOCK_BYTE_SIZE / init->data_size;
     if (init->block_size < BKTHOMPS_DEQUE_MIN_BLOCK_ELEMENT_SIZE) {
         init->block_size = BKTHOMPS_DEQUE_MIN_BLOCK_ELEMENT_SIZE;
     }
     if (init->block_size * data_size / data_size != init->block_size) {
-        free(init);
+        deque_deallocate(allocator, init);
         return NULL;
     }
     init->start_index =
@@ -74,15 +194,17 @@ deque deque_init(const size_t data_size)
     init->block_count = BKTHOMPS_DEQUE_INITIAL_BLOCK_COUNT;
     init->alloc_block_start = init->start_index / init->block_size;
     init->alloc_block_end = init->alloc_block_start;
-    init->data = malloc(init->block_count * sizeof(char *));
+    BKTHOMPS_DEQUE_STAT(init, bytes_allocated,
+                        init->block_count * sizeof(char *));
+    init->data = deque_allocate(allocator, init->block_count * sizeof(char *));
     if (!init->data) {
-        free(init);
+        deque_deallocate(allocator, init);
         return NULL;
     }
-    block = malloc(init->block_size * init->data_size);
+    block = deque_allocate_block(init);
     if (!block) {
-        free(init->data);
-        free(init);
+        deque_deallocate(allocator, init->data);
+        deque_deallocate(allocator, init);
         return NULL;
     }
     init->data[init->alloc_block_start] = block;
@@ -115,6 +237,23 @@ bk_bool deque_is_empty(deque me)
     return deque_size(me) == 0;
 }
 
+/**
+ * Gets the statistics of the deque. They are only tracked if the library is
+ * compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the deque to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void deque_get_stats(deque me, struct bk_stats *const stats)
+{
+#ifdef BK_STATS
+    *stats = me->stats;
+#else
+    (void) me;
+    memset(stats, 0, sizeof *stats);
+#endif
+}
+
 /**
  * Trims the deque so that it does not use memory which does not need to be
  * used.
@@ -131,19 +270,23 @@ bk_err deque_trim(deque me)
     const size_t end_block_index = deque_is_empty(me) ? start_block_index :
                                    (me->end_index - 1) / me->block_size;
     const size_t updated_block_count = end_block_index - start_block_index + 1;
-    char **updated_data = malloc(updated_block_count * sizeof(char *));
+    char **updated_data = deque_allocate(&me->allocator,
+                                         updated_block_count * sizeof(char *));
+    BKTHOMPS_DEQUE_STAT(me, bytes_allocated,
+                        updated_block_count * sizeof(char *));
     if (!updated_data) {
         return -BK_ENOMEM;
     }
+    BKTHOMPS_DEQUE_STAT(me, resizes, 1);
     memcpy(updated_data, me->data + start_block_index,
            updated_block_count * sizeof(char *));
     for (i = me->alloc_block_start; i < start_block_index; i++) {
-        free(me->data[i]);
+        deque_deallocate(&me->allocator, me->data[i]);
     }
     for (i = end_block_index + 1; i <= me->alloc_block_end; i++) {
-        free(me->data[i]);
+        deque_deallocate(&me->allocator, me->data[i]);
     }
-    free(me->data);
+    deque_deallocate(&me->allocator, me->data);
     me->start_index -= start_block_index * me->block_size;
     me->end_index -= start_block_index * me->block_size;
     me->block_count = updated_block_count;
@@ -232,7 +375,7 @@ bk_err deque_add_all(deque me, void *const arr, const size_t size)
         if (new_block_count > block_limit) {
             return -BK_ERANGE;
         }
-        temp = realloc(me->data, new_block_count * sizeof(char *));
+        temp = deque_resize_blocks(me, new_block_count);
         if (!temp) {
             return -BK_ENOMEM;
         }
@@ -240,7 +383,7 @@ bk_err deque_add_all(deque me, void *const arr, const size_t size)
         me->block_count = new_block_count;
     }
     for (i = me->alloc_block_end + 1; i <= block_index + needed_blocks; i++) {
-        me->data[i] = malloc(me->block_size * me->data_size);
+        me->data[i] = deque_allocate_block(me);
         if (!me->data[i]) {
             return -BK_ENOMEM;
         }
@@ -313,7 +456,7 @@ bk_err deque_push_front(deque me, void *const data)
                 return -BK_ERANGE;
             }
             added_blocks = new_block_count - me->block_count;
-            temp = realloc(me->data, new_block_count * sizeof(char *));
+            temp = deque_resize_blocks(me, new_block_count);
             if (!temp) {
                 return -BK_ENOMEM;
             }
@@ -335,8 +478,7 @@ bk_err deque_push_front(deque me, void *const data)
                 me->data[add_block_index] = me->data[me->alloc_block_end];
                 me->alloc_block_end--;
             } else {
-                me->data[add_block_index] =
-                        malloc(me->block_size * me->data_size);
+                me->data[add_block_index] = deque_allocate_block(me);
                 if (!me->data[add_block_index]) {
                     return -BK_ENOMEM;
                 }
@@ -390,7 +532,7 @@ bk_err deque_push_back(deque me, void *const data)
             if (new_block_count == 0) {
                 return -BK_ERANGE;
             }
-            temp = realloc(me->data, new_block_count * sizeof(char *));
+            temp = deque_resize_blocks(me, new_block_count);
             if (!temp) {
                 return -BK_ENOMEM;
             }
@@ -406,8 +548,7 @@ bk_err deque_push_back(deque me, void *const data)
                 me->data[add_block_index] = me->data[me->alloc_block_start];
                 me->alloc_block_start++;
             } else {
-                me->data[add_block_index] =
-                        malloc(me->block_size * me->data_size);
+                me->data[add_block_index] = deque_allocate_block(me);
                 if (!me->data[add_block_index]) {
                     return -BK_ENOMEM;
                 }
@@ -590,6 +731,27 @@ bk_err deque_get_at(void *const data, deque me, size_t index)
     return BK_OK;
 }
 
+/**
+ * Gets a pointer to the value of the deque at the specified index, so that the
+ * value can be read or modified in place without copying it. The pointer is
+ * invalidated by any operation which adds or removes values, or which trims or
+ * clears the deque.
+ *
+ * @param me    the deque to get the value from
+ * @param index the index of the value in the deque
+ *
+ * @return a pointer to the value, or NULL if the index is out of bounds
+ */
+void *deque_get_at_ptr(deque me, const size_t index)
+{
+    const size_t block_index = (index + me->start_index) / me->block_size;
+    const size_t inner_index = (index + me->start_index) % me->block_size;
+    if (index >= deque_size(me)) {
+        return NULL;
+    }
+    return me->data[block_index] + inner_index * me->data_size;
+}
+
 /**
  * Gets the last value of the deque. The pointer to the data being obtained
  * should point to the data type which this deque holds. For example, if this
@@ -621,19 +783,22 @@ bk_err deque_clear(deque me)
     size_t i;
     char *updated_block;
     char **updated_data =
-            malloc(BKTHOMPS_DEQUE_INITIAL_BLOCK_COUNT * sizeof(char *));
+            deque_allocate(&me->allocator,
+                           BKTHOMPS_DEQUE_INITIAL_BLOCK_COUNT * sizeof(char *));
+    BKTHOMPS_DEQUE_STAT(me, bytes_allocated,
+                        BKTHOMPS_DEQUE_INITIAL_BLOCK_COUNT * sizeof(char *));
     if (!updated_data) {
         return -BK_ENOMEM;
     }
-    updated_block = malloc(me->block_size * me->data_size);
+    updated_block = deque_allocate_block(me);
     if (!updated_block) {
-        free(updated_data);
+        deque_deallocate(&me->allocator, updated_data);
         return -BK_ENOMEM;
     }
     for (i = me->alloc_block_start; i <= me->alloc_block_end; i++) {
-        free(me->data[i]);
+        deque_deallocate(&me->allocator, me->data[i]);
     }
-    free(me->data);
+    deque_deallocate(&me->allocator, me->data);
     me->start_index = me->block_size * BKTHOMPS_DEQUE_INITIAL_BLOCK_COUNT / 2;
     me->end_index = me->start_index;
     me->block_count = BKTHOMPS_DEQUE_INITIAL_BLOCK_COUNT;
@@ -658,10 +823,10 @@ deque deque_destroy(deque me)
     if (me) {
         size_t i;
         for (i = me->alloc_block_start; i <= me->alloc_block_end; i++) {
-            free(me->data[i]);
+            deque_deallocate(&me->allocator, me->data[i]);
         }
-        free(me->data);
-        free(me);
+        deque_deallocate(&me->allocator, me->data);
+        deque_deallocate(&me->allocator, me);
     }
     return NULL;
 }
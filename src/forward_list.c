@@ -23,17 +23,77 @@
 #include <string.h>
 #include "include/forward_list.h"
 
+#define BKTHOMPS_FORWARD_LIST_POOL_SLAB_NODES 64
+
+/*
+ * A pool hands out nodes of one size. Nodes are carved out of slabs, and nodes
+ * which are given back are kept on a free list to be handed out again, so that
+ * the singly-linked list does not call the allocator for every insertion and
+ * removal. The slabs are only released when the singly-linked list is cleared
+ * or destroyed.
+ */
+struct forward_list_node_pool {
+    size_t node_size;
+    bk_bool in_use;
+    char *slabs;
+    char *free_nodes;
+};
+
+#ifdef BK_STATS
+#define BKTHOMPS_FORWARD_LIST_STAT(me, counter, amount) \
+    ((me)->stats.counter += (amount))
+#else
+#define BKTHOMPS_FORWARD_LIST_STAT(me, counter, amount) ((void) 0)
+#endif
+
 struct internal_forward_list {
     size_t bytes_per_item;
     size_t item_count;
     char *head;
     char *tail;
+    struct forward_list_node_pool nodes;
+#ifdef BK_STATS
+    struct bk_stats stats;
+#endif
+    struct bk_allocator allocator;
 };
 
 static const size_t ptr_size = sizeof(char *);
 static const size_t node_next_ptr_offset = 0;
 static const size_t node_data_ptr_offset = sizeof(char *);
 
+/*
+ * Used when the singly-linked list is initialized without an allocator. Its
+ * function pointers are all NULL, which means memory is managed by the standard
+ * library.
+ */
+static const struct bk_allocator forward_list_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the singly-linked list.
+ */
+static void *forward_list_allocate(const struct bk_allocator *const allocator,
+                                   const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Frees memory with the allocator of the singly-linked list.
+ */
+static void forward_list_deallocate(const struct bk_allocator *const allocator,
+                                    void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
 /**
  * Initializes a singly-linked list.
  *
@@ -44,18 +104,52 @@ static const size_t node_data_ptr_offset = sizeof(char *);
  *         memory allocation error
  */
 forward_list forward_list_init(const size_t data_size)
+{
+    return forward_list_init_with_allocator(data_size, NULL);
+}
+
+/**
+ * Initializes a singly-linked list, which manages its memory with the given
+ * allocator.
+ *
+ * @param data_size the size of data to store; must be positive
+ * @param allocator the allocator which manages the memory of the singly-linked
+ *                  list, or NULL to use the standard library; if not NULL, its
+ *                  allocate and deallocate functions must not be NULL
+ *
+ * @return the newly-initialized singly-linked list, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+forward_list
+forward_list_init_with_allocator(const size_t data_size,
+                                 const struct bk_allocator *allocator)
 {
     struct internal_forward_list *init;
     if (data_size == 0) {
         return NULL;
     }
+    if (!allocator) {
+        allocator = &forward_list_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
+        return NULL;
+    }
     if (node_data_ptr_offset + data_size < node_data_ptr_offset) {
         return NULL;
     }
-    init = malloc(sizeof *init);
+    init = forward_list_allocate(allocator, sizeof *init);
     if (!init) {
         return NULL;
     }
+    init->allocator = *allocator;
+#ifdef BK_STATS
+    memset(&init->stats, 0, sizeof init->stats);
+#endif
+    BKTHOMPS_FORWARD_LIST_STAT(init, bytes_allocated, sizeof *init);
+    init->nodes.node_size = node_data_ptr_offset + data_size;
+    init->nodes.in_use = BK_FALSE;
+    init->nodes.slabs = NULL;
+    init->nodes.free_nodes = NULL;
     init->bytes_per_item = data_size;
     init->item_count = 0;
     init->head = NULL;
@@ -87,6 +181,44 @@ bk_bool forward_list_is_empty(forward_list me)
     return forward_list_size(me) == 0;
 }
 
+/**
+ * Makes the singly-linked list allocate its nodes from a pool of slabs, rather
+ * than allocating each node individually. Removed nodes are kept by the pool to
+ * be reused, and the slabs are released all at once when the singly-linked list
+ * is cleared or destroyed. The pool may only be enabled while the singly-linked
+ * list is empty.
+ *
+ * @param me the singly-linked list to allocate nodes from a pool for
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_EINVAL if the singly-linked list is not empty
+ */
+bk_err forward_list_use_node_pool(forward_list me)
+{
+    if (!forward_list_is_empty(me)) {
+        return -BK_EINVAL;
+    }
+    me->nodes.in_use = BK_TRUE;
+    return BK_OK;
+}
+
+/**
+ * Gets the statistics of the singly-linked list. They are only tracked if the
+ * library is compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the singly-linked list to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void forward_list_get_stats(forward_list me, struct bk_stats *const stats)
+{
+#ifdef BK_STATS
+    *stats = me->stats;
+#else
+    (void) me;
+    memset(stats, 0, sizeof *stats);
+#endif
+}
+
 /**
  * Copies the nodes of the singly-linked list to an array. Since it is a copy,
  * the array may be modified without causing side effects to the singly-linked
@@ -110,6 +242,90 @@ void forward_list_copy_to_array(void *const arr, forward_list me)
     }
 }
 
+/*
+ * Adds a slab to the node pool, and puts all of its nodes on the free list.
+ * Each node starts on a pointer boundary.
+ */
+static bk_err forward_list_pool_grow(forward_list me,
+                                     struct forward_list_node_pool *const pool)
+{
+    size_t i;
+    char *slab;
+    const size_t stride =
+            (pool->node_size + ptr_size - 1) / ptr_size * ptr_size;
+    const size_t slab_nodes = BKTHOMPS_FORWARD_LIST_POOL_SLAB_NODES;
+    if (stride < pool->node_size
+        || stride > ((size_t) -1 - ptr_size) / slab_nodes) {
+        return -BK_ENOMEM;
+    }
+    BKTHOMPS_FORWARD_LIST_STAT(me, bytes_allocated,
+                               ptr_size + slab_nodes * stride);
+    slab = forward_list_allocate(&me->allocator,
+                                 ptr_size + slab_nodes * stride);
+    if (!slab) {
+        return -BK_ENOMEM;
+    }
+    memcpy(slab, &pool->slabs, ptr_size);
+    pool->slabs = slab;
+    for (i = slab_nodes; i > 0; i--) {
+        char *const node = slab + ptr_size + (i - 1) * stride;
+        memcpy(node, &pool->free_nodes, ptr_size);
+        pool->free_nodes = node;
+    }
+    return BK_OK;
+}
+
+/*
+ * Releases every slab of the node pool at once. All the nodes of the pool must
+ * no longer be in use.
+ */
+static void forward_list_pool_release(forward_list me,
+                                      struct forward_list_node_pool *const pool)
+{
+    while (pool->slabs) {
+        char *const slab = pool->slabs;
+        memcpy(&pool->slabs, slab, ptr_size);
+        forward_list_deallocate(&me->allocator, slab);
+    }
+    pool->free_nodes = NULL;
+}
+
+/*
+ * Allocates a node, taking it from the node pool if the pool is in use.
+ */
+static char *
+forward_list_node_allocate(forward_list me,
+                           struct forward_list_node_pool *const pool)
+{
+    char *node;
+    if (!pool->in_use) {
+        BKTHOMPS_FORWARD_LIST_STAT(me, bytes_allocated, pool->node_size);
+        return forward_list_allocate(&me->allocator, pool->node_size);
+    }
+    if (!pool->free_nodes && forward_list_pool_grow(me, pool) != BK_OK) {
+        return NULL;
+    }
+    node = pool->free_nodes;
+    memcpy(&pool->free_nodes, node, ptr_size);
+    return node;
+}
+
+/*
+ * Frees a node, giving it back to the node pool if the pool is in use.
+ */
+static void
+forward_list_node_deallocate(forward_list me,
+                             struct forward_list_node_pool *const pool,
+                             char *const node)
+{
+    if (!pool->in_use) {
+        forward_list_deallocate(&me->allocator, node);
+        return;
+    }
+    memcpy(node, &pool->free_nodes, ptr_size);
+    pool->free_nodes = node;
+}
+
 /**
  * Copies elements from an array to the singly-linked list. The size specifies
  * the number of elements to copy, starting from the beginning of the array. The
@@ -134,21 +350,21 @@ bk_err forward_list_add_all(forward_list me, void *const arr, const size_t size)
     if (size + me->item_count < size) {
         return -BK_ERANGE;
     }
-    traverse = malloc(ptr_size + me->bytes_per_item);
+    traverse = forward_list_node_allocate(me, &me->nodes);
     if (!traverse) {
         return -BK_ENOMEM;
     }
     traverse_head = traverse;
     memcpy(traverse + node_data_ptr_offset, arr, me->bytes_per_item);
     for (i = 1; i < size; i++) {
-        char *node = malloc(ptr_size + me->bytes_per_item);
+        char *node = forward_list_node_allocate(me, &me->nodes);
         if (!node) {
             memset(traverse + node_next_ptr_offset, 0, ptr_size);
             while (traverse_head) {
                 char *backup = traverse_head;
                 memcpy(&traverse_head, traverse_head + node_next_ptr_offset,
                        ptr_size);
-                free(backup);
+                forward_list_node_deallocate(me, &me->nodes, backup);
             }
             return -BK_ENOMEM;
         }
@@ -236,7 +452,7 @@ bk_err forward_list_add_at(forward_list me, const size_t index,
     if (index > me->item_count) {
         return -BK_EINVAL;
     }
-    node = malloc(ptr_size + me->bytes_per_item);
+    node = forward_list_node_allocate(me, &me->nodes);
     if (!node) {
         return -BK_ENOMEM;
     }
@@ -310,7 +526,7 @@ bk_err forward_list_remove_at(forward_list me, const size_t index)
         if (!me->head) {
             me->tail = NULL;
         }
-        free(temp);
+        forward_list_node_deallocate(me, &me->nodes, temp);
     } else {
         char *traverse = forward_list_get_node_at(me, index - 1);
         char *backup;
@@ -322,7 +538,7 @@ bk_err forward_list_remove_at(forward_list me, const size_t index)
         if (!backup_next) {
             me->tail = NULL;
         }
-        free(backup);
+        forward_list_node_deallocate(me, &me->nodes, backup);
     }
     me->item_count--;
     return BK_OK;
@@ -476,10 +692,14 @@ bk_err forward_list_get_last(void *const data, forward_list me)
 void forward_list_clear(forward_list me)
 {
     char *traverse = me->head;
-    while (traverse) {
-        char *temp = traverse;
-        memcpy(&traverse, traverse + node_next_ptr_offset, ptr_size);
-        free(temp);
+    if (me->nodes.in_use) {
+        forward_list_pool_release(me, &me->nodes);
+    } else {
+        while (traverse) {
+            char *temp = traverse;
+            memcpy(&traverse, traverse + node_next_ptr_offset, ptr_size);
+            forward_list_deallocate(&me->allocator, temp);
+        }
     }
     me->head = NULL;
     me->tail = NULL;
@@ -499,7 +719,7 @@ forward_list forward_list_destroy(forward_list me)
 {
     if (me) {
         forward_list_clear(me);
-        free(me);
+        forward_list_deallocate(&me->allocator, me);
     }
     return NULL;
 }
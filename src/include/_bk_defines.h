@@ -41,4 +41,58 @@
 typedef int bk_err;
 typedef int bk_bool;
 
+/**
+ * A memory allocator which a container may be initialized with, instead of
+ * using the standard library. The context is passed back unchanged as the
+ * first argument of every call. The allocate and deallocate functions must be
+ * set. The reallocate function may be NULL, in which case memory is resized by
+ * allocating a new block, copying the data, and deallocating the old block.
+ */
+struct bk_allocator {
+    void *(*allocate)(void *context, size_t size);
+    void *(*reallocate)(void *context, void *ptr, size_t size);
+    void (*deallocate)(void *context, void *ptr);
+    void *context;
+};
+
+/**
+ * Counters of the work which a container has done since it was initialized.
+ * They are only tracked when the library is compiled with BK_STATS defined,
+ * otherwise they stay zero. Counters which do not apply to a container also
+ * stay zero. The resizes count how often the storage grew or shrank, and the
+ * rehashes how often a hash table moved its entries into a new table. The
+ * probes count the groups of slots which lookups scanned, and longest_probe is
+ * the most groups which a single lookup scanned. The block allocations count
+ * the blocks of a deque, and bytes_allocated is the total of every request made
+ * to the allocator. The counters are unsigned long, which is only 32 bits on
+ * some platforms, such as 64-bit Windows, so there they wrap around after 2^32.
+ */
+struct bk_stats {
+    unsigned long resizes;
+    unsigned long rehashes;
+    unsigned long comparator_calls;
+    unsigned long hash_calls;
+    unsigned long probes;
+    unsigned long longest_probe;
+    unsigned long rotations;
+    unsigned long block_allocations;
+    unsigned long bytes_allocated;
+};
+
+#define BK_PROBE_HISTOGRAM_BUCKETS 16
+
+/**
+ * How the slots of a hash table are occupied, and how many groups of slots a
+ * lookup of each entry scans before finding it. The count at index i is the
+ * number of entries which are in group i + 1 of their probe sequence, except
+ * that the last count also includes every entry which is further away.
+ */
+struct bk_probe_histogram {
+    size_t capacity;
+    size_t full;
+    size_t longest_probe;
+    double average_probe;
+    size_t counts[BK_PROBE_HISTOGRAM_BUCKETS];
+};
+
 #endif /* BKTHOMPS_CONTAINERS_BK_DEFINES_H */
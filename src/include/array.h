@@ -32,6 +32,8 @@ typedef char *array;
 
 /* Starting */
 array array_init(size_t element_count, size_t data_size);
+array array_init_with_allocator(size_t element_count, size_t data_size,
+                                  const struct bk_allocator *allocator);
 
 /* Utility */
 size_t array_size(array me);
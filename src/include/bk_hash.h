@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2017-2025 Bailey Thompson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BKTHOMPS_CONTAINERS_BK_HASH_H
+#define BKTHOMPS_CONTAINERS_BK_HASH_H
+
+#include "_bk_defines.h"
+
+/*
+ * Built-in hash functions, which may be passed to the unordered containers.
+ * Each one is well distributed in every bit, and is as wide as unsigned long.
+ */
+
+unsigned long bk_hash_bytes(const void *const key, size_t size);
+unsigned long bk_hash_int32(const void *const key);
+unsigned long bk_hash_int64(const void *const key);
+unsigned long bk_hash_string(const void *const key);
+
+#endif /* BKTHOMPS_CONTAINERS_BK_HASH_H */
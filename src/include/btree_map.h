@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2017-2025 Bailey Thompson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BKTHOMPS_CONTAINERS_BTREE_MAP_H
+#define BKTHOMPS_CONTAINERS_BTREE_MAP_H
+
+#include "_bk_defines.h"
+
+/**
+ * The btree_map data structure, which is a collection of key-value pairs,
+ * sorted by keys, keys are unique. The keys are kept side by side in the nodes
+ * of a B+ tree, so the tree is shallow and each node is searched in one go.
+ */
+typedef struct internal_btree_map *btree_map;
+
+/**
+ * An in-order iterator over the key-value pairs of a btree_map, which is set up
+ * by one of the btree_map_iter_init functions; its fields should not be used
+ * directly
+ */
+struct btree_map_iter {
+    btree_map map;
+    char *leaf;
+    size_t index;
+};
+
+/* Starting */
+btree_map btree_map_init(size_t key_size, size_t value_size,
+                         int (*comparator)(const void *const one,
+                                           const void *const two));
+btree_map btree_map_init_ex(size_t key_size, size_t value_size,
+                            int (*comparator)(const void *const one,
+                                              const void *const two),
+                            size_t node_size,
+                            const struct bk_allocator *allocator);
+
+/* Capacity */
+size_t btree_map_size(btree_map me);
+bk_bool btree_map_is_empty(btree_map me);
+
+/* Accessing */
+bk_err btree_map_put(btree_map me, void *key, void *value);
+bk_bool btree_map_get(void *value, btree_map me, void *key);
+void *btree_map_get_ptr(btree_map me, void *key);
+bk_bool btree_map_contains(btree_map me, void *key);
+bk_bool btree_map_remove(btree_map me, void *key);
+
+/* Retrieval */
+void *btree_map_first(btree_map me);
+void *btree_map_last(btree_map me);
+void *btree_map_lower(btree_map me, void *key);
+void *btree_map_higher(btree_map me, void *key);
+void *btree_map_floor(btree_map me, void *key);
+void *btree_map_ceiling(btree_map me, void *key);
+
+/* Iterating */
+void btree_map_iter_init(struct btree_map_iter *iter, btree_map me);
+void btree_map_iter_init_at(struct btree_map_iter *iter, btree_map me,
+                            void *key);
+bk_bool btree_map_iter_next(void **key, void **value,
+                            struct btree_map_iter *iter);
+
+/* Ending */
+void btree_map_clear(btree_map me);
+btree_map btree_map_destroy(btree_map me);
+
+#endif /* BKTHOMPS_CONTAINERS_BTREE_MAP_H */
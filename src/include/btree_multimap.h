@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2017-2025 Bailey Thompson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BKTHOMPS_CONTAINERS_BTREE_MULTIMAP_H
+#define BKTHOMPS_CONTAINERS_BTREE_MULTIMAP_H
+
+#include "_bk_defines.h"
+
+/**
+ * The btree_multimap data structure, which is a collection of key-value pairs,
+ * sorted by keys and then by values. Each distinct key-value pair is kept once
+ * along with how many times it occurs, and the pairs are kept side by side in
+ * the nodes of a B+ tree, so the tree is shallow and each node is searched in
+ * one go. Unlike the value comparator of a multimap, which only tests values
+ * for equality, the value ordering must be a strict ordering of the values.
+ * The values of a key come in that order rather than in the order in which
+ * they were put, and pairs which both comparators find equal are merged.
+ */
+typedef struct internal_btree_multimap *btree_multimap;
+
+/**
+ * An in-order iterator over the key-value pairs of a btree_multimap, which is
+ * set up by one of the btree_multimap_iter_init functions; its fields should
+ * not be used directly
+ */
+struct btree_multimap_iter {
+    btree_multimap map;
+    char *leaf;
+    size_t index;
+    size_t occurrence;
+};
+
+/* Starting */
+btree_multimap
+btree_multimap_init(size_t key_size, size_t value_size,
+                    int (*key_comparator)(const void *const one,
+                                          const void *const two),
+                    int (*value_ordering)(const void *const one,
+                                          const void *const two));
+btree_multimap
+btree_multimap_init_ex(size_t key_size, size_t value_size,
+                       int (*key_comparator)(const void *const one,
+                                             const void *const two),
+                       int (*value_ordering)(const void *const one,
+                                             const void *const two),
+                       size_t node_size, const struct bk_allocator *allocator);
+
+/* Capacity */
+size_t btree_multimap_size(btree_multimap me);
+bk_bool btree_multimap_is_empty(btree_multimap me);
+
+/* Accessing */
+bk_err btree_multimap_put(btree_multimap me, void *key, void *value);
+void btree_multimap_get_start(btree_multimap me, void *key);
+bk_bool btree_multimap_get_next(void *value, btree_multimap me);
+size_t btree_multimap_count(btree_multimap me, void *key);
+bk_bool btree_multimap_contains(btree_multimap me, void *key);
+bk_bool btree_multimap_remove(btree_multimap me, void *key, void *value);
+bk_bool btree_multimap_remove_all(btree_multimap me, void *key);
+
+/* Retrieval */
+void *btree_multimap_first(btree_multimap me);
+void *btree_multimap_last(btree_multimap me);
+void *btree_multimap_lower(btree_multimap me, void *key);
+void *btree_multimap_higher(btree_multimap me, void *key);
+void *btree_multimap_floor(btree_multimap me, void *key);
+void *btree_multimap_ceiling(btree_multimap me, void *key);
+
+/* Iterating */
+void btree_multimap_iter_init(struct btree_multimap_iter *iter,
+                              btree_multimap me);
+void btree_multimap_iter_init_at(struct btree_multimap_iter *iter,
+                                 btree_multimap me, void *key);
+bk_bool btree_multimap_iter_next(void **key, void **value,
+                                 struct btree_multimap_iter *iter);
+
+/* Ending */
+void btree_multimap_clear(btree_multimap me);
+btree_multimap btree_multimap_destroy(btree_multimap me);
+
+#endif /* BKTHOMPS_CONTAINERS_BTREE_MULTIMAP_H */
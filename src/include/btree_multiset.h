@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2017-2025 Bailey Thompson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BKTHOMPS_CONTAINERS_BTREE_MULTISET_H
+#define BKTHOMPS_CONTAINERS_BTREE_MULTISET_H
+
+#include "_bk_defines.h"
+
+/**
+ * The btree_multiset data structure, which is a collection of keys, sorted by
+ * keys. Each distinct key is kept once along with how many times it occurs, and
+ * the keys are kept side by side in the nodes of a B+ tree, so the tree is
+ * shallow and each node is searched in one go.
+ */
+typedef struct internal_btree_multiset *btree_multiset;
+
+/**
+ * An in-order iterator over the keys of a btree_multiset, which is set up by
+ * one of the btree_multiset_iter_init functions; its fields should not be used
+ * directly
+ */
+struct btree_multiset_iter {
+    btree_multiset set;
+    char *leaf;
+    size_t index;
+};
+
+/* Starting */
+btree_multiset btree_multiset_init(size_t key_size,
+                                   int (*comparator)(const void *const one,
+                                                     const void *const two));
+btree_multiset
+btree_multiset_init_ex(size_t key_size,
+                       int (*comparator)(const void *const one,
+                                         const void *const two),
+                       size_t node_size, const struct bk_allocator *allocator);
+
+/* Capacity */
+size_t btree_multiset_size(btree_multiset me);
+bk_bool btree_multiset_is_empty(btree_multiset me);
+
+/* Accessing */
+bk_err btree_multiset_put(btree_multiset me, void *key);
+size_t btree_multiset_count(btree_multiset me, void *key);
+bk_bool btree_multiset_contains(btree_multiset me, void *key);
+bk_bool btree_multiset_remove(btree_multiset me, void *key);
+bk_bool btree_multiset_remove_all(btree_multiset me, void *key);
+
+/* Retrieval */
+void *btree_multiset_first(btree_multiset me);
+void *btree_multiset_last(btree_multiset me);
+void *btree_multiset_lower(btree_multiset me, void *key);
+void *btree_multiset_higher(btree_multiset me, void *key);
+void *btree_multiset_floor(btree_multiset me, void *key);
+void *btree_multiset_ceiling(btree_multiset me, void *key);
+
+/* Iterating */
+void btree_multiset_iter_init(struct btree_multiset_iter *iter,
+                              btree_multiset me);
+void btree_multiset_iter_init_at(struct btree_multiset_iter *iter,
+                                 btree_multiset me, void *key);
+bk_bool btree_multiset_iter_next(void **key, size_t *count,
+                                 struct btree_multiset_iter *iter);
+
+/* Ending */
+void btree_multiset_clear(btree_multiset me);
+btree_multiset btree_multiset_destroy(btree_multiset me);
+
+#endif /* BKTHOMPS_CONTAINERS_BTREE_MULTISET_H */
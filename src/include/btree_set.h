@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2017-2025 Bailey Thompson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BKTHOMPS_CONTAINERS_BTREE_SET_H
+#define BKTHOMPS_CONTAINERS_BTREE_SET_H
+
+#include "_bk_defines.h"
+
+/**
+ * The btree_set data structure, which is a collection of unique keys, sorted by
+ * keys. The keys are kept side by side in the nodes of a B+ tree, so the tree
+ * is shallow and each node is searched in one go.
+ */
+typedef struct internal_btree_set *btree_set;
+
+/**
+ * An in-order iterator over the keys of a btree_set, which is set up by one of
+ * the btree_set_iter_init functions; its fields should not be used directly
+ */
+struct btree_set_iter {
+    btree_set set;
+    char *leaf;
+    size_t index;
+};
+
+/* Starting */
+btree_set btree_set_init(size_t key_size,
+                         int (*comparator)(const void *const one,
+                                           const void *const two));
+btree_set btree_set_init_ex(size_t key_size,
+                            int (*comparator)(const void *const one,
+                                              const void *const two),
+                            size_t node_size,
+                            const struct bk_allocator *allocator);
+
+/* Capacity */
+size_t btree_set_size(btree_set me);
+bk_bool btree_set_is_empty(btree_set me);
+
+/* Accessing */
+bk_err btree_set_put(btree_set me, void *key);
+bk_bool btree_set_contains(btree_set me, void *key);
+bk_bool btree_set_remove(btree_set me, void *key);
+
+/* Retrieval */
+void *btree_set_first(btree_set me);
+void *btree_set_last(btree_set me);
+void *btree_set_lower(btree_set me, void *key);
+void *btree_set_higher(btree_set me, void *key);
+void *btree_set_floor(btree_set me, void *key);
+void *btree_set_ceiling(btree_set me, void *key);
+
+/* Iterating */
+void btree_set_iter_init(struct btree_set_iter *iter, btree_set me);
+void btree_set_iter_init_at(struct btree_set_iter *iter, btree_set me,
+                            void *key);
+bk_bool btree_set_iter_next(void **key, struct btree_set_iter *iter);
+
+/* Ending */
+void btree_set_clear(btree_set me);
+btree_set btree_set_destroy(btree_set me);
+
+#endif /* BKTHOMPS_CONTAINERS_BTREE_SET_H */
@@ -32,10 +32,13 @@ typedef struct internal_deque *deque;
 
 /* Starting */
 deque deque_init(size_t data_size);
+deque deque_init_with_allocator(size_t data_size,
+                                const struct bk_allocator *allocator);
 
 /* Utility */
 size_t deque_size(deque me);
 bk_bool deque_is_empty(deque me);
+void deque_get_stats(deque me, struct bk_stats *stats);
 bk_err deque_trim(deque me);
 void deque_copy_to_array(void *arr, deque me);
 bk_err deque_add_all(deque me, void *arr, size_t size);
@@ -56,6 +59,7 @@ bk_err deque_set_last(deque me, void *data);
 /* Getting */
 bk_err deque_get_first(void *data, deque me);
 bk_err deque_get_at(void *data, deque me, size_t index);
+void *deque_get_at_ptr(deque me, size_t index);
 bk_err deque_get_last(void *data, deque me);
 
 /* Ending */
@@ -32,10 +32,15 @@ typedef struct internal_forward_list *forward_list;
 
 /* Starting */
 forward_list forward_list_init(size_t data_size);
+forward_list
+forward_list_init_with_allocator(size_t data_size,
+                                 const struct bk_allocator *allocator);
 
 /* Utility */
 size_t forward_list_size(forward_list me);
 bk_bool forward_list_is_empty(forward_list me);
+bk_err forward_list_use_node_pool(forward_list me);
+void forward_list_get_stats(forward_list me, struct bk_stats *stats);
 void forward_list_copy_to_array(void *arr, forward_list me);
 bk_err forward_list_add_all(forward_list me, void *arr, size_t size);
 
@@ -32,10 +32,14 @@ typedef struct internal_list *list;
 
 /* Starting */
 list list_init(size_t data_size);
+list list_init_with_allocator(size_t data_size,
+                              const struct bk_allocator *allocator);
 
 /* Utility */
 size_t list_size(list me);
 bk_bool list_is_empty(list me);
+bk_err list_use_node_pool(list me);
+void list_get_stats(list me, struct bk_stats *stats);
 void list_copy_to_array(void *arr, list me);
 bk_err list_add_all(list me, void *arr, size_t size);
 
@@ -57,6 +61,7 @@ bk_err list_set_last(list me, void *data);
 /* Getting */
 bk_err list_get_first(void *data, list me);
 bk_err list_get_at(void *data, list me, size_t index);
+void *list_get_at_ptr(list me, size_t index);
 bk_err list_get_last(void *data, list me);
 
 /* Ending */
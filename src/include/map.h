@@ -31,17 +31,40 @@
  */
 typedef struct internal_map *map;
 
+/**
+ * An in-order iterator over the key-value pairs of a map, which is set up by
+ * one of the map_iter_init functions; its fields should not be used directly
+ */
+struct map_iter {
+    map map;
+    char *node;
+};
+
 /* Starting */
 map map_init(size_t key_size, size_t value_size,
              int (*comparator)(const void *const one, const void *const two));
+map map_init_with_allocator(size_t key_size, size_t value_size,
+                            int (*comparator)(const void *const one,
+                                              const void *const two),
+                            const struct bk_allocator *allocator);
+map map_init_pod(size_t key_size, size_t value_size);
+map map_init_from_sorted(size_t key_size, size_t value_size,
+                         int (*comparator)(const void *const one,
+                                           const void *const two),
+                         const void *keys, const void *values, size_t count);
 
 /* Capacity */
 size_t map_size(map me);
 bk_bool map_is_empty(map me);
+bk_err map_use_node_pool(map me);
+bk_err map_use_order_statistics(map me);
+void map_get_stats(map me, struct bk_stats *stats);
 
 /* Accessing */
 bk_err map_put(map me, void *key, void *value);
+void *map_emplace(map me, void *key, bk_bool *inserted);
 bk_bool map_get(void *value, map me, void *key);
+void *map_get_ptr(map me, void *key);
 bk_bool map_contains(map me, void *key);
 bk_bool map_remove(map me, void *key);
 
@@ -52,6 +75,19 @@ void *map_lower(map me, void *key);
 void *map_higher(map me, void *key);
 void *map_floor(map me, void *key);
 void *map_ceiling(map me, void *key);
+void *map_select(map me, size_t index);
+size_t map_rank(map me, void *key);
+
+/* Iterating */
+void map_iter_init(struct map_iter *iter, map me);
+void map_iter_init_last(struct map_iter *iter, map me);
+void map_iter_init_at(struct map_iter *iter, map me, void *key);
+bk_bool map_iter_next(void **key, void **value, struct map_iter *iter);
+bk_bool map_iter_prev(void **key, void **value, struct map_iter *iter);
+void map_range(map me, void *low, void *high,
+               void (*callback)(const void *const key, void *const value,
+                                void *const context),
+               void *context);
 
 /* Ending */
 void map_clear(map me);
@@ -31,16 +31,43 @@
  */
 typedef struct internal_multimap *multimap;
 
+/**
+ * An in-order iterator over the key-value pairs of a multi-map, which is set up
+ * by one of the multimap_iter_init functions; its fields should not be used
+ * directly
+ */
+struct multimap_iter {
+    multimap map;
+    char *node;
+    char *value_node;
+};
+
 /* Starting */
 multimap multimap_init(size_t key_size, size_t value_size,
                        int (*key_comparator)(const void *const one,
                                              const void *const two),
                        int (*value_comparator)(const void *const one,
                                                const void *const two));
+multimap
+multimap_init_with_allocator(size_t key_size, size_t value_size,
+                             int (*key_comparator)(const void *const one,
+                                                   const void *const two),
+                             int (*value_comparator)(const void *const one,
+                                                     const void *const two),
+                             const struct bk_allocator *allocator);
+multimap
+multimap_init_from_sorted(size_t key_size, size_t value_size,
+                          int (*key_comparator)(const void *const one,
+                                                const void *const two),
+                          int (*value_comparator)(const void *const one,
+                                                  const void *const two),
+                          const void *keys, const void *values, size_t count);
 
 /* Capacity */
 size_t multimap_size(multimap me);
 bk_bool multimap_is_empty(multimap me);
+bk_err multimap_use_node_pool(multimap me);
+void multimap_get_stats(multimap me, struct bk_stats *stats);
 
 /* Accessing */
 bk_err multimap_put(multimap me, void *key, void *value);
@@ -59,6 +86,19 @@ void *multimap_higher(multimap me, void *key);
 void *multimap_floor(multimap me, void *key);
 void *multimap_ceiling(multimap me, void *key);
 
+/* Iterating */
+void multimap_iter_init(struct multimap_iter *iter, multimap me);
+void multimap_iter_init_last(struct multimap_iter *iter, multimap me);
+void multimap_iter_init_at(struct multimap_iter *iter, multimap me, void *key);
+bk_bool multimap_iter_next(void **key, void **value,
+                           struct multimap_iter *iter);
+bk_bool multimap_iter_prev(void **key, void **value,
+                           struct multimap_iter *iter);
+void multimap_range(multimap me, void *low, void *high,
+                    void (*callback)(const void *const key, void *const value,
+                                     void *const context),
+                    void *context);
+
 /* Ending */
 void multimap_clear(multimap me);
 multimap multimap_destroy(multimap me);
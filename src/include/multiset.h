@@ -31,14 +31,35 @@
  */
 typedef struct internal_multiset *multiset;
 
+/**
+ * An in-order iterator over the keys of a multi-set, which is set up by one of
+ * the multiset_iter_init functions; its fields should not be used directly
+ */
+struct multiset_iter {
+    multiset set;
+    char *node;
+};
+
 /* Starting */
 multiset multiset_init(size_t key_size,
                        int (*comparator)(const void *const one,
                                          const void *const two));
+multiset
+multiset_init_with_allocator(size_t key_size,
+                             int (*comparator)(const void *const one,
+                                               const void *const two),
+                             const struct bk_allocator *allocator);
+multiset multiset_init_from_sorted(size_t key_size,
+                                   int (*comparator)(const void *const one,
+                                                     const void *const two),
+                                   const void *keys, size_t count);
 
 /* Capacity */
 size_t multiset_size(multiset me);
 bk_bool multiset_is_empty(multiset me);
+bk_err multiset_use_node_pool(multiset me);
+bk_err multiset_use_order_statistics(multiset me);
+void multiset_get_stats(multiset me, struct bk_stats *stats);
 
 /* Accessing */
 bk_err multiset_put(multiset me, void *key);
@@ -54,6 +75,21 @@ void *multiset_lower(multiset me, void *key);
 void *multiset_higher(multiset me, void *key);
 void *multiset_floor(multiset me, void *key);
 void *multiset_ceiling(multiset me, void *key);
+void *multiset_select(multiset me, size_t index);
+size_t multiset_rank(multiset me, void *key);
+
+/* Iterating */
+void multiset_iter_init(struct multiset_iter *iter, multiset me);
+void multiset_iter_init_last(struct multiset_iter *iter, multiset me);
+void multiset_iter_init_at(struct multiset_iter *iter, multiset me, void *key);
+bk_bool multiset_iter_next(void **key, size_t *count,
+                           struct multiset_iter *iter);
+bk_bool multiset_iter_prev(void **key, size_t *count,
+                           struct multiset_iter *iter);
+void multiset_range(multiset me, void *low, void *high,
+                    void (*callback)(const void *const key, const size_t count,
+                                     void *const context),
+                    void *context);
 
 /* Ending */
 void multiset_clear(multiset me);
@@ -35,10 +35,16 @@ typedef struct internal_priority_queue *priority_queue;
 priority_queue priority_queue_init(size_t data_size,
                                    int (*comparator)(const void *const one,
                                                      const void *const two));
+priority_queue
+priority_queue_init_with_allocator(size_t data_size,
+                                   int (*comparator)(const void *const one,
+                                                     const void *const two),
+                                   const struct bk_allocator *allocator);
 
 /* Utility */
 size_t priority_queue_size(priority_queue me);
 bk_bool priority_queue_is_empty(priority_queue me);
+void priority_queue_get_stats(priority_queue me, struct bk_stats *stats);
 
 /* Adding */
 bk_err priority_queue_push(priority_queue me, void *data);
@@ -33,10 +33,13 @@ typedef struct internal_deque *queue;
 
 /* Starting */
 queue queue_init(size_t data_size);
+queue queue_init_with_allocator(size_t data_size,
+                                const struct bk_allocator *allocator);
 
 /* Utility */
 size_t queue_size(queue me);
 bk_bool queue_is_empty(queue me);
+void queue_get_stats(queue me, struct bk_stats *stats);
 bk_err queue_trim(queue me);
 void queue_copy_to_array(void *arr, queue me);
 
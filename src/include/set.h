@@ -30,13 +30,34 @@
  */
 typedef struct internal_set *set;
 
+/**
+ * An in-order iterator over the keys of a set, which is set up by one of the
+ * set_iter_init functions; its fields should not be used directly
+ */
+struct set_iter {
+    set set;
+    char *node;
+};
+
 /* Starting */
 set set_init(size_t key_size,
              int (*comparator)(const void *const one, const void *const two));
+set set_init_with_allocator(size_t key_size,
+                            int (*comparator)(const void *const one,
+                                              const void *const two),
+                            const struct bk_allocator *allocator);
+set set_init_pod(size_t key_size);
+set set_init_from_sorted(size_t key_size,
+                         int (*comparator)(const void *const one,
+                                           const void *const two),
+                         const void *keys, size_t count);
 
 /* Capacity */
 size_t set_size(set me);
 bk_bool set_is_empty(set me);
+bk_err set_use_node_pool(set me);
+bk_err set_use_order_statistics(set me);
+void set_get_stats(set me, struct bk_stats *stats);
 
 /* Accessing */
 bk_err set_put(set me, void *key);
@@ -50,6 +71,18 @@ void *set_lower(set me, void *key);
 void *set_higher(set me, void *key);
 void *set_floor(set me, void *key);
 void *set_ceiling(set me, void *key);
+void *set_select(set me, size_t index);
+size_t set_rank(set me, void *key);
+
+/* Iterating */
+void set_iter_init(struct set_iter *iter, set me);
+void set_iter_init_last(struct set_iter *iter, set me);
+void set_iter_init_at(struct set_iter *iter, set me, void *key);
+bk_bool set_iter_next(void **key, struct set_iter *iter);
+bk_bool set_iter_prev(void **key, struct set_iter *iter);
+void set_range(set me, void *low, void *high,
+               void (*callback)(const void *const key, void *const context),
+               void *context);
 
 /* Ending */
 void set_clear(set me);
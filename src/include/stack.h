@@ -33,10 +33,13 @@ typedef struct internal_deque *stack;
 
 /* Starting */
 stack stack_init(size_t data_size);
+stack stack_init_with_allocator(size_t data_size,
+                                const struct bk_allocator *allocator);
 
 /* Utility */
 size_t stack_size(stack me);
 bk_bool stack_is_empty(stack me);
+void stack_get_stats(stack me, struct bk_stats *stats);
 bk_err stack_trim(stack me);
 void stack_copy_to_array(void *arr, stack me);
 
@@ -31,24 +31,72 @@
  */
 typedef struct internal_unordered_map *unordered_map;
 
+/**
+ * An iterator over the key-value pairs of an unordered map, which is set up by
+ * unordered_map_iter_init; its fields should not be used directly
+ */
+struct unordered_map_iter {
+    unordered_map map;
+    size_t index;
+    bk_bool in_old_table;
+};
+
 /* Starting */
 unordered_map unordered_map_init(size_t key_size,
                                  size_t value_size,
                                  unsigned long (*hash)(const void *const key),
                                  int (*comparator)(const void *const one,
                                                    const void *const two));
+unordered_map
+unordered_map_init_with_allocator(size_t key_size,
+                                  size_t value_size,
+                                  unsigned long (*hash)(const void *const key),
+                                  int (*comparator)(const void *const one,
+                                                    const void *const two),
+                                  const struct bk_allocator *allocator);
+unordered_map
+unordered_map_init_ex(size_t key_size, size_t value_size,
+                      unsigned long (*hash)(const void *const key),
+                      int (*comparator)(const void *const one,
+                                        const void *const two),
+                      size_t expected_count, double max_load_factor,
+                      double growth_factor);
 
 /* Utility */
 bk_err unordered_map_rehash(unordered_map me);
+bk_err unordered_map_reserve(unordered_map me, size_t count);
+void unordered_map_set_incremental_rehash(unordered_map me,
+                                          bk_bool incremental);
 size_t unordered_map_size(unordered_map me);
 bk_bool unordered_map_is_empty(unordered_map me);
+void unordered_map_get_stats(unordered_map me, struct bk_stats *stats);
+void unordered_map_probe_histogram(unordered_map me,
+                                   struct bk_probe_histogram *histogram);
 
 /* Accessing */
 bk_err unordered_map_put(unordered_map me, void *key, void *value);
+void *unordered_map_emplace(unordered_map me, void *key, bk_bool *inserted);
+bk_err unordered_map_put_batch(unordered_map me, void *keys, void *values,
+                               size_t count);
+bk_err unordered_map_put_all(unordered_map me, void *keys, void *values,
+                             size_t count);
 bk_bool unordered_map_get(void *value, unordered_map me, void *key);
+void *unordered_map_get_ptr(unordered_map me, void *key);
+size_t unordered_map_get_batch(void *values, bk_bool *found, unordered_map me,
+                               void *keys, size_t count);
 bk_bool unordered_map_contains(unordered_map me, void *key);
 bk_bool unordered_map_remove(unordered_map me, void *key);
 
+/* Iterating */
+void unordered_map_iter_init(struct unordered_map_iter *iter, unordered_map me);
+bk_bool unordered_map_iter_next(void **key, void **value,
+                                struct unordered_map_iter *iter);
+void unordered_map_for_each(unordered_map me,
+                            void (*callback)(const void *const key,
+                                             void *const value,
+                                             void *const context),
+                            void *context);
+
 /* Ending */
 bk_err unordered_map_clear(unordered_map me);
 unordered_map unordered_map_destroy(unordered_map me);
@@ -40,11 +40,37 @@ unordered_multimap_init(size_t key_size,
                                               const void *const two),
                         int (*value_comparator)(const void *const one,
                                                 const void *const two));
+unordered_multimap
+unordered_multimap_init_with_allocator(size_t key_size,
+                                       size_t value_size,
+                                       unsigned long (*hash)(
+                                               const void *const key),
+                                       int (*key_comparator)(
+                                               const void *const one,
+                                               const void *const two),
+                                       int (*value_comparator)(
+                                               const void *const one,
+                                               const void *const two),
+                                       const struct bk_allocator *allocator);
+unordered_multimap
+unordered_multimap_init_ex(size_t key_size, size_t value_size,
+                           unsigned long (*hash)(const void *const key),
+                           int (*key_comparator)(const void *const one,
+                                                 const void *const two),
+                           int (*value_comparator)(const void *const one,
+                                                   const void *const two),
+                           size_t expected_count, double max_load_factor,
+                           double growth_factor);
 
 /* Utility */
 bk_err unordered_multimap_rehash(unordered_multimap me);
+bk_err unordered_multimap_reserve(unordered_multimap me, size_t count);
 size_t unordered_multimap_size(unordered_multimap me);
 bk_bool unordered_multimap_is_empty(unordered_multimap me);
+void unordered_multimap_get_stats(unordered_multimap me,
+                                  struct bk_stats *stats);
+void unordered_multimap_probe_histogram(unordered_multimap me,
+                                        struct bk_probe_histogram *histogram);
 
 /* Accessing */
 bk_err unordered_multimap_put(unordered_multimap me, void *key, void *value);
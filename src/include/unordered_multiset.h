@@ -37,11 +37,30 @@ unordered_multiset_init(size_t key_size,
                         unsigned long (*hash)(const void *const key),
                         int (*comparator)(const void *const one,
                                           const void *const two));
+unordered_multiset
+unordered_multiset_init_with_allocator(size_t key_size,
+                                       unsigned long (*hash)(
+                                               const void *const key),
+                                       int (*comparator)(const void *const one,
+                                                         const void *const two),
+                                       const struct bk_allocator *allocator);
+unordered_multiset
+unordered_multiset_init_ex(size_t key_size,
+                           unsigned long (*hash)(const void *const key),
+                           int (*comparator)(const void *const one,
+                                             const void *const two),
+                           size_t expected_count, double max_load_factor,
+                           double growth_factor);
 
 /* Utility */
 bk_err unordered_multiset_rehash(unordered_multiset me);
+bk_err unordered_multiset_reserve(unordered_multiset me, size_t count);
 size_t unordered_multiset_size(unordered_multiset me);
 bk_bool unordered_multiset_is_empty(unordered_multiset me);
+void unordered_multiset_get_stats(unordered_multiset me,
+                                  struct bk_stats *stats);
+void unordered_multiset_probe_histogram(unordered_multiset me,
+                                        struct bk_probe_histogram *histogram);
 
 /* Accessing */
 bk_err unordered_multiset_put(unordered_multiset me, void *key);
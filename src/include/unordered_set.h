@@ -31,22 +31,59 @@
  */
 typedef struct internal_unordered_set *unordered_set;
 
+/**
+ * An iterator over the keys of an unordered set, which is set up by
+ * unordered_set_iter_init; its fields should not be used directly
+ */
+struct unordered_set_iter {
+    unordered_set set;
+    size_t index;
+};
+
 /* Starting */
 unordered_set unordered_set_init(size_t key_size,
                                  unsigned long (*hash)(const void *const key),
                                  int (*comparator)(const void *const one,
                                                    const void *const two));
+unordered_set
+unordered_set_init_with_allocator(size_t key_size,
+                                  unsigned long (*hash)(const void *const key),
+                                  int (*comparator)(const void *const one,
+                                                    const void *const two),
+                                  const struct bk_allocator *allocator);
+unordered_set
+unordered_set_init_ex(size_t key_size,
+                      unsigned long (*hash)(const void *const key),
+                      int (*comparator)(const void *const one,
+                                        const void *const two),
+                      size_t expected_count, double max_load_factor,
+                      double growth_factor);
 
 /* Utility */
 bk_err unordered_set_rehash(unordered_set me);
+bk_err unordered_set_reserve(unordered_set me, size_t count);
 size_t unordered_set_size(unordered_set me);
 bk_bool unordered_set_is_empty(unordered_set me);
+void unordered_set_get_stats(unordered_set me, struct bk_stats *stats);
+void unordered_set_probe_histogram(unordered_set me,
+                                   struct bk_probe_histogram *histogram);
 
 /* Accessing */
 bk_err unordered_set_put(unordered_set me, void *key);
+bk_err unordered_set_put_all(unordered_set me, void *keys, size_t count);
 bk_bool unordered_set_contains(unordered_set me, void *key);
+size_t unordered_set_contains_batch(bk_bool *found, unordered_set me,
+                                    void *keys, size_t count);
 bk_bool unordered_set_remove(unordered_set me, void *key);
 
+/* Iterating */
+void unordered_set_iter_init(struct unordered_set_iter *iter, unordered_set me);
+bk_bool unordered_set_iter_next(void **key, struct unordered_set_iter *iter);
+void unordered_set_for_each(unordered_set me,
+                            void (*callback)(const void *const key,
+                                             void *const context),
+                            void *context);
+
 /* Ending */
 bk_err unordered_set_clear(unordered_set me);
 unordered_set unordered_set_destroy(unordered_set me);
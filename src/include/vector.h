@@ -32,11 +32,14 @@ typedef struct internal_vector *vector;
 
 /* Starting */
 vector vector_init(size_t data_size);
+vector vector_init_with_allocator(size_t data_size,
+                                  const struct bk_allocator *allocator);
 
 /* Utility */
 size_t vector_size(vector me);
 size_t vector_capacity(vector me);
 bk_bool vector_is_empty(vector me);
+void vector_get_stats(vector me, struct bk_stats *stats);
 bk_err vector_reserve(vector me, size_t size);
 bk_err vector_trim(vector me);
 void vector_copy_to_array(void *arr, vector me);
@@ -61,6 +64,7 @@ bk_err vector_set_last(vector me, void *data);
 /* Getting */
 bk_err vector_get_first(void *data, vector me);
 bk_err vector_get_at(void *data, vector me, size_t index);
+void *vector_get_at_ptr(vector me, size_t index);
 bk_err vector_get_last(void *data, vector me);
 
 /* Ending */
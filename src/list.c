@@ -23,11 +23,39 @@
 #include <string.h>
 #include "include/list.h"
 
+#define BKTHOMPS_LIST_POOL_SLAB_NODES 64
+
+/*
+ * A pool hands out nodes of one size. Nodes are carved out of slabs, and nodes
+ * which are given back are kept on a free list to be handed out again, so that
+ * the doubly-linked list does not call the allocator for every insertion and
+ * removal. The slabs are only released when the doubly-linked list is cleared
+ * or destroyed.
+ */
+struct list_node_pool {
+    size_t node_size;
+    bk_bool in_use;
+    char *slabs;
+    char *free_nodes;
+};
+
+#ifdef BK_STATS
+#define BKTHOMPS_LIST_STAT(me, counter, amount) \
+    ((me)->stats.counter += (amount))
+#else
+#define BKTHOMPS_LIST_STAT(me, counter, amount) ((void) 0)
+#endif
+
 struct internal_list {
     size_t bytes_per_item;
     size_t item_count;
     char *head;
     char *tail;
+    struct list_node_pool nodes;
+#ifdef BK_STATS
+    struct bk_stats stats;
+#endif
+    struct bk_allocator allocator;
 };
 
 static const size_t ptr_size = sizeof(char *);
@@ -35,6 +63,38 @@ static const size_t node_next_ptr_offset = 0;
 static const size_t node_prev_ptr_offset = sizeof(char *);
 static const size_t node_data_ptr_offset = 2 * sizeof(char *);
 
+/*
+ * Used when the doubly-linked list is initialized without an allocator. Its
+ * function pointers are all NULL, which means memory is managed by the standard
+ * library.
+ */
+static const struct bk_allocator list_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the doubly-linked list.
+ */
+static void *list_allocate(const struct bk_allocator *const allocator,
+                           const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Frees memory with the allocator of the doubly-linked list.
+ */
+static void list_deallocate(const struct bk_allocator *const allocator,
+                            void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
 /**
  * Initializes a doubly-linked list.
  *
@@ -45,18 +105,51 @@ static const size_t node_data_ptr_offset = 2 * sizeof(char *);
  *         memory allocation error
  */
 list list_init(const size_t data_size)
+{
+    return list_init_with_allocator(data_size, NULL);
+}
+
+/**
+ * Initializes a doubly-linked list, which manages its memory with the given
+ * allocator.
+ *
+ * @param data_size the size of data to store; must be positive
+ * @param allocator the allocator which manages the memory of the doubly-linked
+ *                  list, or NULL to use the standard library; if not NULL, its
+ *                  allocate and deallocate functions must not be NULL
+ *
+ * @return the newly-initialized doubly-linked list, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+list list_init_with_allocator(const size_t data_size,
+                              const struct bk_allocator *allocator)
 {
     struct internal_list *init;
     if (data_size == 0) {
         return NULL;
     }
+    if (!allocator) {
+        allocator = &list_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
+        return NULL;
+    }
     if (node_data_ptr_offset + data_size < node_data_ptr_offset) {
         return NULL;
     }
-    init = malloc(sizeof *init);
+    init = list_allocate(allocator, sizeof *init);
     if (!init) {
         return NULL;
     }
+    init->allocator = *allocator;
+#ifdef BK_STATS
+    memset(&init->stats, 0, sizeof init->stats);
+#endif
+    BKTHOMPS_LIST_STAT(init, bytes_allocated, sizeof *init);
+    init->nodes.node_size = node_data_ptr_offset + data_size;
+    init->nodes.in_use = BK_FALSE;
+    init->nodes.slabs = NULL;
+    init->nodes.free_nodes = NULL;
     init->bytes_per_item = data_size;
     init->item_count = 0;
     init->head = NULL;
@@ -88,6 +181,44 @@ bk_bool list_is_empty(list me)
     return list_size(me) == 0;
 }
 
+/**
+ * Makes the doubly-linked list allocate its nodes from a pool of slabs, rather
+ * than allocating each node individually. Removed nodes are kept by the pool to
+ * be reused, and the slabs are released all at once when the doubly-linked list
+ * is cleared or destroyed. The pool may only be enabled while the doubly-linked
+ * list is empty.
+ *
+ * @param me the doubly-linked list to allocate nodes from a pool for
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_EINVAL if the doubly-linked list is not empty
+ */
+bk_err list_use_node_pool(list me)
+{
+    if (!list_is_empty(me)) {
+        return -BK_EINVAL;
+    }
+    me->nodes.in_use = BK_TRUE;
+    return BK_OK;
+}
+
+/**
+ * Gets the statistics of the doubly-linked list. They are only tracked if the
+ * library is compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the doubly-linked list to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void list_get_stats(list me, struct bk_stats *const stats)
+{
+#ifdef BK_STATS
+    *stats = me->stats;
+#else
+    (void) me;
+    memset(stats, 0, sizeof *stats);
+#endif
+}
+
 /**
  * Copies the nodes of the doubly-linked list to an array. Since it is a copy,
  * the array may be modified without causing side effects to the doubly-linked
@@ -111,6 +242,83 @@ void list_copy_to_array(void *const arr, list me)
     }
 }
 
+/*
+ * Adds a slab to the node pool, and puts all of its nodes on the free list.
+ * Each node starts on a pointer boundary.
+ */
+static bk_err list_pool_grow(list me, struct list_node_pool *const pool)
+{
+    size_t i;
+    char *slab;
+    const size_t stride =
+            (pool->node_size + ptr_size - 1) / ptr_size * ptr_size;
+    const size_t slab_nodes = BKTHOMPS_LIST_POOL_SLAB_NODES;
+    if (stride < pool->node_size
+        || stride > ((size_t) -1 - ptr_size) / slab_nodes) {
+        return -BK_ENOMEM;
+    }
+    BKTHOMPS_LIST_STAT(me, bytes_allocated,
+                       ptr_size + slab_nodes * stride);
+    slab = list_allocate(&me->allocator, ptr_size + slab_nodes * stride);
+    if (!slab) {
+        return -BK_ENOMEM;
+    }
+    memcpy(slab, &pool->slabs, ptr_size);
+    pool->slabs = slab;
+    for (i = slab_nodes; i > 0; i--) {
+        char *const node = slab + ptr_size + (i - 1) * stride;
+        memcpy(node, &pool->free_nodes, ptr_size);
+        pool->free_nodes = node;
+    }
+    return BK_OK;
+}
+
+/*
+ * Releases every slab of the node pool at once. All the nodes of the pool must
+ * no longer be in use.
+ */
+static void list_pool_release(list me, struct list_node_pool *const pool)
+{
+    while (pool->slabs) {
+        char *const slab = pool->slabs;
+        memcpy(&pool->slabs, slab, ptr_size);
+        list_deallocate(&me->allocator, slab);
+    }
+    pool->free_nodes = NULL;
+}
+
+/*
+ * Allocates a node, taking it from the node pool if the pool is in use.
+ */
+static char *list_node_allocate(list me, struct list_node_pool *const pool)
+{
+    char *node;
+    if (!pool->in_use) {
+        BKTHOMPS_LIST_STAT(me, bytes_allocated, pool->node_size);
+        return list_allocate(&me->allocator, pool->node_size);
+    }
+    if (!pool->free_nodes && list_pool_grow(me, pool) != BK_OK) {
+        return NULL;
+    }
+    node = pool->free_nodes;
+    memcpy(&pool->free_nodes, node, ptr_size);
+    return node;
+}
+
+/*
+ * Frees a node, giving it back to the node pool if the pool is in use.
+ */
+static void list_node_deallocate(list me, struct list_node_pool *const pool,
+                                 char *const node)
+{
+    if (!pool->in_use) {
+        list_deallocate(&me->allocator, node);
+        return;
+    }
+    memcpy(node, &pool->free_nodes, ptr_size);
+    pool->free_nodes = node;
+}
+
 /**
  * Copies elements from an array to the doubly-linked list. The size specifies
  * the number of elements to copy, starting from the beginning of the array. The
@@ -135,7 +343,7 @@ bk_err list_add_all(list me, void *const arr, const size_t size)
     if (size + me->item_count < size) {
         return -BK_ERANGE;
     }
-    traverse = malloc(2 * ptr_size + me->bytes_per_item);
+    traverse = list_node_allocate(me, &me->nodes);
     if (!traverse) {
         return -BK_ENOMEM;
     }
@@ -143,12 +351,12 @@ bk_err list_add_all(list me, void *const arr, const size_t size)
     memset(traverse + node_prev_ptr_offset, 0, ptr_size);
     memcpy(traverse + node_data_ptr_offset, arr, me->bytes_per_item);
     for (i = 1; i < size; i++) {
-        char *node = malloc(2 * ptr_size + me->bytes_per_item);
+        char *node = list_node_allocate(me, &me->nodes);
         if (!node) {
             while (traverse) {
                 char *backup = traverse;
                 memcpy(&traverse, traverse + node_prev_ptr_offset, ptr_size);
-                free(backup);
+                list_node_deallocate(me, &me->nodes, backup);
             }
             return -BK_ENOMEM;
         }
@@ -246,7 +454,7 @@ bk_err list_add_at(list me, const size_t index, void *const data)
     if (index > me->item_count) {
         return -BK_EINVAL;
     }
-    node = malloc(2 * ptr_size + me->bytes_per_item);
+    node = list_node_allocate(me, &me->nodes);
     if (!node) {
         return -BK_ENOMEM;
     }
@@ -349,7 +557,7 @@ bk_err list_remove_at(list me, const size_t index)
         memcpy(traverse_next + node_prev_ptr_offset, &traverse_prev, ptr_size);
         memcpy(traverse_prev + node_next_ptr_offset, &traverse_next, ptr_size);
     }
-    free(traverse);
+    list_node_deallocate(me, &me->nodes, traverse);
     me->item_count--;
     return BK_OK;
 }
@@ -473,6 +681,25 @@ bk_err list_get_at(void *const data, list me, const size_t index)
     return BK_OK;
 }
 
+/**
+ * Gets a pointer to the data at the specified index in the doubly-linked list,
+ * so that the data can be read or modified in place without copying it. Each
+ * element stays in its own node, so the pointer remains valid until that
+ * element is removed or the doubly-linked list is cleared or destroyed.
+ *
+ * @param me    the doubly-linked list to get data from
+ * @param index the index to get data from
+ *
+ * @return a pointer to the data, or NULL if the index is out of bounds
+ */
+void *list_get_at_ptr(list me, const size_t index)
+{
+    if (index >= me->item_count) {
+        return NULL;
+    }
+    return list_get_node_at(me, index) + node_data_ptr_offset;
+}
+
 /**
  * Gets the data at the last index in the doubly-linked list. The pointer to
  * the data being obtained should point to the data type which this doubly-
@@ -500,10 +727,14 @@ bk_err list_get_last(void *const data, list me)
 void list_clear(list me)
 {
     char *traverse = me->head;
-    while (traverse) {
-        char *temp = traverse;
-        memcpy(&traverse, traverse + node_next_ptr_offset, ptr_size);
-        free(temp);
+    if (me->nodes.in_use) {
+        list_pool_release(me, &me->nodes);
+    } else {
+        while (traverse) {
+            char *temp = traverse;
+            memcpy(&traverse, traverse + node_next_ptr_offset, ptr_size);
+            list_deallocate(&me->allocator, temp);
+        }
     }
     me->item_count = 0;
     me->head = NULL;
@@ -523,7 +754,7 @@ list list_destroy(list me)
 {
     if (me) {
         list_clear(me);
-        free(me);
+        list_deallocate(&me->allocator, me);
     }
     return NULL;
 }
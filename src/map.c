@@ -20,24 +20,143 @@
  * SOFTWARE.
  */
 
+#include <stddef.h>
 #include <string.h>
 #include "include/map.h"
 
+#define BKTHOMPS_MAP_POOL_SLAB_NODES 64
+
+/*
+ * A pool hands out nodes of one size. Nodes are carved out of slabs, and nodes
+ * which are given back are kept on a free list to be handed out again, so that
+ * the map does not call the allocator for every insertion and removal. The
+ * slabs are only released when the map is cleared or destroyed.
+ */
+struct map_node_pool {
+    size_t node_size;
+    size_t alignment;
+    bk_bool in_use;
+    char *slabs;
+    char *free_nodes;
+};
+
+#ifdef BK_STATS
+#define BKTHOMPS_MAP_STAT(me, counter, amount) \
+    ((me)->stats.counter += (amount))
+#else
+#define BKTHOMPS_MAP_STAT(me, counter, amount) ((void) 0)
+#endif
+
 struct internal_map {
     size_t size;
     size_t key_size;
     size_t value_size;
     int (*comparator)(const void *const one, const void *const two);
     char *root;
+    size_t balance_offset;
+    size_t value_offset;
+    size_t subtree_size_offset;
+    bk_bool order_statistics;
+    struct map_node_pool nodes;
+#ifdef BK_STATS
+    struct bk_stats stats;
+#endif
+    struct bk_allocator allocator;
 };
 
 static const size_t ptr_size = sizeof(char *);
-/* Node balance is always the first byte (at index 0). */
-static const size_t node_parent_offset = sizeof(signed char);
-static const size_t node_left_child_offset = 1 + sizeof(char *);
-static const size_t node_right_child_offset = 1 + 2 * sizeof(char *);
-static const size_t node_key_offset = 1 + 3 * sizeof(char *);
-/* Assume the value starts right after the key ends. */
+
+/*
+ * Used when the map is initialized without an allocator. Its function pointers
+ * are all NULL, which means memory is managed by the standard library.
+ */
+static const struct bk_allocator map_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the map.
+ */
+static void *map_allocate(const struct bk_allocator *const allocator,
+                          const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Frees memory with the allocator of the map.
+ */
+static void map_deallocate(const struct bk_allocator *const allocator,
+                           void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+ * The links come first, so that they and the key are aligned to a pointer
+ * boundary. The value follows the key at value_offset, and while order
+ * statistics are in use, the subtree size follows the value at
+ * subtree_size_offset, each padded so that it is aligned. Node balance is
+ * always the last byte, at balance_offset. The padding trades memory for
+ * aligned reads: a 1-byte key with an 8-byte value takes 41 bytes rather than
+ * the 34 it would take packed, and order statistics may add more.
+ */
+static const size_t node_parent_offset = 0;
+static const size_t node_left_child_offset = sizeof(char *);
+static const size_t node_right_child_offset = 2 * sizeof(char *);
+static const size_t node_key_offset = 3 * sizeof(char *);
+
+/*
+ * C89 has no name for the strictest alignment which a fundamental type may
+ * need, so it is found from where a union of those types lands after a char.
+ */
+union map_max_align {
+    long l;
+    double d;
+    long double ld;
+    void *p;
+    void (*f)(void);
+};
+
+struct map_align_probe {
+    char c;
+    union map_max_align u;
+};
+
+static const size_t max_alignment = offsetof(struct map_align_probe, u);
+
+/*
+ * Gets the alignment which an object of the specified size may need. The size
+ * of a type is a multiple of its alignment, which is a power of two, so the
+ * largest power of two which divides the size is enough, up to the strictest
+ * alignment of any type.
+ */
+static size_t map_alignment(const size_t size)
+{
+    size_t alignment = 1;
+    while (alignment < max_alignment && size % (2 * alignment) == 0) {
+        alignment *= 2;
+    }
+    return alignment;
+}
+
+/*
+ * Rounds the offset up to a multiple of the alignment, or gets zero if that
+ * would overflow.
+ */
+static size_t map_align(const size_t offset, const size_t alignment)
+{
+    const size_t padding = (alignment - offset % alignment) % alignment;
+    if (offset + padding < offset) {
+        return 0;
+    }
+    return offset + padding;
+}
 
 /**
  * Initializes a map.
@@ -53,29 +172,112 @@ static const size_t node_key_offset = 1 + 3 * sizeof(char *);
  */
 map map_init(const size_t key_size, const size_t value_size,
              int (*const comparator)(const void *const, const void *const))
+{
+    return map_init_with_allocator(key_size, value_size, comparator, NULL);
+}
+
+/*
+ * Initializes a map, which manages its memory with the given allocator unless
+ * it is NULL. If the comparator is NULL, keys are compared as plain old data.
+ */
+static map map_create(const size_t key_size, const size_t value_size,
+                      int (*const comparator)(const void *const,
+                                              const void *const),
+                      const struct bk_allocator *allocator)
 {
     struct internal_map *init;
-    if (key_size == 0 || value_size == 0 || !comparator) {
+    size_t value_alignment;
+    size_t value_offset;
+    if (key_size == 0 || value_size == 0) {
+        return NULL;
+    }
+    if (!allocator) {
+        allocator = &map_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
         return NULL;
     }
     if (node_key_offset + key_size < node_key_offset) {
         return NULL;
     }
-    if (node_key_offset + key_size + value_size < node_key_offset + key_size) {
+    value_alignment = map_alignment(value_size);
+    value_offset = map_align(node_key_offset + key_size, value_alignment);
+    if (value_offset == 0 || value_offset + value_size + 1 <= value_offset) {
         return NULL;
     }
-    init = malloc(sizeof *init);
+    init = map_allocate(allocator, sizeof *init);
     if (!init) {
         return NULL;
     }
+    init->allocator = *allocator;
+#ifdef BK_STATS
+    memset(&init->stats, 0, sizeof init->stats);
+#endif
+    BKTHOMPS_MAP_STAT(init, bytes_allocated, sizeof *init);
+    init->value_offset = value_offset;
+    init->balance_offset = value_offset + value_size;
+    init->subtree_size_offset = 0;
+    init->nodes.node_size = init->balance_offset + 1;
+    init->nodes.alignment = map_alignment(ptr_size);
+    if (init->nodes.alignment < value_alignment) {
+        init->nodes.alignment = value_alignment;
+    }
+    init->nodes.in_use = BK_FALSE;
+    init->nodes.slabs = NULL;
+    init->nodes.free_nodes = NULL;
     init->size = 0;
     init->key_size = key_size;
     init->value_size = value_size;
     init->comparator = comparator;
     init->root = NULL;
+    init->order_statistics = BK_FALSE;
     return init;
 }
 
+/**
+ * Initializes a map, which manages its memory with the given allocator.
+ *
+ * @param key_size   the size of each key in the map; must be positive
+ * @param value_size the size of each value in the map; must be positive
+ * @param comparator the comparator function used for key ordering; must not be
+ *                   NULL
+ * @param allocator  the allocator which manages the memory of the map, or NULL
+ *                   to use the standard library; if not NULL, its allocate and
+ *                   deallocate functions must not be NULL
+ *
+ * @return the newly-initialized map, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+map map_init_with_allocator(const size_t key_size, const size_t value_size,
+                            int (*const comparator)(const void *const,
+                                                    const void *const),
+                            const struct bk_allocator *allocator)
+{
+    if (!comparator) {
+        return NULL;
+    }
+    return map_create(key_size, value_size, comparator, allocator);
+}
+
+/**
+ * Initializes a map whose keys are plain old data, such as integers or
+ * fixed-size byte strings, so that no comparator function is needed. Keys the
+ * size of signed char, short, int or long are ordered as that signed integer
+ * type, and keys of any other size are ordered byte by byte like memcmp. This
+ * is faster than a comparator, since no function is called through a pointer.
+ *
+ * @param key_size   the size of each key in the map; must be positive
+ * @param value_size the size of each value in the map; must be positive
+ *
+ * @return the newly-initialized map, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+map map_init_pod(const size_t key_size, const size_t value_size)
+{
+    return map_create(key_size, value_size, NULL, NULL);
+}
+
 /**
  * Gets the size of the map.
  *
@@ -100,6 +302,140 @@ bk_bool map_is_empty(map me)
     return map_size(me) == 0;
 }
 
+/**
+ * Makes the map allocate its nodes from a pool of slabs, rather than allocating
+ * each node individually. Removed nodes are kept by the pool to be reused, and
+ * the slabs are released all at once when the map is cleared or destroyed. The
+ * pool may only be enabled while the map is empty.
+ *
+ * @param me the map to allocate nodes from a pool for
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_EINVAL if the map is not empty
+ */
+bk_err map_use_node_pool(map me)
+{
+    if (!map_is_empty(me)) {
+        return -BK_EINVAL;
+    }
+    me->nodes.in_use = BK_TRUE;
+    return BK_OK;
+}
+
+/**
+ * Gets the statistics of the map. They are only tracked if the library is
+ * compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the map to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void map_get_stats(map me, struct bk_stats *const stats)
+{
+#ifdef BK_STATS
+    *stats = me->stats;
+#else
+    (void) me;
+    memset(stats, 0, sizeof *stats);
+#endif
+}
+
+/*
+ * Compares two keys of plain old data, for a map without a comparator.
+ */
+static int map_compare_pod(const size_t key_size, const void *const one,
+                           const void *const two)
+{
+    if (key_size == sizeof(int)) {
+        int a;
+        int b;
+        memcpy(&a, one, sizeof(int));
+        memcpy(&b, two, sizeof(int));
+        return (a > b) - (a < b);
+    }
+    if (key_size == sizeof(long)) {
+        long a;
+        long b;
+        memcpy(&a, one, sizeof(long));
+        memcpy(&b, two, sizeof(long));
+        return (a > b) - (a < b);
+    }
+    if (key_size == sizeof(short)) {
+        short a;
+        short b;
+        memcpy(&a, one, sizeof(short));
+        memcpy(&b, two, sizeof(short));
+        return (a > b) - (a < b);
+    }
+    if (key_size == sizeof(signed char)) {
+        const signed char a = *(const signed char *) one;
+        const signed char b = *(const signed char *) two;
+        return (a > b) - (a < b);
+    }
+    return memcmp(one, two, key_size);
+}
+
+/*
+ * Compares two keys with the comparator, counting the call.
+ */
+static int map_compare(map me, const void *const one, const void *const two)
+{
+    BKTHOMPS_MAP_STAT(me, comparator_calls, 1);
+    if (!me->comparator) {
+        return map_compare_pod(me->key_size, one, two);
+    }
+    return me->comparator(one, two);
+}
+
+/*
+ * Gets the number of key-value pairs in the subtree of the node, which is
+ * stored after the value while order statistics are in use.
+ */
+static size_t map_subtree_size(map me, const char *const node)
+{
+    size_t size;
+    if (!node) {
+        return 0;
+    }
+    memcpy(&size, node + me->subtree_size_offset, sizeof(size_t));
+    return size;
+}
+
+/*
+ * Sets the number of key-value pairs in the subtree of the node.
+ */
+static void map_store_subtree_size(map me, char *const node, const size_t size)
+{
+    memcpy(node + me->subtree_size_offset, &size, sizeof(size_t));
+}
+
+/*
+ * Recomputes the subtree size of the node from the sizes of its children.
+ */
+static void map_resize_subtree(map me, char *const node)
+{
+    char *left;
+    char *right;
+    memcpy(&left, node + node_left_child_offset, ptr_size);
+    memcpy(&right, node + node_right_child_offset, ptr_size);
+    map_store_subtree_size(me, node, map_subtree_size(me, left)
+                                     + map_subtree_size(me, right) + 1);
+}
+
+/*
+ * Adds one to, or removes one from, the subtree size of each node starting at
+ * the given node and going up the tree until the end node is reached. The end
+ * node is not changed, and is NULL to go all the way up past the root.
+ */
+static void map_adjust_ancestors(map me, char *node, const char *const end,
+                                 const bk_bool is_growing)
+{
+    while (node != end) {
+        const size_t size = map_subtree_size(me, node);
+        map_store_subtree_size(me, node, is_growing ? size + 1 : size - 1);
+        memcpy(&node, node + node_parent_offset, ptr_size);
+    }
+}
+
 /*
  * Resets the parent reference.
  */
@@ -128,6 +464,7 @@ static void map_reference_parent(map me, char *const parent, char *const child)
 static void map_rotate_left(map me, char *const parent, char *const child)
 {
     char *left_grand_child;
+    BKTHOMPS_MAP_STAT(me, rotations, 1);
     map_reference_parent(me, parent, child);
     memcpy(&left_grand_child, child + node_left_child_offset, ptr_size);
     if (left_grand_child) {
@@ -136,6 +473,10 @@ static void map_rotate_left(map me, char *const parent, char *const child)
     memcpy(parent + node_parent_offset, &child, ptr_size);
     memcpy(parent + node_right_child_offset, &left_grand_child, ptr_size);
     memcpy(child + node_left_child_offset, &parent, ptr_size);
+    if (me->order_statistics) {
+        map_resize_subtree(me, parent);
+        map_resize_subtree(me, child);
+    }
 }
 
 /*
@@ -144,6 +485,7 @@ static void map_rotate_left(map me, char *const parent, char *const child)
 static void map_rotate_right(map me, char *const parent, char *const child)
 {
     char *right_grand_child;
+    BKTHOMPS_MAP_STAT(me, rotations, 1);
     map_reference_parent(me, parent, child);
     memcpy(&right_grand_child, child + node_right_child_offset, ptr_size);
     if (right_grand_child) {
@@ -152,6 +494,10 @@ static void map_rotate_right(map me, char *const parent, char *const child)
     memcpy(parent + node_parent_offset, &child, ptr_size);
     memcpy(parent + node_left_child_offset, &right_grand_child, ptr_size);
     memcpy(child + node_right_child_offset, &parent, ptr_size);
+    if (me->order_statistics) {
+        map_resize_subtree(me, parent);
+        map_resize_subtree(me, child);
+    }
 }
 
 /*
@@ -160,12 +506,12 @@ static void map_rotate_right(map me, char *const parent, char *const child)
 static char *map_repair_left(map me, char *const parent, char *const child)
 {
     map_rotate_left(me, parent, child);
-    if (child[0] == 0) {
-        parent[0] = 1;
-        child[0] = -1;
+    if (child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = 1;
+        child[me->balance_offset] = -1;
     } else {
-        parent[0] = 0;
-        child[0] = 0;
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     }
     return child;
 }
@@ -176,12 +522,12 @@ static char *map_repair_left(map me, char *const parent, char *const child)
 static char *map_repair_right(map me, char *const parent, char *const child)
 {
     map_rotate_right(me, parent, child);
-    if (child[0] == 0) {
-        parent[0] = -1;
-        child[0] = 1;
+    if (child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = -1;
+        child[me->balance_offset] = 1;
     } else {
-        parent[0] = 0;
-        child[0] = 0;
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     }
     return child;
 }
@@ -194,17 +540,17 @@ static char *map_repair_left_right(map me, char *const parent,
 {
     map_rotate_left(me, child, grand_child);
     map_rotate_right(me, parent, grand_child);
-    if (grand_child[0] == 1) {
-        parent[0] = 0;
-        child[0] = -1;
-    } else if (grand_child[0] == 0) {
-        parent[0] = 0;
-        child[0] = 0;
+    if (grand_child[me->balance_offset] == 1) {
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = -1;
+    } else if (grand_child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     } else {
-        parent[0] = 1;
-        child[0] = 0;
+        parent[me->balance_offset] = 1;
+        child[me->balance_offset] = 0;
     }
-    grand_child[0] = 0;
+    grand_child[me->balance_offset] = 0;
     return grand_child;
 }
 
@@ -216,17 +562,17 @@ static char *map_repair_right_left(map me, char *const parent,
 {
     map_rotate_right(me, child, grand_child);
     map_rotate_left(me, parent, grand_child);
-    if (grand_child[0] == 1) {
-        parent[0] = -1;
-        child[0] = 0;
-    } else if (grand_child[0] == 0) {
-        parent[0] = 0;
-        child[0] = 0;
+    if (grand_child[me->balance_offset] == 1) {
+        parent[me->balance_offset] = -1;
+        child[me->balance_offset] = 0;
+    } else if (grand_child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     } else {
-        parent[0] = 0;
-        child[0] = 1;
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 1;
     }
-    grand_child[0] = 0;
+    grand_child[me->balance_offset] = 0;
     return grand_child;
 }
 
@@ -237,13 +583,13 @@ static char *map_repair_right_left(map me, char *const parent,
 static char *map_repair(map me, char *const parent, char *const child,
                         char *const grand_child)
 {
-    if (parent[0] == 2) {
-        if (child[0] == -1) {
+    if (parent[me->balance_offset] == 2) {
+        if (child[me->balance_offset] == -1) {
             return map_repair_right_left(me, parent, child, grand_child);
         }
         return map_repair_left(me, parent, child);
     }
-    if (child[0] == 1) {
+    if (child[me->balance_offset] == 1) {
         return map_repair_left_right(me, parent, child, grand_child);
     }
     return map_repair_right(me, parent, child);
@@ -258,20 +604,23 @@ static void map_insert_balance(map me, char *const item)
     char *child = item;
     char *parent;
     memcpy(&parent, item + node_parent_offset, ptr_size);
+    if (me->order_statistics) {
+        map_adjust_ancestors(me, parent, NULL, BK_TRUE);
+    }
     while (parent) {
         char *parent_left;
         memcpy(&parent_left, parent + node_left_child_offset, ptr_size);
         if (parent_left == child) {
-            parent[0]--;
+            parent[me->balance_offset]--;
         } else {
-            parent[0]++;
+            parent[me->balance_offset]++;
         }
         /* If balance is zero after modification, then the tree is balanced. */
-        if (parent[0] == 0) {
+        if (parent[me->balance_offset] == 0) {
             return;
         }
         /* Must re-balance if not in {-1, 0, 1} */
-        if (parent[0] > 1 || parent[0] < -1) {
+        if (parent[me->balance_offset] > 1 || parent[me->balance_offset] < -1) {
             /* After one repair, the tree is balanced. */
             map_repair(me, parent, child, grand_child);
             return;
@@ -283,25 +632,201 @@ static void map_insert_balance(map me, char *const item)
 }
 
 /*
- * Creates and allocates a node.
+ * Adds a slab to the node pool, and puts all of its nodes on the free list.
+ * Each node starts on a boundary of the pool alignment, after the link to the
+ * next slab.
+ */
+static bk_err map_pool_grow(map me, struct map_node_pool *const pool)
+{
+    size_t i;
+    char *slab;
+    const size_t header = map_align(ptr_size, pool->alignment);
+    const size_t stride = map_align(pool->node_size, pool->alignment);
+    const size_t slab_nodes = BKTHOMPS_MAP_POOL_SLAB_NODES;
+    if (stride == 0 || stride > ((size_t) -1 - header) / slab_nodes) {
+        return -BK_ENOMEM;
+    }
+    BKTHOMPS_MAP_STAT(me, bytes_allocated, header + slab_nodes * stride);
+    slab = map_allocate(&me->allocator, header + slab_nodes * stride);
+    if (!slab) {
+        return -BK_ENOMEM;
+    }
+    memcpy(slab, &pool->slabs, ptr_size);
+    pool->slabs = slab;
+    for (i = slab_nodes; i > 0; i--) {
+        char *const node = slab + header + (i - 1) * stride;
+        memcpy(node, &pool->free_nodes, ptr_size);
+        pool->free_nodes = node;
+    }
+    return BK_OK;
+}
+
+/*
+ * Releases every slab of the node pool at once. All the nodes of the pool must
+ * no longer be in use.
+ */
+static void map_pool_release(map me, struct map_node_pool *const pool)
+{
+    while (pool->slabs) {
+        char *const slab = pool->slabs;
+        memcpy(&pool->slabs, slab, ptr_size);
+        map_deallocate(&me->allocator, slab);
+    }
+    pool->free_nodes = NULL;
+}
+
+/*
+ * Allocates a node, taking it from the node pool if the pool is in use.
+ */
+static char *map_node_allocate(map me, struct map_node_pool *const pool)
+{
+    char *node;
+    if (!pool->in_use) {
+        BKTHOMPS_MAP_STAT(me, bytes_allocated, pool->node_size);
+        return map_allocate(&me->allocator, pool->node_size);
+    }
+    if (!pool->free_nodes && map_pool_grow(me, pool) != BK_OK) {
+        return NULL;
+    }
+    node = pool->free_nodes;
+    memcpy(&pool->free_nodes, node, ptr_size);
+    return node;
+}
+
+/*
+ * Frees a node, giving it back to the node pool if the pool is in use.
+ */
+static void map_node_deallocate(map me, struct map_node_pool *const pool,
+                                char *const node)
+{
+    if (!pool->in_use) {
+        map_deallocate(&me->allocator, node);
+        return;
+    }
+    memcpy(node, &pool->free_nodes, ptr_size);
+    pool->free_nodes = node;
+}
+
+/*
+ * Creates and allocates a node, whose value is zeroed.
  */
 static char *map_create_node(map me, const void *const key,
-                             const void *const value, char *const parent)
+                             char *const parent)
 {
-    char *insert = malloc(1 + 3 * ptr_size + me->key_size + me->value_size);
+    char *insert = map_node_allocate(me, &me->nodes);
     if (!insert) {
         return NULL;
     }
-    insert[0] = 0;
+    insert[me->balance_offset] = 0;
     memcpy(insert + node_parent_offset, &parent, ptr_size);
     memset(insert + node_left_child_offset, 0, ptr_size);
     memset(insert + node_right_child_offset, 0, ptr_size);
     memcpy(insert + node_key_offset, key, me->key_size);
-    memcpy(insert + node_key_offset + me->key_size, value, me->value_size);
+    memset(insert + me->value_offset, 0, me->value_size);
+    if (me->order_statistics) {
+        map_store_subtree_size(me, insert, 1);
+    }
     me->size++;
     return insert;
 }
 
+/**
+ * Makes the map keep the number of key-value pairs in the subtree of each node,
+ * so that map_select and map_rank take logarithmic rather than linear time.
+ * This costs the size of a size_t per node, and a walk up to the root on every
+ * put and remove. Order statistics may only be enabled while the map is empty.
+ *
+ * @param me the map to keep order statistics for
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_EINVAL if the map is not empty
+ * @return -BK_ENOMEM if the nodes would become too large
+ */
+bk_err map_use_order_statistics(map me)
+{
+    const size_t size_alignment = map_alignment(sizeof(size_t));
+    const size_t subtree_size_offset =
+            map_align(me->value_offset + me->value_size, size_alignment);
+    const size_t node_size = subtree_size_offset + sizeof(size_t) + 1;
+    if (!map_is_empty(me)) {
+        return -BK_EINVAL;
+    }
+    if (subtree_size_offset == 0 || node_size < subtree_size_offset) {
+        return -BK_ENOMEM;
+    }
+    if (me->order_statistics) {
+        return BK_OK;
+    }
+    /* The pooled nodes which are left over from before are too small. */
+    map_pool_release(me, &me->nodes);
+    me->subtree_size_offset = subtree_size_offset;
+    me->balance_offset = node_size - 1;
+    me->nodes.node_size = node_size;
+    if (me->nodes.alignment < size_alignment) {
+        me->nodes.alignment = size_alignment;
+    }
+    me->order_statistics = BK_TRUE;
+    return BK_OK;
+}
+
+/**
+ * Gets a pointer to the value associated with a key in the map, adding the key
+ * with a zeroed value first if the map does not already contain it. This lets a
+ * value be created or updated in place with a single search, such as when
+ * counting or aggregating by key. The key itself must not be modified. The
+ * pointer is aligned for the value type, and remains valid until the key is
+ * removed or the map is cleared or destroyed.
+ *
+ * @param me       the map to add to
+ * @param key      the key to find or add
+ * @param inserted set to whether or not the key was added, unless it is NULL
+ *
+ * @return a pointer to the value, or NULL if out of memory
+ */
+void *map_emplace(map me, void *const key, bk_bool *const inserted)
+{
+    char *traverse;
+    char *insert;
+    if (inserted) {
+        *inserted = BK_FALSE;
+    }
+    if (!me->root) {
+        insert = map_create_node(me, key, NULL);
+        if (!insert) {
+            return NULL;
+        }
+        me->root = insert;
+    } else {
+        traverse = me->root;
+        for (;;) {
+            const int compare = map_compare(me, key,
+                                            traverse + node_key_offset);
+            const size_t child_offset = compare < 0 ? node_left_child_offset
+                                                    : node_right_child_offset;
+            char *child;
+            if (compare == 0) {
+                return traverse + me->value_offset;
+            }
+            memcpy(&child, traverse + child_offset, ptr_size);
+            if (child) {
+                traverse = child;
+                continue;
+            }
+            insert = map_create_node(me, key, traverse);
+            if (!insert) {
+                return NULL;
+            }
+            memcpy(traverse + child_offset, &insert, ptr_size);
+            map_insert_balance(me, insert);
+            break;
+        }
+    }
+    if (inserted) {
+        *inserted = BK_TRUE;
+    }
+    return insert + me->value_offset;
+}
+
 /**
  * Adds a key-value pair to the map. If the map already contains the key, the
  * value is updated to the new value. The pointer to the key and value being
@@ -319,53 +844,12 @@ static char *map_create_node(map me, const void *const key,
  */
 bk_err map_put(map me, void *const key, void *const value)
 {
-    char *traverse;
-    if (!me->root) {
-        char *insert = map_create_node(me, key, value, NULL);
-        if (!insert) {
-            return -BK_ENOMEM;
-        }
-        me->root = insert;
-        return BK_OK;
-    }
-    traverse = me->root;
-    for (;;) {
-        const int compare = me->comparator(key, traverse + node_key_offset);
-        if (compare < 0) {
-            char *traverse_left;
-            memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
-            if (traverse_left) {
-                traverse = traverse_left;
-            } else {
-                char *insert = map_create_node(me, key, value, traverse);
-                if (!insert) {
-                    return -BK_ENOMEM;
-                }
-                memcpy(traverse + node_left_child_offset, &insert, ptr_size);
-                map_insert_balance(me, insert);
-                return BK_OK;
-            }
-        } else if (compare > 0) {
-            char *traverse_right;
-            memcpy(&traverse_right, traverse + node_right_child_offset,
-                   ptr_size);
-            if (traverse_right) {
-                traverse = traverse_right;
-            } else {
-                char *insert = map_create_node(me, key, value, traverse);
-                if (!insert) {
-                    return -BK_ENOMEM;
-                }
-                memcpy(traverse + node_right_child_offset, &insert, ptr_size);
-                map_insert_balance(me, insert);
-                return BK_OK;
-            }
-        } else {
-            memcpy(traverse + node_key_offset + me->key_size, value,
-                   me->value_size);
-            return BK_OK;
-        }
+    char *const found = map_emplace(me, key, NULL);
+    if (!found) {
+        return -BK_ENOMEM;
     }
+    memcpy(found, value, me->value_size);
+    return BK_OK;
 }
 
 /*
@@ -378,7 +862,7 @@ static char *map_equal_match(map me, const void *const key)
         return NULL;
     }
     for (;;) {
-        const int compare = me->comparator(key, traverse + node_key_offset);
+        const int compare = map_compare(me, key, traverse + node_key_offset);
         if (compare < 0) {
             char *traverse_left;
             memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
@@ -422,10 +906,32 @@ bk_bool map_get(void *const value, map me, void *const key)
     if (!traverse) {
         return BK_FALSE;
     }
-    memcpy(value, traverse + node_key_offset + me->key_size, me->value_size);
+    memcpy(value, traverse + me->value_offset, me->value_size);
     return BK_TRUE;
 }
 
+/**
+ * Gets a pointer to the value associated with a key in the map, so that the
+ * value can be read or modified in place without copying it or looking the key
+ * up a second time. The key itself must not be modified. The value is aligned
+ * for its type, so it may be accessed through a pointer of that type. Each
+ * key-value pair stays in its own node, so the pointer remains valid until that
+ * key is removed or the map is cleared or destroyed.
+ *
+ * @param me  the map to get from
+ * @param key the key to search for
+ *
+ * @return a pointer to the value, or NULL if the map does not contain the key
+ */
+void *map_get_ptr(map me, void *const key)
+{
+    char *const traverse = map_equal_match(me, key);
+    if (!traverse) {
+        return NULL;
+    }
+    return traverse + me->value_offset;
+}
+
 /**
  * Determines if the map contains the specified key. The pointer to the key
  * being passed in should point to the key type which this map holds. For
@@ -459,7 +965,7 @@ static char *map_repair_pivot(map me, char *const item, const int is_left_pivot)
     child = is_left_pivot ? item_right : item_left;
     memcpy(&child_right, child + node_right_child_offset, ptr_size);
     memcpy(&child_left, child + node_left_child_offset, ptr_size);
-    grand_child = child[0] == 1 ? child_right : child_left;
+    grand_child = child[me->balance_offset] == 1 ? child_right : child_left;
     return map_repair(me, item, child, grand_child);
 }
 
@@ -475,21 +981,23 @@ static void map_trace_ancestors(map me, char *item)
         char *parent_left;
         memcpy(&parent_left, parent + node_left_child_offset, ptr_size);
         if (parent_left == child) {
-            parent[0]++;
+            parent[me->balance_offset]++;
         } else {
-            parent[0]--;
+            parent[me->balance_offset]--;
         }
         /* The tree is balanced if balance is -1 or +1 after modification. */
-        if (parent[0] == -1 || parent[0] == 1) {
+        if (parent[me->balance_offset] == -1
+            || parent[me->balance_offset] == 1) {
             return;
         }
         /* Must re-balance if not in {-1, 0, 1} */
-        if (parent[0] > 1 || parent[0] < -1) {
+        if (parent[me->balance_offset] > 1 || parent[me->balance_offset] < -1) {
             child = map_repair_pivot(me, parent, parent_left == child);
             memcpy(&parent, child + node_parent_offset, ptr_size);
             /* If balance is -1 or +1 after modification or   */
             /* the parent is NULL, then the tree is balanced. */
-            if (!parent || child[0] == -1 || child[0] == 1) {
+            if (!parent || child[me->balance_offset] == -1
+                || child[me->balance_offset] == 1) {
                 return;
             }
         } else {
@@ -505,20 +1013,21 @@ static void map_trace_ancestors(map me, char *item)
 static void map_delete_balance(map me, char *item, const int is_left_deleted)
 {
     if (is_left_deleted) {
-        item[0]++;
+        item[me->balance_offset]++;
     } else {
-        item[0]--;
+        item[me->balance_offset]--;
     }
     /* If balance is -1 or +1 after modification, then the tree is balanced. */
-    if (item[0] == -1 || item[0] == 1) {
+    if (item[me->balance_offset] == -1 || item[me->balance_offset] == 1) {
         return;
     }
     /* Must re-balance if not in {-1, 0, 1} */
-    if (item[0] > 1 || item[0] < -1) {
+    if (item[me->balance_offset] > 1 || item[me->balance_offset] < -1) {
         char *item_parent;
         item = map_repair_pivot(me, item, is_left_deleted);
         memcpy(&item_parent, item + node_parent_offset, ptr_size);
-        if (!item_parent || item[0] == -1 || item[0] == 1) {
+        if (!item_parent || item[me->balance_offset] == -1
+            || item[me->balance_offset] == 1) {
             return;
         }
     }
@@ -625,7 +1134,7 @@ static void map_remove_two_children(map me, const char *const traverse)
         char *item_left;
         memcpy(&item, traverse + node_right_child_offset, ptr_size);
         parent = item;
-        item[0] = traverse[0];
+        item[me->balance_offset] = traverse[me->balance_offset];
         memcpy(item + node_parent_offset, traverse + node_parent_offset,
                ptr_size);
         memcpy(item + node_left_child_offset, traverse + node_left_child_offset,
@@ -642,7 +1151,7 @@ static void map_remove_two_children(map me, const char *const traverse)
             memcpy(&item_left, item + node_left_child_offset, ptr_size);
         }
         memcpy(&parent, item + node_parent_offset, ptr_size);
-        item[0] = traverse[0];
+        item[me->balance_offset] = traverse[me->balance_offset];
         memcpy(&item_parent, item + node_parent_offset, ptr_size);
         memcpy(item_parent + node_left_child_offset,
                item + node_right_child_offset, ptr_size);
@@ -679,6 +1188,35 @@ static void map_remove_two_children(map me, const char *const traverse)
     map_delete_balance(me, parent, is_left_deleted);
 }
 
+/*
+ * Takes the node which is about to be removed out of the subtree sizes of its
+ * ancestors. If it has two children, the lowest node of its right subtree is
+ * moved into its place, so that node leaves the subtrees in between and takes
+ * over the subtree size of the removed node.
+ */
+static void map_remove_subtree_size(map me, const char *const traverse)
+{
+    char *traverse_left;
+    char *traverse_right;
+    char *parent;
+    memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
+    memcpy(&traverse_right, traverse + node_right_child_offset, ptr_size);
+    if (traverse_left && traverse_right) {
+        char *item = traverse_right;
+        char *item_left;
+        memcpy(&item_left, item + node_left_child_offset, ptr_size);
+        while (item_left) {
+            item = item_left;
+            memcpy(&item_left, item + node_left_child_offset, ptr_size);
+        }
+        memcpy(&parent, item + node_parent_offset, ptr_size);
+        map_adjust_ancestors(me, parent, traverse, BK_FALSE);
+        map_store_subtree_size(me, item, map_subtree_size(me, traverse) - 1);
+    }
+    memcpy(&parent, traverse + node_parent_offset, ptr_size);
+    map_adjust_ancestors(me, parent, NULL, BK_FALSE);
+}
+
 /*
  * Removes the element from the map.
  */
@@ -686,6 +1224,9 @@ static void map_remove_element(map me, char *const traverse)
 {
     char *traverse_left;
     char *traverse_right;
+    if (me->order_statistics) {
+        map_remove_subtree_size(me, traverse);
+    }
     memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
     memcpy(&traverse_right, traverse + node_right_child_offset, ptr_size);
     if (!traverse_left && !traverse_right) {
@@ -695,7 +1236,7 @@ static void map_remove_element(map me, char *const traverse)
     } else {
         map_remove_two_children(me, traverse);
     }
-    free(traverse);
+    map_node_deallocate(me, &me->nodes, traverse);
     me->size--;
 }
 
@@ -721,6 +1262,110 @@ bk_bool map_remove(map me, void *const key)
     return BK_TRUE;
 }
 
+/*
+ * Gets the node with the lowest key in the subtree, or NULL if it is empty.
+ */
+static char *map_leftmost(char *node)
+{
+    char *left;
+    if (!node) {
+        return NULL;
+    }
+    memcpy(&left, node + node_left_child_offset, ptr_size);
+    while (left) {
+        node = left;
+        memcpy(&left, node + node_left_child_offset, ptr_size);
+    }
+    return node;
+}
+
+/*
+ * Gets the node with the highest key in the subtree, or NULL if it is empty.
+ */
+static char *map_rightmost(char *node)
+{
+    char *right;
+    if (!node) {
+        return NULL;
+    }
+    memcpy(&right, node + node_right_child_offset, ptr_size);
+    while (right) {
+        node = right;
+        memcpy(&right, node + node_right_child_offset, ptr_size);
+    }
+    return node;
+}
+
+/*
+ * Gets the node with the next higher key, or NULL if there is none. Only the
+ * links around the node are followed, so walking the whole tree this way
+ * visits each link at most twice.
+ */
+static char *map_successor(char *node)
+{
+    char *right;
+    char *parent;
+    memcpy(&right, node + node_right_child_offset, ptr_size);
+    if (right) {
+        return map_leftmost(right);
+    }
+    memcpy(&parent, node + node_parent_offset, ptr_size);
+    while (parent) {
+        char *parent_right;
+        memcpy(&parent_right, parent + node_right_child_offset, ptr_size);
+        if (parent_right != node) {
+            return parent;
+        }
+        node = parent;
+        memcpy(&parent, node + node_parent_offset, ptr_size);
+    }
+    return NULL;
+}
+
+/*
+ * Gets the node with the next lower key, or NULL if there is none.
+ */
+static char *map_predecessor(char *node)
+{
+    char *left;
+    char *parent;
+    memcpy(&left, node + node_left_child_offset, ptr_size);
+    if (left) {
+        return map_rightmost(left);
+    }
+    memcpy(&parent, node + node_parent_offset, ptr_size);
+    while (parent) {
+        char *parent_left;
+        memcpy(&parent_left, parent + node_left_child_offset, ptr_size);
+        if (parent_left != node) {
+            return parent;
+        }
+        node = parent;
+        memcpy(&parent, node + node_parent_offset, ptr_size);
+    }
+    return NULL;
+}
+
+/*
+ * Gets the node with the lowest key which is not less than the key, or NULL if
+ * there is none.
+ */
+static char *map_ceiling_node(map me, const void *const key)
+{
+    char *ret = NULL;
+    char *traverse = me->root;
+    while (traverse) {
+        const int compare = map_compare(me, traverse + node_key_offset, key);
+        if (compare >= 0) {
+            ret = traverse;
+            memcpy(&traverse, traverse + node_left_child_offset, ptr_size);
+        } else {
+            memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
+        }
+    }
+    return ret;
+}
+
 /**
  * Returns the first (lowest) key in this map. The returned key is a pointer to
  * the internally stored key, which should not be modified. Modifying it results
@@ -783,7 +1428,7 @@ void *map_lower(map me, void *const key)
     char *ret = NULL;
     char *traverse = me->root;
     while (traverse) {
-        const int compare = me->comparator(traverse + node_key_offset, key);
+        const int compare = map_compare(me, traverse + node_key_offset, key);
         if (compare < 0) {
             ret = traverse + node_key_offset;
             memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
@@ -809,7 +1454,7 @@ void *map_higher(map me, void *const key)
     char *ret = NULL;
     char *traverse = me->root;
     while (traverse) {
-        const int compare = me->comparator(traverse + node_key_offset, key);
+        const int compare = map_compare(me, traverse + node_key_offset, key);
         if (compare > 0) {
             ret = traverse + node_key_offset;
             memcpy(&traverse, traverse + node_left_child_offset, ptr_size);
@@ -835,7 +1480,7 @@ void *map_floor(map me, void *const key)
     char *ret = NULL;
     char *traverse = me->root;
     while (traverse) {
-        const int compare = me->comparator(traverse + node_key_offset, key);
+        const int compare = map_compare(me, traverse + node_key_offset, key);
         if (compare <= 0) {
             ret = traverse + node_key_offset;
             memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
@@ -858,18 +1503,348 @@ void *map_floor(map me, void *const key)
  */
 void *map_ceiling(map me, void *const key)
 {
-    char *ret = NULL;
+    char *const node = map_ceiling_node(me, key);
+    if (!node) {
+        return NULL;
+    }
+    return node + node_key_offset;
+}
+
+/**
+ * Returns the key at the given position in the order of the map, so that the
+ * lowest key is at position zero. The returned key is a pointer to the
+ * internally stored key, which should not be modified. Modifying it results in
+ * undefined behaviour. This takes logarithmic time if the map keeps order
+ * statistics, otherwise it takes linear time.
+ *
+ * @param me    the map to get the key from
+ * @param index the position of the key
+ *
+ * @return the key at the position, or NULL if the index is out of bounds
+ */
+void *map_select(map me, size_t index)
+{
+    char *traverse = me->root;
+    if (index >= me->size) {
+        return NULL;
+    }
+    if (!me->order_statistics) {
+        traverse = map_leftmost(traverse);
+        for (; index > 0; index--) {
+            traverse = map_successor(traverse);
+        }
+        return traverse + node_key_offset;
+    }
+    for (;;) {
+        char *traverse_left;
+        size_t left_size;
+        memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
+        left_size = map_subtree_size(me, traverse_left);
+        if (index < left_size) {
+            traverse = traverse_left;
+        } else if (index == left_size) {
+            return traverse + node_key_offset;
+        } else {
+            index -= left_size + 1;
+            memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
+        }
+    }
+}
+
+/**
+ * Determines the number of keys in the map which are lower than the given key,
+ * which is the position the key has, or would have, in the order of the map.
+ * This takes logarithmic time if the map keeps order statistics, otherwise it
+ * takes linear time.
+ *
+ * @param me  the map to rank the key in
+ * @param key the key to rank
+ *
+ * @return the number of keys which are lower than the key
+ */
+size_t map_rank(map me, void *const key)
+{
     char *traverse = me->root;
+    size_t rank = 0;
+    if (!me->order_statistics) {
+        traverse = map_leftmost(traverse);
+        while (traverse
+               && map_compare(me, traverse + node_key_offset, key) < 0) {
+            traverse = map_successor(traverse);
+            rank++;
+        }
+        return rank;
+    }
     while (traverse) {
-        const int compare = me->comparator(traverse + node_key_offset, key);
-        if (compare >= 0) {
-            ret = traverse + node_key_offset;
-            memcpy(&traverse, traverse + node_left_child_offset, ptr_size);
+        const int compare = map_compare(me, key, traverse + node_key_offset);
+        char *traverse_left;
+        memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
+        if (compare == 0) {
+            return rank + map_subtree_size(me, traverse_left);
+        }
+        if (compare < 0) {
+            traverse = traverse_left;
         } else {
+            rank += map_subtree_size(me, traverse_left) + 1;
             memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
         }
     }
-    return ret;
+    return rank;
+}
+
+/**
+ * Starts an in-order iteration over the map at its lowest key. Each step
+ * follows the links between the nodes instead of searching from the root, so
+ * walking k key-value pairs takes O(k) time. Adding key-value pairs, or
+ * removing ones other than the one which the iterator is at, does not
+ * invalidate the iterator.
+ *
+ * @param iter the iterator to set up
+ * @param me   the map to iterate over
+ */
+void map_iter_init(struct map_iter *const iter, map me)
+{
+    iter->map = me;
+    iter->node = map_leftmost(me->root);
+}
+
+/**
+ * Starts an in-order iteration over the map at its highest key, for iterating
+ * in descending order with map_iter_prev.
+ *
+ * @param iter the iterator to set up
+ * @param me   the map to iterate over
+ */
+void map_iter_init_last(struct map_iter *const iter, map me)
+{
+    iter->map = me;
+    iter->node = map_rightmost(me->root);
+}
+
+/**
+ * Starts an in-order iteration over the map at the lowest key which is not
+ * less than the specified key.
+ *
+ * @param iter the iterator to set up
+ * @param me   the map to iterate over
+ * @param key  the key to start at
+ */
+void map_iter_init_at(struct map_iter *const iter, map me, void *const key)
+{
+    iter->map = me;
+    iter->node = map_ceiling_node(me, key);
+}
+
+/**
+ * Gets the key-value pair which the iterator is at, and then moves the iterator
+ * to the next higher key. The key and the value point to where they are stored.
+ * The key must not be modified, but the value may be.
+ *
+ * @param key   set to the key of the key-value pair
+ * @param value set to the value of the key-value pair, unless it is NULL
+ * @param iter  the iterator to advance
+ *
+ * @return BK_TRUE if there was a key-value pair, otherwise BK_FALSE
+ */
+bk_bool map_iter_next(void **const key, void **const value,
+                      struct map_iter *const iter)
+{
+    char *const node = iter->node;
+    if (!node) {
+        return BK_FALSE;
+    }
+    *key = node + node_key_offset;
+    if (value) {
+        *value = node + iter->map->value_offset;
+    }
+    iter->node = map_successor(node);
+    return BK_TRUE;
+}
+
+/**
+ * Gets the key-value pair which the iterator is at, and then moves the iterator
+ * to the next lower key. The key and the value point to where they are stored.
+ * The key must not be modified, but the value may be.
+ *
+ * @param key   set to the key of the key-value pair
+ * @param value set to the value of the key-value pair, unless it is NULL
+ * @param iter  the iterator to move back
+ *
+ * @return BK_TRUE if there was a key-value pair, otherwise BK_FALSE
+ */
+bk_bool map_iter_prev(void **const key, void **const value,
+                      struct map_iter *const iter)
+{
+    char *const node = iter->node;
+    if (!node) {
+        return BK_FALSE;
+    }
+    *key = node + node_key_offset;
+    if (value) {
+        *value = node + iter->map->value_offset;
+    }
+    iter->node = map_predecessor(node);
+    return BK_TRUE;
+}
+
+/**
+ * Calls the callback on every key-value pair whose key is between the low and
+ * the high keys, inclusive, in ascending order. The map is only searched once,
+ * for the low key, so a scan of k key-value pairs costs O(log n + k) time. The
+ * callback must not add or remove key-value pairs, but it may modify the value.
+ *
+ * @param me       the map to scan
+ * @param low      the lowest key to visit
+ * @param high     the highest key to visit
+ * @param callback the function to call with the key, the value, and the context
+ * @param context  passed to each call of the callback
+ */
+void map_range(map me, void *const low, void *const high,
+               void (*const callback)(const void *const key, void *const value,
+                                      void *const context),
+               void *const context)
+{
+    char *node = map_ceiling_node(me, low);
+    while (node && map_compare(me, node + node_key_offset, high) <= 0) {
+        callback(node + node_key_offset,
+                 node + me->value_offset, context);
+        node = map_successor(node);
+    }
+}
+
+/*
+ * Frees every node of a subtree in linear time, without rebalancing. Child
+ * references are cut on the way down so that each node is freed after both of
+ * its children, and the parent references lead back up. The parent of the
+ * subtree root must be NULL.
+ */
+static void map_free_nodes(map me, char *traverse)
+{
+    while (traverse) {
+        char *next;
+        memcpy(&next, traverse + node_left_child_offset, ptr_size);
+        if (next) {
+            memset(traverse + node_left_child_offset, 0, ptr_size);
+            traverse = next;
+            continue;
+        }
+        memcpy(&next, traverse + node_right_child_offset, ptr_size);
+        if (next) {
+            memset(traverse + node_right_child_offset, 0, ptr_size);
+            traverse = next;
+            continue;
+        }
+        memcpy(&next, traverse + node_parent_offset, ptr_size);
+        map_deallocate(&me->allocator, traverse);
+        traverse = next;
+    }
+}
+
+/*
+ * Builds a balanced subtree out of the next count keys of the sorted input,
+ * taking the keys and values in order. The two subtrees of each node differ in
+ * size by at most one, so their heights differ by at most one as well.
+ */
+static bk_err map_build_sorted(map me, const char **const keys,
+                               const char **const values, const size_t count,
+                               char **const root, int *const height)
+{
+    char *left;
+    char *right;
+    char *node;
+    int left_height;
+    int right_height;
+    bk_err err;
+    if (count == 0) {
+        *root = NULL;
+        *height = 0;
+        return BK_OK;
+    }
+    err = map_build_sorted(me, keys, values, count / 2, &left, &left_height);
+    if (err != BK_OK) {
+        return err;
+    }
+    node = map_node_allocate(me, &me->nodes);
+    if (!node) {
+        map_free_nodes(me, left);
+        return -BK_ENOMEM;
+    }
+    memset(node + node_parent_offset, 0, ptr_size);
+    memcpy(node + node_left_child_offset, &left, ptr_size);
+    memset(node + node_right_child_offset, 0, ptr_size);
+    if (left) {
+        memcpy(left + node_parent_offset, &node, ptr_size);
+    }
+    memcpy(node + node_key_offset, *keys, me->key_size);
+    memcpy(node + me->value_offset, *values, me->value_size);
+    *keys += me->key_size;
+    *values += me->value_size;
+    err = map_build_sorted(me, keys, values, count - count / 2 - 1, &right,
+                           &right_height);
+    if (err != BK_OK) {
+        map_free_nodes(me, node);
+        return err;
+    }
+    memcpy(node + node_right_child_offset, &right, ptr_size);
+    if (right) {
+        memcpy(right + node_parent_offset, &node, ptr_size);
+    }
+    node[me->balance_offset] = (char) (right_height - left_height);
+    *root = node;
+    *height = (left_height > right_height ? left_height : right_height) + 1;
+    return BK_OK;
+}
+
+/**
+ * Initializes a map from keys which are already sorted in ascending order. The
+ * value at each index belongs to the key at the same index. Rather than putting
+ * each key-value pair, the tree is built balanced in linear time.
+ *
+ * @param key_size   the size of each key in the map; must be positive
+ * @param value_size the size of each value in the map; must be positive
+ * @param comparator the comparator function used for key ordering; must not be
+ *                   NULL
+ * @param keys       the keys to initialize the map with; must be strictly
+ *                   ascending according to the comparator
+ * @param values     the values to initialize the map with
+ * @param count      the number of key-value pairs
+ *
+ * @return the newly-initialized map, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+map map_init_from_sorted(const size_t key_size, const size_t value_size,
+                         int (*const comparator)(const void *const,
+                                                 const void *const),
+                         const void *const keys, const void *const values,
+                         const size_t count)
+{
+    size_t i;
+    int height;
+    const char *key_traverse = keys;
+    const char *value_traverse = values;
+    map me = map_init(key_size, value_size, comparator);
+    if (!me) {
+        return NULL;
+    }
+    if (count == 0) {
+        return me;
+    }
+    if (!keys || !values) {
+        return map_destroy(me);
+    }
+    for (i = 1; i < count; i++) {
+        if (comparator(key_traverse + (i - 1) * key_size,
+                       key_traverse + i * key_size) >= 0) {
+            return map_destroy(me);
+        }
+    }
+    if (map_build_sorted(me, &key_traverse, &value_traverse, count, &me->root,
+                         &height) != BK_OK) {
+        return map_destroy(me);
+    }
+    me->size = count;
+    return me;
 }
 
 /**
@@ -879,9 +1854,13 @@ void *map_ceiling(map me, void *const key)
  */
 void map_clear(map me)
 {
-    while (me->root) {
-        map_remove_element(me, me->root);
+    if (me->nodes.in_use) {
+        map_pool_release(me, &me->nodes);
+    } else {
+        map_free_nodes(me, me->root);
     }
+    me->root = NULL;
+    me->size = 0;
 }
 
 /**
@@ -897,7 +1876,7 @@ map map_destroy(map me)
 {
     if (me) {
         map_clear(me);
-        free(me);
+        map_deallocate(&me->allocator, me);
     }
     return NULL;
 }
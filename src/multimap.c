@@ -23,6 +23,28 @@
 #include <string.h>
 #include "include/multimap.h"
 
+#define BKTHOMPS_MULTIMAP_POOL_SLAB_NODES 64
+
+/*
+ * A pool hands out nodes of one size. Nodes are carved out of slabs, and nodes
+ * which are given back are kept on a free list to be handed out again, so that
+ * the multi-map does not call the allocator for every insertion and removal.
+ * The slabs are only released when the multi-map is cleared or destroyed.
+ */
+struct multimap_node_pool {
+    size_t node_size;
+    bk_bool in_use;
+    char *slabs;
+    char *free_nodes;
+};
+
+#ifdef BK_STATS
+#define BKTHOMPS_MULTIMAP_STAT(me, counter, amount) \
+    ((me)->stats.counter += (amount))
+#else
+#define BKTHOMPS_MULTIMAP_STAT(me, counter, amount) ((void) 0)
+#endif
+
 struct internal_multimap {
     size_t size;
     size_t key_size;
@@ -30,20 +52,61 @@ struct internal_multimap {
     int (*key_comparator)(const void *const one, const void *const two);
     int (*value_comparator)(const void *const one, const void *const two);
     char *root;
+    size_t balance_offset;
     char *iterate_get;
+    struct multimap_node_pool nodes;
+    struct multimap_node_pool value_nodes;
+#ifdef BK_STATS
+    struct bk_stats stats;
+#endif
+    struct bk_allocator allocator;
 };
 
 static const size_t ptr_size = sizeof(char *);
 static const size_t count_size = sizeof(size_t);
-/* Node balance is always the first byte (at index 0). */
-static const size_t node_value_count_offset = sizeof(signed char);
-static const size_t node_value_head_offset = 1 + sizeof(size_t);
-static const size_t node_parent_offset = 1 + sizeof(size_t) + sizeof(char *);
-static const size_t node_left_child_offset =
-        1 + sizeof(size_t) + 2 * sizeof(char *);
-static const size_t node_right_child_offset =
-        1 + sizeof(size_t) + 3 * sizeof(char *);
-static const size_t node_key_offset = 1 + sizeof(size_t) + 4 * sizeof(char *);
+
+/*
+ * Used when the multi-map is initialized without an allocator. Its function
+ * pointers are all NULL, which means memory is managed by the standard library.
+ */
+static const struct bk_allocator multimap_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the multi-map.
+ */
+static void *multimap_allocate(const struct bk_allocator *const allocator,
+                               const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Frees memory with the allocator of the multi-map.
+ */
+static void multimap_deallocate(const struct bk_allocator *const allocator,
+                                void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+ * The links and the value count come first, so that they and the key are
+ * aligned to a pointer boundary. Node balance is always the last byte, at
+ * balance_offset.
+ */
+static const size_t node_parent_offset = 0;
+static const size_t node_left_child_offset = sizeof(char *);
+static const size_t node_right_child_offset = 2 * sizeof(char *);
+static const size_t node_value_head_offset = 3 * sizeof(char *);
+static const size_t node_value_count_offset = 4 * sizeof(char *);
+static const size_t node_key_offset = 4 * sizeof(char *) + sizeof(size_t);
 
 static const size_t value_node_next_offset = 0;
 static const size_t value_node_value_offset = sizeof(char *);
@@ -67,6 +130,36 @@ multimap multimap_init(const size_t key_size, const size_t value_size,
                                                    const void *const),
                        int (*const value_comparator)(const void *const,
                                                      const void *const))
+{
+    return multimap_init_with_allocator(key_size, value_size, key_comparator,
+                                        value_comparator, NULL);
+}
+
+/**
+ * Initializes a multi-map, which manages its memory with the given allocator.
+ *
+ * @param key_size         the size of each key in the multi-map; must be
+ *                         positive
+ * @param value_size       the size of each value in the multi-map; must be
+ *                         positive
+ * @param key_comparator   the key comparator function; must not be NULL
+ * @param value_comparator the value comparator function; must not be NULL
+ * @param allocator        the allocator which manages the memory of the
+ *                         multi-map, or NULL to use the standard library; if
+ *                         not NULL, its allocate and deallocate functions must
+ *                         not be NULL
+ *
+ * @return the newly-initialized multi-map, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+multimap
+multimap_init_with_allocator(const size_t key_size, const size_t value_size,
+                             int (*const key_comparator)(const void *const,
+                                                         const void *const),
+                             int (*const value_comparator)(const void *const,
+                                                           const void *const),
+                             const struct bk_allocator *allocator)
 {
     struct internal_multimap *init;
     if (key_size == 0 || value_size == 0
@@ -76,13 +169,32 @@ multimap multimap_init(const size_t key_size, const size_t value_size,
     if (ptr_size + value_size < ptr_size) {
         return NULL;
     }
-    if (node_key_offset + key_size < node_key_offset) {
+    if (!allocator) {
+        allocator = &multimap_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
+        return NULL;
+    }
+    if (node_key_offset + key_size + 1 <= node_key_offset) {
         return NULL;
     }
-    init = malloc(sizeof *init);
+    init = multimap_allocate(allocator, sizeof *init);
     if (!init) {
         return NULL;
     }
+    init->allocator = *allocator;
+#ifdef BK_STATS
+    memset(&init->stats, 0, sizeof init->stats);
+#endif
+    BKTHOMPS_MULTIMAP_STAT(init, bytes_allocated, sizeof *init);
+    init->balance_offset = node_key_offset + key_size;
+    init->nodes.node_size = init->balance_offset + 1;
+    init->nodes.in_use = BK_FALSE;
+    init->nodes.slabs = NULL;
+    init->nodes.free_nodes = NULL;
+    init->value_nodes.node_size = value_node_value_offset + value_size;
+    init->value_nodes.in_use = BK_FALSE;
+    init->value_nodes.slabs = NULL;
+    init->value_nodes.free_nodes = NULL;
     init->size = 0;
     init->key_size = key_size;
     init->value_size = value_size;
@@ -117,6 +229,64 @@ bk_bool multimap_is_empty(multimap me)
     return multimap_size(me) == 0;
 }
 
+/**
+ * Makes the multi-map allocate its nodes from a pool of slabs, rather than
+ * allocating each node individually. Removed nodes are kept by the pool to be
+ * reused, and the slabs are released all at once when the multi-map is cleared
+ * or destroyed. The pool may only be enabled while the multi-map is empty.
+ *
+ * @param me the multi-map to allocate nodes from a pool for
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_EINVAL if the multi-map is not empty
+ */
+bk_err multimap_use_node_pool(multimap me)
+{
+    if (!multimap_is_empty(me)) {
+        return -BK_EINVAL;
+    }
+    me->nodes.in_use = BK_TRUE;
+    me->value_nodes.in_use = BK_TRUE;
+    return BK_OK;
+}
+
+/**
+ * Gets the statistics of the multi-map. They are only tracked if the library is
+ * compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the multi-map to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void multimap_get_stats(multimap me, struct bk_stats *const stats)
+{
+#ifdef BK_STATS
+    *stats = me->stats;
+#else
+    (void) me;
+    memset(stats, 0, sizeof *stats);
+#endif
+}
+
+/*
+ * Compares two keys with the key comparator, counting the call.
+ */
+static int multimap_compare_keys(multimap me, const void *const one,
+                                 const void *const two)
+{
+    BKTHOMPS_MULTIMAP_STAT(me, comparator_calls, 1);
+    return me->key_comparator(one, two);
+}
+
+/*
+ * Compares two values with the value comparator, counting the call.
+ */
+static int multimap_compare_values(multimap me, const void *const one,
+                                   const void *const two)
+{
+    BKTHOMPS_MULTIMAP_STAT(me, comparator_calls, 1);
+    return me->value_comparator(one, two);
+}
+
 /*
  * Resets the parent reference.
  */
@@ -147,6 +317,7 @@ static void multimap_rotate_left(multimap me, char *const parent,
                                  char *const child)
 {
     char *left_grand_child;
+    BKTHOMPS_MULTIMAP_STAT(me, rotations, 1);
     multimap_reference_parent(me, parent, child);
     memcpy(&left_grand_child, child + node_left_child_offset, ptr_size);
     if (left_grand_child) {
@@ -164,6 +335,7 @@ static void multimap_rotate_right(multimap me, char *const parent,
                                   char *const child)
 {
     char *right_grand_child;
+    BKTHOMPS_MULTIMAP_STAT(me, rotations, 1);
     multimap_reference_parent(me, parent, child);
     memcpy(&right_grand_child, child + node_right_child_offset, ptr_size);
     if (right_grand_child) {
@@ -181,12 +353,12 @@ static char *multimap_repair_left(multimap me, char *const parent,
                                   char *const child)
 {
     multimap_rotate_left(me, parent, child);
-    if (child[0] == 0) {
-        parent[0] = 1;
-        child[0] = -1;
+    if (child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = 1;
+        child[me->balance_offset] = -1;
     } else {
-        parent[0] = 0;
-        child[0] = 0;
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     }
     return child;
 }
@@ -198,12 +370,12 @@ static char *multimap_repair_right(multimap me, char *const parent,
                                    char *const child)
 {
     multimap_rotate_right(me, parent, child);
-    if (child[0] == 0) {
-        parent[0] = -1;
-        child[0] = 1;
+    if (child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = -1;
+        child[me->balance_offset] = 1;
     } else {
-        parent[0] = 0;
-        child[0] = 0;
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     }
     return child;
 }
@@ -217,17 +389,17 @@ static char *multimap_repair_left_right(multimap me, char *const parent,
 {
     multimap_rotate_left(me, child, grand_child);
     multimap_rotate_right(me, parent, grand_child);
-    if (grand_child[0] == 1) {
-        parent[0] = 0;
-        child[0] = -1;
-    } else if (grand_child[0] == 0) {
-        parent[0] = 0;
-        child[0] = 0;
+    if (grand_child[me->balance_offset] == 1) {
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = -1;
+    } else if (grand_child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     } else {
-        parent[0] = 1;
-        child[0] = 0;
+        parent[me->balance_offset] = 1;
+        child[me->balance_offset] = 0;
     }
-    grand_child[0] = 0;
+    grand_child[me->balance_offset] = 0;
     return grand_child;
 }
 
@@ -240,17 +412,17 @@ static char *multimap_repair_right_left(multimap me, char *const parent,
 {
     multimap_rotate_right(me, child, grand_child);
     multimap_rotate_left(me, parent, grand_child);
-    if (grand_child[0] == 1) {
-        parent[0] = -1;
-        child[0] = 0;
-    } else if (grand_child[0] == 0) {
-        parent[0] = 0;
-        child[0] = 0;
+    if (grand_child[me->balance_offset] == 1) {
+        parent[me->balance_offset] = -1;
+        child[me->balance_offset] = 0;
+    } else if (grand_child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     } else {
-        parent[0] = 0;
-        child[0] = 1;
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 1;
     }
-    grand_child[0] = 0;
+    grand_child[me->balance_offset] = 0;
     return grand_child;
 }
 
@@ -261,13 +433,13 @@ static char *multimap_repair_right_left(multimap me, char *const parent,
 static char *multimap_repair(multimap me, char *const parent,
                              char *const child, char *const grand_child)
 {
-    if (parent[0] == 2) {
-        if (child[0] == -1) {
+    if (parent[me->balance_offset] == 2) {
+        if (child[me->balance_offset] == -1) {
             return multimap_repair_right_left(me, parent, child, grand_child);
         }
         return multimap_repair_left(me, parent, child);
     }
-    if (child[0] == 1) {
+    if (child[me->balance_offset] == 1) {
         return multimap_repair_left_right(me, parent, child, grand_child);
     }
     return multimap_repair_right(me, parent, child);
@@ -286,16 +458,16 @@ static void multimap_insert_balance(multimap me, char *const item)
         char *parent_left;
         memcpy(&parent_left, parent + node_left_child_offset, ptr_size);
         if (parent_left == child) {
-            parent[0]--;
+            parent[me->balance_offset]--;
         } else {
-            parent[0]++;
+            parent[me->balance_offset]++;
         }
         /* If balance is zero after modification, then the tree is balanced. */
-        if (parent[0] == 0) {
+        if (parent[me->balance_offset] == 0) {
             return;
         }
         /* Must re-balance if not in {-1, 0, 1} */
-        if (parent[0] > 1 || parent[0] < -1) {
+        if (parent[me->balance_offset] > 1 || parent[me->balance_offset] < -1) {
             /* After one repair, the tree is balanced. */
             multimap_repair(me, parent, child, grand_child);
             return;
@@ -306,12 +478,92 @@ static void multimap_insert_balance(multimap me, char *const item)
     }
 }
 
+/*
+ * Adds a slab to the node pool, and puts all of its nodes on the free list.
+ * Each node starts on a pointer boundary.
+ */
+static bk_err multimap_pool_grow(multimap me,
+                                 struct multimap_node_pool *const pool)
+{
+    size_t i;
+    char *slab;
+    const size_t stride =
+            (pool->node_size + ptr_size - 1) / ptr_size * ptr_size;
+    const size_t slab_nodes = BKTHOMPS_MULTIMAP_POOL_SLAB_NODES;
+    if (stride < pool->node_size
+        || stride > ((size_t) -1 - ptr_size) / slab_nodes) {
+        return -BK_ENOMEM;
+    }
+    BKTHOMPS_MULTIMAP_STAT(me, bytes_allocated, ptr_size + slab_nodes * stride);
+    slab = multimap_allocate(&me->allocator, ptr_size + slab_nodes * stride);
+    if (!slab) {
+        return -BK_ENOMEM;
+    }
+    memcpy(slab, &pool->slabs, ptr_size);
+    pool->slabs = slab;
+    for (i = slab_nodes; i > 0; i--) {
+        char *const node = slab + ptr_size + (i - 1) * stride;
+        memcpy(node, &pool->free_nodes, ptr_size);
+        pool->free_nodes = node;
+    }
+    return BK_OK;
+}
+
+/*
+ * Releases every slab of the node pool at once. All the nodes of the pool must
+ * no longer be in use.
+ */
+static void multimap_pool_release(multimap me,
+                                  struct multimap_node_pool *const pool)
+{
+    while (pool->slabs) {
+        char *const slab = pool->slabs;
+        memcpy(&pool->slabs, slab, ptr_size);
+        multimap_deallocate(&me->allocator, slab);
+    }
+    pool->free_nodes = NULL;
+}
+
+/*
+ * Allocates a node, taking it from the node pool if the pool is in use.
+ */
+static char *multimap_node_allocate(multimap me,
+                                    struct multimap_node_pool *const pool)
+{
+    char *node;
+    if (!pool->in_use) {
+        BKTHOMPS_MULTIMAP_STAT(me, bytes_allocated, pool->node_size);
+        return multimap_allocate(&me->allocator, pool->node_size);
+    }
+    if (!pool->free_nodes && multimap_pool_grow(me, pool) != BK_OK) {
+        return NULL;
+    }
+    node = pool->free_nodes;
+    memcpy(&pool->free_nodes, node, ptr_size);
+    return node;
+}
+
+/*
+ * Frees a node, giving it back to the node pool if the pool is in use.
+ */
+static void multimap_node_deallocate(multimap me,
+                                     struct multimap_node_pool *const pool,
+                                     char *const node)
+{
+    if (!pool->in_use) {
+        multimap_deallocate(&me->allocator, node);
+        return;
+    }
+    memcpy(node, &pool->free_nodes, ptr_size);
+    pool->free_nodes = node;
+}
+
 /*
  * Creates and allocates a value node.
  */
 static char *multimap_create_value_node(multimap me, const void *const value)
 {
-    char *const add = malloc(ptr_size + me->value_size);
+    char *const add = multimap_node_allocate(me, &me->value_nodes);
     if (!add) {
         return NULL;
     }
@@ -326,7 +578,7 @@ static char *multimap_create_value_node(multimap me, const void *const value)
 static char *multimap_create_node(multimap me, const void *const key,
                                   const void *const value, char *const parent)
 {
-    char *const insert = malloc(1 + count_size + 4 * ptr_size + me->key_size);
+    char *const insert = multimap_node_allocate(me, &me->nodes);
     const size_t one = 1;
     char *value_node;
     if (!insert) {
@@ -334,10 +586,10 @@ static char *multimap_create_node(multimap me, const void *const key,
     }
     value_node = multimap_create_value_node(me, value);
     if (!value_node) {
-        free(insert);
+        multimap_node_deallocate(me, &me->nodes, insert);
         return NULL;
     }
-    insert[0] = 0;
+    insert[me->balance_offset] = 0;
     memcpy(insert + node_value_count_offset, &one, count_size);
     memcpy(insert + node_value_head_offset, &value_node, ptr_size);
     memcpy(insert + node_parent_offset, &parent, ptr_size);
@@ -377,7 +629,8 @@ bk_err multimap_put(multimap me, void *const key, void *const value)
     }
     traverse = me->root;
     for (;;) {
-        const int compare = me->key_comparator(key, traverse + node_key_offset);
+        const int compare =
+                multimap_compare_keys(me, key, traverse + node_key_offset);
         if (compare < 0) {
             char *traverse_left;
             memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
@@ -443,7 +696,8 @@ static char *multimap_equal_match(multimap me, const void *const key)
         return NULL;
     }
     for (;;) {
-        const int compare = me->key_comparator(key, traverse + node_key_offset);
+        const int compare =
+                multimap_compare_keys(me, key, traverse + node_key_offset);
         if (compare < 0) {
             char *traverse_left;
             memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
@@ -573,7 +827,7 @@ static char *multimap_repair_pivot(multimap me, char *const item,
     child = is_left_pivot ? item_right : item_left;
     memcpy(&child_right, child + node_right_child_offset, ptr_size);
     memcpy(&child_left, child + node_left_child_offset, ptr_size);
-    grand_child = child[0] == 1 ? child_right : child_left;
+    grand_child = child[me->balance_offset] == 1 ? child_right : child_left;
     return multimap_repair(me, item, child, grand_child);
 }
 
@@ -589,21 +843,23 @@ static void multimap_trace_ancestors(multimap me, char *item)
         char *parent_left;
         memcpy(&parent_left, parent + node_left_child_offset, ptr_size);
         if (parent_left == child) {
-            parent[0]++;
+            parent[me->balance_offset]++;
         } else {
-            parent[0]--;
+            parent[me->balance_offset]--;
         }
         /* The tree is balanced if balance is -1 or +1 after modification. */
-        if (parent[0] == -1 || parent[0] == 1) {
+        if (parent[me->balance_offset] == -1
+            || parent[me->balance_offset] == 1) {
             return;
         }
         /* Must re-balance if not in {-1, 0, 1} */
-        if (parent[0] > 1 || parent[0] < -1) {
+        if (parent[me->balance_offset] > 1 || parent[me->balance_offset] < -1) {
             child = multimap_repair_pivot(me, parent, parent_left == child);
             memcpy(&parent, child + node_parent_offset, ptr_size);
             /* If balance is -1 or +1 after modification or   */
             /* the parent is NULL, then the tree is balanced. */
-            if (!parent || child[0] == -1 || child[0] == 1) {
+            if (!parent || child[me->balance_offset] == -1
+                || child[me->balance_offset] == 1) {
                 return;
             }
         } else {
@@ -620,20 +876,21 @@ static void multimap_delete_balance(multimap me, char *item,
                                     const int is_left_deleted)
 {
     if (is_left_deleted) {
-        item[0]++;
+        item[me->balance_offset]++;
     } else {
-        item[0]--;
+        item[me->balance_offset]--;
     }
     /* If balance is -1 or +1 after modification, then the tree is balanced. */
-    if (item[0] == -1 || item[0] == 1) {
+    if (item[me->balance_offset] == -1 || item[me->balance_offset] == 1) {
         return;
     }
     /* Must re-balance if not in {-1, 0, 1} */
-    if (item[0] > 1 || item[0] < -1) {
+    if (item[me->balance_offset] > 1 || item[me->balance_offset] < -1) {
         char *item_parent;
         item = multimap_repair_pivot(me, item, is_left_deleted);
         memcpy(&item_parent, item + node_parent_offset, ptr_size);
-        if (!item_parent || item[0] == -1 || item[0] == 1) {
+        if (!item_parent || item[me->balance_offset] == -1
+            || item[me->balance_offset] == 1) {
             return;
         }
     }
@@ -741,7 +998,7 @@ static void multimap_remove_two_children(multimap me,
         char *item_left;
         memcpy(&item, traverse + node_right_child_offset, ptr_size);
         parent = item;
-        item[0] = traverse[0];
+        item[me->balance_offset] = traverse[me->balance_offset];
         memcpy(item + node_parent_offset, traverse + node_parent_offset,
                ptr_size);
         memcpy(item + node_left_child_offset, traverse + node_left_child_offset,
@@ -758,7 +1015,7 @@ static void multimap_remove_two_children(multimap me,
             memcpy(&item_left, item + node_left_child_offset, ptr_size);
         }
         memcpy(&parent, item + node_parent_offset, ptr_size);
-        item[0] = traverse[0];
+        item[me->balance_offset] = traverse[me->balance_offset];
         memcpy(&item_parent, item + node_parent_offset, ptr_size);
         memcpy(item_parent + node_left_child_offset,
                item + node_right_child_offset, ptr_size);
@@ -811,7 +1068,7 @@ static void multimap_remove_element(multimap me, char *const traverse)
     } else {
         multimap_remove_two_children(me, traverse);
     }
-    free(traverse);
+    multimap_node_deallocate(me, &me->nodes, traverse);
 }
 
 /**
@@ -837,15 +1094,16 @@ bk_bool multimap_remove(multimap me, void *const key, void *const value)
         return BK_FALSE;
     }
     memcpy(&current_value_node, traverse + node_value_head_offset, ptr_size);
-    if (me->value_comparator(current_value_node + value_node_value_offset,
-                             value) == 0) {
+    if (multimap_compare_values(me,
+                                current_value_node + value_node_value_offset,
+                                value) == 0) {
         memcpy(traverse + node_value_head_offset,
                current_value_node + value_node_next_offset, ptr_size);
     } else {
         char *previous_value_node = current_value_node;
         memcpy(&current_value_node, current_value_node + value_node_next_offset,
                ptr_size);
-        while (current_value_node && me->value_comparator(
+        while (current_value_node && multimap_compare_values(me,
                 current_value_node + value_node_value_offset, value) != 0) {
             previous_value_node = current_value_node;
             memcpy(&current_value_node,
@@ -857,7 +1115,7 @@ bk_bool multimap_remove(multimap me, void *const key, void *const value)
         memcpy(previous_value_node + value_node_next_offset,
                current_value_node + value_node_next_offset, ptr_size);
     }
-    free(current_value_node);
+    multimap_node_deallocate(me, &me->value_nodes, current_value_node);
     memcpy(&count, traverse + node_value_count_offset, count_size);
     if (count == 1) {
         multimap_remove_element(me, traverse);
@@ -881,7 +1139,7 @@ static void multimap_remove_all_elements(multimap me, char *const traverse)
         char *const temp = value_traverse;
         memcpy(&value_traverse, value_traverse + value_node_next_offset,
                ptr_size);
-        free(temp);
+        multimap_node_deallocate(me, &me->value_nodes, temp);
     }
     memcpy(&value_count, traverse + node_value_count_offset, count_size);
     me->size -= value_count;
@@ -910,6 +1168,111 @@ bk_bool multimap_remove_all(multimap me, void *const key)
     return BK_TRUE;
 }
 
+/*
+ * Gets the node with the lowest key in the subtree, or NULL if it is empty.
+ */
+static char *multimap_leftmost(char *node)
+{
+    char *left;
+    if (!node) {
+        return NULL;
+    }
+    memcpy(&left, node + node_left_child_offset, ptr_size);
+    while (left) {
+        node = left;
+        memcpy(&left, node + node_left_child_offset, ptr_size);
+    }
+    return node;
+}
+
+/*
+ * Gets the node with the highest key in the subtree, or NULL if it is empty.
+ */
+static char *multimap_rightmost(char *node)
+{
+    char *right;
+    if (!node) {
+        return NULL;
+    }
+    memcpy(&right, node + node_right_child_offset, ptr_size);
+    while (right) {
+        node = right;
+        memcpy(&right, node + node_right_child_offset, ptr_size);
+    }
+    return node;
+}
+
+/*
+ * Gets the node with the next higher key, or NULL if there is none. Only the
+ * links around the node are followed, so walking the whole tree this way
+ * visits each link at most twice.
+ */
+static char *multimap_successor(char *node)
+{
+    char *right;
+    char *parent;
+    memcpy(&right, node + node_right_child_offset, ptr_size);
+    if (right) {
+        return multimap_leftmost(right);
+    }
+    memcpy(&parent, node + node_parent_offset, ptr_size);
+    while (parent) {
+        char *parent_right;
+        memcpy(&parent_right, parent + node_right_child_offset, ptr_size);
+        if (parent_right != node) {
+            return parent;
+        }
+        node = parent;
+        memcpy(&parent, node + node_parent_offset, ptr_size);
+    }
+    return NULL;
+}
+
+/*
+ * Gets the node with the next lower key, or NULL if there is none.
+ */
+static char *multimap_predecessor(char *node)
+{
+    char *left;
+    char *parent;
+    memcpy(&left, node + node_left_child_offset, ptr_size);
+    if (left) {
+        return multimap_rightmost(left);
+    }
+    memcpy(&parent, node + node_parent_offset, ptr_size);
+    while (parent) {
+        char *parent_left;
+        memcpy(&parent_left, parent + node_left_child_offset, ptr_size);
+        if (parent_left != node) {
+            return parent;
+        }
+        node = parent;
+        memcpy(&parent, node + node_parent_offset, ptr_size);
+    }
+    return NULL;
+}
+
+/*
+ * Gets the node with the lowest key which is not less than the key, or NULL if
+ * there is none.
+ */
+static char *multimap_ceiling_node(multimap me, const void *const key)
+{
+    char *ret = NULL;
+    char *traverse = me->root;
+    while (traverse) {
+        const int compare =
+                multimap_compare_keys(me, traverse + node_key_offset, key);
+        if (compare >= 0) {
+            ret = traverse;
+            memcpy(&traverse, traverse + node_left_child_offset, ptr_size);
+        } else {
+            memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
+        }
+    }
+    return ret;
+}
+
 /**
  * Returns the first (lowest) key in this multi-map. The returned key is a
  * pointer to the internally stored key, which should not be modified. Modifying
@@ -972,7 +1335,8 @@ void *multimap_lower(multimap me, void *const key)
     char *ret = NULL;
     char *traverse = me->root;
     while (traverse) {
-        const int compare = me->key_comparator(traverse + node_key_offset, key);
+        const int compare =
+                multimap_compare_keys(me, traverse + node_key_offset, key);
         if (compare < 0) {
             ret = traverse + node_key_offset;
             memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
@@ -998,7 +1362,8 @@ void *multimap_higher(multimap me, void *const key)
     char *ret = NULL;
     char *traverse = me->root;
     while (traverse) {
-        const int compare = me->key_comparator(traverse + node_key_offset, key);
+        const int compare =
+                multimap_compare_keys(me, traverse + node_key_offset, key);
         if (compare > 0) {
             ret = traverse + node_key_offset;
             memcpy(&traverse, traverse + node_left_child_offset, ptr_size);
@@ -1024,7 +1389,8 @@ void *multimap_floor(multimap me, void *const key)
     char *ret = NULL;
     char *traverse = me->root;
     while (traverse) {
-        const int compare = me->key_comparator(traverse + node_key_offset, key);
+        const int compare =
+                multimap_compare_keys(me, traverse + node_key_offset, key);
         if (compare <= 0) {
             ret = traverse + node_key_offset;
             memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
@@ -1047,18 +1413,342 @@ void *multimap_floor(multimap me, void *const key)
  */
 void *multimap_ceiling(multimap me, void *const key)
 {
-    char *ret = NULL;
-    char *traverse = me->root;
+    char *const node = multimap_ceiling_node(me, key);
+    if (!node) {
+        return NULL;
+    }
+    return node + node_key_offset;
+}
+
+/*
+ * Moves the iterator to the first value of the node, or to the end if the node
+ * is NULL.
+ */
+static void multimap_iter_move(struct multimap_iter *const iter,
+                               char *const node)
+{
+    iter->node = node;
+    iter->value_node = NULL;
+    if (node) {
+        memcpy(&iter->value_node, node + node_value_head_offset, ptr_size);
+    }
+}
+
+/**
+ * Starts an in-order iteration over the multi-map at its lowest key. Every
+ * key-value pair is visited, and the values of each key are visited in the
+ * order in which they were added. Each step follows the links between the
+ * nodes instead of searching from the root, so walking k key-value pairs takes
+ * O(k) time. Adding key-value pairs, or removing ones other than the one which
+ * the iterator is at, does not invalidate the iterator.
+ *
+ * @param iter the iterator to set up
+ * @param me   the multi-map to iterate over
+ */
+void multimap_iter_init(struct multimap_iter *const iter, multimap me)
+{
+    iter->map = me;
+    multimap_iter_move(iter, multimap_leftmost(me->root));
+}
+
+/**
+ * Starts an in-order iteration over the multi-map at its highest key, for
+ * iterating in descending order of keys with multimap_iter_prev.
+ *
+ * @param iter the iterator to set up
+ * @param me   the multi-map to iterate over
+ */
+void multimap_iter_init_last(struct multimap_iter *const iter, multimap me)
+{
+    iter->map = me;
+    multimap_iter_move(iter, multimap_rightmost(me->root));
+}
+
+/**
+ * Starts an in-order iteration over the multi-map at the first value of the
+ * lowest key which is not less than the specified key.
+ *
+ * @param iter the iterator to set up
+ * @param me   the multi-map to iterate over
+ * @param key  the key to start at
+ */
+void multimap_iter_init_at(struct multimap_iter *const iter, multimap me,
+                           void *const key)
+{
+    iter->map = me;
+    multimap_iter_move(iter, multimap_ceiling_node(me, key));
+}
+
+/*
+ * Gets the key-value pair which the iterator is at, and then moves the iterator
+ * to the next value of the key, or else to the node which comes next.
+ */
+static bk_bool multimap_iter_step(void **const key, void **const value,
+                                  struct multimap_iter *const iter,
+                                  char *(*const step)(char *node))
+{
+    char *const value_node = iter->value_node;
+    char *next;
+    if (!value_node) {
+        return BK_FALSE;
+    }
+    *key = iter->node + node_key_offset;
+    if (value) {
+        *value = value_node + value_node_value_offset;
+    }
+    memcpy(&next, value_node + value_node_next_offset, ptr_size);
+    if (next) {
+        iter->value_node = next;
+    } else {
+        multimap_iter_move(iter, step(iter->node));
+    }
+    return BK_TRUE;
+}
+
+/**
+ * Gets the key-value pair which the iterator is at, and then moves the iterator
+ * to the next value of the same key, or else to the first value of the next
+ * higher key. The key and the value point to where they are stored. The key
+ * must not be modified, but the value may be.
+ *
+ * @param key   set to the key of the key-value pair
+ * @param value set to the value of the key-value pair, unless it is NULL
+ * @param iter  the iterator to advance
+ *
+ * @return BK_TRUE if there was a key-value pair, otherwise BK_FALSE
+ */
+bk_bool multimap_iter_next(void **const key, void **const value,
+                           struct multimap_iter *const iter)
+{
+    return multimap_iter_step(key, value, iter, multimap_successor);
+}
+
+/**
+ * Gets the key-value pair which the iterator is at, and then moves the iterator
+ * to the next value of the same key, or else to the first value of the next
+ * lower key. The key and the value point to where they are stored. The key
+ * must not be modified, but the value may be.
+ *
+ * @param key   set to the key of the key-value pair
+ * @param value set to the value of the key-value pair, unless it is NULL
+ * @param iter  the iterator to move back
+ *
+ * @return BK_TRUE if there was a key-value pair, otherwise BK_FALSE
+ */
+bk_bool multimap_iter_prev(void **const key, void **const value,
+                           struct multimap_iter *const iter)
+{
+    return multimap_iter_step(key, value, iter, multimap_predecessor);
+}
+
+/**
+ * Calls the callback on every key-value pair whose key is between the low and
+ * the high keys, inclusive, in ascending order of keys. The multi-map is only
+ * searched once, for the low key, so a scan of k key-value pairs costs
+ * O(log n + k) time. The callback must not add or remove key-value pairs, but
+ * it may modify the value.
+ *
+ * @param me       the multi-map to scan
+ * @param low      the lowest key to visit
+ * @param high     the highest key to visit
+ * @param callback the function to call with the key, the value, and the context
+ * @param context  passed to each call of the callback
+ */
+void multimap_range(multimap me, void *const low, void *const high,
+                    void (*const callback)(const void *const key,
+                                           void *const value,
+                                           void *const context),
+                    void *const context)
+{
+    char *node = multimap_ceiling_node(me, low);
+    while (node
+           && multimap_compare_keys(me, node + node_key_offset, high) <= 0) {
+        char *value_node;
+        memcpy(&value_node, node + node_value_head_offset, ptr_size);
+        while (value_node) {
+            callback(node + node_key_offset,
+                     value_node + value_node_value_offset, context);
+            memcpy(&value_node, value_node + value_node_next_offset, ptr_size);
+        }
+        node = multimap_successor(node);
+    }
+}
+
+/*
+ * Frees every node of a subtree in linear time, without rebalancing. Child
+ * references are cut on the way down so that each node is freed after both of
+ * its children, and the parent references lead back up. The parent of the
+ * subtree root must be NULL.
+ */
+static void multimap_free_nodes(multimap me, char *traverse)
+{
     while (traverse) {
-        const int compare = me->key_comparator(traverse + node_key_offset, key);
-        if (compare >= 0) {
-            ret = traverse + node_key_offset;
-            memcpy(&traverse, traverse + node_left_child_offset, ptr_size);
+        char *next;
+        memcpy(&next, traverse + node_left_child_offset, ptr_size);
+        if (next) {
+            memset(traverse + node_left_child_offset, 0, ptr_size);
+            traverse = next;
+            continue;
+        }
+        memcpy(&next, traverse + node_right_child_offset, ptr_size);
+        if (next) {
+            memset(traverse + node_right_child_offset, 0, ptr_size);
+            traverse = next;
+            continue;
+        }
+        memcpy(&next, traverse + node_value_head_offset, ptr_size);
+        while (next) {
+            char *const value_node = next;
+            memcpy(&next, next + value_node_next_offset, ptr_size);
+            multimap_deallocate(&me->allocator, value_node);
+        }
+        memcpy(&next, traverse + node_parent_offset, ptr_size);
+        multimap_deallocate(&me->allocator, traverse);
+        traverse = next;
+    }
+}
+
+/*
+ * Builds a balanced subtree out of the next count distinct keys of the sorted
+ * input, taking each run of equal keys as a single node whose values keep their
+ * input order. The two subtrees of each node differ in size by at most one, so
+ * their heights differ by at most one as well.
+ */
+static bk_err multimap_build_sorted(multimap me, const char **const keys,
+                                    const char **const values,
+                                    const char *const end, const size_t count,
+                                    char **const root, int *const height)
+{
+    char *left;
+    char *right;
+    char *node;
+    char *tail = NULL;
+    int left_height;
+    int right_height;
+    size_t value_count = 0;
+    bk_err err;
+    if (count == 0) {
+        *root = NULL;
+        *height = 0;
+        return BK_OK;
+    }
+    err = multimap_build_sorted(me, keys, values, end, count / 2, &left,
+                                &left_height);
+    if (err != BK_OK) {
+        return err;
+    }
+    node = multimap_node_allocate(me, &me->nodes);
+    if (!node) {
+        multimap_free_nodes(me, left);
+        return -BK_ENOMEM;
+    }
+    memset(node + node_value_count_offset, 0, count_size);
+    memset(node + node_value_head_offset, 0, ptr_size);
+    memset(node + node_parent_offset, 0, ptr_size);
+    memcpy(node + node_left_child_offset, &left, ptr_size);
+    memset(node + node_right_child_offset, 0, ptr_size);
+    if (left) {
+        memcpy(left + node_parent_offset, &node, ptr_size);
+    }
+    memcpy(node + node_key_offset, *keys, me->key_size);
+    do {
+        char *const value_node = multimap_create_value_node(me, *values);
+        if (!value_node) {
+            multimap_free_nodes(me, node);
+            return -BK_ENOMEM;
+        }
+        if (tail) {
+            memcpy(tail + value_node_next_offset, &value_node, ptr_size);
         } else {
-            memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
+            memcpy(node + node_value_head_offset, &value_node, ptr_size);
         }
+        tail = value_node;
+        value_count++;
+        memcpy(node + node_value_count_offset, &value_count, count_size);
+        *keys += me->key_size;
+        *values += me->value_size;
+    } while (*keys != end
+             && multimap_compare_keys(me, node + node_key_offset, *keys) == 0);
+    err = multimap_build_sorted(me, keys, values, end, count - count / 2 - 1,
+                                &right, &right_height);
+    if (err != BK_OK) {
+        multimap_free_nodes(me, node);
+        return err;
     }
-    return ret;
+    memcpy(node + node_right_child_offset, &right, ptr_size);
+    if (right) {
+        memcpy(right + node_parent_offset, &node, ptr_size);
+    }
+    node[me->balance_offset] = (char) (right_height - left_height);
+    *root = node;
+    *height = (left_height > right_height ? left_height : right_height) + 1;
+    return BK_OK;
+}
+
+/**
+ * Initializes a multi-map from keys which are already sorted in ascending
+ * order, where equal keys may repeat. The value at each index belongs to the
+ * key at the same index, and the values of equal keys keep their input order.
+ * Rather than putting each key-value pair, the tree is built balanced in linear
+ * time.
+ *
+ * @param key_size         the size of each key in the multi-map; must be
+ *                         positive
+ * @param value_size       the size of each value in the multi-map; must be
+ *                         positive
+ * @param key_comparator   the key comparator function; must not be NULL
+ * @param value_comparator the value comparator function; must not be NULL
+ * @param keys             the keys to initialize the multi-map with; must be in
+ *                         non-decreasing order according to the key comparator
+ * @param values           the values to initialize the multi-map with
+ * @param count            the number of key-value pairs
+ *
+ * @return the newly-initialized multi-map, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+multimap
+multimap_init_from_sorted(const size_t key_size, const size_t value_size,
+                          int (*const key_comparator)(const void *const,
+                                                      const void *const),
+                          int (*const value_comparator)(const void *const,
+                                                        const void *const),
+                          const void *const keys, const void *const values,
+                          const size_t count)
+{
+    size_t i;
+    size_t distinct = 1;
+    int height;
+    const char *key_traverse = keys;
+    const char *value_traverse = values;
+    multimap me = multimap_init(key_size, value_size, key_comparator,
+                                value_comparator);
+    if (!me) {
+        return NULL;
+    }
+    if (count == 0) {
+        return me;
+    }
+    if (!keys || !values) {
+        return multimap_destroy(me);
+    }
+    for (i = 1; i < count; i++) {
+        const int compare = key_comparator(key_traverse + (i - 1) * key_size,
+                                           key_traverse + i * key_size);
+        if (compare > 0) {
+            return multimap_destroy(me);
+        }
+        if (compare < 0) {
+            distinct++;
+        }
+    }
+    if (multimap_build_sorted(me, &key_traverse, &value_traverse,
+                              key_traverse + count * key_size, distinct,
+                              &me->root, &height) != BK_OK) {
+        return multimap_destroy(me);
+    }
+    me->size = count;
+    return me;
 }
 
 /**
@@ -1068,9 +1758,14 @@ void *multimap_ceiling(multimap me, void *const key)
  */
 void multimap_clear(multimap me)
 {
-    while (me->root) {
-        multimap_remove_all_elements(me, me->root);
+    if (me->nodes.in_use) {
+        multimap_pool_release(me, &me->nodes);
+        multimap_pool_release(me, &me->value_nodes);
+    } else {
+        multimap_free_nodes(me, me->root);
     }
+    me->root = NULL;
+    me->size = 0;
 }
 
 /**
@@ -1086,7 +1781,7 @@ multimap multimap_destroy(multimap me)
 {
     if (me) {
         multimap_clear(me);
-        free(me);
+        multimap_deallocate(&me->allocator, me);
     }
     return NULL;
 }
@@ -23,23 +23,88 @@
 #include <string.h>
 #include "include/multiset.h"
 
+#define BKTHOMPS_MULTISET_POOL_SLAB_NODES 64
+
+/*
+ * A pool hands out nodes of one size. Nodes are carved out of slabs, and nodes
+ * which are given back are kept on a free list to be handed out again, so that
+ * the multi-set does not call the allocator for every insertion and removal.
+ * The slabs are only released when the multi-set is cleared or destroyed.
+ */
+struct multiset_node_pool {
+    size_t node_size;
+    bk_bool in_use;
+    char *slabs;
+    char *free_nodes;
+};
+
+#ifdef BK_STATS
+#define BKTHOMPS_MULTISET_STAT(me, counter, amount) \
+    ((me)->stats.counter += (amount))
+#else
+#define BKTHOMPS_MULTISET_STAT(me, counter, amount) ((void) 0)
+#endif
+
 struct internal_multiset {
     size_t size;
     size_t key_size;
     int (*comparator)(const void *const one, const void *const two);
     char *root;
+    size_t balance_offset;
+    size_t subtree_size_offset;
+    bk_bool order_statistics;
+    struct multiset_node_pool nodes;
+#ifdef BK_STATS
+    struct bk_stats stats;
+#endif
+    struct bk_allocator allocator;
 };
 
 static const size_t ptr_size = sizeof(char *);
 static const size_t count_size = sizeof(size_t);
-/* Node balance is always the first byte (at index 0). */
-static const size_t node_count_offset = sizeof(signed char);
-static const size_t node_parent_offset = 1 + sizeof(size_t);
-static const size_t node_left_child_offset =
-        1 + sizeof(size_t) + sizeof(char *);
-static const size_t node_right_child_offset =
-        1 + sizeof(size_t) + 2 * sizeof(char *);
-static const size_t node_key_offset = 1 + sizeof(size_t) + 3 * sizeof(char *);
+
+/*
+ * Used when the multi-set is initialized without an allocator. Its function
+ * pointers are all NULL, which means memory is managed by the standard library.
+ */
+static const struct bk_allocator multiset_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the multi-set.
+ */
+static void *multiset_allocate(const struct bk_allocator *const allocator,
+                               const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Frees memory with the allocator of the multi-set.
+ */
+static void multiset_deallocate(const struct bk_allocator *const allocator,
+                                void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+ * The links and the count come first, so that they and the key are aligned to
+ * a pointer boundary. While order statistics are in use, the subtree size
+ * follows the key at subtree_size_offset, padded so that it is aligned. Node
+ * balance is always the last byte, at balance_offset.
+ */
+static const size_t node_parent_offset = 0;
+static const size_t node_left_child_offset = sizeof(char *);
+static const size_t node_right_child_offset = 2 * sizeof(char *);
+static const size_t node_count_offset = 3 * sizeof(char *);
+static const size_t node_key_offset = 3 * sizeof(char *) + sizeof(size_t);
 
 /**
  * Initializes a multi-set.
@@ -56,22 +121,62 @@ static const size_t node_key_offset = 1 + sizeof(size_t) + 3 * sizeof(char *);
 multiset multiset_init(const size_t key_size,
                        int (*const comparator)(const void *const,
                                                const void *const))
+{
+    return multiset_init_with_allocator(key_size, comparator, NULL);
+}
+
+/**
+ * Initializes a multi-set, which manages its memory with the given allocator.
+ *
+ * @param key_size   the size of each element in the multi-set; must be positive
+ * @param comparator the comparator function used for key ordering; must not be
+ *                   NULL
+ * @param allocator  the allocator which manages the memory of the multi-set, or
+ *                   NULL to use the standard library; if not NULL, its allocate
+ *                   and deallocate functions must not be NULL
+ *
+ * @return the newly-initialized multi-set, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+multiset
+multiset_init_with_allocator(const size_t key_size,
+                             int (*const comparator)(const void *const,
+                                                     const void *const),
+                             const struct bk_allocator *allocator)
 {
     struct internal_multiset *init;
     if (key_size == 0 || !comparator) {
         return NULL;
     }
-    if (node_key_offset + key_size < node_key_offset) {
+    if (!allocator) {
+        allocator = &multiset_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
+        return NULL;
+    }
+    if (node_key_offset + key_size + 1 <= node_key_offset) {
         return NULL;
     }
-    init = malloc(sizeof *init);
+    init = multiset_allocate(allocator, sizeof *init);
     if (!init) {
         return NULL;
     }
+    init->allocator = *allocator;
+#ifdef BK_STATS
+    memset(&init->stats, 0, sizeof init->stats);
+#endif
+    BKTHOMPS_MULTISET_STAT(init, bytes_allocated, sizeof *init);
+    init->balance_offset = node_key_offset + key_size;
+    init->subtree_size_offset = 0;
+    init->nodes.node_size = init->balance_offset + 1;
+    init->nodes.in_use = BK_FALSE;
+    init->nodes.slabs = NULL;
+    init->nodes.free_nodes = NULL;
     init->size = 0;
     init->key_size = key_size;
     init->comparator = comparator;
     init->root = NULL;
+    init->order_statistics = BK_FALSE;
     return init;
 }
 
@@ -99,6 +204,112 @@ bk_bool multiset_is_empty(multiset me)
     return multiset_size(me) == 0;
 }
 
+/**
+ * Makes the multi-set allocate its nodes from a pool of slabs, rather than
+ * allocating each node individually. Removed nodes are kept by the pool to be
+ * reused, and the slabs are released all at once when the multi-set is cleared
+ * or destroyed. The pool may only be enabled while the multi-set is empty.
+ *
+ * @param me the multi-set to allocate nodes from a pool for
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_EINVAL if the multi-set is not empty
+ */
+bk_err multiset_use_node_pool(multiset me)
+{
+    if (!multiset_is_empty(me)) {
+        return -BK_EINVAL;
+    }
+    me->nodes.in_use = BK_TRUE;
+    return BK_OK;
+}
+
+/**
+ * Gets the statistics of the multi-set. They are only tracked if the library is
+ * compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the multi-set to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void multiset_get_stats(multiset me, struct bk_stats *const stats)
+{
+#ifdef BK_STATS
+    *stats = me->stats;
+#else
+    (void) me;
+    memset(stats, 0, sizeof *stats);
+#endif
+}
+
+/*
+ * Compares two keys with the comparator, counting the call.
+ */
+static int multiset_compare(multiset me, const void *const one,
+                            const void *const two)
+{
+    BKTHOMPS_MULTISET_STAT(me, comparator_calls, 1);
+    return me->comparator(one, two);
+}
+
+/*
+ * Gets the number of keys in the subtree of the node, counting each occurrence
+ * of a key, which is stored after the key while order statistics are in use.
+ */
+static size_t multiset_subtree_size(multiset me, const char *const node)
+{
+    size_t size;
+    if (!node) {
+        return 0;
+    }
+    memcpy(&size, node + me->subtree_size_offset, count_size);
+    return size;
+}
+
+/*
+ * Sets the number of keys in the subtree of the node.
+ */
+static void multiset_store_subtree_size(multiset me, char *const node,
+                                        const size_t size)
+{
+    memcpy(node + me->subtree_size_offset, &size, count_size);
+}
+
+/*
+ * Recomputes the subtree size of the node from its count and the sizes of its
+ * children.
+ */
+static void multiset_resize_subtree(multiset me, char *const node)
+{
+    char *left;
+    char *right;
+    size_t count;
+    memcpy(&count, node + node_count_offset, count_size);
+    memcpy(&left, node + node_left_child_offset, ptr_size);
+    memcpy(&right, node + node_right_child_offset, ptr_size);
+    multiset_store_subtree_size(me, node, multiset_subtree_size(me, left)
+                                          + multiset_subtree_size(me, right)
+                                          + count);
+}
+
+/*
+ * Adds the amount to, or removes it from, the subtree size of each node
+ * starting at the given node and going up the tree until the end node is
+ * reached. The end node is not changed, and is NULL to go all the way up past
+ * the root.
+ */
+static void multiset_adjust_ancestors(multiset me, char *node,
+                                      const char *const end,
+                                      const size_t amount,
+                                      const bk_bool is_growing)
+{
+    while (node != end) {
+        const size_t size = multiset_subtree_size(me, node);
+        multiset_store_subtree_size(me, node, is_growing ? size + amount
+                                                         : size - amount);
+        memcpy(&node, node + node_parent_offset, ptr_size);
+    }
+}
+
 /*
  * Resets the parent reference.
  */
@@ -129,6 +340,7 @@ static void multiset_rotate_left(multiset me, char *const parent,
                                  char *const child)
 {
     char *left_grand_child;
+    BKTHOMPS_MULTISET_STAT(me, rotations, 1);
     multiset_reference_parent(me, parent, child);
     memcpy(&left_grand_child, child + node_left_child_offset, ptr_size);
     if (left_grand_child) {
@@ -137,6 +349,10 @@ static void multiset_rotate_left(multiset me, char *const parent,
     memcpy(parent + node_parent_offset, &child, ptr_size);
     memcpy(parent + node_right_child_offset, &left_grand_child, ptr_size);
     memcpy(child + node_left_child_offset, &parent, ptr_size);
+    if (me->order_statistics) {
+        multiset_resize_subtree(me, parent);
+        multiset_resize_subtree(me, child);
+    }
 }
 
 /*
@@ -146,6 +362,7 @@ static void multiset_rotate_right(multiset me, char *const parent,
                                   char *const child)
 {
     char *right_grand_child;
+    BKTHOMPS_MULTISET_STAT(me, rotations, 1);
     multiset_reference_parent(me, parent, child);
     memcpy(&right_grand_child, child + node_right_child_offset, ptr_size);
     if (right_grand_child) {
@@ -154,6 +371,10 @@ static void multiset_rotate_right(multiset me, char *const parent,
     memcpy(parent + node_parent_offset, &child, ptr_size);
     memcpy(parent + node_left_child_offset, &right_grand_child, ptr_size);
     memcpy(child + node_right_child_offset, &parent, ptr_size);
+    if (me->order_statistics) {
+        multiset_resize_subtree(me, parent);
+        multiset_resize_subtree(me, child);
+    }
 }
 
 /*
@@ -163,12 +384,12 @@ static char *multiset_repair_left(multiset me, char *const parent,
                                   char *const child)
 {
     multiset_rotate_left(me, parent, child);
-    if (child[0] == 0) {
-        parent[0] = 1;
-        child[0] = -1;
+    if (child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = 1;
+        child[me->balance_offset] = -1;
     } else {
-        parent[0] = 0;
-        child[0] = 0;
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     }
     return child;
 }
@@ -180,12 +401,12 @@ static char *multiset_repair_right(multiset me, char *const parent,
                                    char *const child)
 {
     multiset_rotate_right(me, parent, child);
-    if (child[0] == 0) {
-        parent[0] = -1;
-        child[0] = 1;
+    if (child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = -1;
+        child[me->balance_offset] = 1;
     } else {
-        parent[0] = 0;
-        child[0] = 0;
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     }
     return child;
 }
@@ -199,17 +420,17 @@ static char *multiset_repair_left_right(multiset me, char *const parent,
 {
     multiset_rotate_left(me, child, grand_child);
     multiset_rotate_right(me, parent, grand_child);
-    if (grand_child[0] == 1) {
-        parent[0] = 0;
-        child[0] = -1;
-    } else if (grand_child[0] == 0) {
-        parent[0] = 0;
-        child[0] = 0;
+    if (grand_child[me->balance_offset] == 1) {
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = -1;
+    } else if (grand_child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     } else {
-        parent[0] = 1;
-        child[0] = 0;
+        parent[me->balance_offset] = 1;
+        child[me->balance_offset] = 0;
     }
-    grand_child[0] = 0;
+    grand_child[me->balance_offset] = 0;
     return grand_child;
 }
 
@@ -222,17 +443,17 @@ static char *multiset_repair_right_left(multiset me, char *const parent,
 {
     multiset_rotate_right(me, child, grand_child);
     multiset_rotate_left(me, parent, grand_child);
-    if (grand_child[0] == 1) {
-        parent[0] = -1;
-        child[0] = 0;
-    } else if (grand_child[0] == 0) {
-        parent[0] = 0;
-        child[0] = 0;
+    if (grand_child[me->balance_offset] == 1) {
+        parent[me->balance_offset] = -1;
+        child[me->balance_offset] = 0;
+    } else if (grand_child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     } else {
-        parent[0] = 0;
-        child[0] = 1;
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 1;
     }
-    grand_child[0] = 0;
+    grand_child[me->balance_offset] = 0;
     return grand_child;
 }
 
@@ -243,13 +464,13 @@ static char *multiset_repair_right_left(multiset me, char *const parent,
 static char *multiset_repair(multiset me, char *const parent,
                              char *const child, char *const grand_child)
 {
-    if (parent[0] == 2) {
-        if (child[0] == -1) {
+    if (parent[me->balance_offset] == 2) {
+        if (child[me->balance_offset] == -1) {
             return multiset_repair_right_left(me, parent, child, grand_child);
         }
         return multiset_repair_left(me, parent, child);
     }
-    if (child[0] == 1) {
+    if (child[me->balance_offset] == 1) {
         return multiset_repair_left_right(me, parent, child, grand_child);
     }
     return multiset_repair_right(me, parent, child);
@@ -264,20 +485,23 @@ static void multiset_insert_balance(multiset me, char *const item)
     char *child = item;
     char *parent;
     memcpy(&parent, item + node_parent_offset, ptr_size);
+    if (me->order_statistics) {
+        multiset_adjust_ancestors(me, parent, NULL, 1, BK_TRUE);
+    }
     while (parent) {
         char *parent_left;
         memcpy(&parent_left, parent + node_left_child_offset, ptr_size);
         if (parent_left == child) {
-            parent[0]--;
+            parent[me->balance_offset]--;
         } else {
-            parent[0]++;
+            parent[me->balance_offset]++;
         }
         /* If balance is zero after modification, then the tree is balanced. */
-        if (parent[0] == 0) {
+        if (parent[me->balance_offset] == 0) {
             return;
         }
         /* Must re-balance if not in {-1, 0, 1} */
-        if (parent[0] > 1 || parent[0] < -1) {
+        if (parent[me->balance_offset] > 1 || parent[me->balance_offset] < -1) {
             /* After one repair, the tree is balanced. */
             multiset_repair(me, parent, child, grand_child);
             return;
@@ -288,27 +512,147 @@ static void multiset_insert_balance(multiset me, char *const item)
     }
 }
 
+/*
+ * Adds a slab to the node pool, and puts all of its nodes on the free list.
+ * Each node starts on a pointer boundary.
+ */
+static bk_err multiset_pool_grow(multiset me,
+                                 struct multiset_node_pool *const pool)
+{
+    size_t i;
+    char *slab;
+    const size_t stride =
+            (pool->node_size + ptr_size - 1) / ptr_size * ptr_size;
+    const size_t slab_nodes = BKTHOMPS_MULTISET_POOL_SLAB_NODES;
+    if (stride < pool->node_size
+        || stride > ((size_t) -1 - ptr_size) / slab_nodes) {
+        return -BK_ENOMEM;
+    }
+    BKTHOMPS_MULTISET_STAT(me, bytes_allocated, ptr_size + slab_nodes * stride);
+    slab = multiset_allocate(&me->allocator, ptr_size + slab_nodes * stride);
+    if (!slab) {
+        return -BK_ENOMEM;
+    }
+    memcpy(slab, &pool->slabs, ptr_size);
+    pool->slabs = slab;
+    for (i = slab_nodes; i > 0; i--) {
+        char *const node = slab + ptr_size + (i - 1) * stride;
+        memcpy(node, &pool->free_nodes, ptr_size);
+        pool->free_nodes = node;
+    }
+    return BK_OK;
+}
+
+/*
+ * Releases every slab of the node pool at once. All the nodes of the pool must
+ * no longer be in use.
+ */
+static void multiset_pool_release(multiset me,
+                                  struct multiset_node_pool *const pool)
+{
+    while (pool->slabs) {
+        char *const slab = pool->slabs;
+        memcpy(&pool->slabs, slab, ptr_size);
+        multiset_deallocate(&me->allocator, slab);
+    }
+    pool->free_nodes = NULL;
+}
+
+/*
+ * Allocates a node, taking it from the node pool if the pool is in use.
+ */
+static char *multiset_node_allocate(multiset me,
+                                    struct multiset_node_pool *const pool)
+{
+    char *node;
+    if (!pool->in_use) {
+        BKTHOMPS_MULTISET_STAT(me, bytes_allocated, pool->node_size);
+        return multiset_allocate(&me->allocator, pool->node_size);
+    }
+    if (!pool->free_nodes && multiset_pool_grow(me, pool) != BK_OK) {
+        return NULL;
+    }
+    node = pool->free_nodes;
+    memcpy(&pool->free_nodes, node, ptr_size);
+    return node;
+}
+
+/*
+ * Frees a node, giving it back to the node pool if the pool is in use.
+ */
+static void multiset_node_deallocate(multiset me,
+                                     struct multiset_node_pool *const pool,
+                                     char *const node)
+{
+    if (!pool->in_use) {
+        multiset_deallocate(&me->allocator, node);
+        return;
+    }
+    memcpy(node, &pool->free_nodes, ptr_size);
+    pool->free_nodes = node;
+}
+
 /*
  * Creates and allocates a node.
  */
 static char *multiset_create_node(multiset me, const void *const data,
                                   char *const parent)
 {
-    char *insert = malloc(1 + count_size + 3 * ptr_size + me->key_size);
+    char *insert = multiset_node_allocate(me, &me->nodes);
     const size_t one = 1;
     if (!insert) {
         return NULL;
     }
-    insert[0] = 0;
+    insert[me->balance_offset] = 0;
     memcpy(insert + node_count_offset, &one, count_size);
     memcpy(insert + node_parent_offset, &parent, ptr_size);
     memset(insert + node_left_child_offset, 0, ptr_size);
     memset(insert + node_right_child_offset, 0, ptr_size);
     memcpy(insert + node_key_offset, data, me->key_size);
+    if (me->order_statistics) {
+        multiset_store_subtree_size(me, insert, 1);
+    }
     me->size++;
     return insert;
 }
 
+/**
+ * Makes the multi-set keep the number of keys in the subtree of each node, so
+ * that multiset_select and multiset_rank take logarithmic rather than linear
+ * time. This costs the size of a size_t per node, and a walk up to the root on
+ * every put and remove. Order statistics may only be enabled while the
+ * multi-set is empty.
+ *
+ * @param me the multi-set to keep order statistics for
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_EINVAL if the multi-set is not empty
+ * @return -BK_ENOMEM if the nodes would become too large
+ */
+bk_err multiset_use_order_statistics(multiset me)
+{
+    const size_t key_end = node_key_offset + me->key_size;
+    const size_t subtree_size_offset =
+            (key_end + count_size - 1) / count_size * count_size;
+    const size_t node_size = subtree_size_offset + count_size + 1;
+    if (!multiset_is_empty(me)) {
+        return -BK_EINVAL;
+    }
+    if (subtree_size_offset < key_end || node_size < subtree_size_offset) {
+        return -BK_ENOMEM;
+    }
+    if (me->order_statistics) {
+        return BK_OK;
+    }
+    /* The pooled nodes which are left over from before are too small. */
+    multiset_pool_release(me, &me->nodes);
+    me->subtree_size_offset = subtree_size_offset;
+    me->balance_offset = node_size - 1;
+    me->nodes.node_size = node_size;
+    me->order_statistics = BK_TRUE;
+    return BK_OK;
+}
+
 /**
  * Adds a key to the multi-set. The pointer to the key being passed in should
  * point to the key type which this multi-set holds. For example, if this
@@ -335,7 +679,8 @@ bk_bool multiset_put(multiset me, void *const key)
     }
     traverse = me->root;
     for (;;) {
-        const int compare = me->comparator(key, traverse + node_key_offset);
+        const int compare =
+                multiset_compare(me, key, traverse + node_key_offset);
         if (compare < 0) {
             char *traverse_left;
             memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
@@ -370,6 +715,9 @@ bk_bool multiset_put(multiset me, void *const key)
             memcpy(&count, traverse + node_count_offset, count_size);
             count++;
             memcpy(traverse + node_count_offset, &count, count_size);
+            if (me->order_statistics) {
+                multiset_adjust_ancestors(me, traverse, NULL, 1, BK_TRUE);
+            }
             me->size++;
             return BK_OK;
         }
@@ -386,7 +734,8 @@ static char *multiset_equal_match(multiset me, const void *const key)
         return NULL;
     }
     for (;;) {
-        const int compare = me->comparator(key, traverse + node_key_offset);
+        const int compare =
+                multiset_compare(me, key, traverse + node_key_offset);
         if (compare < 0) {
             char *traverse_left;
             memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
@@ -467,7 +816,7 @@ static char *multiset_repair_pivot(multiset me, char *const item,
     child = is_left_pivot ? item_right : item_left;
     memcpy(&child_right, child + node_right_child_offset, ptr_size);
     memcpy(&child_left, child + node_left_child_offset, ptr_size);
-    grand_child = child[0] == 1 ? child_right : child_left;
+    grand_child = child[me->balance_offset] == 1 ? child_right : child_left;
     return multiset_repair(me, item, child, grand_child);
 }
 
@@ -483,21 +832,23 @@ static void multiset_trace_ancestors(multiset me, char *item)
         char *parent_left;
         memcpy(&parent_left, parent + node_left_child_offset, ptr_size);
         if (parent_left == child) {
-            parent[0]++;
+            parent[me->balance_offset]++;
         } else {
-            parent[0]--;
+            parent[me->balance_offset]--;
         }
         /* The tree is balanced if balance is -1 or +1 after modification. */
-        if (parent[0] == -1 || parent[0] == 1) {
+        if (parent[me->balance_offset] == -1
+            || parent[me->balance_offset] == 1) {
             return;
         }
         /* Must re-balance if not in {-1, 0, 1} */
-        if (parent[0] > 1 || parent[0] < -1) {
+        if (parent[me->balance_offset] > 1 || parent[me->balance_offset] < -1) {
             child = multiset_repair_pivot(me, parent, parent_left == child);
             memcpy(&parent, child + node_parent_offset, ptr_size);
             /* If balance is -1 or +1 after modification or   */
             /* the parent is NULL, then the tree is balanced. */
-            if (!parent || child[0] == -1 || child[0] == 1) {
+            if (!parent || child[me->balance_offset] == -1
+                || child[me->balance_offset] == 1) {
                 return;
             }
         } else {
@@ -514,20 +865,21 @@ static void multiset_delete_balance(multiset me, char *item,
                                     const int is_left_deleted)
 {
     if (is_left_deleted) {
-        item[0]++;
+        item[me->balance_offset]++;
     } else {
-        item[0]--;
+        item[me->balance_offset]--;
     }
     /* If balance is -1 or +1 after modification, then the tree is balanced. */
-    if (item[0] == -1 || item[0] == 1) {
+    if (item[me->balance_offset] == -1 || item[me->balance_offset] == 1) {
         return;
     }
     /* Must re-balance if not in {-1, 0, 1} */
-    if (item[0] > 1 || item[0] < -1) {
+    if (item[me->balance_offset] > 1 || item[me->balance_offset] < -1) {
         char *item_parent;
         item = multiset_repair_pivot(me, item, is_left_deleted);
         memcpy(&item_parent, item + node_parent_offset, ptr_size);
-        if (!item_parent || item[0] == -1 || item[0] == 1) {
+        if (!item_parent || item[me->balance_offset] == -1
+            || item[me->balance_offset] == 1) {
             return;
         }
     }
@@ -635,7 +987,7 @@ static void multiset_remove_two_children(multiset me,
         char *item_left;
         memcpy(&item, traverse + node_right_child_offset, ptr_size);
         parent = item;
-        item[0] = traverse[0];
+        item[me->balance_offset] = traverse[me->balance_offset];
         memcpy(item + node_parent_offset, traverse + node_parent_offset,
                ptr_size);
         memcpy(item + node_left_child_offset, traverse + node_left_child_offset,
@@ -652,7 +1004,7 @@ static void multiset_remove_two_children(multiset me,
             memcpy(&item_left, item + node_left_child_offset, ptr_size);
         }
         memcpy(&parent, item + node_parent_offset, ptr_size);
-        item[0] = traverse[0];
+        item[me->balance_offset] = traverse[me->balance_offset];
         memcpy(&item_parent, item + node_parent_offset, ptr_size);
         memcpy(item_parent + node_left_child_offset,
                item + node_right_child_offset, ptr_size);
@@ -689,6 +1041,43 @@ static void multiset_remove_two_children(multiset me,
     multiset_delete_balance(me, parent, is_left_deleted);
 }
 
+/*
+ * Takes the node which is about to be removed, along with all the occurrences
+ * of its key, out of the subtree sizes of its ancestors. If it has two
+ * children, the lowest node of its right subtree is moved into its place, so
+ * that node leaves the subtrees in between and takes over the subtree size of
+ * the removed node.
+ */
+static void multiset_remove_subtree_size(multiset me,
+                                         const char *const traverse)
+{
+    char *traverse_left;
+    char *traverse_right;
+    char *parent;
+    size_t traverse_count;
+    memcpy(&traverse_count, traverse + node_count_offset, count_size);
+    memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
+    memcpy(&traverse_right, traverse + node_right_child_offset, ptr_size);
+    if (traverse_left && traverse_right) {
+        char *item = traverse_right;
+        char *item_left;
+        size_t item_count;
+        memcpy(&item_left, item + node_left_child_offset, ptr_size);
+        while (item_left) {
+            item = item_left;
+            memcpy(&item_left, item + node_left_child_offset, ptr_size);
+        }
+        memcpy(&item_count, item + node_count_offset, count_size);
+        memcpy(&parent, item + node_parent_offset, ptr_size);
+        multiset_adjust_ancestors(me, parent, traverse, item_count, BK_FALSE);
+        multiset_store_subtree_size(me, item,
+                                    multiset_subtree_size(me, traverse)
+                                    - traverse_count);
+    }
+    memcpy(&parent, traverse + node_parent_offset, ptr_size);
+    multiset_adjust_ancestors(me, parent, NULL, traverse_count, BK_FALSE);
+}
+
 /*
  * Removes the element from the set.
  */
@@ -696,6 +1085,9 @@ static void multiset_remove_element(multiset me, char *const traverse)
 {
     char *traverse_left;
     char *traverse_right;
+    if (me->order_statistics) {
+        multiset_remove_subtree_size(me, traverse);
+    }
     memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
     memcpy(&traverse_right, traverse + node_right_child_offset, ptr_size);
     if (!traverse_left && !traverse_right) {
@@ -705,7 +1097,7 @@ static void multiset_remove_element(multiset me, char *const traverse)
     } else {
         multiset_remove_two_children(me, traverse);
     }
-    free(traverse);
+    multiset_node_deallocate(me, &me->nodes, traverse);
 }
 
 /**
@@ -733,6 +1125,9 @@ bk_bool multiset_remove(multiset me, void *const key)
     } else {
         traverse_count--;
         memcpy(traverse + node_count_offset, &traverse_count, count_size);
+        if (me->order_statistics) {
+            multiset_adjust_ancestors(me, traverse, NULL, 1, BK_FALSE);
+        }
     }
     me->size--;
     return BK_TRUE;
@@ -763,6 +1158,111 @@ bk_bool multiset_remove_all(multiset me, void *const key)
     return BK_TRUE;
 }
 
+/*
+ * Gets the node with the lowest key in the subtree, or NULL if it is empty.
+ */
+static char *multiset_leftmost(char *node)
+{
+    char *left;
+    if (!node) {
+        return NULL;
+    }
+    memcpy(&left, node + node_left_child_offset, ptr_size);
+    while (left) {
+        node = left;
+        memcpy(&left, node + node_left_child_offset, ptr_size);
+    }
+    return node;
+}
+
+/*
+ * Gets the node with the highest key in the subtree, or NULL if it is empty.
+ */
+static char *multiset_rightmost(char *node)
+{
+    char *right;
+    if (!node) {
+        return NULL;
+    }
+    memcpy(&right, node + node_right_child_offset, ptr_size);
+    while (right) {
+        node = right;
+        memcpy(&right, node + node_right_child_offset, ptr_size);
+    }
+    return node;
+}
+
+/*
+ * Gets the node with the next higher key, or NULL if there is none. Only the
+ * links around the node are followed, so walking the whole tree this way
+ * visits each link at most twice.
+ */
+static char *multiset_successor(char *node)
+{
+    char *right;
+    char *parent;
+    memcpy(&right, node + node_right_child_offset, ptr_size);
+    if (right) {
+        return multiset_leftmost(right);
+    }
+    memcpy(&parent, node + node_parent_offset, ptr_size);
+    while (parent) {
+        char *parent_right;
+        memcpy(&parent_right, parent + node_right_child_offset, ptr_size);
+        if (parent_right != node) {
+            return parent;
+        }
+        node = parent;
+        memcpy(&parent, node + node_parent_offset, ptr_size);
+    }
+    return NULL;
+}
+
+/*
+ * Gets the node with the next lower key, or NULL if there is none.
+ */
+static char *multiset_predecessor(char *node)
+{
+    char *left;
+    char *parent;
+    memcpy(&left, node + node_left_child_offset, ptr_size);
+    if (left) {
+        return multiset_rightmost(left);
+    }
+    memcpy(&parent, node + node_parent_offset, ptr_size);
+    while (parent) {
+        char *parent_left;
+        memcpy(&parent_left, parent + node_left_child_offset, ptr_size);
+        if (parent_left != node) {
+            return parent;
+        }
+        node = parent;
+        memcpy(&parent, node + node_parent_offset, ptr_size);
+    }
+    return NULL;
+}
+
+/*
+ * Gets the node with the lowest key which is not less than the key, or NULL if
+ * there is none.
+ */
+static char *multiset_ceiling_node(multiset me, const void *const key)
+{
+    char *ret = NULL;
+    char *traverse = me->root;
+    while (traverse) {
+        const int compare =
+                multiset_compare(me, traverse + node_key_offset, key);
+        if (compare >= 0) {
+            ret = traverse;
+            memcpy(&traverse, traverse + node_left_child_offset, ptr_size);
+        } else {
+            memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
+        }
+    }
+    return ret;
+}
+
 /**
  * Returns the first (lowest) key in this multi-set. The returned key is a
  * pointer to the internally stored key, which should not be modified. Modifying
@@ -825,7 +1325,8 @@ void *multiset_lower(multiset me, void *const key)
     char *ret = NULL;
     char *traverse = me->root;
     while (traverse) {
-        const int compare = me->comparator(traverse + node_key_offset, key);
+        const int compare =
+                multiset_compare(me, traverse + node_key_offset, key);
         if (compare < 0) {
             ret = traverse + node_key_offset;
             memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
@@ -851,7 +1352,8 @@ void *multiset_higher(multiset me, void *const key)
     char *ret = NULL;
     char *traverse = me->root;
     while (traverse) {
-        const int compare = me->comparator(traverse + node_key_offset, key);
+        const int compare =
+                multiset_compare(me, traverse + node_key_offset, key);
         if (compare > 0) {
             ret = traverse + node_key_offset;
             memcpy(&traverse, traverse + node_left_child_offset, ptr_size);
@@ -877,7 +1379,8 @@ void *multiset_floor(multiset me, void *const key)
     char *ret = NULL;
     char *traverse = me->root;
     while (traverse) {
-        const int compare = me->comparator(traverse + node_key_offset, key);
+        const int compare =
+                multiset_compare(me, traverse + node_key_offset, key);
         if (compare <= 0) {
             ret = traverse + node_key_offset;
             memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
@@ -900,18 +1403,376 @@ void *multiset_floor(multiset me, void *const key)
  */
 void *multiset_ceiling(multiset me, void *const key)
 {
-    char *ret = NULL;
+    char *const node = multiset_ceiling_node(me, key);
+    if (!node) {
+        return NULL;
+    }
+    return node + node_key_offset;
+}
+
+/**
+ * Returns the key at the given position in the order of the multi-set, so that
+ * the lowest key is at position zero and a key which occurs several times takes
+ * up that many positions. The returned key is a pointer to the internally
+ * stored key, which should not be modified. Modifying it results in undefined
+ * behaviour. This takes logarithmic time if the multi-set keeps order
+ * statistics, otherwise it takes linear time in the number of distinct keys.
+ *
+ * @param me    the multi-set to get the key from
+ * @param index the position of the key
+ *
+ * @return the key at the position, or NULL if the index is out of bounds
+ */
+void *multiset_select(multiset me, size_t index)
+{
+    char *traverse = me->root;
+    if (index >= me->size) {
+        return NULL;
+    }
+    if (!me->order_statistics) {
+        size_t count;
+        traverse = multiset_leftmost(traverse);
+        memcpy(&count, traverse + node_count_offset, count_size);
+        while (index >= count) {
+            index -= count;
+            traverse = multiset_successor(traverse);
+            memcpy(&count, traverse + node_count_offset, count_size);
+        }
+        return traverse + node_key_offset;
+    }
+    for (;;) {
+        char *traverse_left;
+        size_t left_size;
+        size_t count;
+        memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
+        memcpy(&count, traverse + node_count_offset, count_size);
+        left_size = multiset_subtree_size(me, traverse_left);
+        if (index < left_size) {
+            traverse = traverse_left;
+        } else if (index < left_size + count) {
+            return traverse + node_key_offset;
+        } else {
+            index -= left_size + count;
+            memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
+        }
+    }
+}
+
+/**
+ * Determines the number of keys in the multi-set which are lower than the given
+ * key, counting each occurrence of a key, which is the position the key has,
+ * or would have, in the order of the multi-set. This takes logarithmic time if
+ * the multi-set keeps order statistics, otherwise it takes linear time in the
+ * number of distinct keys.
+ *
+ * @param me  the multi-set to rank the key in
+ * @param key the key to rank
+ *
+ * @return the number of keys which are lower than the key
+ */
+size_t multiset_rank(multiset me, void *const key)
+{
     char *traverse = me->root;
+    size_t rank = 0;
+    if (!me->order_statistics) {
+        traverse = multiset_leftmost(traverse);
+        while (traverse
+               && multiset_compare(me, traverse + node_key_offset, key) < 0) {
+            size_t count;
+            memcpy(&count, traverse + node_count_offset, count_size);
+            traverse = multiset_successor(traverse);
+            rank += count;
+        }
+        return rank;
+    }
     while (traverse) {
-        const int compare = me->comparator(traverse + node_key_offset, key);
-        if (compare >= 0) {
-            ret = traverse + node_key_offset;
-            memcpy(&traverse, traverse + node_left_child_offset, ptr_size);
+        const int compare =
+                multiset_compare(me, key, traverse + node_key_offset);
+        char *traverse_left;
+        memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
+        if (compare == 0) {
+            return rank + multiset_subtree_size(me, traverse_left);
+        }
+        if (compare < 0) {
+            traverse = traverse_left;
         } else {
+            size_t count;
+            memcpy(&count, traverse + node_count_offset, count_size);
+            rank += multiset_subtree_size(me, traverse_left) + count;
             memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
         }
     }
-    return ret;
+    return rank;
+}
+
+/**
+ * Starts an in-order iteration over the multi-set at its lowest key. Each key
+ * is visited once, along with the number of times it is in the multi-set. Each
+ * step follows the links between the nodes instead of searching from the root,
+ * so walking k keys takes O(k) time. Adding keys, or removing ones other than
+ * the one which the iterator is at, does not invalidate the iterator.
+ *
+ * @param iter the iterator to set up
+ * @param me   the multi-set to iterate over
+ */
+void multiset_iter_init(struct multiset_iter *const iter, multiset me)
+{
+    iter->set = me;
+    iter->node = multiset_leftmost(me->root);
+}
+
+/**
+ * Starts an in-order iteration over the multi-set at its highest key, for
+ * iterating in descending order with multiset_iter_prev.
+ *
+ * @param iter the iterator to set up
+ * @param me   the multi-set to iterate over
+ */
+void multiset_iter_init_last(struct multiset_iter *const iter, multiset me)
+{
+    iter->set = me;
+    iter->node = multiset_rightmost(me->root);
+}
+
+/**
+ * Starts an in-order iteration over the multi-set at the lowest key which is
+ * not less than the specified key.
+ *
+ * @param iter the iterator to set up
+ * @param me   the multi-set to iterate over
+ * @param key  the key to start at
+ */
+void multiset_iter_init_at(struct multiset_iter *const iter, multiset me,
+                           void *const key)
+{
+    iter->set = me;
+    iter->node = multiset_ceiling_node(me, key);
+}
+
+/**
+ * Gets the key which the iterator is at, and then moves the iterator to the
+ * next higher key. The key points to where it is stored, and must not be
+ * modified.
+ *
+ * @param key   set to the key
+ * @param count set to the number of times the key is in the multi-set, unless
+ *              it is NULL
+ * @param iter  the iterator to advance
+ *
+ * @return BK_TRUE if there was a key, otherwise BK_FALSE
+ */
+bk_bool multiset_iter_next(void **const key, size_t *const count,
+                           struct multiset_iter *const iter)
+{
+    char *const node = iter->node;
+    if (!node) {
+        return BK_FALSE;
+    }
+    *key = node + node_key_offset;
+    if (count) {
+        memcpy(count, node + node_count_offset, count_size);
+    }
+    iter->node = multiset_successor(node);
+    return BK_TRUE;
+}
+
+/**
+ * Gets the key which the iterator is at, and then moves the iterator to the
+ * next lower key. The key points to where it is stored, and must not be
+ * modified.
+ *
+ * @param key   set to the key
+ * @param count set to the number of times the key is in the multi-set, unless
+ *              it is NULL
+ * @param iter  the iterator to move back
+ *
+ * @return BK_TRUE if there was a key, otherwise BK_FALSE
+ */
+bk_bool multiset_iter_prev(void **const key, size_t *const count,
+                           struct multiset_iter *const iter)
+{
+    char *const node = iter->node;
+    if (!node) {
+        return BK_FALSE;
+    }
+    *key = node + node_key_offset;
+    if (count) {
+        memcpy(count, node + node_count_offset, count_size);
+    }
+    iter->node = multiset_predecessor(node);
+    return BK_TRUE;
+}
+
+/**
+ * Calls the callback on every key which is between the low and the high keys,
+ * inclusive, in ascending order, along with the number of times that key is in
+ * the multi-set. The multi-set is only searched once, for the low key, so a
+ * scan of k keys costs O(log n + k) time. The callback must not add or remove
+ * keys.
+ *
+ * @param me       the multi-set to scan
+ * @param low      the lowest key to visit
+ * @param high     the highest key to visit
+ * @param callback the function to call with the key, its count, and the context
+ * @param context  passed to each call of the callback
+ */
+void multiset_range(multiset me, void *const low, void *const high,
+                    void (*const callback)(const void *const key,
+                                           const size_t count,
+                                           void *const context),
+                    void *const context)
+{
+    char *node = multiset_ceiling_node(me, low);
+    while (node && multiset_compare(me, node + node_key_offset, high) <= 0) {
+        size_t count;
+        memcpy(&count, node + node_count_offset, count_size);
+        callback(node + node_key_offset, count, context);
+        node = multiset_successor(node);
+    }
+}
+
+/*
+ * Frees every node of a subtree in linear time, without rebalancing. Child
+ * references are cut on the way down so that each node is freed after both of
+ * its children, and the parent references lead back up. The parent of the
+ * subtree root must be NULL.
+ */
+static void multiset_free_nodes(multiset me, char *traverse)
+{
+    while (traverse) {
+        char *next;
+        memcpy(&next, traverse + node_left_child_offset, ptr_size);
+        if (next) {
+            memset(traverse + node_left_child_offset, 0, ptr_size);
+            traverse = next;
+            continue;
+        }
+        memcpy(&next, traverse + node_right_child_offset, ptr_size);
+        if (next) {
+            memset(traverse + node_right_child_offset, 0, ptr_size);
+            traverse = next;
+            continue;
+        }
+        memcpy(&next, traverse + node_parent_offset, ptr_size);
+        multiset_deallocate(&me->allocator, traverse);
+        traverse = next;
+    }
+}
+
+/*
+ * Builds a balanced subtree out of the next count distinct keys of the sorted
+ * input, taking each run of equal keys as a single node. The two subtrees of
+ * each node differ in size by at most one, so their heights differ by at most
+ * one as well.
+ */
+static bk_err multiset_build_sorted(multiset me, const char **const keys,
+                                    const char *const end, const size_t count,
+                                    char **const root, int *const height)
+{
+    char *left;
+    char *right;
+    char *node;
+    int left_height;
+    int right_height;
+    size_t key_count = 1;
+    bk_err err;
+    if (count == 0) {
+        *root = NULL;
+        *height = 0;
+        return BK_OK;
+    }
+    err = multiset_build_sorted(me, keys, end, count / 2, &left, &left_height);
+    if (err != BK_OK) {
+        return err;
+    }
+    node = multiset_node_allocate(me, &me->nodes);
+    if (!node) {
+        multiset_free_nodes(me, left);
+        return -BK_ENOMEM;
+    }
+    memset(node + node_parent_offset, 0, ptr_size);
+    memcpy(node + node_left_child_offset, &left, ptr_size);
+    memset(node + node_right_child_offset, 0, ptr_size);
+    if (left) {
+        memcpy(left + node_parent_offset, &node, ptr_size);
+    }
+    memcpy(node + node_key_offset, *keys, me->key_size);
+    *keys += me->key_size;
+    while (*keys != end
+           && multiset_compare(me, node + node_key_offset, *keys) == 0) {
+        *keys += me->key_size;
+        key_count++;
+    }
+    memcpy(node + node_count_offset, &key_count, count_size);
+    err = multiset_build_sorted(me, keys, end, count - count / 2 - 1, &right,
+                                &right_height);
+    if (err != BK_OK) {
+        multiset_free_nodes(me, node);
+        return err;
+    }
+    memcpy(node + node_right_child_offset, &right, ptr_size);
+    if (right) {
+        memcpy(right + node_parent_offset, &node, ptr_size);
+    }
+    node[me->balance_offset] = (char) (right_height - left_height);
+    *root = node;
+    *height = (left_height > right_height ? left_height : right_height) + 1;
+    return BK_OK;
+}
+
+/**
+ * Initializes a multi-set from keys which are already sorted in ascending
+ * order, where equal keys may repeat. Rather than putting each key, the tree is
+ * built balanced in linear time.
+ *
+ * @param key_size   the size of each element in the multi-set; must be
+ *                   positive
+ * @param comparator the comparator function used for key ordering; must not be
+ *                   NULL
+ * @param keys       the keys to initialize the multi-set with; must be in
+ *                   non-decreasing order according to the comparator
+ * @param count      the number of keys
+ *
+ * @return the newly-initialized multi-set, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+multiset multiset_init_from_sorted(const size_t key_size,
+                                   int (*const comparator)(const void *const,
+                                                           const void *const),
+                                   const void *const keys, const size_t count)
+{
+    size_t i;
+    size_t distinct = 1;
+    int height;
+    const char *key_traverse = keys;
+    multiset me = multiset_init(key_size, comparator);
+    if (!me) {
+        return NULL;
+    }
+    if (count == 0) {
+        return me;
+    }
+    if (!keys) {
+        return multiset_destroy(me);
+    }
+    for (i = 1; i < count; i++) {
+        const int compare = comparator(key_traverse + (i - 1) * key_size,
+                                       key_traverse + i * key_size);
+        if (compare > 0) {
+            return multiset_destroy(me);
+        }
+        if (compare < 0) {
+            distinct++;
+        }
+    }
+    if (multiset_build_sorted(me, &key_traverse,
+                              key_traverse + count * key_size, distinct,
+                              &me->root, &height) != BK_OK) {
+        return multiset_destroy(me);
+    }
+    me->size = count;
+    return me;
 }
 
 /**
@@ -921,9 +1782,12 @@ void *multiset_ceiling(multiset me, void *const key)
  */
 void multiset_clear(multiset me)
 {
-    while (me->root) {
-        multiset_remove_element(me, me->root);
+    if (me->nodes.in_use) {
+        multiset_pool_release(me, &me->nodes);
+    } else {
+        multiset_free_nodes(me, me->root);
     }
+    me->root = NULL;
     me->size = 0;
 }
 
@@ -940,7 +1804,7 @@ multiset multiset_destroy(multiset me)
 {
     if (me) {
         multiset_clear(me);
-        free(me);
+        multiset_deallocate(&me->allocator, me);
     }
     return NULL;
 }
@@ -24,12 +24,66 @@
 #include "include/vector.h"
 #include "include/priority_queue.h"
 
+#ifdef BK_STATS
+#define BKTHOMPS_PRIORITY_QUEUE_STAT(me, counter, amount) \
+    ((me)->stats.counter += (amount))
+#else
+#define BKTHOMPS_PRIORITY_QUEUE_STAT(me, counter, amount) ((void) 0)
+#endif
+
 struct internal_priority_queue {
     size_t data_size;
     int (*comparator)(const void *const one, const void *const two);
     vector data;
+#ifdef BK_STATS
+    struct bk_stats stats;
+#endif
+    struct bk_allocator allocator;
 };
 
+/*
+ * Used when the priority queue is initialized without an allocator. Its
+ * function pointers are all NULL, which means memory is managed by the standard
+ * library.
+ */
+static const struct bk_allocator priority_queue_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the priority queue.
+ */
+static void *priority_queue_allocate(const struct bk_allocator *const allocator,
+                                     const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Frees memory with the allocator of the priority queue.
+ */
+static void
+priority_queue_deallocate(const struct bk_allocator *const allocator,
+                          void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+ * Compares two elements with the comparator, counting the call.
+ */
+static int priority_queue_compare(priority_queue me, const void *const one,
+                                  const void *const two)
+{
+    BKTHOMPS_PRIORITY_QUEUE_STAT(me, comparator_calls, 1);
+    return me->comparator(one, two);
+}
+
 /**
  * Initializes a priority queue.
  *
@@ -44,20 +98,58 @@ struct internal_priority_queue {
 priority_queue priority_queue_init(const size_t data_size,
                                    int (*comparator)(const void *const,
                                                      const void *const))
+{
+    return priority_queue_init_with_allocator(data_size, comparator, NULL);
+}
+
+/**
+ * Initializes a priority queue, which manages its memory with the given
+ * allocator.
+ *
+ * @param data_size  the size of the data in the priority queue; must be
+ *                   positive
+ * @param comparator the priority comparator function; must not be NULL
+ * @param allocator  the allocator which manages the memory of the priority
+ *                   queue, or NULL to use the standard library; if not NULL,
+ *                   its allocate and deallocate functions must not be NULL
+ *
+ * @return the newly-initialized priority queue, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+priority_queue
+priority_queue_init_with_allocator(const size_t data_size,
+                                   int (*comparator)(const void *const,
+                                                     const void *const),
+                                   const struct bk_allocator *allocator)
 {
     struct internal_priority_queue *init;
     if (data_size == 0 || !comparator) {
         return NULL;
     }
-    init = malloc(sizeof *init);
+    if (!allocator) {
+        allocator = &priority_queue_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
+        return NULL;
+    }
+    init = priority_queue_allocate(allocator, sizeof *init);
     if (!init) {
         return NULL;
     }
+    init->allocator = *allocator;
+#ifdef BK_STATS
+    memset(&init->stats, 0, sizeof init->stats);
+#endif
+    BKTHOMPS_PRIORITY_QUEUE_STAT(init, bytes_allocated, sizeof *init);
     init->data_size = data_size;
     init->comparator = comparator;
-    init->data = vector_init(data_size);
+    if (allocator == &priority_queue_standard_allocator) {
+        init->data = vector_init(data_size);
+    } else {
+        init->data = vector_init_with_allocator(data_size, allocator);
+    }
     if (!init->data) {
-        free(init);
+        priority_queue_deallocate(allocator, init);
         return NULL;
     }
     return init;
@@ -87,6 +179,23 @@ bk_bool priority_queue_is_empty(priority_queue me)
     return vector_is_empty(me->data);
 }
 
+/**
+ * Gets the statistics of the priority queue. They are only tracked if the
+ * library is compiled with BK_STATS defined, otherwise they are all zero. The
+ * resizes and bytes allocated include those of the underlying vector.
+ *
+ * @param me    the priority queue to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void priority_queue_get_stats(priority_queue me, struct bk_stats *const stats)
+{
+    vector_get_stats(me->data, stats);
+#ifdef BK_STATS
+    stats->comparator_calls += me->stats.comparator_calls;
+    stats->bytes_allocated += me->stats.bytes_allocated;
+#endif
+}
+
 /**
  * Adds an element to the priority queue. The pointer to the data being passed
  * in should point to the data type which this priority queue holds. For
@@ -109,13 +218,13 @@ bk_err priority_queue_push(priority_queue me, void *const data)
     size_t parent_index;
     char *data_index;
     char *data_parent_index;
-    char *const temp = malloc(me->data_size);
+    char *const temp = priority_queue_allocate(&me->allocator, me->data_size);
     if (!temp) {
         return -BK_ENOMEM;
     }
     rc = vector_add_last(me->data, data);
     if (rc != BK_OK) {
-        free(temp);
+        priority_queue_deallocate(&me->allocator, temp);
         return rc;
     }
     vector_storage = vector_get_data(me->data);
@@ -123,7 +232,8 @@ bk_err priority_queue_push(priority_queue me, void *const data)
     parent_index = (index - 1) / 2;
     data_index = vector_storage + index * me->data_size;
     data_parent_index = vector_storage + parent_index * me->data_size;
-    while (index > 0 && me->comparator(data_index, data_parent_index) > 0) {
+    while (index > 0
+           && priority_queue_compare(me, data_index, data_parent_index) > 0) {
         memcpy(temp, data_parent_index, me->data_size);
         memcpy(data_parent_index, data_index, me->data_size);
         memcpy(data_index, temp, me->data_size);
@@ -132,7 +242,7 @@ bk_err priority_queue_push(priority_queue me, void *const data)
         data_index = vector_storage + index * me->data_size;
         data_parent_index = vector_storage + parent_index * me->data_size;
     }
-    free(temp);
+    priority_queue_deallocate(&me->allocator, temp);
     return BK_OK;
 }
 
@@ -175,15 +285,16 @@ bk_bool priority_queue_pop(void *const data, priority_queue me)
     data_right_index = vector_storage + right_index * me->data_size;
     for (;;) {
         if (right_index < size &&
-            me->comparator(data_right_index, data_left_index) > 0 &&
-            me->comparator(data_right_index, data_index) > 0) {
+            priority_queue_compare(me, data_right_index, data_left_index) > 0 &&
+            priority_queue_compare(me, data_right_index, data_index) > 0) {
             /* Swap parent and right child then continue down right child. */
             memcpy(temp, data_index, me->data_size);
             memcpy(data_index, data_right_index, me->data_size);
             memcpy(data_right_index, temp, me->data_size);
             index = right_index;
-        } else if (left_index < size &&
-                   me->comparator(data_left_index, data_index) > 0) {
+        } else if (left_index < size
+                   && priority_queue_compare(me, data_left_index,
+                                             data_index) > 0) {
             /* Swap parent and left child then continue down left child. */
             memcpy(temp, data_index, me->data_size);
             memcpy(data_index, data_left_index, me->data_size);
@@ -247,7 +358,7 @@ priority_queue priority_queue_destroy(priority_queue me)
 {
     if (me) {
         vector_destroy(me->data);
-        free(me);
+        priority_queue_deallocate(&me->allocator, me);
     }
     return NULL;
 }
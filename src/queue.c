@@ -37,6 +37,24 @@ queue queue_init(const size_t data_size)
     return deque_init(data_size);
 }
 
+/**
+ * Initializes a queue, which manages its memory with the given allocator.
+ *
+ * @param data_size the size of each element; must be positive
+ * @param allocator the allocator which manages the memory of the queue, or NULL
+ *                  to use the standard library; if not NULL, its allocate and
+ *                  deallocate functions must not be NULL
+ *
+ * @return the newly-initialized queue, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+queue queue_init_with_allocator(const size_t data_size,
+                                const struct bk_allocator *const allocator)
+{
+    return deque_init_with_allocator(data_size, allocator);
+}
+
 /**
  * Determines the size of the queue.
  *
@@ -62,6 +80,18 @@ bk_bool queue_is_empty(queue me)
     return deque_is_empty(me);
 }
 
+/**
+ * Gets the statistics of the queue. They are only tracked if the library is
+ * compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the queue to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void queue_get_stats(queue me, struct bk_stats *const stats)
+{
+    deque_get_stats(me, stats);
+}
+
 /**
  * Frees the unused memory in the queue.
  *
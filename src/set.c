@@ -23,19 +23,87 @@
 #include <string.h>
 #include "include/set.h"
 
+#define BKTHOMPS_SET_POOL_SLAB_NODES 64
+
+/*
+ * A pool hands out nodes of one size. Nodes are carved out of slabs, and nodes
+ * which are given back are kept on a free list to be handed out again, so that
+ * the set does not call the allocator for every insertion and removal. The
+ * slabs are only released when the set is cleared or destroyed.
+ */
+struct set_node_pool {
+    size_t node_size;
+    bk_bool in_use;
+    char *slabs;
+    char *free_nodes;
+};
+
+#ifdef BK_STATS
+#define BKTHOMPS_SET_STAT(me, counter, amount) \
+    ((me)->stats.counter += (amount))
+#else
+#define BKTHOMPS_SET_STAT(me, counter, amount) ((void) 0)
+#endif
+
 struct internal_set {
     size_t size;
     size_t key_size;
     int (*comparator)(const void *const one, const void *const two);
     char *root;
+    size_t balance_offset;
+    size_t subtree_size_offset;
+    bk_bool order_statistics;
+    struct set_node_pool nodes;
+#ifdef BK_STATS
+    struct bk_stats stats;
+#endif
+    struct bk_allocator allocator;
 };
 
 static const size_t ptr_size = sizeof(char *);
-/* Node balance is always the first byte (at index 0). */
-static const size_t node_parent_offset = sizeof(signed char);
-static const size_t node_left_child_offset = 1 + sizeof(char *);
-static const size_t node_right_child_offset = 1 + 2 * sizeof(char *);
-static const size_t node_key_offset = 1 + 3 * sizeof(char *);
+
+/*
+ * Used when the set is initialized without an allocator. Its function pointers
+ * are all NULL, which means memory is managed by the standard library.
+ */
+static const struct bk_allocator set_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the set.
+ */
+static void *set_allocate(const struct bk_allocator *const allocator,
+                          const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Frees memory with the allocator of the set.
+ */
+static void set_deallocate(const struct bk_allocator *const allocator,
+                           void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+ * The links come first, so that they and the key are aligned to a pointer
+ * boundary. While order statistics are in use, the subtree size follows the
+ * key at subtree_size_offset, padded so that it is aligned. Node balance is
+ * always the last byte, at balance_offset. The padding before the subtree
+ * size trades memory for aligned reads.
+ */
+static const size_t node_parent_offset = 0;
+static const size_t node_left_child_offset = sizeof(char *);
+static const size_t node_right_child_offset = 2 * sizeof(char *);
+static const size_t node_key_offset = 3 * sizeof(char *);
 
 /**
  * Initializes a set.
@@ -50,25 +118,97 @@ static const size_t node_key_offset = 1 + 3 * sizeof(char *);
  */
 set set_init(const size_t key_size,
              int (*const comparator)(const void *const, const void *const))
+{
+    return set_init_with_allocator(key_size, comparator, NULL);
+}
+
+/*
+ * Initializes a set, which manages its memory with the given allocator unless
+ * it is NULL. If the comparator is NULL, keys are compared as plain old data.
+ */
+static set set_create(const size_t key_size,
+                      int (*const comparator)(const void *const,
+                                              const void *const),
+                      const struct bk_allocator *allocator)
 {
     struct internal_set *init;
-    if (key_size == 0 || !comparator) {
+    if (key_size == 0) {
+        return NULL;
+    }
+    if (!allocator) {
+        allocator = &set_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
         return NULL;
     }
-    if (node_key_offset + key_size < node_key_offset) {
+    if (node_key_offset + key_size + 1 <= node_key_offset) {
         return NULL;
     }
-    init = malloc(sizeof *init);
+    init = set_allocate(allocator, sizeof *init);
     if (!init) {
         return NULL;
     }
+    init->allocator = *allocator;
+#ifdef BK_STATS
+    memset(&init->stats, 0, sizeof init->stats);
+#endif
+    BKTHOMPS_SET_STAT(init, bytes_allocated, sizeof *init);
+    init->balance_offset = node_key_offset + key_size;
+    init->subtree_size_offset = 0;
+    init->nodes.node_size = init->balance_offset + 1;
+    init->nodes.in_use = BK_FALSE;
+    init->nodes.slabs = NULL;
+    init->nodes.free_nodes = NULL;
     init->size = 0;
     init->key_size = key_size;
     init->comparator = comparator;
     init->root = NULL;
+    init->order_statistics = BK_FALSE;
     return init;
 }
 
+/**
+ * Initializes a set, which manages its memory with the given allocator.
+ *
+ * @param key_size   the size of each element in the set; must be positive
+ * @param comparator the comparator function used for key ordering; must not be
+ *                   NULL
+ * @param allocator  the allocator which manages the memory of the set, or NULL
+ *                   to use the standard library; if not NULL, its allocate and
+ *                   deallocate functions must not be NULL
+ *
+ * @return the newly-initialized set, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+set set_init_with_allocator(const size_t key_size,
+                            int (*const comparator)(const void *const,
+                                                    const void *const),
+                            const struct bk_allocator *allocator)
+{
+    if (!comparator) {
+        return NULL;
+    }
+    return set_create(key_size, comparator, allocator);
+}
+
+/**
+ * Initializes a set whose keys are plain old data, such as integers or
+ * fixed-size byte strings, so that no comparator function is needed. Keys the
+ * size of signed char, short, int or long are ordered as that signed integer
+ * type, and keys of any other size are ordered byte by byte like memcmp. This
+ * is faster than a comparator, since no function is called through a pointer.
+ *
+ * @param key_size the size of each key in the set; must be positive
+ *
+ * @return the newly-initialized set, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+set set_init_pod(const size_t key_size)
+{
+    return set_create(key_size, NULL, NULL);
+}
+
 /**
  * Gets the size of the set.
  *
@@ -93,6 +233,140 @@ bk_bool set_is_empty(set me)
     return set_size(me) == 0;
 }
 
+/**
+ * Makes the set allocate its nodes from a pool of slabs, rather than allocating
+ * each node individually. Removed nodes are kept by the pool to be reused, and
+ * the slabs are released all at once when the set is cleared or destroyed. The
+ * pool may only be enabled while the set is empty.
+ *
+ * @param me the set to allocate nodes from a pool for
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_EINVAL if the set is not empty
+ */
+bk_err set_use_node_pool(set me)
+{
+    if (!set_is_empty(me)) {
+        return -BK_EINVAL;
+    }
+    me->nodes.in_use = BK_TRUE;
+    return BK_OK;
+}
+
+/**
+ * Gets the statistics of the set. They are only tracked if the library is
+ * compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the set to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void set_get_stats(set me, struct bk_stats *const stats)
+{
+#ifdef BK_STATS
+    *stats = me->stats;
+#else
+    (void) me;
+    memset(stats, 0, sizeof *stats);
+#endif
+}
+
+/*
+ * Compares two keys of plain old data, for a set without a comparator.
+ */
+static int set_compare_pod(const size_t key_size, const void *const one,
+                           const void *const two)
+{
+    if (key_size == sizeof(int)) {
+        int a;
+        int b;
+        memcpy(&a, one, sizeof(int));
+        memcpy(&b, two, sizeof(int));
+        return (a > b) - (a < b);
+    }
+    if (key_size == sizeof(long)) {
+        long a;
+        long b;
+        memcpy(&a, one, sizeof(long));
+        memcpy(&b, two, sizeof(long));
+        return (a > b) - (a < b);
+    }
+    if (key_size == sizeof(short)) {
+        short a;
+        short b;
+        memcpy(&a, one, sizeof(short));
+        memcpy(&b, two, sizeof(short));
+        return (a > b) - (a < b);
+    }
+    if (key_size == sizeof(signed char)) {
+        const signed char a = *(const signed char *) one;
+        const signed char b = *(const signed char *) two;
+        return (a > b) - (a < b);
+    }
+    return memcmp(one, two, key_size);
+}
+
+/*
+ * Compares two keys with the comparator, counting the call.
+ */
+static int set_compare(set me, const void *const one, const void *const two)
+{
+    BKTHOMPS_SET_STAT(me, comparator_calls, 1);
+    if (!me->comparator) {
+        return set_compare_pod(me->key_size, one, two);
+    }
+    return me->comparator(one, two);
+}
+
+/*
+ * Gets the number of keys in the subtree of the node, which is stored after the
+ * key while order statistics are in use.
+ */
+static size_t set_subtree_size(set me, const char *const node)
+{
+    size_t size;
+    if (!node) {
+        return 0;
+    }
+    memcpy(&size, node + me->subtree_size_offset, sizeof(size_t));
+    return size;
+}
+
+/*
+ * Sets the number of keys in the subtree of the node.
+ */
+static void set_store_subtree_size(set me, char *const node, const size_t size)
+{
+    memcpy(node + me->subtree_size_offset, &size, sizeof(size_t));
+}
+
+/*
+ * Recomputes the subtree size of the node from the sizes of its children.
+ */
+static void set_resize_subtree(set me, char *const node)
+{
+    char *left;
+    char *right;
+    memcpy(&left, node + node_left_child_offset, ptr_size);
+    memcpy(&right, node + node_right_child_offset, ptr_size);
+    set_store_subtree_size(me, node, set_subtree_size(me, left)
+                                     + set_subtree_size(me, right) + 1);
+}
+
+/*
+ * Adds one to, or removes one from, the subtree size of each node starting at
+ * the given node and going up the tree until the end node is reached. The end
+ * node is not changed, and is NULL to go all the way up past the root.
+ */
+static void set_adjust_ancestors(set me, char *node, const char *const end,
+                                 const bk_bool is_growing)
+{
+    while (node != end) {
+        const size_t size = set_subtree_size(me, node);
+        set_store_subtree_size(me, node, is_growing ? size + 1 : size - 1);
+        memcpy(&node, node + node_parent_offset, ptr_size);
+    }
+}
+
 /*
  * Resets the parent reference.
  */
@@ -121,6 +395,7 @@ static void set_reference_parent(set me, char *const parent, char *const child)
 static void set_rotate_left(set me, char *const parent, char *const child)
 {
     char *left_grand_child;
+    BKTHOMPS_SET_STAT(me, rotations, 1);
     set_reference_parent(me, parent, child);
     memcpy(&left_grand_child, child + node_left_child_offset, ptr_size);
     if (left_grand_child) {
@@ -129,6 +404,10 @@ static void set_rotate_left(set me, char *const parent, char *const child)
     memcpy(parent + node_parent_offset, &child, ptr_size);
     memcpy(parent + node_right_child_offset, &left_grand_child, ptr_size);
     memcpy(child + node_left_child_offset, &parent, ptr_size);
+    if (me->order_statistics) {
+        set_resize_subtree(me, parent);
+        set_resize_subtree(me, child);
+    }
 }
 
 /*
@@ -137,6 +416,7 @@ static void set_rotate_left(set me, char *const parent, char *const child)
 static void set_rotate_right(set me, char *const parent, char *const child)
 {
     char *right_grand_child;
+    BKTHOMPS_SET_STAT(me, rotations, 1);
     set_reference_parent(me, parent, child);
     memcpy(&right_grand_child, child + node_right_child_offset, ptr_size);
     if (right_grand_child) {
@@ -145,6 +425,10 @@ static void set_rotate_right(set me, char *const parent, char *const child)
     memcpy(parent + node_parent_offset, &child, ptr_size);
     memcpy(parent + node_left_child_offset, &right_grand_child, ptr_size);
     memcpy(child + node_right_child_offset, &parent, ptr_size);
+    if (me->order_statistics) {
+        set_resize_subtree(me, parent);
+        set_resize_subtree(me, child);
+    }
 }
 
 /*
@@ -153,12 +437,12 @@ static void set_rotate_right(set me, char *const parent, char *const child)
 static char *set_repair_left(set me, char *const parent, char *const child)
 {
     set_rotate_left(me, parent, child);
-    if (child[0] == 0) {
-        parent[0] = 1;
-        child[0] = -1;
+    if (child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = 1;
+        child[me->balance_offset] = -1;
     } else {
-        parent[0] = 0;
-        child[0] = 0;
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     }
     return child;
 }
@@ -169,12 +453,12 @@ static char *set_repair_left(set me, char *const parent, char *const child)
 static char *set_repair_right(set me, char *const parent, char *const child)
 {
     set_rotate_right(me, parent, child);
-    if (child[0] == 0) {
-        parent[0] = -1;
-        child[0] = 1;
+    if (child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = -1;
+        child[me->balance_offset] = 1;
     } else {
-        parent[0] = 0;
-        child[0] = 0;
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     }
     return child;
 }
@@ -187,17 +471,17 @@ static char *set_repair_left_right(set me, char *const parent,
 {
     set_rotate_left(me, child, grand_child);
     set_rotate_right(me, parent, grand_child);
-    if (grand_child[0] == 1) {
-        parent[0] = 0;
-        child[0] = -1;
-    } else if (grand_child[0] == 0) {
-        parent[0] = 0;
-        child[0] = 0;
+    if (grand_child[me->balance_offset] == 1) {
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = -1;
+    } else if (grand_child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     } else {
-        parent[0] = 1;
-        child[0] = 0;
+        parent[me->balance_offset] = 1;
+        child[me->balance_offset] = 0;
     }
-    grand_child[0] = 0;
+    grand_child[me->balance_offset] = 0;
     return grand_child;
 }
 
@@ -209,17 +493,17 @@ static char *set_repair_right_left(set me, char *const parent,
 {
     set_rotate_right(me, child, grand_child);
     set_rotate_left(me, parent, grand_child);
-    if (grand_child[0] == 1) {
-        parent[0] = -1;
-        child[0] = 0;
-    } else if (grand_child[0] == 0) {
-        parent[0] = 0;
-        child[0] = 0;
+    if (grand_child[me->balance_offset] == 1) {
+        parent[me->balance_offset] = -1;
+        child[me->balance_offset] = 0;
+    } else if (grand_child[me->balance_offset] == 0) {
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 0;
     } else {
-        parent[0] = 0;
-        child[0] = 1;
+        parent[me->balance_offset] = 0;
+        child[me->balance_offset] = 1;
     }
-    grand_child[0] = 0;
+    grand_child[me->balance_offset] = 0;
     return grand_child;
 }
 
@@ -230,13 +514,13 @@ static char *set_repair_right_left(set me, char *const parent,
 static char *set_repair(set me, char *const parent, char *const child,
                         char *const grand_child)
 {
-    if (parent[0] == 2) {
-        if (child[0] == -1) {
+    if (parent[me->balance_offset] == 2) {
+        if (child[me->balance_offset] == -1) {
             return set_repair_right_left(me, parent, child, grand_child);
         }
         return set_repair_left(me, parent, child);
     }
-    if (child[0] == 1) {
+    if (child[me->balance_offset] == 1) {
         return set_repair_left_right(me, parent, child, grand_child);
     }
     return set_repair_right(me, parent, child);
@@ -251,20 +535,23 @@ static void set_insert_balance(set me, char *const item)
     char *child = item;
     char *parent;
     memcpy(&parent, item + node_parent_offset, ptr_size);
+    if (me->order_statistics) {
+        set_adjust_ancestors(me, parent, NULL, BK_TRUE);
+    }
     while (parent) {
         char *parent_left;
         memcpy(&parent_left, parent + node_left_child_offset, ptr_size);
         if (parent_left == child) {
-            parent[0]--;
+            parent[me->balance_offset]--;
         } else {
-            parent[0]++;
+            parent[me->balance_offset]++;
         }
         /* If balance is zero after modification, then the tree is balanced. */
-        if (parent[0] == 0) {
+        if (parent[me->balance_offset] == 0) {
             return;
         }
         /* Must re-balance if not in {-1, 0, 1} */
-        if (parent[0] > 1 || parent[0] < -1) {
+        if (parent[me->balance_offset] > 1 || parent[me->balance_offset] < -1) {
             /* After one repair, the tree is balanced. */
             set_repair(me, parent, child, grand_child);
             return;
@@ -275,24 +562,139 @@ static void set_insert_balance(set me, char *const item)
     }
 }
 
+/*
+ * Adds a slab to the node pool, and puts all of its nodes on the free list.
+ * Each node starts on a pointer boundary.
+ */
+static bk_err set_pool_grow(set me, struct set_node_pool *const pool)
+{
+    size_t i;
+    char *slab;
+    const size_t stride =
+            (pool->node_size + ptr_size - 1) / ptr_size * ptr_size;
+    const size_t slab_nodes = BKTHOMPS_SET_POOL_SLAB_NODES;
+    if (stride < pool->node_size
+        || stride > ((size_t) -1 - ptr_size) / slab_nodes) {
+        return -BK_ENOMEM;
+    }
+    BKTHOMPS_SET_STAT(me, bytes_allocated, ptr_size + slab_nodes * stride);
+    slab = set_allocate(&me->allocator, ptr_size + slab_nodes * stride);
+    if (!slab) {
+        return -BK_ENOMEM;
+    }
+    memcpy(slab, &pool->slabs, ptr_size);
+    pool->slabs = slab;
+    for (i = slab_nodes; i > 0; i--) {
+        char *const node = slab + ptr_size + (i - 1) * stride;
+        memcpy(node, &pool->free_nodes, ptr_size);
+        pool->free_nodes = node;
+    }
+    return BK_OK;
+}
+
+/*
+ * Releases every slab of the node pool at once. All the nodes of the pool must
+ * no longer be in use.
+ */
+static void set_pool_release(set me, struct set_node_pool *const pool)
+{
+    while (pool->slabs) {
+        char *const slab = pool->slabs;
+        memcpy(&pool->slabs, slab, ptr_size);
+        set_deallocate(&me->allocator, slab);
+    }
+    pool->free_nodes = NULL;
+}
+
+/*
+ * Allocates a node, taking it from the node pool if the pool is in use.
+ */
+static char *set_node_allocate(set me, struct set_node_pool *const pool)
+{
+    char *node;
+    if (!pool->in_use) {
+        BKTHOMPS_SET_STAT(me, bytes_allocated, pool->node_size);
+        return set_allocate(&me->allocator, pool->node_size);
+    }
+    if (!pool->free_nodes && set_pool_grow(me, pool) != BK_OK) {
+        return NULL;
+    }
+    node = pool->free_nodes;
+    memcpy(&pool->free_nodes, node, ptr_size);
+    return node;
+}
+
+/*
+ * Frees a node, giving it back to the node pool if the pool is in use.
+ */
+static void set_node_deallocate(set me, struct set_node_pool *const pool,
+                                char *const node)
+{
+    if (!pool->in_use) {
+        set_deallocate(&me->allocator, node);
+        return;
+    }
+    memcpy(node, &pool->free_nodes, ptr_size);
+    pool->free_nodes = node;
+}
+
 /*
  * Creates and allocates a node.
  */
 static char *set_create_node(set me, const void *const data, char *const parent)
 {
-    char *insert = malloc(1 + 3 * ptr_size + me->key_size);
+    char *insert = set_node_allocate(me, &me->nodes);
     if (!insert) {
         return NULL;
     }
-    insert[0] = 0;
+    insert[me->balance_offset] = 0;
     memcpy(insert + node_parent_offset, &parent, ptr_size);
     memset(insert + node_left_child_offset, 0, ptr_size);
     memset(insert + node_right_child_offset, 0, ptr_size);
     memcpy(insert + node_key_offset, data, me->key_size);
+    if (me->order_statistics) {
+        set_store_subtree_size(me, insert, 1);
+    }
     me->size++;
     return insert;
 }
 
+/**
+ * Makes the set keep the number of keys in the subtree of each node, so that
+ * set_select and set_rank take logarithmic rather than linear time. This costs
+ * the size of a size_t per node, and a walk up to the root on every put and
+ * remove. Order statistics may only be enabled while the set is empty.
+ *
+ * @param me the set to keep order statistics for
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_EINVAL if the set is not empty
+ * @return -BK_ENOMEM if the nodes would become too large
+ */
+bk_err set_use_order_statistics(set me)
+{
+    const size_t key_end = node_key_offset + me->key_size;
+    const size_t subtree_size_offset =
+            (key_end + sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t);
+    const size_t node_size = subtree_size_offset + sizeof(size_t) + 1;
+    if (!set_is_empty(me)) {
+        return -BK_EINVAL;
+    }
+    if (subtree_size_offset < key_end || node_size < subtree_size_offset) {
+        return -BK_ENOMEM;
+    }
+    if (me->order_statistics) {
+        return BK_OK;
+    }
+    /* The pooled nodes which are left over from before are too small. */
+    set_pool_release(me, &me->nodes);
+    me->subtree_size_offset = subtree_size_offset;
+    me->balance_offset = node_size - 1;
+    me->nodes.node_size = node_size;
+    me->order_statistics = BK_TRUE;
+    return BK_OK;
+}
+
 /**
  * Adds a key to the set if the set does not already contain it. The pointer to
  * the key being passed in should point to the key type which this set holds.
@@ -319,7 +721,7 @@ bk_err set_put(set me, void *const key)
     }
     traverse = me->root;
     for (;;) {
-        const int compare = me->comparator(key, traverse + node_key_offset);
+        const int compare = set_compare(me, key, traverse + node_key_offset);
         if (compare < 0) {
             char *traverse_left;
             memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
@@ -365,7 +767,7 @@ static char *set_equal_match(set me, const void *const key)
         return NULL;
     }
     for (;;) {
-        const int compare = me->comparator(key, traverse + node_key_offset);
+        const int compare = set_compare(me, key, traverse + node_key_offset);
         if (compare < 0) {
             char *traverse_left;
             memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
@@ -422,7 +824,7 @@ static char *set_repair_pivot(set me, char *const item, const int is_left_pivot)
     child = is_left_pivot ? item_right : item_left;
     memcpy(&child_right, child + node_right_child_offset, ptr_size);
     memcpy(&child_left, child + node_left_child_offset, ptr_size);
-    grand_child = child[0] == 1 ? child_right : child_left;
+    grand_child = child[me->balance_offset] == 1 ? child_right : child_left;
     return set_repair(me, item, child, grand_child);
 }
 
@@ -438,21 +840,23 @@ static void set_trace_ancestors(set me, char *item)
         char *parent_left;
         memcpy(&parent_left, parent + node_left_child_offset, ptr_size);
         if (parent_left == child) {
-            parent[0]++;
+            parent[me->balance_offset]++;
         } else {
-            parent[0]--;
+            parent[me->balance_offset]--;
         }
         /* The tree is balanced if balance is -1 or +1 after modification. */
-        if (parent[0] == -1 || parent[0] == 1) {
+        if (parent[me->balance_offset] == -1
+            || parent[me->balance_offset] == 1) {
             return;
         }
         /* Must re-balance if not in {-1, 0, 1} */
-        if (parent[0] > 1 || parent[0] < -1) {
+        if (parent[me->balance_offset] > 1 || parent[me->balance_offset] < -1) {
             child = set_repair_pivot(me, parent, parent_left == child);
             memcpy(&parent, child + node_parent_offset, ptr_size);
             /* If balance is -1 or +1 after modification or   */
             /* the parent is NULL, then the tree is balanced. */
-            if (!parent || child[0] == -1 || child[0] == 1) {
+            if (!parent || child[me->balance_offset] == -1
+                || child[me->balance_offset] == 1) {
                 return;
             }
         } else {
@@ -468,20 +872,21 @@ static void set_trace_ancestors(set me, char *item)
 static void set_delete_balance(set me, char *item, const int is_left_deleted)
 {
     if (is_left_deleted) {
-        item[0]++;
+        item[me->balance_offset]++;
     } else {
-        item[0]--;
+        item[me->balance_offset]--;
     }
     /* If balance is -1 or +1 after modification, then the tree is balanced. */
-    if (item[0] == -1 || item[0] == 1) {
+    if (item[me->balance_offset] == -1 || item[me->balance_offset] == 1) {
         return;
     }
     /* Must re-balance if not in {-1, 0, 1} */
-    if (item[0] > 1 || item[0] < -1) {
+    if (item[me->balance_offset] > 1 || item[me->balance_offset] < -1) {
         char *item_parent;
         item = set_repair_pivot(me, item, is_left_deleted);
         memcpy(&item_parent, item + node_parent_offset, ptr_size);
-        if (!item_parent || item[0] == -1 || item[0] == 1) {
+        if (!item_parent || item[me->balance_offset] == -1
+            || item[me->balance_offset] == 1) {
             return;
         }
     }
@@ -588,7 +993,7 @@ static void set_remove_two_children(set me, const char *const traverse)
         char *item_left;
         memcpy(&item, traverse + node_right_child_offset, ptr_size);
         parent = item;
-        item[0] = traverse[0];
+        item[me->balance_offset] = traverse[me->balance_offset];
         memcpy(item + node_parent_offset, traverse + node_parent_offset,
                ptr_size);
         memcpy(item + node_left_child_offset, traverse + node_left_child_offset,
@@ -605,7 +1010,7 @@ static void set_remove_two_children(set me, const char *const traverse)
             memcpy(&item_left, item + node_left_child_offset, ptr_size);
         }
         memcpy(&parent, item + node_parent_offset, ptr_size);
-        item[0] = traverse[0];
+        item[me->balance_offset] = traverse[me->balance_offset];
         memcpy(&item_parent, item + node_parent_offset, ptr_size);
         memcpy(item_parent + node_left_child_offset,
                item + node_right_child_offset, ptr_size);
@@ -642,6 +1047,35 @@ static void set_remove_two_children(set me, const char *const traverse)
     set_delete_balance(me, parent, is_left_deleted);
 }
 
+/*
+ * Takes the node which is about to be removed out of the subtree sizes of its
+ * ancestors. If it has two children, the lowest node of its right subtree is
+ * moved into its place, so that node leaves the subtrees in between and takes
+ * over the subtree size of the removed node.
+ */
+static void set_remove_subtree_size(set me, const char *const traverse)
+{
+    char *traverse_left;
+    char *traverse_right;
+    char *parent;
+    memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
+    memcpy(&traverse_right, traverse + node_right_child_offset, ptr_size);
+    if (traverse_left && traverse_right) {
+        char *item = traverse_right;
+        char *item_left;
+        memcpy(&item_left, item + node_left_child_offset, ptr_size);
+        while (item_left) {
+            item = item_left;
+            memcpy(&item_left, item + node_left_child_offset, ptr_size);
+        }
+        memcpy(&parent, item + node_parent_offset, ptr_size);
+        set_adjust_ancestors(me, parent, traverse, BK_FALSE);
+        set_store_subtree_size(me, item, set_subtree_size(me, traverse) - 1);
+    }
+    memcpy(&parent, traverse + node_parent_offset, ptr_size);
+    set_adjust_ancestors(me, parent, NULL, BK_FALSE);
+}
+
 /*
  * Removes the element from the set.
  */
@@ -649,6 +1083,9 @@ static void set_remove_element(set me, char *const traverse)
 {
     char *traverse_left;
     char *traverse_right;
+    if (me->order_statistics) {
+        set_remove_subtree_size(me, traverse);
+    }
     memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
     memcpy(&traverse_right, traverse + node_right_child_offset, ptr_size);
     if (!traverse_left && !traverse_right) {
@@ -658,7 +1095,7 @@ static void set_remove_element(set me, char *const traverse)
     } else {
         set_remove_two_children(me, traverse);
     }
-    free(traverse);
+    set_node_deallocate(me, &me->nodes, traverse);
     me->size--;
 }
 
@@ -684,6 +1121,110 @@ bk_err set_remove(set me, void *const key)
     return BK_TRUE;
 }
 
+/*
+ * Gets the node with the lowest key in the subtree, or NULL if it is empty.
+ */
+static char *set_leftmost(char *node)
+{
+    char *left;
+    if (!node) {
+        return NULL;
+    }
+    memcpy(&left, node + node_left_child_offset, ptr_size);
+    while (left) {
+        node = left;
+        memcpy(&left, node + node_left_child_offset, ptr_size);
+    }
+    return node;
+}
+
+/*
+ * Gets the node with the highest key in the subtree, or NULL if it is empty.
+ */
+static char *set_rightmost(char *node)
+{
+    char *right;
+    if (!node) {
+        return NULL;
+    }
+    memcpy(&right, node + node_right_child_offset, ptr_size);
+    while (right) {
+        node = right;
+        memcpy(&right, node + node_right_child_offset, ptr_size);
+    }
+    return node;
+}
+
+/*
+ * Gets the node with the next higher key, or NULL if there is none. Only the
+ * links around the node are followed, so walking the whole tree this way
+ * visits each link at most twice.
+ */
+static char *set_successor(char *node)
+{
+    char *right;
+    char *parent;
+    memcpy(&right, node + node_right_child_offset, ptr_size);
+    if (right) {
+        return set_leftmost(right);
+    }
+    memcpy(&parent, node + node_parent_offset, ptr_size);
+    while (parent) {
+        char *parent_right;
+        memcpy(&parent_right, parent + node_right_child_offset, ptr_size);
+        if (parent_right != node) {
+            return parent;
+        }
+        node = parent;
+        memcpy(&parent, node + node_parent_offset, ptr_size);
+    }
+    return NULL;
+}
+
+/*
+ * Gets the node with the next lower key, or NULL if there is none.
+ */
+static char *set_predecessor(char *node)
+{
+    char *left;
+    char *parent;
+    memcpy(&left, node + node_left_child_offset, ptr_size);
+    if (left) {
+        return set_rightmost(left);
+    }
+    memcpy(&parent, node + node_parent_offset, ptr_size);
+    while (parent) {
+        char *parent_left;
+        memcpy(&parent_left, parent + node_left_child_offset, ptr_size);
+        if (parent_left != node) {
+            return parent;
+        }
+        node = parent;
+        memcpy(&parent, node + node_parent_offset, ptr_size);
+    }
+    return NULL;
+}
+
+/*
+ * Gets the node with the lowest key which is not less than the key, or NULL if
+ * there is none.
+ */
+static char *set_ceiling_node(set me, const void *const key)
+{
+    char *ret = NULL;
+    char *traverse = me->root;
+    while (traverse) {
+        const int compare = set_compare(me, traverse + node_key_offset, key);
+        if (compare >= 0) {
+            ret = traverse;
+            memcpy(&traverse, traverse + node_left_child_offset, ptr_size);
+        } else {
+            memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
+        }
+    }
+    return ret;
+}
+
 /**
  * Returns the first (lowest) key in this set. The returned key is a pointer to
  * the internally stored key, which should not be modified. Modifying it results
@@ -746,7 +1287,7 @@ void *set_lower(set me, void *const key)
     char *ret = NULL;
     char *traverse = me->root;
     while (traverse) {
-        const int compare = me->comparator(traverse + node_key_offset, key);
+        const int compare = set_compare(me, traverse + node_key_offset, key);
         if (compare < 0) {
             ret = traverse + node_key_offset;
             memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
@@ -772,7 +1313,7 @@ void *set_higher(set me, void *const key)
     char *ret = NULL;
     char *traverse = me->root;
     while (traverse) {
-        const int compare = me->comparator(traverse + node_key_offset, key);
+        const int compare = set_compare(me, traverse + node_key_offset, key);
         if (compare > 0) {
             ret = traverse + node_key_offset;
             memcpy(&traverse, traverse + node_left_child_offset, ptr_size);
@@ -798,7 +1339,7 @@ void *set_floor(set me, void *const key)
     char *ret = NULL;
     char *traverse = me->root;
     while (traverse) {
-        const int compare = me->comparator(traverse + node_key_offset, key);
+        const int compare = set_compare(me, traverse + node_key_offset, key);
         if (compare <= 0) {
             ret = traverse + node_key_offset;
             memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
@@ -821,18 +1362,329 @@ void *set_floor(set me, void *const key)
  */
 void *set_ceiling(set me, void *const key)
 {
-    char *ret = NULL;
+    char *const node = set_ceiling_node(me, key);
+    if (!node) {
+        return NULL;
+    }
+    return node + node_key_offset;
+}
+
+/**
+ * Returns the key at the given position in the order of the set, so that the
+ * lowest key is at position zero. The returned key is a pointer to the
+ * internally stored key, which should not be modified. Modifying it results in
+ * undefined behaviour. This takes logarithmic time if the set keeps order
+ * statistics, otherwise it takes linear time.
+ *
+ * @param me    the set to get the key from
+ * @param index the position of the key
+ *
+ * @return the key at the position, or NULL if the index is out of bounds
+ */
+void *set_select(set me, size_t index)
+{
+    char *traverse = me->root;
+    if (index >= me->size) {
+        return NULL;
+    }
+    if (!me->order_statistics) {
+        traverse = set_leftmost(traverse);
+        for (; index > 0; index--) {
+            traverse = set_successor(traverse);
+        }
+        return traverse + node_key_offset;
+    }
+    for (;;) {
+        char *traverse_left;
+        size_t left_size;
+        memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
+        left_size = set_subtree_size(me, traverse_left);
+        if (index < left_size) {
+            traverse = traverse_left;
+        } else if (index == left_size) {
+            return traverse + node_key_offset;
+        } else {
+            index -= left_size + 1;
+            memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
+        }
+    }
+}
+
+/**
+ * Determines the number of keys in the set which are lower than the given key,
+ * which is the position the key has, or would have, in the order of the set.
+ * This takes logarithmic time if the set keeps order statistics, otherwise it
+ * takes linear time.
+ *
+ * @param me  the set to rank the key in
+ * @param key the key to rank
+ *
+ * @return the number of keys which are lower than the key
+ */
+size_t set_rank(set me, void *const key)
+{
     char *traverse = me->root;
+    size_t rank = 0;
+    if (!me->order_statistics) {
+        traverse = set_leftmost(traverse);
+        while (traverse
+               && set_compare(me, traverse + node_key_offset, key) < 0) {
+            traverse = set_successor(traverse);
+            rank++;
+        }
+        return rank;
+    }
     while (traverse) {
-        const int compare = me->comparator(traverse + node_key_offset, key);
-        if (compare >= 0) {
-            ret = traverse + node_key_offset;
-            memcpy(&traverse, traverse + node_left_child_offset, ptr_size);
+        const int compare = set_compare(me, key, traverse + node_key_offset);
+        char *traverse_left;
+        memcpy(&traverse_left, traverse + node_left_child_offset, ptr_size);
+        if (compare == 0) {
+            return rank + set_subtree_size(me, traverse_left);
+        }
+        if (compare < 0) {
+            traverse = traverse_left;
         } else {
+            rank += set_subtree_size(me, traverse_left) + 1;
             memcpy(&traverse, traverse + node_right_child_offset, ptr_size);
         }
     }
-    return ret;
+    return rank;
+}
+
+/**
+ * Starts an in-order iteration over the set at its lowest key. Each step
+ * follows the links between the nodes instead of searching from the root, so
+ * walking k keys takes O(k) time. Adding keys, or removing ones other than the
+ * one which the iterator is at, does not invalidate the iterator.
+ *
+ * @param iter the iterator to set up
+ * @param me   the set to iterate over
+ */
+void set_iter_init(struct set_iter *const iter, set me)
+{
+    iter->set = me;
+    iter->node = set_leftmost(me->root);
+}
+
+/**
+ * Starts an in-order iteration over the set at its highest key, for iterating
+ * in descending order with set_iter_prev.
+ *
+ * @param iter the iterator to set up
+ * @param me   the set to iterate over
+ */
+void set_iter_init_last(struct set_iter *const iter, set me)
+{
+    iter->set = me;
+    iter->node = set_rightmost(me->root);
+}
+
+/**
+ * Starts an in-order iteration over the set at the lowest key which is not less
+ * than the specified key.
+ *
+ * @param iter the iterator to set up
+ * @param me   the set to iterate over
+ * @param key  the key to start at
+ */
+void set_iter_init_at(struct set_iter *const iter, set me, void *const key)
+{
+    iter->set = me;
+    iter->node = set_ceiling_node(me, key);
+}
+
+/**
+ * Gets the key which the iterator is at, and then moves the iterator to the
+ * next higher key. The key points to where it is stored, and must not be
+ * modified.
+ *
+ * @param key  set to the key
+ * @param iter the iterator to advance
+ *
+ * @return BK_TRUE if there was a key, otherwise BK_FALSE
+ */
+bk_bool set_iter_next(void **const key, struct set_iter *const iter)
+{
+    char *const node = iter->node;
+    if (!node) {
+        return BK_FALSE;
+    }
+    *key = node + node_key_offset;
+    iter->node = set_successor(node);
+    return BK_TRUE;
+}
+
+/**
+ * Gets the key which the iterator is at, and then moves the iterator to the
+ * next lower key. The key points to where it is stored, and must not be
+ * modified.
+ *
+ * @param key  set to the key
+ * @param iter the iterator to move back
+ *
+ * @return BK_TRUE if there was a key, otherwise BK_FALSE
+ */
+bk_bool set_iter_prev(void **const key, struct set_iter *const iter)
+{
+    char *const node = iter->node;
+    if (!node) {
+        return BK_FALSE;
+    }
+    *key = node + node_key_offset;
+    iter->node = set_predecessor(node);
+    return BK_TRUE;
+}
+
+/**
+ * Calls the callback on every key which is between the low and the high keys,
+ * inclusive, in ascending order. The set is only searched once, for the low
+ * key, so a scan of k keys costs O(log n + k) time. The callback must not add
+ * or remove keys.
+ *
+ * @param me       the set to scan
+ * @param low      the lowest key to visit
+ * @param high     the highest key to visit
+ * @param callback the function to call with the key and the context
+ * @param context  passed to each call of the callback
+ */
+void set_range(set me, void *const low, void *const high,
+               void (*const callback)(const void *const key,
+                                      void *const context),
+               void *const context)
+{
+    char *node = set_ceiling_node(me, low);
+    while (node && set_compare(me, node + node_key_offset, high) <= 0) {
+        callback(node + node_key_offset, context);
+        node = set_successor(node);
+    }
+}
+
+/*
+ * Frees every node of a subtree in linear time, without rebalancing. Child
+ * references are cut on the way down so that each node is freed after both of
+ * its children, and the parent references lead back up. The parent of the
+ * subtree root must be NULL.
+ */
+static void set_free_nodes(set me, char *traverse)
+{
+    while (traverse) {
+        char *next;
+        memcpy(&next, traverse + node_left_child_offset, ptr_size);
+        if (next) {
+            memset(traverse + node_left_child_offset, 0, ptr_size);
+            traverse = next;
+            continue;
+        }
+        memcpy(&next, traverse + node_right_child_offset, ptr_size);
+        if (next) {
+            memset(traverse + node_right_child_offset, 0, ptr_size);
+            traverse = next;
+            continue;
+        }
+        memcpy(&next, traverse + node_parent_offset, ptr_size);
+        set_deallocate(&me->allocator, traverse);
+        traverse = next;
+    }
+}
+
+/*
+ * Builds a balanced subtree out of the next count keys of the sorted input,
+ * taking the keys in order. The two subtrees of each node differ in
+ * size by at most one, so their heights differ by at most one as well.
+ */
+static bk_err set_build_sorted(set me, const char **const keys,
+                               const size_t count, char **const root,
+                               int *const height)
+{
+    char *left;
+    char *right;
+    char *node;
+    int left_height;
+    int right_height;
+    bk_err err;
+    if (count == 0) {
+        *root = NULL;
+        *height = 0;
+        return BK_OK;
+    }
+    err = set_build_sorted(me, keys, count / 2, &left, &left_height);
+    if (err != BK_OK) {
+        return err;
+    }
+    node = set_node_allocate(me, &me->nodes);
+    if (!node) {
+        set_free_nodes(me, left);
+        return -BK_ENOMEM;
+    }
+    memset(node + node_parent_offset, 0, ptr_size);
+    memcpy(node + node_left_child_offset, &left, ptr_size);
+    memset(node + node_right_child_offset, 0, ptr_size);
+    if (left) {
+        memcpy(left + node_parent_offset, &node, ptr_size);
+    }
+    memcpy(node + node_key_offset, *keys, me->key_size);
+    *keys += me->key_size;
+    err = set_build_sorted(me, keys, count - count / 2 - 1, &right,
+                           &right_height);
+    if (err != BK_OK) {
+        set_free_nodes(me, node);
+        return err;
+    }
+    memcpy(node + node_right_child_offset, &right, ptr_size);
+    if (right) {
+        memcpy(right + node_parent_offset, &node, ptr_size);
+    }
+    node[me->balance_offset] = (char) (right_height - left_height);
+    *root = node;
+    *height = (left_height > right_height ? left_height : right_height) + 1;
+    return BK_OK;
+}
+
+/**
+ * Initializes a set from keys which are already sorted in ascending order.
+ * Rather than putting each key, the tree is built balanced in linear time.
+ *
+ * @param key_size   the size of each element in the set; must be positive
+ * @param comparator the comparator function used for key ordering; must not be
+ *                   NULL
+ * @param keys       the keys to initialize the set with; must be strictly
+ *                   ascending according to the comparator
+ * @param count      the number of keys
+ *
+ * @return the newly-initialized set, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+set set_init_from_sorted(const size_t key_size,
+                         int (*const comparator)(const void *const,
+                                                 const void *const),
+                         const void *const keys, const size_t count)
+{
+    size_t i;
+    int height;
+    const char *key_traverse = keys;
+    set me = set_init(key_size, comparator);
+    if (!me) {
+        return NULL;
+    }
+    if (count == 0) {
+        return me;
+    }
+    if (!keys) {
+        return set_destroy(me);
+    }
+    for (i = 1; i < count; i++) {
+        if (comparator(key_traverse + (i - 1) * key_size,
+                       key_traverse + i * key_size) >= 0) {
+            return set_destroy(me);
+        }
+    }
+    if (set_build_sorted(me, &key_traverse, count, &me->root, &height)
+        != BK_OK) {
+        return set_destroy(me);
+    }
+    me->size = count;
+    return me;
 }
 
 /**
@@ -842,9 +1694,13 @@ void *set_ceiling(set me, void *const key)
  */
 void set_clear(set me)
 {
-    while (me->root) {
-        set_remove_element(me, me->root);
+    if (me->nodes.in_use) {
+        set_pool_release(me, &me->nodes);
+    } else {
+        set_free_nodes(me, me->root);
     }
+    me->root = NULL;
+    me->size = 0;
 }
 
 /**
@@ -860,7 +1716,7 @@ set set_destroy(set me)
 {
     if (me) {
         set_clear(me);
-        free(me);
+        set_deallocate(&me->allocator, me);
     }
     return NULL;
 }
@@ -38,6 +38,25 @@ stack stack_init(const size_t data_size)
     return deque_init(data_size);
 }
 
+/**
+ * Initializes a stack, which manages its memory with the given allocator.
+ *
+ * @param data_size the size of each data element in the stack; must be
+ *                  positive
+ * @param allocator the allocator which manages the memory of the stack, or NULL
+ *                  to use the standard library; if not NULL, its allocate and
+ *                  deallocate functions must not be NULL
+ *
+ * @return the newly-initialized stack, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+stack stack_init_with_allocator(const size_t data_size,
+                                const struct bk_allocator *const allocator)
+{
+    return deque_init_with_allocator(data_size, allocator);
+}
+
 /**
  * Determines the size of the stack.
  *
@@ -62,6 +81,18 @@ bk_bool stack_is_empty(stack me)
     return deque_is_empty(me);
 }
 
+/**
+ * Gets the statistics of the stack. They are only tracked if the library is
+ * compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the stack to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void stack_get_stats(stack me, struct bk_stats *const stats)
+{
+    deque_get_stats(me, stats);
+}
+
 /**
  * Frees unused memory from the stack.
  *
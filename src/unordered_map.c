@@ -20,41 +20,376 @@
  * SOFTWARE.
  */
 
+#include <stddef.h>
 #include <string.h>
+#include "include/bk_hash.h"
 #include "include/unordered_map.h"
 
 #define BKTHOMPS_U_MAP_STARTING_BUCKETS 16
 #define BKTHOMPS_U_MAP_RESIZE_AT 0.75
 #define BKTHOMPS_U_MAP_RESIZE_RATIO 2
 
+/*
+ * Each slot has a control byte. A full slot has the high bit set and keeps 7
+ * bits of the hash as a tag, so that most mismatches are rejected without
+ * touching the slot itself.
+ */
+#define BKTHOMPS_U_MAP_CTRL_EMPTY 0x00
+#define BKTHOMPS_U_MAP_CTRL_DELETED 0x01
+#define BKTHOMPS_U_MAP_CTRL_FULL 0x80
+#define BKTHOMPS_U_MAP_TAG_MASK 0x7F
+#define BKTHOMPS_U_MAP_TAG_BITS 7
+
+/*
+ * The control bytes are scanned a group at a time, using SSE2 if it is
+ * available. The control bytes of the first group are mirrored past the end of
+ * the table so that a group may start at any slot.
+ */
+#define BKTHOMPS_U_MAP_GROUP_WIDTH 16
+
+/*
+ * During an incremental rehash, each write to the unordered map moves this many
+ * slots of the old table into the new table.
+ */
+#define BKTHOMPS_U_MAP_MIGRATION_STEP (4 * BKTHOMPS_U_MAP_GROUP_WIDTH)
+
+/*
+ * The batch functions hash this many keys and prefetch their slots before
+ * looking any of them up, so that the cache misses of the keys overlap.
+ */
+#define BKTHOMPS_U_MAP_BATCH_SIZE 16
+
+#ifdef __GNUC__
+#define BKTHOMPS_U_MAP_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define BKTHOMPS_U_MAP_PREFETCH(address) ((void) 0)
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BKTHOMPS_U_MAP_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef BK_STATS
+#define BKTHOMPS_U_MAP_STAT(me, counter, amount) \
+    ((me)->stats.counter += (amount))
+#else
+#define BKTHOMPS_U_MAP_STAT(me, counter, amount) ((void) 0)
+#endif
+
 struct internal_unordered_map {
     size_t key_size;
     size_t value_size;
+    size_t slot_size;
+    size_t value_offset;
+    size_t hash_offset;
     size_t size;
     size_t capacity;
     unsigned long (*hash)(const void *const key);
     int (*comparator)(const void *const one, const void *const two);
-    char **buckets;
+    unsigned char *ctrl;
+    char *slots;
+    double max_load_factor;
+    double growth_factor;
+    size_t initial_capacity;
+    bk_bool incremental;
+    unsigned char *old_ctrl;
+    char *old_slots;
+    size_t old_capacity;
+    size_t old_size;
+    size_t migrated;
+#ifdef BK_STATS
+    struct bk_stats stats;
+#endif
+    struct bk_allocator allocator;
 };
 
-static const size_t ptr_size = sizeof(char *);
+/*
+ * Each slot holds the key, then the value, then the hash. The value and the
+ * hash are padded so that each of them is aligned, and the slot size is padded
+ * so that every slot is aligned as well.
+ */
 static const size_t hash_size = sizeof(unsigned long);
-static const size_t node_next_offset = 0;
-static const size_t node_hash_offset = sizeof(char *);
-static const size_t node_key_offset = sizeof(char *) + sizeof(unsigned long);
-/* Assume the value starts right after the key ends. */
+static const size_t slot_key_offset = 0;
+
+/*
+ * C89 has no name for the strictest alignment which a fundamental type may
+ * need, so it is found from where a union of those types lands after a char.
+ */
+union unordered_map_max_align {
+    long l;
+    double d;
+    long double ld;
+    void *p;
+    void (*f)(void);
+};
+
+struct unordered_map_align_probe {
+    char c;
+    union unordered_map_max_align u;
+};
+
+static const size_t max_alignment =
+        offsetof(struct unordered_map_align_probe, u);
+
+/*
+ * Used when the unordered map is initialized without an allocator. Its function
+ * pointers are all NULL, which means memory is managed by the standard library.
+ */
+static const struct bk_allocator unordered_map_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the unordered map.
+ */
+static void *unordered_map_allocate(const struct bk_allocator *const allocator,
+                                    const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Allocates zero-initialized memory with the allocator of the unordered map.
+ */
+static void *
+unordered_map_zero_allocate(const struct bk_allocator *const allocator,
+                            const size_t size)
+{
+    void *ptr;
+    if (!allocator->allocate) {
+        return calloc(1, size);
+    }
+    ptr = allocator->allocate(allocator->context, size);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+/*
+ * Frees memory with the allocator of the unordered map.
+ */
+static void unordered_map_deallocate(const struct bk_allocator *const allocator,
+                                     void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+ * Gets the alignment which an object of the specified size may need. The size
+ * of a type is a multiple of its alignment, which is a power of two, so the
+ * largest power of two which divides the size is enough, up to the strictest
+ * alignment of any type.
+ */
+static size_t unordered_map_alignment(const size_t size)
+{
+    size_t alignment = 1;
+    while (alignment < max_alignment && size % (2 * alignment) == 0) {
+        alignment *= 2;
+    }
+    return alignment;
+}
+
+/*
+ * Rounds the offset up to a multiple of the alignment, or gets zero if that
+ * would overflow.
+ */
+static size_t unordered_map_align(const size_t offset, const size_t alignment)
+{
+    const size_t padding = (alignment - offset % alignment) % alignment;
+    if (offset + padding < offset) {
+        return 0;
+    }
+    return offset + padding;
+}
 
 /*
- * Gets the hash by first calling the user-defined hash, and then using a
- * second hash to prevent hashing clusters if the user-defined hash is
- * sub-optimal.
+ * Gets the hash by first calling the user-defined hash, and then mixing it so
+ * that each bit of the result depends on every bit of the user-defined hash.
+ * The table only uses the low bits to pick a slot, so this prevents clusters if
+ * the user-defined hash is sub-optimal. If unsigned long is wider than 32 bits,
+ * its upper half is folded in first. The built-in hash is used as is, since it
+ * is already mixed.
  */
 static unsigned long unordered_map_hash(unordered_map me,
                                         const void *const key)
 {
-    unsigned long hash = me->hash(key);
-    hash ^= (hash >> 20UL) ^ (hash >> 12UL);
-    return hash ^ (hash >> 7UL) ^ (hash >> 4UL);
+    unsigned long hash;
+    BKTHOMPS_U_MAP_STAT(me, hash_calls, 1);
+    if (!me->hash) {
+        return bk_hash_bytes(key, me->key_size);
+    }
+    hash = me->hash(key);
+    hash ^= (hash >> 16UL) >> 16UL;
+    hash ^= hash >> 16UL;
+    hash *= 0x85EBCA6BUL;
+    hash ^= hash >> 13UL;
+    hash *= 0xC2B2AE35UL;
+    return hash ^ (hash >> 16UL);
+}
+
+/*
+ * Gets the control byte which marks a slot as full for the specified hash.
+ */
+static unsigned char unordered_map_tag(const unsigned long hash)
+{
+    return (unsigned char) (BKTHOMPS_U_MAP_CTRL_FULL
+                            | (hash & BKTHOMPS_U_MAP_TAG_MASK));
+}
+
+/*
+ * Gets the slot at which the probe sequence for the specified hash starts. The
+ * capacity is a power of two, so masking picks the slot without a division.
+ */
+static size_t unordered_map_home(unordered_map me, const unsigned long hash)
+{
+    return (size_t) (hash >> BKTHOMPS_U_MAP_TAG_BITS) & (me->capacity - 1);
+}
+
+/*
+ * Gets a bit mask of the slots in the group which have the control byte.
+ */
+static unsigned int unordered_map_group_match(const unsigned char *const group,
+                                              const unsigned char ctrl)
+{
+#ifdef BKTHOMPS_U_MAP_SSE2
+    const __m128i bytes = _mm_loadu_si128((const __m128i *) group);
+    const __m128i match = _mm_cmpeq_epi8(bytes, _mm_set1_epi8((char) ctrl));
+    return (unsigned int) _mm_movemask_epi8(match);
+#else
+    unsigned int mask = 0;
+    int i;
+    for (i = 0; i < BKTHOMPS_U_MAP_GROUP_WIDTH; i++) {
+        if (group[i] == ctrl) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Gets a bit mask of the slots in the group which are either empty or deleted.
+ */
+static unsigned int unordered_map_group_match_free(const unsigned char *group)
+{
+#ifdef BKTHOMPS_U_MAP_SSE2
+    const __m128i bytes = _mm_loadu_si128((const __m128i *) group);
+    return (unsigned int) _mm_movemask_epi8(bytes) ^ 0xFFFFU;
+#else
+    unsigned int mask = 0;
+    int i;
+    for (i = 0; i < BKTHOMPS_U_MAP_GROUP_WIDTH; i++) {
+        if (!(group[i] & BKTHOMPS_U_MAP_CTRL_FULL)) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Gets the index of the lowest set bit of the non-zero mask.
+ */
+static size_t unordered_map_lowest_bit(unsigned int mask)
+{
+#ifdef __GNUC__
+    return (size_t) __builtin_ctz(mask);
+#else
+    size_t i = 0;
+    while (!(mask & 1U)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+/*
+ * Gets the slot index which is the specified offset into the group.
+ */
+static size_t unordered_map_group_index(unordered_map me, const size_t group,
+                                        const size_t offset)
+{
+    return (group + offset) & (me->capacity - 1);
+}
+
+/*
+ * Sets the control byte of a slot, as well as its mirror if it has one.
+ */
+static void unordered_map_set_ctrl(unordered_map me, const size_t index,
+                                   const unsigned char ctrl)
+{
+    me->ctrl[index] = ctrl;
+    if (index < BKTHOMPS_U_MAP_GROUP_WIDTH - 1) {
+        me->ctrl[me->capacity + index] = ctrl;
+    }
+}
+
+/*
+ * Gets the slot at the specified index.
+ */
+static char *unordered_map_slot(unordered_map me, const size_t index)
+{
+    return me->slots + index * me->slot_size;
+}
+
+/*
+ * Empties the slot at the specified index without leaving a tombstone. Every
+ * entry sits in the run of non-empty slots which starts at its home slot, so
+ * the entries after the slot, up to the end of its run, are shifted back into
+ * the gap whenever doing so does not move them before their home slot. Probe
+ * lengths therefore do not grow as entries are removed and added over time.
+ */
+static void unordered_map_erase(unordered_map me, size_t index)
+{
+    const size_t mask = me->capacity - 1;
+    size_t next = (index + 1) & mask;
+    while (me->ctrl[next] != BKTHOMPS_U_MAP_CTRL_EMPTY) {
+        char *const slot = unordered_map_slot(me, next);
+        unsigned long hash;
+        size_t home;
+        memcpy(&hash, slot + me->hash_offset, hash_size);
+        home = unordered_map_home(me, hash);
+        if (((next - home) & mask) >= ((next - index) & mask)) {
+            memcpy(unordered_map_slot(me, index), slot, me->slot_size);
+            unordered_map_set_ctrl(me, index, me->ctrl[next]);
+            index = next;
+        }
+        next = (next + 1) & mask;
+    }
+    unordered_map_set_ctrl(me, index, BKTHOMPS_U_MAP_CTRL_EMPTY);
+}
+
+/*
+ * Allocates a table of the specified capacity, with every slot empty. The slots
+ * and the control bytes share one allocation.
+ */
+static bk_err unordered_map_alloc_table(unordered_map me, const size_t capacity)
+{
+    char *block;
+    const size_t ctrl_size = capacity + BKTHOMPS_U_MAP_GROUP_WIDTH - 1;
+    if (capacity > ((size_t) -1 - ctrl_size) / me->slot_size) {
+        return -BK_ENOMEM;
+    }
+    BKTHOMPS_U_MAP_STAT(me, bytes_allocated,
+                        capacity * me->slot_size + ctrl_size);
+    block = unordered_map_zero_allocate(&me->allocator,
+                                        capacity * me->slot_size + ctrl_size);
+    if (!block) {
+        return -BK_ENOMEM;
+    }
+    me->slots = block;
+    me->ctrl = (unsigned char *) block + capacity * me->slot_size;
+    me->capacity = capacity;
+    return BK_OK;
 }
 
 /**
@@ -78,58 +413,353 @@ unordered_map unordered_map_init(const size_t key_size,
                                  unsigned long (*hash)(const void *const),
                                  int (*comparator)(const void *const,
                                                    const void *const))
+{
+    return unordered_map_init_with_allocator(key_size, value_size, hash,
+                                             comparator, NULL);
+}
+
+/*
+ * Initializes an unordered map, which manages its memory with the given
+ * allocator unless it is NULL. If the hash is NULL, the built-in hash of the
+ * key size is used, and if the key comparator is NULL, keys are compared byte
+ * by byte.
+ */
+static unordered_map
+unordered_map_create(const size_t key_size, const size_t value_size,
+                     unsigned long (*hash)(const void *const),
+                     int (*comparator)(const void *const, const void *const),
+                     const struct bk_allocator *allocator)
 {
     struct internal_unordered_map *init;
-    if (key_size == 0 || value_size == 0 || !hash || !comparator) {
+    size_t value_alignment;
+    size_t hash_alignment;
+    size_t slot_alignment;
+    size_t value_offset;
+    size_t hash_offset;
+    size_t slot_size;
+    if (key_size == 0 || value_size == 0) {
         return NULL;
     }
-    if (node_key_offset + key_size < node_key_offset) {
+    if (!allocator) {
+        allocator = &unordered_map_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
         return NULL;
     }
-    if (node_key_offset + key_size + value_size < node_key_offset + key_size) {
+    value_alignment = unordered_map_alignment(value_size);
+    hash_alignment = unordered_map_alignment(hash_size);
+    slot_alignment = unordered_map_alignment(key_size);
+    if (slot_alignment < value_alignment) {
+        slot_alignment = value_alignment;
+    }
+    if (slot_alignment < hash_alignment) {
+        slot_alignment = hash_alignment;
+    }
+    value_offset = unordered_map_align(slot_key_offset + key_size,
+                                       value_alignment);
+    if (value_offset == 0 || value_offset + value_size < value_offset) {
+        return NULL;
+    }
+    hash_offset = unordered_map_align(value_offset + value_size,
+                                      hash_alignment);
+    if (hash_offset == 0 || hash_offset + hash_size < hash_offset) {
         return NULL;
     }
-    init = malloc(sizeof *init);
+    slot_size = unordered_map_align(hash_offset + hash_size, slot_alignment);
+    if (slot_size == 0) {
+        return NULL;
+    }
+    init = unordered_map_allocate(allocator, sizeof *init);
     if (!init) {
         return NULL;
     }
+    init->allocator = *allocator;
+#ifdef BK_STATS
+    memset(&init->stats, 0, sizeof init->stats);
+#endif
+    BKTHOMPS_U_MAP_STAT(init, bytes_allocated, sizeof *init);
     init->key_size = key_size;
     init->value_size = value_size;
+    init->slot_size = slot_size;
+    init->value_offset = value_offset;
+    init->hash_offset = hash_offset;
     init->hash = hash;
     init->comparator = comparator;
     init->size = 0;
-    init->capacity = BKTHOMPS_U_MAP_STARTING_BUCKETS;
-    init->buckets = calloc(BKTHOMPS_U_MAP_STARTING_BUCKETS, ptr_size);
-    if (!init->buckets) {
-        free(init);
+    init->max_load_factor = BKTHOMPS_U_MAP_RESIZE_AT;
+    init->growth_factor = BKTHOMPS_U_MAP_RESIZE_RATIO;
+    init->initial_capacity = BKTHOMPS_U_MAP_STARTING_BUCKETS;
+    init->incremental = BK_FALSE;
+    init->old_ctrl = NULL;
+    init->old_slots = NULL;
+    init->old_capacity = 0;
+    init->old_size = 0;
+    init->migrated = 0;
+    if (unordered_map_alloc_table(init, init->initial_capacity) != BK_OK) {
+        unordered_map_deallocate(allocator, init);
         return NULL;
     }
     return init;
 }
 
+/**
+ * Initializes an unordered map, which manages its memory with the given
+ * allocator.
+ *
+ * @param key_size   the size of each key in the unordered map; must be positive
+ * @param value_size the size of each value in the unordered map; must be
+ *                   positive
+ * @param hash       the hash function which computes the hash from the key;
+ *                   must not be NULL
+ * @param comparator the comparator function which compares two keys; must not
+ *                   be NULL
+ * @param allocator  the allocator which manages the memory of the unordered
+ *                   map, or NULL to use the standard library; if not NULL, its
+ *                   allocate and deallocate functions must not be NULL
+ *
+ * @return the newly-initialized unordered map, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+unordered_map
+unordered_map_init_with_allocator(const size_t key_size,
+                                  const size_t value_size,
+                                  unsigned long (*hash)(const void *const),
+                                  int (*comparator)(const void *const,
+                                                    const void *const),
+                                  const struct bk_allocator *allocator)
+{
+    if (!hash || !comparator) {
+        return NULL;
+    }
+    return unordered_map_create(key_size, value_size, hash, comparator,
+                                allocator);
+}
+
+/**
+ * Initializes an unordered map, with its table sized up front for the expected
+ * number of key-value pairs, and with the specified load factor and growth
+ * factor.
+ *
+ * @param key_size        the size of each key in the unordered map; must be
+ *                        positive
+ * @param value_size      the size of each value in the unordered map; must be
+ *                        positive
+ * @param hash            the hash function which computes the hash from the
+ *                        key, or NULL to use the built-in hash of the key size,
+ *                        which is bk_hash_bytes
+ * @param comparator      the comparator function which compares two keys, or
+ *                        NULL to compare the bytes of the keys
+ * @param expected_count  the number of key-value pairs which the unordered map
+ *                        is expected to hold; space for them is reserved up
+ *                        front
+ * @param max_load_factor the fraction of slots which may be used before the
+ *                        table grows; must be greater than zero and less than
+ *                        one
+ * @param growth_factor   the least factor by which the table grows, as its
+ *                        capacity is rounded up to a power of two; must be
+ *                        greater than one
+ *
+ * @return the newly-initialized unordered map, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+unordered_map
+unordered_map_init_ex(const size_t key_size, const size_t value_size,
+                      unsigned long (*hash)(const void *const),
+                      int (*comparator)(const void *const, const void *const),
+                      const size_t expected_count, const double max_load_factor,
+                      const double growth_factor)
+{
+    unordered_map me;
+    if (!(max_load_factor > 0 && max_load_factor < 1) || !(growth_factor > 1)) {
+        return NULL;
+    }
+    me = unordered_map_create(key_size, value_size, hash, comparator, NULL);
+    if (!me) {
+        return NULL;
+    }
+    me->max_load_factor = max_load_factor;
+    me->growth_factor = growth_factor;
+    if (unordered_map_reserve(me, expected_count) != BK_OK) {
+        return unordered_map_destroy(me);
+    }
+    me->initial_capacity = me->capacity;
+    return me;
+}
+
+/*
+ * Gets the index of the first slot in the probe sequence of the hash which is
+ * either empty or deleted, and marks it as full. The map must have a free slot.
+ */
+static size_t unordered_map_claim_slot(unordered_map me,
+                                       const unsigned long hash)
+{
+    size_t group = unordered_map_home(me, hash);
+    for (;;) {
+        const unsigned int free_slots =
+                unordered_map_group_match_free(me->ctrl + group);
+        if (free_slots) {
+            const size_t index = unordered_map_group_index(
+                    me, group, unordered_map_lowest_bit(free_slots));
+            unordered_map_set_ctrl(me, index, unordered_map_tag(hash));
+            return index;
+        }
+        group = unordered_map_group_index(me, group,
+                                          BKTHOMPS_U_MAP_GROUP_WIDTH);
+    }
+}
+
 /*
- * Adds the specified node to the map.
+ * Places the slot into the first free position of its probe sequence. The key
+ * must not already be in the map, and the map must have a free slot.
  */
-static void unordered_map_add_item(unordered_map me, char *const add)
+static void unordered_map_add_item(unordered_map me, const char *const slot)
 {
-    char *traverse;
-    char *traverse_next;
     unsigned long hash;
     size_t index;
-    memcpy(&hash, add + node_hash_offset, hash_size);
-    index = hash % me->capacity;
-    memset(add + node_next_offset, 0, ptr_size);
-    if (!me->buckets[index]) {
-        me->buckets[index] = add;
+    memcpy(&hash, slot + me->hash_offset, hash_size);
+    index = unordered_map_claim_slot(me, hash);
+    memcpy(unordered_map_slot(me, index), slot, me->slot_size);
+}
+
+/*
+ * Moves every entry into a newly-allocated table of the specified capacity. If
+ * specified, the hashes are recomputed.
+ */
+static bk_err unordered_map_rebuild(unordered_map me, const size_t capacity,
+                                    const bk_bool recompute_hash)
+{
+    size_t i;
+    unsigned char *const old_ctrl = me->ctrl;
+    char *const old_slots = me->slots;
+    const size_t old_capacity = me->capacity;
+    const bk_err rc = unordered_map_alloc_table(me, capacity);
+    if (rc != BK_OK) {
+        me->ctrl = old_ctrl;
+        me->slots = old_slots;
+        me->capacity = old_capacity;
+        return rc;
+    }
+    BKTHOMPS_U_MAP_STAT(me, rehashes, 1);
+    BKTHOMPS_U_MAP_STAT(me, resizes, capacity != old_capacity);
+    for (i = 0; i < old_capacity; i++) {
+        char *const slot = old_slots + i * me->slot_size;
+        if (!(old_ctrl[i] & BKTHOMPS_U_MAP_CTRL_FULL)) {
+            continue;
+        }
+        if (recompute_hash) {
+            const unsigned long hash =
+                    unordered_map_hash(me, slot + slot_key_offset);
+            memcpy(slot + me->hash_offset, &hash, hash_size);
+        }
+        unordered_map_add_item(me, slot);
+    }
+    unordered_map_deallocate(&me->allocator, old_slots);
+    return BK_OK;
+}
+
+/*
+ * Starts an incremental rehash into a newly-allocated table of the specified
+ * capacity. The current table becomes the old table, whose entries are moved a
+ * few at a time by later writes.
+ */
+static bk_err unordered_map_begin_migration(unordered_map me,
+                                            const size_t capacity)
+{
+    unsigned char *const old_ctrl = me->ctrl;
+    char *const old_slots = me->slots;
+    const size_t old_capacity = me->capacity;
+    const bk_err rc = unordered_map_alloc_table(me, capacity);
+    if (rc != BK_OK) {
+        me->ctrl = old_ctrl;
+        me->slots = old_slots;
+        me->capacity = old_capacity;
+        return rc;
+    }
+    BKTHOMPS_U_MAP_STAT(me, rehashes, 1);
+    BKTHOMPS_U_MAP_STAT(me, resizes, capacity != old_capacity);
+    me->old_ctrl = old_ctrl;
+    me->old_slots = old_slots;
+    me->old_capacity = old_capacity;
+    me->old_size = me->size;
+    me->migrated = 0;
+    return BK_OK;
+}
+
+/*
+ * Marks the slot of the old table at the specified index as deleted, as well as
+ * its mirror if it has one. Its probe sequence is left intact for the slots
+ * which have not been moved yet.
+ */
+static void unordered_map_delete_old(unordered_map me, const size_t index)
+{
+    me->old_ctrl[index] = BKTHOMPS_U_MAP_CTRL_DELETED;
+    if (index < BKTHOMPS_U_MAP_GROUP_WIDTH - 1) {
+        me->old_ctrl[me->old_capacity + index] = BKTHOMPS_U_MAP_CTRL_DELETED;
+    }
+}
+
+/*
+ * Moves up to the specified number of slots of the old table into the new
+ * table, and frees the old table once every slot has been moved.
+ */
+static void unordered_map_migrate(unordered_map me, const size_t count)
+{
+    size_t end;
+    if (!me->old_slots) {
         return;
     }
-    traverse = me->buckets[index];
-    memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-    while (traverse_next) {
-        traverse = traverse_next;
-        memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
+    end = me->migrated + count;
+    if (end > me->old_capacity || end < me->migrated) {
+        end = me->old_capacity;
+    }
+    for (; me->migrated < end; me->migrated++) {
+        const size_t i = me->migrated;
+        if (!(me->old_ctrl[i] & BKTHOMPS_U_MAP_CTRL_FULL)) {
+            continue;
+        }
+        unordered_map_add_item(me, me->old_slots + i * me->slot_size);
+        unordered_map_delete_old(me, i);
+        me->old_size--;
+    }
+    if (me->migrated == me->old_capacity) {
+        unordered_map_deallocate(&me->allocator, me->old_slots);
+        me->old_ctrl = NULL;
+        me->old_slots = NULL;
+        me->old_capacity = 0;
+        me->old_size = 0;
+        me->migrated = 0;
+    }
+}
+
+/*
+ * Moves every remaining slot of the old table into the new table, if an
+ * incremental rehash is in progress.
+ */
+static void unordered_map_finish_migration(unordered_map me)
+{
+    unordered_map_migrate(me, me->old_capacity);
+}
+
+/**
+ * Sets whether the unordered map rehashes incrementally. Normally, growing the
+ * table moves every entry at once, which makes the put which triggers it much
+ * slower than the others. When rehashing incrementally, the old table is kept
+ * alongside the new one, and each put or remove which adds or removes a
+ * key-value pair moves a bounded number of its slots. Lookups check both tables
+ * until every slot has been moved. Turning it off finishes any rehash which is
+ * in progress.
+ *
+ * @param me          the unordered map to configure
+ * @param incremental whether or not to rehash incrementally
+ */
+void unordered_map_set_incremental_rehash(unordered_map me,
+                                          const bk_bool incremental)
+{
+    me->incremental = incremental;
+    if (!incremental) {
+        unordered_map_finish_migration(me);
     }
-    memcpy(traverse + node_next_offset, &add, ptr_size);
 }
 
 /**
@@ -143,27 +773,60 @@ static void unordered_map_add_item(unordered_map me, char *const add)
  */
 bk_err unordered_map_rehash(unordered_map me)
 {
-    size_t i;
-    char **old_buckets = me->buckets;
-    me->buckets = calloc(me->capacity, ptr_size);
-    if (!me->buckets) {
-        me->buckets = old_buckets;
+    unordered_map_finish_migration(me);
+    return unordered_map_rebuild(me, me->capacity, BK_TRUE);
+}
+
+/*
+ * Gets the smallest power of two capacity at which the specified number of
+ * entries fit without the table growing, or zero if it is not representable.
+ */
+static size_t unordered_map_capacity_for(unordered_map me, const size_t count)
+{
+    size_t capacity = BKTHOMPS_U_MAP_STARTING_BUCKETS;
+    while ((size_t) (me->max_load_factor * capacity) <= count) {
+        if (capacity > (size_t) -1 / 2) {
+            return 0;
+        }
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+/**
+ * Reserves space for the specified number of key-value pairs, so that the
+ * unordered map does not grow until it holds more than that. If there already
+ * is enough space, nothing is done.
+ *
+ * @param me    the unordered map to reserve space in
+ * @param count the number of key-value pairs to reserve space for
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_ENOMEM if out of memory
+ */
+bk_err unordered_map_reserve(unordered_map me, const size_t count)
+{
+    const size_t capacity = unordered_map_capacity_for(me, count);
+    if (capacity == 0) {
         return -BK_ENOMEM;
     }
-    for (i = 0; i < me->capacity; i++) {
-        char *traverse = old_buckets[i];
-        while (traverse) {
-            char *backup;
-            unsigned long hash;
-            memcpy(&backup, traverse + node_next_offset, ptr_size);
-            hash = unordered_map_hash(me, traverse + node_key_offset);
-            memcpy(traverse + node_hash_offset, &hash, hash_size);
-            unordered_map_add_item(me, traverse);
-            traverse = backup;
-        }
+    unordered_map_finish_migration(me);
+    if (capacity <= me->capacity) {
+        return BK_OK;
     }
-    free(old_buckets);
-    return BK_OK;
+    return unordered_map_rebuild(me, capacity, BK_FALSE);
+}
+
+/*
+ * Makes room for the specified number of new entries ahead of adding them, so
+ * that none of them has to resize the table.
+ */
+static bk_err unordered_map_reserve_more(unordered_map me, const size_t count)
+{
+    if (count > (size_t) -1 - me->size) {
+        return -BK_ENOMEM;
+    }
+    return unordered_map_reserve(me, me->size + count);
 }
 
 /**
@@ -190,64 +853,300 @@ bk_bool unordered_map_is_empty(unordered_map me)
     return unordered_map_size(me) == 0;
 }
 
-/*
- * Increases the size of the map and redistributes the nodes.
+/**
+ * Gets the statistics of the unordered map. They are only tracked if the
+ * library is compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the unordered map to get the statistics of
+ * @param stats the statistics to copy to
  */
-static bk_err unordered_map_resize(unordered_map me)
+void unordered_map_get_stats(unordered_map me, struct bk_stats *const stats)
+{
+#ifdef BK_STATS
+    *stats = me->stats;
+#else
+    (void) me;
+    memset(stats, 0, sizeof *stats);
+#endif
+}
+
+/**
+ * Gets a histogram of how many groups of slots a lookup of each entry of the
+ * unordered map scans, as well as how its slots are occupied. With a good hash
+ * function, nearly every entry is in the first group of its probe sequence.
+ * Many entries which are further away mean that the hash function clusters.
+ * During an incremental rehash, only the new table is described.
+ *
+ * @param me        the unordered map to get the histogram of
+ * @param histogram the histogram to copy to
+ */
+void unordered_map_probe_histogram(unordered_map me,
+                                   struct bk_probe_histogram *const histogram)
 {
     size_t i;
-    const size_t old_capacity = me->capacity;
-    const size_t new_capacity = me->capacity * BKTHOMPS_U_MAP_RESIZE_RATIO;
-    char **old_buckets = me->buckets;
-    me->buckets = calloc(new_capacity, ptr_size);
-    if (!me->buckets) {
-        me->buckets = old_buckets;
-        return -BK_ENOMEM;
+    size_t total = 0;
+    memset(histogram, 0, sizeof *histogram);
+    histogram->capacity = me->capacity;
+    for (i = 0; i < me->capacity; i++) {
+        unsigned long hash;
+        size_t distance;
+        size_t groups;
+        if (!(me->ctrl[i] & BKTHOMPS_U_MAP_CTRL_FULL)) {
+            continue;
+        }
+        memcpy(&hash, unordered_map_slot(me, i) + me->hash_offset, hash_size);
+        distance = i + me->capacity - unordered_map_home(me, hash);
+        groups = (distance & (me->capacity - 1)) / BKTHOMPS_U_MAP_GROUP_WIDTH
+                 + 1;
+        if (groups > histogram->longest_probe) {
+            histogram->longest_probe = groups;
+        }
+        if (groups > BK_PROBE_HISTOGRAM_BUCKETS) {
+            histogram->counts[BK_PROBE_HISTOGRAM_BUCKETS - 1]++;
+        } else {
+            histogram->counts[groups - 1]++;
+        }
+        histogram->full++;
+        total += groups;
     }
-    me->capacity = new_capacity;
-    for (i = 0; i < old_capacity; i++) {
-        char *traverse = old_buckets[i];
-        while (traverse) {
-            char *backup;
-            memcpy(&backup, traverse + node_next_offset, ptr_size);
-            unordered_map_add_item(me, traverse);
-            traverse = backup;
+    if (histogram->full > 0) {
+        histogram->average_probe = (double) total / (double) histogram->full;
+    }
+}
+
+/*
+ * Moves the entries into a new table of the specified capacity, either all at
+ * once or incrementally.
+ */
+static bk_err unordered_map_resize(unordered_map me, const size_t capacity)
+{
+    if (me->incremental) {
+        return unordered_map_begin_migration(me, capacity);
+    }
+    return unordered_map_rebuild(me, capacity, BK_FALSE);
+}
+
+/*
+ * Makes room for one more entry. Grows the table by at least the growth factor,
+ * to the next power of two, when it is mostly full. The entries which are still
+ * in the old table of an incremental rehash count towards the new table, and if
+ * they do not fit, the rehash is finished before the next one starts.
+ */
+static bk_err unordered_map_make_room(unordered_map me)
+{
+    const size_t limit = (size_t) (me->max_load_factor * me->capacity);
+    double grown;
+    size_t capacity;
+    if (me->size + 1 < limit) {
+        return BK_OK;
+    }
+    unordered_map_finish_migration(me);
+    grown = me->growth_factor * me->capacity;
+    capacity = me->capacity;
+    do {
+        if (capacity > (size_t) -1 / 2) {
+            return -BK_ENOMEM;
         }
+        capacity *= 2;
+    } while ((double) capacity < grown);
+    return unordered_map_resize(me, capacity);
+}
+
+/*
+ * Determines if two keys are equal. Without a comparator, keys the size of an
+ * integer type are compared as that type, and other keys byte by byte.
+ */
+static bk_bool unordered_map_keys_equal(unordered_map me, const void *const one,
+                                        const void *const two)
+{
+    BKTHOMPS_U_MAP_STAT(me, comparator_calls, 1);
+    if (me->comparator) {
+        return me->comparator(one, two) == 0;
     }
-    free(old_buckets);
-    return BK_OK;
+    if (me->key_size == sizeof(unsigned long)) {
+        unsigned long a;
+        unsigned long b;
+        memcpy(&a, one, sizeof(unsigned long));
+        memcpy(&b, two, sizeof(unsigned long));
+        return a == b;
+    }
+    if (me->key_size == sizeof(unsigned int)) {
+        unsigned int a;
+        unsigned int b;
+        memcpy(&a, one, sizeof(unsigned int));
+        memcpy(&b, two, sizeof(unsigned int));
+        return a == b;
+    }
+    return memcmp(one, two, me->key_size) == 0;
 }
 
 /*
- * Determines if an element is equal to the key.
+ * Determines if the slot at the specified index holds the key.
  */
-static bk_bool unordered_map_is_equal(unordered_map me, char *const item,
+static bk_bool unordered_map_is_equal(unordered_map me, const size_t index,
                                       const unsigned long hash,
                                       const void *const key)
 {
-    unsigned long item_hash;
-    memcpy(&item_hash, item + node_hash_offset, hash_size);
-    return item_hash == hash &&
-           me->comparator(item + node_key_offset, key) == 0;
+    const char *const slot = unordered_map_slot(me, index);
+    unsigned long slot_hash;
+    memcpy(&slot_hash, slot + me->hash_offset, hash_size);
+    if (slot_hash != hash) {
+        return BK_FALSE;
+    }
+    return unordered_map_keys_equal(me, slot + slot_key_offset, key);
 }
 
 /*
- * Creates an element to add.
+ * Counts the groups which a lookup of the unordered map scanned.
  */
-static char *unordered_map_create_element(unordered_map me,
+static void unordered_map_count_probe(unordered_map me, const size_t groups)
+{
+#ifdef BK_STATS
+    me->stats.probes += groups;
+    if (groups > me->stats.longest_probe) {
+        me->stats.longest_probe = groups;
+    }
+#else
+    (void) me;
+    (void) groups;
+#endif
+}
+
+/*
+ * Gets the index of the slot which holds the key, or the capacity if the key is
+ * not in the map. Only the slots whose tag matches are compared, and the probe
+ * stops at the first group which has an empty slot.
+ */
+static size_t unordered_map_find(unordered_map me, const unsigned long hash,
+                                 const void *const key)
+{
+    const unsigned char tag = unordered_map_tag(hash);
+    size_t group = unordered_map_home(me, hash);
+    size_t groups = 1;
+    for (;;) {
+        const unsigned char *const ctrl = me->ctrl + group;
+        unsigned int match = unordered_map_group_match(ctrl, tag);
+        const unsigned int empty =
+                unordered_map_group_match(ctrl, BKTHOMPS_U_MAP_CTRL_EMPTY);
+        if (empty) {
+            /* Slots after the first empty slot are not in the sequence. */
+            match &= (empty & (0U - empty)) - 1U;
+        }
+        while (match) {
+            const size_t index = unordered_map_group_index(
+                    me, group, unordered_map_lowest_bit(match));
+            if (unordered_map_is_equal(me, index, hash, key)) {
+                unordered_map_count_probe(me, groups);
+                return index;
+            }
+            match &= match - 1U;
+        }
+        if (empty) {
+            unordered_map_count_probe(me, groups);
+            return me->capacity;
+        }
+        groups++;
+        group = unordered_map_group_index(me, group,
+                                          BKTHOMPS_U_MAP_GROUP_WIDTH);
+    }
+}
+
+/*
+ * Gets the index of the slot of the old table which holds the key, or the old
+ * capacity if the key is not in the old table. The slots which were already
+ * moved are marked as deleted, so they are never matched.
+ */
+static size_t unordered_map_find_old(unordered_map me, const unsigned long hash,
+                                     const void *const key)
+{
+    const unsigned char tag = unordered_map_tag(hash);
+    size_t group;
+    size_t groups = 1;
+    if (!me->old_slots) {
+        return me->old_capacity;
+    }
+    group = (size_t) (hash >> BKTHOMPS_U_MAP_TAG_BITS) & (me->old_capacity - 1);
+    for (;;) {
+        const unsigned char *const ctrl = me->old_ctrl + group;
+        unsigned int match = unordered_map_group_match(ctrl, tag);
+        const unsigned int empty =
+                unordered_map_group_match(ctrl, BKTHOMPS_U_MAP_CTRL_EMPTY);
+        if (empty) {
+            match &= (empty & (0U - empty)) - 1U;
+        }
+        while (match) {
+            const size_t index = (group + unordered_map_lowest_bit(match))
+                                 & (me->old_capacity - 1);
+            const char *const slot = me->old_slots + index * me->slot_size;
+            unsigned long slot_hash;
+            memcpy(&slot_hash, slot + me->hash_offset, hash_size);
+            if (slot_hash == hash
+                && unordered_map_keys_equal(me, slot + slot_key_offset, key)) {
+                unordered_map_count_probe(me, groups);
+                return index;
+            }
+            match &= match - 1U;
+        }
+        if (empty) {
+            unordered_map_count_probe(me, groups);
+            return me->old_capacity;
+        }
+        groups++;
+        group = (group + BKTHOMPS_U_MAP_GROUP_WIDTH) & (me->old_capacity - 1);
+    }
+}
+
+/*
+ * Finds the value associated with the key, whose key has the specified hash,
+ * adding the key with a zeroed value if it is not in the unordered map.
+ */
+static char *unordered_map_emplace_hashed(unordered_map me,
                                           const unsigned long hash,
                                           const void *const key,
-                                          const void *const value)
+                                          bk_bool *const inserted)
 {
-    char *init = malloc(ptr_size + hash_size + me->key_size + me->value_size);
-    if (!init) {
+    size_t index;
+    char *slot;
+    index = unordered_map_find(me, hash, key);
+    if (index != me->capacity) {
+        slot = unordered_map_slot(me, index);
+        return slot + me->value_offset;
+    }
+    index = unordered_map_find_old(me, hash, key);
+    if (index != me->old_capacity) {
+        slot = me->old_slots + index * me->slot_size;
+        return slot + me->value_offset;
+    }
+    unordered_map_migrate(me, BKTHOMPS_U_MAP_MIGRATION_STEP);
+    if (unordered_map_make_room(me) != BK_OK) {
         return NULL;
     }
-    memset(init + node_next_offset, 0, ptr_size);
-    memcpy(init + node_hash_offset, &hash, hash_size);
-    memcpy(init + node_key_offset, key, me->key_size);
-    memcpy(init + node_key_offset + me->key_size, value, me->value_size);
-    return init;
+    index = unordered_map_claim_slot(me, hash);
+    slot = unordered_map_slot(me, index);
+    memcpy(slot + me->hash_offset, &hash, hash_size);
+    memcpy(slot + slot_key_offset, key, me->key_size);
+    memset(slot + me->value_offset, 0, me->value_size);
+    me->size++;
+    if (inserted) {
+        *inserted = BK_TRUE;
+    }
+    return slot + me->value_offset;
+}
+
+/*
+ * Puts the key-value pair, whose key has the specified hash.
+ */
+static bk_err unordered_map_put_hashed(unordered_map me,
+                                       const unsigned long hash,
+                                       const void *const key,
+                                       const void *const value)
+{
+    char *const found = unordered_map_emplace_hashed(me, hash, key, NULL);
+    if (!found) {
+        return -BK_ENOMEM;
+    }
+    memcpy(found, value, me->value_size);
+    return BK_OK;
 }
 
 /**
@@ -269,47 +1168,156 @@ static char *unordered_map_create_element(unordered_map me,
 bk_err unordered_map_put(unordered_map me, void *const key, void *const value)
 {
     const unsigned long hash = unordered_map_hash(me, key);
-    size_t index;
-    if (me->size + 1 >= (size_t) (BKTHOMPS_U_MAP_RESIZE_AT * me->capacity)) {
-        const bk_err rc = unordered_map_resize(me);
-        if (rc != BK_OK) {
-            return rc;
-        }
+    return unordered_map_put_hashed(me, hash, key, value);
+}
+
+/*
+ * Hashes a batch of keys, and prefetches the control bytes and the first slot
+ * of the probe sequence of each one, so that they are in the cache once the
+ * keys are looked up.
+ */
+static void unordered_map_hash_batch(unordered_map me,
+                                     unsigned long *const hashes,
+                                     const char *const keys, const size_t count)
+{
+    size_t i;
+    for (i = 0; i < count; i++) {
+        size_t home;
+        hashes[i] = unordered_map_hash(me, keys + i * me->key_size);
+        home = unordered_map_home(me, hashes[i]);
+        BKTHOMPS_U_MAP_PREFETCH(me->ctrl + home);
+        BKTHOMPS_U_MAP_PREFETCH(unordered_map_slot(me, home));
     }
-    index = hash % me->capacity;
-    if (!me->buckets[index]) {
-        me->buckets[index] = unordered_map_create_element(me, hash, key, value);
-        if (!me->buckets[index]) {
-            return -BK_ENOMEM;
-        }
-    } else {
-        char *traverse = me->buckets[index];
-        char *traverse_next;
-        if (unordered_map_is_equal(me, traverse, hash, key)) {
-            memcpy(traverse + node_key_offset + me->key_size, value,
-                   me->value_size);
-            return BK_OK;
+}
+
+/**
+ * Gets a pointer to the value associated with a key in the unordered map,
+ * adding the key with a zeroed value first if the unordered map does not
+ * already contain it. This lets a value be created or updated in place with a
+ * single probe, such as when counting or aggregating by key. The key itself
+ * must not be modified. The pointer is aligned for the value type, and is
+ * invalidated by the same operations as the pointer from unordered_map_get_ptr.
+ *
+ * @param me       the unordered map to add to
+ * @param key      the key to find or add
+ * @param inserted set to whether or not the key was added, unless it is NULL
+ *
+ * @return a pointer to the value, or NULL if out of memory
+ */
+void *unordered_map_emplace(unordered_map me, void *const key,
+                            bk_bool *const inserted)
+{
+    const unsigned long hash = unordered_map_hash(me, key);
+    if (inserted) {
+        *inserted = BK_FALSE;
+    }
+    return unordered_map_emplace_hashed(me, hash, key, inserted);
+}
+
+/**
+ * Adds many key-value pairs to the unordered map, as if each were put in turn.
+ * The keys are hashed and their slots prefetched a batch at a time, so that
+ * this is faster than putting each key-value pair separately. The keys and the
+ * values are each laid out contiguously.
+ *
+ * @param me     the unordered map to add to
+ * @param keys   the keys to add
+ * @param values the values to add, one for each key
+ * @param count  the number of key-value pairs
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_ENOMEM if out of memory, in which case only the key-value pairs
+ *                    before the one which failed were added
+ */
+bk_err unordered_map_put_batch(unordered_map me, void *const keys,
+                               void *const values, const size_t count)
+{
+    unsigned long hashes[BKTHOMPS_U_MAP_BATCH_SIZE];
+    const char *const key_bytes = keys;
+    const char *const value_bytes = values;
+    size_t start;
+    for (start = 0; start < count; start += BKTHOMPS_U_MAP_BATCH_SIZE) {
+        size_t i;
+        size_t batch = count - start;
+        if (batch > BKTHOMPS_U_MAP_BATCH_SIZE) {
+            batch = BKTHOMPS_U_MAP_BATCH_SIZE;
         }
-        memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-        while (traverse_next) {
-            traverse = traverse_next;
-            memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-            if (unordered_map_is_equal(me, traverse, hash, key)) {
-                memcpy(traverse + node_key_offset + me->key_size, value,
-                       me->value_size);
-                return BK_OK;
+        unordered_map_hash_batch(me, hashes, key_bytes + start * me->key_size,
+                                 batch);
+        for (i = 0; i < batch; i++) {
+            const size_t at = start + i;
+            const bk_err rc = unordered_map_put_hashed(
+                    me, hashes[i], key_bytes + at * me->key_size,
+                    value_bytes + at * me->value_size);
+            if (rc != BK_OK) {
+                return rc;
             }
         }
-        traverse_next = unordered_map_create_element(me, hash, key, value);
-        if (!traverse_next) {
-            return -BK_ENOMEM;
-        }
-        memcpy(traverse + node_next_offset, &traverse_next, ptr_size);
     }
-    me->size++;
     return BK_OK;
 }
 
+/**
+ * Adds many key-value pairs to the unordered map, as if each were put in turn.
+ * Space for all of them is reserved up front, so that the unordered map is
+ * resized at most once, and the keys are then hashed a batch at a time. The
+ * keys and the values are each laid out contiguously.
+ *
+ * @param me     the unordered map to add to
+ * @param keys   the keys to add
+ * @param values the values to add, one for each key
+ * @param count  the number of key-value pairs
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_ENOMEM if out of memory, in which case no key-value pairs were
+ *                    added
+ */
+bk_err unordered_map_put_all(unordered_map me, void *const keys,
+                             void *const values, const size_t count)
+{
+    if (unordered_map_reserve_more(me, count) != BK_OK) {
+        return -BK_ENOMEM;
+    }
+    return unordered_map_put_batch(me, keys, values, count);
+}
+
+/*
+ * Finds the value associated with the key, whose key has the specified hash,
+ * in whichever table holds it.
+ */
+static char *unordered_map_find_value(unordered_map me,
+                                      const unsigned long hash,
+                                      const void *const key)
+{
+    char *slot;
+    size_t index = unordered_map_find(me, hash, key);
+    if (index != me->capacity) {
+        slot = unordered_map_slot(me, index);
+    } else {
+        index = unordered_map_find_old(me, hash, key);
+        if (index == me->old_capacity) {
+            return NULL;
+        }
+        slot = me->old_slots + index * me->slot_size;
+    }
+    return slot + me->value_offset;
+}
+
+/*
+ * Gets the value associated with the key, whose key has the specified hash.
+ */
+static bk_bool unordered_map_get_hashed(void *const value, unordered_map me,
+                                        const unsigned long hash,
+                                        const void *const key)
+{
+    const char *const found = unordered_map_find_value(me, hash, key);
+    if (!found) {
+        return BK_FALSE;
+    }
+    memcpy(value, found, me->value_size);
+    return BK_TRUE;
+}
+
 /**
  * Gets the value associated with a key in the unordered map. The pointer to the
  * key being passed in and the value being obtained should point to the key and
@@ -328,16 +1336,78 @@ bk_err unordered_map_put(unordered_map me, void *const key, void *const value)
 bk_bool unordered_map_get(void *const value, unordered_map me, void *const key)
 {
     const unsigned long hash = unordered_map_hash(me, key);
-    char *traverse = me->buckets[hash % me->capacity];
-    while (traverse) {
-        if (unordered_map_is_equal(me, traverse, hash, key)) {
-            memcpy(value, traverse + node_key_offset + me->key_size,
-                   me->value_size);
-            return BK_TRUE;
+    return unordered_map_get_hashed(value, me, hash, key);
+}
+
+/**
+ * Gets a pointer to the value associated with a key in the unordered map, so
+ * that the value can be read or modified in place without copying it or looking
+ * the key up a second time. The key itself must not be modified. Entries move
+ * when the table is resized, rehashed or migrated, so the pointer is
+ * invalidated by any operation which adds or removes a key-value pair, and by
+ * rehash, reserve, clear and turning incremental rehashing off. An incremental
+ * rehash only moves entries when a key-value pair is added or removed, so
+ * updating a key which is already in the unordered map, or removing one which
+ * is not, keeps the pointer valid. The value is aligned for its type, so it may
+ * be accessed through a pointer of that type.
+ *
+ * @param me  the unordered map to get from
+ * @param key the key to search for
+ *
+ * @return a pointer to the value, or NULL if the unordered map does not contain
+ *         the key
+ */
+void *unordered_map_get_ptr(unordered_map me, void *const key)
+{
+    const unsigned long hash = unordered_map_hash(me, key);
+    return unordered_map_find_value(me, hash, key);
+}
+
+/**
+ * Gets the values associated with many keys in the unordered map, as if each
+ * were gotten in turn. The keys are hashed and their slots prefetched a batch
+ * at a time, so that this is faster than getting each value separately. The
+ * keys and the values are each laid out contiguously, and the value of a key
+ * which is not in the unordered map is left unchanged.
+ *
+ * @param values the values to copy to, one for each key
+ * @param found  whether or not each key was in the unordered map, or NULL if
+ *               this is not needed
+ * @param me     the unordered map to get from
+ * @param keys   the keys to search for
+ * @param count  the number of keys
+ *
+ * @return the number of keys which were in the unordered map
+ */
+size_t unordered_map_get_batch(void *const values, bk_bool *const found,
+                               unordered_map me, void *const keys,
+                               const size_t count)
+{
+    unsigned long hashes[BKTHOMPS_U_MAP_BATCH_SIZE];
+    const char *const key_bytes = keys;
+    char *const value_bytes = values;
+    size_t total = 0;
+    size_t start;
+    for (start = 0; start < count; start += BKTHOMPS_U_MAP_BATCH_SIZE) {
+        size_t i;
+        size_t batch = count - start;
+        if (batch > BKTHOMPS_U_MAP_BATCH_SIZE) {
+            batch = BKTHOMPS_U_MAP_BATCH_SIZE;
+        }
+        unordered_map_hash_batch(me, hashes, key_bytes + start * me->key_size,
+                                 batch);
+        for (i = 0; i < batch; i++) {
+            const size_t at = start + i;
+            const bk_bool is_found = unordered_map_get_hashed(
+                    value_bytes + at * me->value_size, me, hashes[i],
+                    key_bytes + at * me->key_size);
+            if (found) {
+                found[at] = is_found;
+            }
+            total += is_found;
         }
-        memcpy(&traverse, traverse + node_next_offset, ptr_size);
     }
-    return BK_FALSE;
+    return total;
 }
 
 /**
@@ -355,14 +1425,10 @@ bk_bool unordered_map_get(void *const value, unordered_map me, void *const key)
 bk_bool unordered_map_contains(unordered_map me, void *const key)
 {
     const unsigned long hash = unordered_map_hash(me, key);
-    char *traverse = me->buckets[hash % me->capacity];
-    while (traverse) {
-        if (unordered_map_is_equal(me, traverse, hash, key)) {
-            return BK_TRUE;
-        }
-        memcpy(&traverse, traverse + node_next_offset, ptr_size);
+    if (unordered_map_find(me, hash, key) != me->capacity) {
+        return BK_TRUE;
     }
-    return BK_FALSE;
+    return unordered_map_find_old(me, hash, key) != me->old_capacity;
 }
 
 /**
@@ -379,33 +1445,146 @@ bk_bool unordered_map_contains(unordered_map me, void *const key)
  */
 bk_bool unordered_map_remove(unordered_map me, void *const key)
 {
-    char *traverse;
-    char *traverse_next;
     const unsigned long hash = unordered_map_hash(me, key);
-    const size_t index = hash % me->capacity;
-    if (!me->buckets[index]) {
-        return BK_FALSE;
+    size_t index = unordered_map_find(me, hash, key);
+    if (index != me->capacity) {
+        unordered_map_erase(me, index);
+        me->size--;
+        unordered_map_migrate(me, BKTHOMPS_U_MAP_MIGRATION_STEP);
+        return BK_TRUE;
     }
-    traverse = me->buckets[index];
-    if (unordered_map_is_equal(me, traverse, hash, key)) {
-        memcpy(me->buckets + index, traverse + node_next_offset, ptr_size);
-        free(traverse);
+    index = unordered_map_find_old(me, hash, key);
+    if (index != me->old_capacity) {
+        unordered_map_delete_old(me, index);
+        me->old_size--;
         me->size--;
+        unordered_map_migrate(me, BKTHOMPS_U_MAP_MIGRATION_STEP);
         return BK_TRUE;
     }
-    memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-    while (traverse_next) {
-        if (unordered_map_is_equal(me, traverse_next, hash, key)) {
-            memcpy(traverse + node_next_offset,
-                   traverse_next + node_next_offset, ptr_size);
-            free(traverse_next);
-            me->size--;
+    return BK_FALSE;
+}
+
+/**
+ * Starts an iteration over every key-value pair of the unordered map. The pairs
+ * are visited in the order of their slots, which is unrelated to the order in
+ * which they were added. Adding or removing a key-value pair, or anything which
+ * rehashes the unordered map, invalidates the iterator.
+ *
+ * @param iter the iterator to set up
+ * @param me   the unordered map to iterate over
+ */
+void unordered_map_iter_init(struct unordered_map_iter *const iter,
+                             unordered_map me)
+{
+    iter->map = me;
+    iter->index = 0;
+    iter->in_old_table = BK_FALSE;
+}
+
+/**
+ * Advances the iterator to the next key-value pair of the unordered map, and
+ * points the key and the value at where they are stored, so that nothing is
+ * copied or hashed. The key must not be modified, but the value may be. During
+ * an incremental rehash, the pairs of the new table are visited before the
+ * pairs which are still in the old table.
+ *
+ * @param key   set to the key of the next key-value pair
+ * @param value set to the value of the next key-value pair, unless it is NULL
+ * @param iter  the iterator to advance
+ *
+ * @return BK_TRUE if there was another key-value pair, otherwise BK_FALSE
+ */
+bk_bool unordered_map_iter_next(void **const key, void **const value,
+                                struct unordered_map_iter *const iter)
+{
+    unordered_map me = iter->map;
+    for (;;) {
+        const unsigned char *const ctrl =
+                iter->in_old_table ? me->old_ctrl : me->ctrl;
+        char *const slots = iter->in_old_table ? me->old_slots : me->slots;
+        const size_t capacity =
+                iter->in_old_table ? me->old_capacity : me->capacity;
+        while (iter->index < capacity) {
+            const unsigned int full =
+                    unordered_map_group_match_free(ctrl + iter->index)
+                    ^ 0xFFFFU;
+            size_t index;
+            char *slot;
+            if (!full) {
+                iter->index += BKTHOMPS_U_MAP_GROUP_WIDTH;
+                continue;
+            }
+            index = iter->index + unordered_map_lowest_bit(full);
+            if (index >= capacity) {
+                /* Only the mirrored control bytes were left. */
+                break;
+            }
+            iter->index = index + 1;
+            slot = slots + index * me->slot_size;
+            *key = slot + slot_key_offset;
+            if (value) {
+                *value = slot + me->value_offset;
+            }
             return BK_TRUE;
         }
-        traverse = traverse_next;
-        memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
+        if (iter->in_old_table || !me->old_slots) {
+            return BK_FALSE;
+        }
+        iter->in_old_table = BK_TRUE;
+        iter->index = 0;
+    }
+}
+
+/*
+ * Calls the callback on each key-value pair of one table, finding the full
+ * slots a group of control bytes at a time.
+ */
+static void unordered_map_for_each_in(unordered_map me,
+                                      const unsigned char *const ctrl,
+                                      char *const slots, const size_t capacity,
+                                      void (*const callback)(
+                                              const void *const key,
+                                              void *const value,
+                                              void *const context),
+                                      void *const context)
+{
+    size_t group;
+    for (group = 0; group < capacity; group += BKTHOMPS_U_MAP_GROUP_WIDTH) {
+        unsigned int full =
+                unordered_map_group_match_free(ctrl + group) ^ 0xFFFFU;
+        while (full) {
+            char *const slot = slots + (group + unordered_map_lowest_bit(full))
+                                       * me->slot_size;
+            callback(slot + slot_key_offset,
+                     slot + me->value_offset, context);
+            full &= full - 1U;
+        }
+    }
+}
+
+/**
+ * Calls the callback on every key-value pair of the unordered map, in the same
+ * order as an iterator. The slots are scanned in order a group at a time, and
+ * no key is hashed, so this runs at close to the speed of reading the table.
+ * The callback must not add or remove key-value pairs, or rehash the unordered
+ * map, but it may modify the value.
+ *
+ * @param me       the unordered map to iterate over
+ * @param callback the function to call with the key, the value, and the context
+ * @param context  passed to each call of the callback
+ */
+void unordered_map_for_each(unordered_map me,
+                            void (*const callback)(const void *const key,
+                                                   void *const value,
+                                                   void *const context),
+                            void *const context)
+{
+    unordered_map_for_each_in(me, me->ctrl, me->slots, me->capacity, callback,
+                              context);
+    if (me->old_slots) {
+        unordered_map_for_each_in(me, me->old_ctrl, me->old_slots,
+                                  me->old_capacity, callback, context);
     }
-    return BK_FALSE;
 }
 
 /**
@@ -416,25 +1595,27 @@ bk_bool unordered_map_remove(unordered_map me, void *const key)
  * @return  BK_OK     if no error
  * @return -BK_ENOMEM if out of memory
  */
-int unordered_map_clear(unordered_map me)
+bk_err unordered_map_clear(unordered_map me)
 {
-    size_t i;
-    char **updated_buckets = calloc(BKTHOMPS_U_MAP_STARTING_BUCKETS, ptr_size);
-    if (!updated_buckets) {
+    unsigned char *const old_ctrl = me->ctrl;
+    char *const old_slots = me->slots;
+    const size_t old_capacity = me->capacity;
+    if (unordered_map_alloc_table(me, me->initial_capacity) != BK_OK) {
+        me->ctrl = old_ctrl;
+        me->slots = old_slots;
+        me->capacity = old_capacity;
         return -BK_ENOMEM;
     }
-    for (i = 0; i < me->capacity; i++) {
-        char *traverse = me->buckets[i];
-        while (traverse) {
-            char *backup = traverse;
-            memcpy(&traverse, traverse + node_next_offset, ptr_size);
-            free(backup);
-        }
+    unordered_map_deallocate(&me->allocator, old_slots);
+    if (me->old_slots) {
+        unordered_map_deallocate(&me->allocator, me->old_slots);
     }
-    free(me->buckets);
+    me->old_ctrl = NULL;
+    me->old_slots = NULL;
+    me->old_capacity = 0;
+    me->old_size = 0;
+    me->migrated = 0;
     me->size = 0;
-    me->capacity = BKTHOMPS_U_MAP_STARTING_BUCKETS;
-    me->buckets = updated_buckets;
     return BK_OK;
 }
 
@@ -450,9 +1631,11 @@ int unordered_map_clear(unordered_map me)
 unordered_map unordered_map_destroy(unordered_map me)
 {
     if (me) {
-        unordered_map_clear(me);
-        free(me->buckets);
-        free(me);
+        unordered_map_deallocate(&me->allocator, me->slots);
+        if (me->old_slots) {
+            unordered_map_deallocate(&me->allocator, me->old_slots);
+        }
+        unordered_map_deallocate(&me->allocator, me);
     }
     return NULL;
 }
@@ -20,45 +20,366 @@
  * SOFTWARE.
  */
 
+#include <stddef.h>
 #include <string.h>
+#include "include/bk_hash.h"
 #include "include/unordered_multimap.h"
 
 #define BKTHOMPS_U_MULTIMAP_STARTING_BUCKETS 16
 #define BKTHOMPS_U_MULTIMAP_RESIZE_AT 0.75
 #define BKTHOMPS_U_MULTIMAP_RESIZE_RATIO 2
 
+/*
+ * Each slot has a control byte. A full slot has the high bit set and keeps 7
+ * bits of the hash as a tag, so that most mismatches are rejected without
+ * touching the slot itself.
+ */
+#define BKTHOMPS_U_MULTIMAP_CTRL_EMPTY 0x00
+#define BKTHOMPS_U_MULTIMAP_CTRL_FULL 0x80
+#define BKTHOMPS_U_MULTIMAP_TAG_MASK 0x7F
+#define BKTHOMPS_U_MULTIMAP_TAG_BITS 7
+
+/*
+ * The control bytes are scanned a group at a time, using SSE2 if it is
+ * available. The control bytes of the first group are mirrored past the end of
+ * the table so that a group may start at any slot.
+ */
+#define BKTHOMPS_U_MULTIMAP_GROUP_WIDTH 16
+
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BKTHOMPS_U_MULTIMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef BK_STATS
+#define BKTHOMPS_U_MULTIMAP_STAT(me, counter, amount) \
+    ((me)->stats.counter += (amount))
+#else
+#define BKTHOMPS_U_MULTIMAP_STAT(me, counter, amount) ((void) 0)
+#endif
+
 struct internal_unordered_multimap {
     size_t key_size;
     size_t value_size;
+    size_t slot_size;
+    size_t value_offset;
+    size_t hash_offset;
     size_t size;
     size_t capacity;
     unsigned long (*hash)(const void *const key);
     int (*key_comparator)(const void *const one, const void *const two);
     int (*value_comparator)(const void *const one, const void *const two);
-    char **buckets;
+    unsigned char *ctrl;
+    char *slots;
     unsigned long iterate_hash;
     char *iterate_key;
-    char *iterate_element;
+    size_t iterate_index;
+    double max_load_factor;
+    double growth_factor;
+    size_t initial_capacity;
+#ifdef BK_STATS
+    struct bk_stats stats;
+#endif
+    struct bk_allocator allocator;
 };
 
-static const size_t ptr_size = sizeof(char *);
+/*
+ * Each slot holds the key, then the value, then the hash. The value and the
+ * hash are padded so that each of them is aligned, and the slot size is padded
+ * so that every slot is aligned as well.
+ */
 static const size_t hash_size = sizeof(unsigned long);
-static const size_t node_next_offset = 0;
-static const size_t node_hash_offset = sizeof(char *);
-static const size_t node_key_offset = sizeof(char *) + sizeof(unsigned long);
-/* Assume the value starts right after the key ends. */
+static const size_t slot_key_offset = 0;
+
+/*
+ * C89 has no name for the strictest alignment which a fundamental type may
+ * need, so it is found from where a union of those types lands after a char.
+ */
+union unordered_multimap_max_align {
+    long l;
+    double d;
+    long double ld;
+    void *p;
+    void (*f)(void);
+};
+
+struct unordered_multimap_align_probe {
+    char c;
+    union unordered_multimap_max_align u;
+};
+
+static const size_t max_alignment =
+        offsetof(struct unordered_multimap_align_probe, u);
+
+/*
+ * Used when the unordered multi-map is initialized without an allocator. Its
+ * function pointers are all NULL, which means memory is managed by the standard
+ * library.
+ */
+static const struct bk_allocator unordered_multimap_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the unordered multi-map.
+ */
+static void *
+unordered_multimap_allocate(const struct bk_allocator *const allocator,
+                            const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Allocates zero-initialized memory with the allocator of the unordered multi-
+ * map.
+ */
+static void *
+unordered_multimap_zero_allocate(const struct bk_allocator *const allocator,
+                                 const size_t size)
+{
+    void *ptr;
+    if (!allocator->allocate) {
+        return calloc(1, size);
+    }
+    ptr = allocator->allocate(allocator->context, size);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+/*
+ * Frees memory with the allocator of the unordered multi-map.
+ */
+static void
+unordered_multimap_deallocate(const struct bk_allocator *const allocator,
+                              void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+ * Gets the alignment which an object of the specified size may need. The size
+ * of a type is a multiple of its alignment, which is a power of two, so the
+ * largest power of two which divides the size is enough, up to the strictest
+ * alignment of any type.
+ */
+static size_t unordered_multimap_alignment(const size_t size)
+{
+    size_t alignment = 1;
+    while (alignment < max_alignment && size % (2 * alignment) == 0) {
+        alignment *= 2;
+    }
+    return alignment;
+}
+
+/*
+ * Rounds the offset up to a multiple of the alignment, or gets zero if that
+ * would overflow.
+ */
+static size_t unordered_multimap_align(const size_t offset,
+                                       const size_t alignment)
+{
+    const size_t padding = (alignment - offset % alignment) % alignment;
+    if (offset + padding < offset) {
+        return 0;
+    }
+    return offset + padding;
+}
 
 /*
- * Gets the hash by first calling the user-defined hash, and then using a
- * second hash to prevent hashing clusters if the user-defined hash is
- * sub-optimal.
+ * Gets the hash by first calling the user-defined hash, and then mixing it so
+ * that each bit of the result depends on every bit of the user-defined hash.
+ * The table only uses the low bits to pick a slot, so this prevents clusters if
+ * the user-defined hash is sub-optimal. If unsigned long is wider than 32 bits,
+ * its upper half is folded in first. The built-in hash is used as is, since it
+ * is already mixed.
  */
 static unsigned long unordered_multimap_hash(unordered_multimap me,
                                              const void *const key)
 {
-    unsigned long hash = me->hash(key);
-    hash ^= (hash >> 20UL) ^ (hash >> 12UL);
-    return hash ^ (hash >> 7UL) ^ (hash >> 4UL);
+    unsigned long hash;
+    BKTHOMPS_U_MULTIMAP_STAT(me, hash_calls, 1);
+    if (!me->hash) {
+        return bk_hash_bytes(key, me->key_size);
+    }
+    hash = me->hash(key);
+    hash ^= (hash >> 16UL) >> 16UL;
+    hash ^= hash >> 16UL;
+    hash *= 0x85EBCA6BUL;
+    hash ^= hash >> 13UL;
+    hash *= 0xC2B2AE35UL;
+    return hash ^ (hash >> 16UL);
+}
+
+/*
+ * Gets the control byte which marks a slot as full for the specified hash.
+ */
+static unsigned char unordered_multimap_tag(const unsigned long hash)
+{
+    return (unsigned char) (BKTHOMPS_U_MULTIMAP_CTRL_FULL
+                            | (hash & BKTHOMPS_U_MULTIMAP_TAG_MASK));
+}
+
+/*
+ * Gets the slot at which the probe sequence for the specified hash starts. The
+ * capacity is a power of two, so masking picks the slot without a division.
+ */
+static size_t unordered_multimap_home(unordered_multimap me,
+                                      const unsigned long hash)
+{
+    return (size_t) (hash >> BKTHOMPS_U_MULTIMAP_TAG_BITS) & (me->capacity - 1);
+}
+
+/*
+ * Gets a bit mask of the slots in the group which have the control byte.
+ */
+static unsigned int
+unordered_multimap_group_match(const unsigned char *const group,
+                               const unsigned char ctrl)
+{
+#ifdef BKTHOMPS_U_MULTIMAP_SSE2
+    const __m128i bytes = _mm_loadu_si128((const __m128i *) group);
+    const __m128i match = _mm_cmpeq_epi8(bytes, _mm_set1_epi8((char) ctrl));
+    return (unsigned int) _mm_movemask_epi8(match);
+#else
+    unsigned int mask = 0;
+    int i;
+    for (i = 0; i < BKTHOMPS_U_MULTIMAP_GROUP_WIDTH; i++) {
+        if (group[i] == ctrl) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Gets a bit mask of the slots in the group which are empty.
+ */
+static unsigned int
+unordered_multimap_group_match_free(const unsigned char *group)
+{
+#ifdef BKTHOMPS_U_MULTIMAP_SSE2
+    const __m128i bytes = _mm_loadu_si128((const __m128i *) group);
+    return (unsigned int) _mm_movemask_epi8(bytes) ^ 0xFFFFU;
+#else
+    unsigned int mask = 0;
+    int i;
+    for (i = 0; i < BKTHOMPS_U_MULTIMAP_GROUP_WIDTH; i++) {
+        if (!(group[i] & BKTHOMPS_U_MULTIMAP_CTRL_FULL)) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Gets the index of the lowest set bit of the non-zero mask.
+ */
+static size_t unordered_multimap_lowest_bit(unsigned int mask)
+{
+#ifdef __GNUC__
+    return (size_t) __builtin_ctz(mask);
+#else
+    size_t i = 0;
+    while (!(mask & 1U)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+/*
+ * Gets the slot index which is the specified offset into the group.
+ */
+static size_t unordered_multimap_group_index(unordered_multimap me,
+                                             const size_t group,
+                                             const size_t offset)
+{
+    return (group + offset) & (me->capacity - 1);
+}
+
+/*
+ * Sets the control byte of a slot, as well as its mirror if it has one.
+ */
+static void unordered_multimap_set_ctrl(unordered_multimap me,
+                                        const size_t index,
+                                        const unsigned char ctrl)
+{
+    me->ctrl[index] = ctrl;
+    if (index < BKTHOMPS_U_MULTIMAP_GROUP_WIDTH - 1) {
+        me->ctrl[me->capacity + index] = ctrl;
+    }
+}
+
+/*
+ * Gets the slot at the specified index.
+ */
+static char *unordered_multimap_slot(unordered_multimap me, const size_t index)
+{
+    return me->slots + index * me->slot_size;
+}
+
+/*
+ * Empties the slot at the specified index without leaving a tombstone. Every
+ * entry sits in the run of non-empty slots which starts at its home slot, so
+ * the entries after the slot, up to the end of its run, are shifted back into
+ * the gap whenever doing so does not move them before their home slot. Probe
+ * lengths therefore do not grow as entries are removed and added over time.
+ */
+static void unordered_multimap_erase(unordered_multimap me, size_t index)
+{
+    const size_t mask = me->capacity - 1;
+    size_t next = (index + 1) & mask;
+    while (me->ctrl[next] != BKTHOMPS_U_MULTIMAP_CTRL_EMPTY) {
+        char *const slot = unordered_multimap_slot(me, next);
+        unsigned long hash;
+        size_t home;
+        memcpy(&hash, slot + me->hash_offset, hash_size);
+        home = unordered_multimap_home(me, hash);
+        if (((next - home) & mask) >= ((next - index) & mask)) {
+            memcpy(unordered_multimap_slot(me, index), slot, me->slot_size);
+            unordered_multimap_set_ctrl(me, index, me->ctrl[next]);
+            index = next;
+        }
+        next = (next + 1) & mask;
+    }
+    unordered_multimap_set_ctrl(me, index, BKTHOMPS_U_MULTIMAP_CTRL_EMPTY);
+}
+
+/*
+ * Allocates a table of the specified capacity, with every slot empty. The slots
+ * and the control bytes share one allocation.
+ */
+static bk_err unordered_multimap_alloc_table(unordered_multimap me,
+                                             const size_t capacity)
+{
+    char *block;
+    const size_t ctrl_size = capacity + BKTHOMPS_U_MULTIMAP_GROUP_WIDTH - 1;
+    if (capacity > ((size_t) -1 - ctrl_size) / me->slot_size) {
+        return -BK_ENOMEM;
+    }
+    BKTHOMPS_U_MULTIMAP_STAT(me, bytes_allocated,
+                             capacity * me->slot_size + ctrl_size);
+    block = unordered_multimap_zero_allocate(
+            &me->allocator, capacity * me->slot_size + ctrl_size);
+    if (!block) {
+        return -BK_ENOMEM;
+    }
+    me->slots = block;
+    me->ctrl = (unsigned char *) block + capacity * me->slot_size;
+    me->capacity = capacity;
+    return BK_OK;
 }
 
 /**
@@ -87,68 +408,277 @@ unordered_multimap_init(const size_t key_size,
                                               const void *const),
                         int (*value_comparator)(const void *const,
                                                 const void *const))
+{
+    return unordered_multimap_init_with_allocator(key_size, value_size, hash,
+                                                  key_comparator,
+                                                  value_comparator, NULL);
+}
+
+/*
+ * Initializes an unordered multi-map, which manages its memory with the given
+ * allocator unless it is NULL. If the hash is NULL, the built-in hash of the
+ * key size is used, and if the key comparator is NULL, keys are compared byte
+ * by byte.
+ */
+static unordered_multimap
+unordered_multimap_create(const size_t key_size, const size_t value_size,
+                          unsigned long (*hash)(const void *const),
+                          int (*key_comparator)(const void *const,
+                                                const void *const),
+                          int (*value_comparator)(const void *const,
+                                                  const void *const),
+                          const struct bk_allocator *allocator)
 {
     struct internal_unordered_multimap *init;
-    if (key_size == 0 || value_size == 0
-        || !hash || !key_comparator || !value_comparator) {
+    size_t value_alignment;
+    size_t hash_alignment;
+    size_t slot_alignment;
+    size_t value_offset;
+    size_t hash_offset;
+    size_t slot_size;
+    if (key_size == 0 || value_size == 0 || !value_comparator) {
+        return NULL;
+    }
+    if (!allocator) {
+        allocator = &unordered_multimap_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
+        return NULL;
+    }
+    value_alignment = unordered_multimap_alignment(value_size);
+    hash_alignment = unordered_multimap_alignment(hash_size);
+    slot_alignment = unordered_multimap_alignment(key_size);
+    if (slot_alignment < value_alignment) {
+        slot_alignment = value_alignment;
+    }
+    if (slot_alignment < hash_alignment) {
+        slot_alignment = hash_alignment;
+    }
+    value_offset = unordered_multimap_align(slot_key_offset + key_size,
+                                            value_alignment);
+    if (value_offset == 0 || value_offset + value_size < value_offset) {
         return NULL;
     }
-    if (node_key_offset + key_size < node_key_offset) {
+    hash_offset = unordered_multimap_align(value_offset + value_size,
+                                           hash_alignment);
+    if (hash_offset == 0 || hash_offset + hash_size < hash_offset) {
         return NULL;
     }
-    if (node_key_offset + key_size + value_size < node_key_offset + key_size) {
+    slot_size = unordered_multimap_align(hash_offset + hash_size,
+                                         slot_alignment);
+    if (slot_size == 0) {
         return NULL;
     }
-    init = malloc(sizeof *init);
+    init = unordered_multimap_allocate(allocator, sizeof *init);
     if (!init) {
         return NULL;
     }
+    init->allocator = *allocator;
+#ifdef BK_STATS
+    memset(&init->stats, 0, sizeof init->stats);
+#endif
+    BKTHOMPS_U_MULTIMAP_STAT(init, bytes_allocated, sizeof *init);
     init->key_size = key_size;
     init->value_size = value_size;
+    init->slot_size = slot_size;
+    init->value_offset = value_offset;
+    init->hash_offset = hash_offset;
     init->hash = hash;
     init->key_comparator = key_comparator;
     init->value_comparator = value_comparator;
     init->size = 0;
-    init->capacity = BKTHOMPS_U_MULTIMAP_STARTING_BUCKETS;
-    init->buckets = calloc(BKTHOMPS_U_MULTIMAP_STARTING_BUCKETS, ptr_size);
-    if (!init->buckets) {
-        free(init);
+    init->max_load_factor = BKTHOMPS_U_MULTIMAP_RESIZE_AT;
+    init->growth_factor = BKTHOMPS_U_MULTIMAP_RESIZE_RATIO;
+    init->initial_capacity = BKTHOMPS_U_MULTIMAP_STARTING_BUCKETS;
+    if (unordered_multimap_alloc_table(init, init->initial_capacity) != BK_OK) {
+        unordered_multimap_deallocate(allocator, init);
         return NULL;
     }
     init->iterate_hash = 0;
-    init->iterate_key = calloc(1, init->key_size);
+    BKTHOMPS_U_MULTIMAP_STAT(init, bytes_allocated, init->key_size);
+    init->iterate_key = unordered_multimap_zero_allocate(allocator,
+                                                         init->key_size);
     if (!init->iterate_key) {
-        free(init->buckets);
-        free(init);
+        unordered_multimap_deallocate(allocator, init->slots);
+        unordered_multimap_deallocate(allocator, init);
         return NULL;
     }
-    init->iterate_element = NULL;
+    init->iterate_index = init->capacity;
     return init;
 }
 
+/**
+ * Initializes an unordered multi-map, which manages its memory with the given
+ * allocator.
+ *
+ * @param key_size         the size of each key in the unordered multi-map; must
+ *                         be positive
+ * @param value_size       the size of each value in the unordered multi-map;
+ *                         must be positive
+ * @param hash             the hash function which computes the hash from key;
+ *                         must not be NULL
+ * @param key_comparator   the comparator function which compares two keys; must
+ *                         not be NULL
+ * @param value_comparator the comparator function which compares two values;
+ *                         must not be NULL
+ * @param allocator        the allocator which manages the memory of the
+ *                         unordered multi-map, or NULL to use the standard
+ *                         library; if not NULL, its allocate and deallocate
+ *                         functions must not be NULL
+ *
+ * @return the newly-initialized unordered multi-map, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+unordered_multimap
+unordered_multimap_init_with_allocator(const size_t key_size,
+                                       const size_t value_size,
+                                       unsigned long (*hash)(const void *const),
+                                       int (*key_comparator)(const void *const,
+                                                             const void *const),
+                                       int (*value_comparator)(
+                                               const void *const,
+                                               const void *const),
+                                       const struct bk_allocator *allocator)
+{
+    if (!hash || !key_comparator) {
+        return NULL;
+    }
+    return unordered_multimap_create(key_size, value_size, hash, key_comparator,
+                                     value_comparator, allocator);
+}
+
+/**
+ * Initializes an unordered multi-map, with its table sized up front for the
+ * expected number of key-value pairs, and with the specified load factor and
+ * growth factor.
+ *
+ * @param key_size         the size of each key in the unordered multi-map; must
+ *                         be positive
+ * @param value_size       the size of each value in the unordered multi-map;
+ *                         must be positive
+ * @param hash             the hash function which computes the hash from the
+ *                         key, or NULL to use the built-in hash of the key
+ *                         size, which is bk_hash_bytes
+ * @param key_comparator   the comparator function which compares two keys, or
+ *                         NULL to compare the bytes of the keys
+ * @param value_comparator the comparator function which compares two values;
+ *                         must not be NULL
+ * @param expected_count   the number of key-value pairs which the unordered
+ *                         multi-map is expected to hold; space for them is
+ *                         reserved up front
+ * @param max_load_factor  the fraction of slots which may be used before the
+ *                         table grows; must be greater than zero and less than
+ *                         one
+ * @param growth_factor    the least factor by which the table grows, as its
+ *                         capacity is rounded up to a power of two; must be
+ *                         greater than one
+ *
+ * @return the newly-initialized unordered multi-map, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+unordered_multimap
+unordered_multimap_init_ex(const size_t key_size, const size_t value_size,
+                           unsigned long (*hash)(const void *const),
+                           int (*key_comparator)(const void *const,
+                                                 const void *const),
+                           int (*value_comparator)(const void *const,
+                                                   const void *const),
+                           const size_t expected_count,
+                           const double max_load_factor,
+                           const double growth_factor)
+{
+    unordered_multimap me;
+    if (!(max_load_factor > 0 && max_load_factor < 1) || !(growth_factor > 1)) {
+        return NULL;
+    }
+    me = unordered_multimap_create(key_size, value_size, hash, key_comparator,
+                                   value_comparator, NULL);
+    if (!me) {
+        return NULL;
+    }
+    me->max_load_factor = max_load_factor;
+    me->growth_factor = growth_factor;
+    if (unordered_multimap_reserve(me, expected_count) != BK_OK) {
+        return unordered_multimap_destroy(me);
+    }
+    me->initial_capacity = me->capacity;
+    return me;
+}
+
 /*
- * Adds the specified node to the multi-map.
+ * Gets the index of the first slot in the probe sequence of the hash which is
+ * empty, and marks it as full. The multi-map must have a free slot.
  */
-static void unordered_multimap_add_item(unordered_multimap me, char *const add)
+static size_t unordered_multimap_claim_slot(unordered_multimap me,
+                                            const unsigned long hash)
+{
+    size_t group = unordered_multimap_home(me, hash);
+    for (;;) {
+        const unsigned int free_slots =
+                unordered_multimap_group_match_free(me->ctrl + group);
+        if (free_slots) {
+            const size_t index = unordered_multimap_group_index(
+                    me, group, unordered_multimap_lowest_bit(free_slots));
+            unordered_multimap_set_ctrl(me, index,
+                                        unordered_multimap_tag(hash));
+            return index;
+        }
+        group = unordered_multimap_group_index(me, group,
+                                               BKTHOMPS_U_MULTIMAP_GROUP_WIDTH);
+    }
+}
+
+/*
+ * Places the slot into the first free position of its probe sequence. The key
+ * must not already be in the multi-map, and the multi-map must have a free
+ * slot.
+ */
+static void unordered_multimap_add_item(unordered_multimap me,
+                                        const char *const slot)
 {
-    char *traverse;
-    char *traverse_next;
     unsigned long hash;
     size_t index;
-    memcpy(&hash, add + node_hash_offset, hash_size);
-    index = hash % me->capacity;
-    memset(add + node_next_offset, 0, ptr_size);
-    if (!me->buckets[index]) {
-        me->buckets[index] = add;
-        return;
+    memcpy(&hash, slot + me->hash_offset, hash_size);
+    index = unordered_multimap_claim_slot(me, hash);
+    memcpy(unordered_multimap_slot(me, index), slot, me->slot_size);
+}
+
+/*
+ * Moves every entry into a newly-allocated table of the specified capacity. If
+ * specified, the hashes are recomputed.
+ */
+static bk_err unordered_multimap_rebuild(unordered_multimap me,
+                                         const size_t capacity,
+                                         const bk_bool recompute_hash)
+{
+    size_t i;
+    unsigned char *const old_ctrl = me->ctrl;
+    char *const old_slots = me->slots;
+    const size_t old_capacity = me->capacity;
+    const bk_err rc = unordered_multimap_alloc_table(me, capacity);
+    if (rc != BK_OK) {
+        me->ctrl = old_ctrl;
+        me->slots = old_slots;
+        me->capacity = old_capacity;
+        return rc;
     }
-    traverse = me->buckets[index];
-    memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-    while (traverse_next) {
-        traverse = traverse_next;
-        memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
+    BKTHOMPS_U_MULTIMAP_STAT(me, rehashes, 1);
+    BKTHOMPS_U_MULTIMAP_STAT(me, resizes, capacity != old_capacity);
+    for (i = 0; i < old_capacity; i++) {
+        char *const slot = old_slots + i * me->slot_size;
+        if (!(old_ctrl[i] & BKTHOMPS_U_MULTIMAP_CTRL_FULL)) {
+            continue;
+        }
+        if (recompute_hash) {
+            const unsigned long hash =
+                    unordered_multimap_hash(me, slot + slot_key_offset);
+            memcpy(slot + me->hash_offset, &hash, hash_size);
+        }
+        unordered_multimap_add_item(me, slot);
     }
-    memcpy(traverse + node_next_offset, &add, ptr_size);
+    unordered_multimap_deallocate(&me->allocator, old_slots);
+    return BK_OK;
 }
 
 /**
@@ -162,27 +692,47 @@ static void unordered_multimap_add_item(unordered_multimap me, char *const add)
  */
 bk_err unordered_multimap_rehash(unordered_multimap me)
 {
-    size_t i;
-    char **old_buckets = me->buckets;
-    me->buckets = calloc(me->capacity, ptr_size);
-    if (!me->buckets) {
-        me->buckets = old_buckets;
+    return unordered_multimap_rebuild(me, me->capacity, BK_TRUE);
+}
+
+/*
+ * Gets the smallest power of two capacity at which the specified number of
+ * entries fit without the table growing, or zero if it is not representable.
+ */
+static size_t
+unordered_multimap_capacity_for(unordered_multimap me, const size_t count)
+{
+    size_t capacity = BKTHOMPS_U_MULTIMAP_STARTING_BUCKETS;
+    while ((size_t) (me->max_load_factor * capacity) <= count) {
+        if (capacity > (size_t) -1 / 2) {
+            return 0;
+        }
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+/**
+ * Reserves space for the specified number of key-value pairs, so that the
+ * unordered multi-map does not grow until it holds more than that. If there
+ * already is enough space, nothing is done.
+ *
+ * @param me    the unordered multi-map to reserve space in
+ * @param count the number of key-value pairs to reserve space for
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_ENOMEM if out of memory
+ */
+bk_err unordered_multimap_reserve(unordered_multimap me, const size_t count)
+{
+    const size_t capacity = unordered_multimap_capacity_for(me, count);
+    if (capacity == 0) {
         return -BK_ENOMEM;
     }
-    for (i = 0; i < me->capacity; i++) {
-        char *traverse = old_buckets[i];
-        while (traverse) {
-            char *backup;
-            unsigned long hash;
-            memcpy(&backup, traverse + node_next_offset, ptr_size);
-            hash = unordered_multimap_hash(me, traverse + node_key_offset);
-            memcpy(traverse + node_hash_offset, &hash, hash_size);
-            unordered_multimap_add_item(me, traverse);
-            traverse = backup;
-        }
+    if (capacity <= me->capacity) {
+        return BK_OK;
     }
-    free(old_buckets);
-    return BK_OK;
+    return unordered_multimap_rebuild(me, capacity, BK_FALSE);
 }
 
 /**
@@ -209,65 +759,222 @@ bk_bool unordered_multimap_is_empty(unordered_multimap me)
     return unordered_multimap_size(me) == 0;
 }
 
-/*
- * Increases the size of the multi-map and redistributes the nodes.
+/**
+ * Gets the statistics of the unordered multi-map. They are only tracked if the
+ * library is compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the unordered multi-map to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void unordered_multimap_get_stats(unordered_multimap me,
+                                  struct bk_stats *const stats)
+{
+#ifdef BK_STATS
+    *stats = me->stats;
+#else
+    (void) me;
+    memset(stats, 0, sizeof *stats);
+#endif
+}
+
+/**
+ * Gets a histogram of how many groups of slots a lookup of each entry of the
+ * unordered multi-map scans, as well as how its slots are occupied. With a good
+ * hash function, nearly every entry is in the first group of its probe
+ * sequence. Many entries which are further away mean that the hash function
+ * clusters.
+ *
+ * @param me        the unordered multi-map to get the histogram of
+ * @param histogram the histogram to copy to
  */
-static bk_err unordered_multimap_resize(unordered_multimap me)
+void
+unordered_multimap_probe_histogram(unordered_multimap me,
+                                   struct bk_probe_histogram *const histogram)
 {
     size_t i;
-    const size_t old_capacity = me->capacity;
-    const size_t new_capacity = me->capacity * BKTHOMPS_U_MULTIMAP_RESIZE_RATIO;
-    char **old_buckets = me->buckets;
-    me->buckets = calloc(new_capacity, ptr_size);
-    if (!me->buckets) {
-        me->buckets = old_buckets;
-        return -BK_ENOMEM;
+    size_t total = 0;
+    memset(histogram, 0, sizeof *histogram);
+    histogram->capacity = me->capacity;
+    for (i = 0; i < me->capacity; i++) {
+        unsigned long hash;
+        size_t distance;
+        size_t groups;
+        if (!(me->ctrl[i] & BKTHOMPS_U_MULTIMAP_CTRL_FULL)) {
+            continue;
+        }
+        memcpy(&hash, unordered_multimap_slot(me, i) + me->hash_offset,
+               hash_size);
+        distance = i + me->capacity - unordered_multimap_home(me, hash);
+        groups = (distance & (me->capacity - 1))
+                 / BKTHOMPS_U_MULTIMAP_GROUP_WIDTH + 1;
+        if (groups > histogram->longest_probe) {
+            histogram->longest_probe = groups;
+        }
+        if (groups > BK_PROBE_HISTOGRAM_BUCKETS) {
+            histogram->counts[BK_PROBE_HISTOGRAM_BUCKETS - 1]++;
+        } else {
+            histogram->counts[groups - 1]++;
+        }
+        histogram->full++;
+        total += groups;
     }
-    me->capacity = new_capacity;
-    for (i = 0; i < old_capacity; i++) {
-        char *traverse = old_buckets[i];
-        while (traverse) {
-            char *backup;
-            memcpy(&backup, traverse + node_next_offset, ptr_size);
-            unordered_multimap_add_item(me, traverse);
-            traverse = backup;
+    if (histogram->full > 0) {
+        histogram->average_probe = (double) total / (double) histogram->full;
+    }
+}
+
+/*
+ * Makes room for one more entry. Grows the table by at least the growth factor,
+ * to the next power of two, when it is mostly full.
+ */
+static bk_err unordered_multimap_make_room(unordered_multimap me)
+{
+    const size_t limit = (size_t) (me->max_load_factor * me->capacity);
+    double grown;
+    size_t capacity;
+    if (me->size + 1 < limit) {
+        return BK_OK;
+    }
+    grown = me->growth_factor * me->capacity;
+    capacity = me->capacity;
+    do {
+        if (capacity > (size_t) -1 / 2) {
+            return -BK_ENOMEM;
         }
+        capacity *= 2;
+    } while ((double) capacity < grown);
+    return unordered_multimap_rebuild(me, capacity, BK_FALSE);
+}
+
+/*
+ * Determines if two keys are equal. Without a comparator, keys the size of an
+ * integer type are compared as that type, and other keys byte by byte.
+ */
+static bk_bool
+unordered_multimap_keys_equal(unordered_multimap me, const void *const one,
+                              const void *const two)
+{
+    BKTHOMPS_U_MULTIMAP_STAT(me, comparator_calls, 1);
+    if (me->key_comparator) {
+        return me->key_comparator(one, two) == 0;
     }
-    free(old_buckets);
-    return BK_OK;
+    if (me->key_size == sizeof(unsigned long)) {
+        unsigned long a;
+        unsigned long b;
+        memcpy(&a, one, sizeof(unsigned long));
+        memcpy(&b, two, sizeof(unsigned long));
+        return a == b;
+    }
+    if (me->key_size == sizeof(unsigned int)) {
+        unsigned int a;
+        unsigned int b;
+        memcpy(&a, one, sizeof(unsigned int));
+        memcpy(&b, two, sizeof(unsigned int));
+        return a == b;
+    }
+    return memcmp(one, two, me->key_size) == 0;
 }
 
 /*
- * Determines if an element is equal to the key.
+ * Determines if the slot at the specified index holds the key.
  */
 static bk_bool unordered_multimap_is_equal(unordered_multimap me,
-                                           char *const item,
+                                           const size_t index,
                                            const unsigned long hash,
                                            const void *const key)
 {
-    unsigned long item_hash;
-    memcpy(&item_hash, item + node_hash_offset, hash_size);
-    return item_hash == hash &&
-           me->key_comparator(item + node_key_offset, key) == 0;
+    const char *const slot = unordered_multimap_slot(me, index);
+    unsigned long slot_hash;
+    memcpy(&slot_hash, slot + me->hash_offset, hash_size);
+    if (slot_hash != hash) {
+        return BK_FALSE;
+    }
+    return unordered_multimap_keys_equal(me, slot + slot_key_offset, key);
 }
 
 /*
- * Creates an element to add.
+ * Counts the groups which a lookup of the unordered multi-map scanned.
  */
-static char *unordered_multimap_create_element(unordered_multimap me,
-                                               const unsigned long hash,
-                                               const void *const key,
-                                               const void *const value)
+static void unordered_multimap_count_probe(unordered_multimap me,
+                                           const size_t groups)
 {
-    char *init = malloc(ptr_size + hash_size + me->key_size + me->value_size);
-    if (!init) {
-        return NULL;
+#ifdef BK_STATS
+    me->stats.probes += groups;
+    if (groups > me->stats.longest_probe) {
+        me->stats.longest_probe = groups;
     }
-    memset(init + node_next_offset, 0, ptr_size);
-    memcpy(init + node_hash_offset, &hash, hash_size);
-    memcpy(init + node_key_offset, key, me->key_size);
-    memcpy(init + node_key_offset + me->key_size, value, me->value_size);
-    return init;
+#else
+    (void) me;
+    (void) groups;
+#endif
+}
+
+/*
+ * Gets the index of the first slot which holds the key, starting the search at
+ * the specified slot of the probe sequence of the key, or the capacity if there
+ * is no such slot. Only the slots whose tag matches are compared, and the probe
+ * stops at the first group which has an empty slot.
+ */
+static size_t unordered_multimap_find_from(unordered_multimap me,
+                                           const size_t start,
+                                           const unsigned long hash,
+                                           const void *const key)
+{
+    const unsigned char tag = unordered_multimap_tag(hash);
+    size_t group = start;
+    size_t groups = 1;
+    for (;;) {
+        const unsigned char *const ctrl = me->ctrl + group;
+        unsigned int match = unordered_multimap_group_match(ctrl, tag);
+        const unsigned int empty =
+                unordered_multimap_group_match(ctrl,
+                                               BKTHOMPS_U_MULTIMAP_CTRL_EMPTY);
+        if (empty) {
+            /* Slots after the first empty slot are not in the sequence. */
+            match &= (empty & (0U - empty)) - 1U;
+        }
+        while (match) {
+            const size_t index = unordered_multimap_group_index(
+                    me, group, unordered_multimap_lowest_bit(match));
+            if (unordered_multimap_is_equal(me, index, hash, key)) {
+                unordered_multimap_count_probe(me, groups);
+                return index;
+            }
+            match &= match - 1U;
+        }
+        if (empty) {
+            unordered_multimap_count_probe(me, groups);
+            return me->capacity;
+        }
+        groups++;
+        group = unordered_multimap_group_index(me, group,
+                                               BKTHOMPS_U_MULTIMAP_GROUP_WIDTH);
+    }
+}
+
+/*
+ * Gets the index of the first slot which holds the key, or the capacity if the
+ * key is not in the multi-map.
+ */
+static size_t unordered_multimap_find(unordered_multimap me,
+                                      const unsigned long hash,
+                                      const void *const key)
+{
+    return unordered_multimap_find_from(me, unordered_multimap_home(me, hash),
+                                        hash, key);
+}
+
+/*
+ * Gets the index of the next slot after the specified slot which holds the key,
+ * or the capacity if there is no such slot.
+ */
+static size_t unordered_multimap_find_next(unordered_multimap me,
+                                           const size_t index,
+                                           const unsigned long hash,
+                                           const void *const key)
+{
+    return unordered_multimap_find_from(
+            me, unordered_multimap_group_index(me, index, 1), hash, key);
 }
 
 /**
@@ -290,34 +997,15 @@ bk_err unordered_multimap_put(unordered_multimap me, void *const key,
 {
     const unsigned long hash = unordered_multimap_hash(me, key);
     size_t index;
-    if (me->size + 1 >=
-        (size_t) (BKTHOMPS_U_MULTIMAP_RESIZE_AT * me->capacity)) {
-        const bk_err rc = unordered_multimap_resize(me);
-        if (rc != BK_OK) {
-            return rc;
-        }
-    }
-    index = hash % me->capacity;
-    if (!me->buckets[index]) {
-        me->buckets[index] = unordered_multimap_create_element(me, hash, key,
-                                                               value);
-        if (!me->buckets[index]) {
-            return -BK_ENOMEM;
-        }
-    } else {
-        char *traverse = me->buckets[index];
-        char *traverse_next;
-        memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-        while (traverse_next) {
-            traverse = traverse_next;
-            memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-        }
-        traverse_next = unordered_multimap_create_element(me, hash, key, value);
-        if (!traverse_next) {
-            return -BK_ENOMEM;
-        }
-        memcpy(traverse + node_next_offset, &traverse_next, ptr_size);
+    char *slot;
+    if (unordered_multimap_make_room(me) != BK_OK) {
+        return -BK_ENOMEM;
     }
+    index = unordered_multimap_claim_slot(me, hash);
+    slot = unordered_multimap_slot(me, index);
+    memcpy(slot + me->hash_offset, &hash, hash_size);
+    memcpy(slot + slot_key_offset, key, me->key_size);
+    memcpy(slot + me->value_offset, value, me->value_size);
     me->size++;
     return BK_OK;
 }
@@ -336,18 +1024,9 @@ bk_err unordered_multimap_put(unordered_multimap me, void *const key,
  */
 void unordered_multimap_get_start(unordered_multimap me, void *const key)
 {
-    char *traverse;
     me->iterate_hash = unordered_multimap_hash(me, key);
     memcpy(me->iterate_key, key, me->key_size);
-    me->iterate_element = NULL;
-    traverse = me->buckets[me->iterate_hash % me->capacity];
-    while (traverse) {
-        if (unordered_multimap_is_equal(me, traverse, me->iterate_hash, key)) {
-            me->iterate_element = traverse;
-            return;
-        }
-        memcpy(&traverse, traverse + node_next_offset, ptr_size);
-    }
+    me->iterate_index = unordered_multimap_find(me, me->iterate_hash, key);
 }
 
 /**
@@ -367,25 +1046,15 @@ void unordered_multimap_get_start(unordered_multimap me, void *const key)
  */
 bk_bool unordered_multimap_get_next(void *const value, unordered_multimap me)
 {
-    char *item;
-    char *traverse;
-    if (!me->iterate_element) {
+    const size_t index = me->iterate_index;
+    if (index == me->capacity) {
         return BK_FALSE;
     }
-    item = me->iterate_element;
-    memcpy(&traverse, item + node_next_offset, ptr_size);
-    while (traverse) {
-        if (unordered_multimap_is_equal(me, traverse, me->iterate_hash,
-                                        me->iterate_key)) {
-            me->iterate_element = traverse;
-            memcpy(value, item + node_key_offset + me->key_size,
-                   me->value_size);
-            return BK_TRUE;
-        }
-        memcpy(&traverse, traverse + node_next_offset, ptr_size);
-    }
-    me->iterate_element = NULL;
-    memcpy(value, item + node_key_offset + me->key_size, me->value_size);
+    me->iterate_index = unordered_multimap_find_next(me, index,
+                                                     me->iterate_hash,
+                                                     me->iterate_key);
+    memcpy(value, unordered_multimap_slot(me, index) + me->value_offset,
+           me->value_size);
     return BK_TRUE;
 }
 
@@ -406,12 +1075,10 @@ size_t unordered_multimap_count(unordered_multimap me, void *const key)
 {
     size_t count = 0;
     const unsigned long hash = unordered_multimap_hash(me, key);
-    char *traverse = me->buckets[hash % me->capacity];
-    while (traverse) {
-        if (unordered_multimap_is_equal(me, traverse, hash, key)) {
-            count++;
-        }
-        memcpy(&traverse, traverse + node_next_offset, ptr_size);
+    size_t index = unordered_multimap_find(me, hash, key);
+    while (index != me->capacity) {
+        count++;
+        index = unordered_multimap_find_next(me, index, hash, key);
     }
     return count;
 }
@@ -432,14 +1099,7 @@ size_t unordered_multimap_count(unordered_multimap me, void *const key)
 bk_bool unordered_multimap_contains(unordered_multimap me, void *const key)
 {
     const unsigned long hash = unordered_multimap_hash(me, key);
-    char *traverse = me->buckets[hash % me->capacity];
-    while (traverse) {
-        if (unordered_multimap_is_equal(me, traverse, hash, key)) {
-            return BK_TRUE;
-        }
-        memcpy(&traverse, traverse + node_next_offset, ptr_size);
-    }
-    return BK_FALSE;
+    return unordered_multimap_find(me, hash, key) != me->capacity;
 }
 
 /**
@@ -460,35 +1120,18 @@ bk_bool unordered_multimap_contains(unordered_multimap me, void *const key)
 bk_bool unordered_multimap_remove(unordered_multimap me, void *const key,
                                   void *const value)
 {
-    char *traverse;
-    char *traverse_next;
     const unsigned long hash = unordered_multimap_hash(me, key);
-    const size_t index = hash % me->capacity;
-    if (!me->buckets[index]) {
-        return BK_FALSE;
-    }
-    traverse = me->buckets[index];
-    if (unordered_multimap_is_equal(me, traverse, hash, key)
-        && me->value_comparator(traverse + node_key_offset + me->key_size,
-                                value) == 0) {
-        memcpy(me->buckets + index, traverse + node_next_offset, ptr_size);
-        free(traverse);
-        me->size--;
-        return BK_TRUE;
-    }
-    memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-    while (traverse_next) {
-        if (unordered_multimap_is_equal(me, traverse_next, hash, key)
-            && me->value_comparator(traverse + node_key_offset + me->key_size,
-                                    value) == 0) {
-            memcpy(traverse + node_next_offset,
-                   traverse_next + node_next_offset, ptr_size);
-            free(traverse_next);
+    size_t index = unordered_multimap_find(me, hash, key);
+    while (index != me->capacity) {
+        const char *const slot = unordered_multimap_slot(me, index);
+        BKTHOMPS_U_MULTIMAP_STAT(me, comparator_calls, 1);
+        if (me->value_comparator(slot + me->value_offset,
+                                 value) == 0) {
+            unordered_multimap_erase(me, index);
             me->size--;
             return BK_TRUE;
         }
-        traverse = traverse_next;
-        memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
+        index = unordered_multimap_find_next(me, index, hash, key);
     }
     return BK_FALSE;
 }
@@ -510,36 +1153,14 @@ bk_bool unordered_multimap_remove(unordered_multimap me, void *const key,
 bk_bool unordered_multimap_remove_all(unordered_multimap me, void *const key)
 {
     const unsigned long hash = unordered_multimap_hash(me, key);
-    const size_t index = hash % me->capacity;
+    size_t index = unordered_multimap_find(me, hash, key);
     bk_bool was_modified = BK_FALSE;
-    for (;;) {
-        char *traverse = me->buckets[index];
-        char *traverse_next;
-        if (!traverse) {
-            break;
-        }
-        memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-        if (unordered_multimap_is_equal(me, traverse, hash, key)) {
-            me->buckets[index] = traverse_next;
-            free(traverse);
-            me->size--;
-            was_modified = BK_TRUE;
-            continue;
-        }
-        while (traverse_next) {
-            if (unordered_multimap_is_equal(me, traverse_next, hash, key)) {
-                memcpy(traverse + node_next_offset,
-                       traverse_next + node_next_offset, ptr_size);
-                free(traverse_next);
-                me->size--;
-                was_modified = BK_TRUE;
-                memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-                continue;
-            }
-            traverse = traverse_next;
-            memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-        }
-        break;
+    while (index != me->capacity) {
+        unordered_multimap_erase(me, index);
+        me->size--;
+        was_modified = BK_TRUE;
+        /* The erase may have shifted another match into the same slot. */
+        index = unordered_multimap_find_from(me, index, hash, key);
     }
     return was_modified;
 }
@@ -554,24 +1175,18 @@ bk_bool unordered_multimap_remove_all(unordered_multimap me, void *const key)
  */
 bk_err unordered_multimap_clear(unordered_multimap me)
 {
-    size_t i;
-    char **updated_buckets = calloc(BKTHOMPS_U_MULTIMAP_STARTING_BUCKETS,
-                                    ptr_size);
-    if (!updated_buckets) {
+    unsigned char *const old_ctrl = me->ctrl;
+    char *const old_slots = me->slots;
+    const size_t old_capacity = me->capacity;
+    if (unordered_multimap_alloc_table(me, me->initial_capacity) != BK_OK) {
+        me->ctrl = old_ctrl;
+        me->slots = old_slots;
+        me->capacity = old_capacity;
         return -BK_ENOMEM;
     }
-    for (i = 0; i < me->capacity; i++) {
-        char *traverse = me->buckets[i];
-        while (traverse) {
-            char *backup = traverse;
-            memcpy(&traverse, traverse + node_next_offset, ptr_size);
-            free(backup);
-        }
-    }
-    free(me->buckets);
+    unordered_multimap_deallocate(&me->allocator, old_slots);
     me->size = 0;
-    me->capacity = BKTHOMPS_U_MULTIMAP_STARTING_BUCKETS;
-    me->buckets = updated_buckets;
+    me->iterate_index = me->capacity;
     return BK_OK;
 }
 
@@ -587,10 +1202,9 @@ bk_err unordered_multimap_clear(unordered_multimap me)
 unordered_multimap unordered_multimap_destroy(unordered_multimap me)
 {
     if (me) {
-        unordered_multimap_clear(me);
-        free(me->iterate_key);
-        free(me->buckets);
-        free(me);
+        unordered_multimap_deallocate(&me->allocator, me->iterate_key);
+        unordered_multimap_deallocate(&me->allocator, me->slots);
+        unordered_multimap_deallocate(&me->allocator, me);
     }
     return NULL;
 }
@@ -20,43 +20,364 @@
  * SOFTWARE.
  */
 
+#include <stddef.h>
 #include <string.h>
+#include "include/bk_hash.h"
 #include "include/unordered_multiset.h"
 
 #define BKTHOMPS_U_MULTISET_STARTING_BUCKETS 16
 #define BKTHOMPS_U_MULTISET_RESIZE_AT 0.75
 #define BKTHOMPS_U_MULTISET_RESIZE_RATIO 2
 
+/*
+ * Each slot has a control byte. A full slot has the high bit set and keeps 7
+ * bits of the hash as a tag, so that most mismatches are rejected without
+ * touching the slot itself.
+ */
+#define BKTHOMPS_U_MULTISET_CTRL_EMPTY 0x00
+#define BKTHOMPS_U_MULTISET_CTRL_FULL 0x80
+#define BKTHOMPS_U_MULTISET_TAG_MASK 0x7F
+#define BKTHOMPS_U_MULTISET_TAG_BITS 7
+
+/*
+ * The control bytes are scanned a group at a time, using SSE2 if it is
+ * available. The control bytes of the first group are mirrored past the end of
+ * the table so that a group may start at any slot.
+ */
+#define BKTHOMPS_U_MULTISET_GROUP_WIDTH 16
+
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BKTHOMPS_U_MULTISET_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef BK_STATS
+#define BKTHOMPS_U_MULTISET_STAT(me, counter, amount) \
+    ((me)->stats.counter += (amount))
+#else
+#define BKTHOMPS_U_MULTISET_STAT(me, counter, amount) ((void) 0)
+#endif
+
 struct internal_unordered_multiset {
     size_t key_size;
+    size_t slot_size;
+    size_t count_offset;
+    size_t hash_offset;
     size_t size;
-    size_t capacity;
+    size_t entries;
     size_t used;
+    size_t capacity;
     unsigned long (*hash)(const void *const key);
     int (*comparator)(const void *const one, const void *const two);
-    char **buckets;
+    unsigned char *ctrl;
+    char *slots;
+    double max_load_factor;
+    double growth_factor;
+    size_t initial_capacity;
+#ifdef BK_STATS
+    struct bk_stats stats;
+#endif
+    struct bk_allocator allocator;
 };
 
-static const size_t ptr_size = sizeof(char *);
 static const size_t count_size = sizeof(size_t);
+/*
+ * Each slot holds the key, then the count, then the hash. The count and the
+ * hash are padded so that each of them is aligned, and the slot size is padded
+ * so that every slot is aligned as well.
+ */
 static const size_t hash_size = sizeof(unsigned long);
-static const size_t node_next_offset = 0;
-static const size_t node_count_offset = sizeof(char *);
-static const size_t node_hash_offset = sizeof(char *) + sizeof(size_t);
-static const size_t node_key_offset =
-        sizeof(char *) + sizeof(size_t) + sizeof(unsigned long);
+static const size_t slot_key_offset = 0;
+
+/*
+ * C89 has no name for the strictest alignment which a fundamental type may
+ * need, so it is found from where a union of those types lands after a char.
+ */
+union unordered_multiset_max_align {
+    long l;
+    double d;
+    long double ld;
+    void *p;
+    void (*f)(void);
+};
+
+struct unordered_multiset_align_probe {
+    char c;
+    union unordered_multiset_max_align u;
+};
+
+static const size_t max_alignment =
+        offsetof(struct unordered_multiset_align_probe, u);
+
+/*
+ * Used when the unordered multi-set is initialized without an allocator. Its
+ * function pointers are all NULL, which means memory is managed by the standard
+ * library.
+ */
+static const struct bk_allocator unordered_multiset_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the unordered multi-set.
+ */
+static void *
+unordered_multiset_allocate(const struct bk_allocator *const allocator,
+                            const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
 
 /*
- * Gets the hash by first calling the user-defined hash, and then using a
- * second hash to prevent hashing clusters if the user-defined hash is
- * sub-optimal.
+ * Allocates zero-initialized memory with the allocator of the unordered multi-
+ * set.
+ */
+static void *
+unordered_multiset_zero_allocate(const struct bk_allocator *const allocator,
+                                 const size_t size)
+{
+    void *ptr;
+    if (!allocator->allocate) {
+        return calloc(1, size);
+    }
+    ptr = allocator->allocate(allocator->context, size);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+/*
+ * Frees memory with the allocator of the unordered multi-set.
+ */
+static void
+unordered_multiset_deallocate(const struct bk_allocator *const allocator,
+                              void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
+/*
+ * Gets the alignment which an object of the specified size may need. The size
+ * of a type is a multiple of its alignment, which is a power of two, so the
+ * largest power of two which divides the size is enough, up to the strictest
+ * alignment of any type.
+ */
+static size_t unordered_multiset_alignment(const size_t size)
+{
+    size_t alignment = 1;
+    while (alignment < max_alignment && size % (2 * alignment) == 0) {
+        alignment *= 2;
+    }
+    return alignment;
+}
+
+/*
+ * Rounds the offset up to a multiple of the alignment, or gets zero if that
+ * would overflow.
+ */
+static size_t unordered_multiset_align(const size_t offset,
+                                       const size_t alignment)
+{
+    const size_t padding = (alignment - offset % alignment) % alignment;
+    if (offset + padding < offset) {
+        return 0;
+    }
+    return offset + padding;
+}
+
+/*
+ * Gets the hash by first calling the user-defined hash, and then mixing it so
+ * that each bit of the result depends on every bit of the user-defined hash.
+ * The table only uses the low bits to pick a slot, so this prevents clusters if
+ * the user-defined hash is sub-optimal. If unsigned long is wider than 32 bits,
+ * its upper half is folded in first. The built-in hash is used as is, since it
+ * is already mixed.
  */
 static unsigned long unordered_multiset_hash(unordered_multiset me,
                                              const void *const key)
 {
-    unsigned long hash = me->hash(key);
-    hash ^= (hash >> 20UL) ^ (hash >> 12UL);
-    return hash ^ (hash >> 7UL) ^ (hash >> 4UL);
+    unsigned long hash;
+    BKTHOMPS_U_MULTISET_STAT(me, hash_calls, 1);
+    if (!me->hash) {
+        return bk_hash_bytes(key, me->key_size);
+    }
+    hash = me->hash(key);
+    hash ^= (hash >> 16UL) >> 16UL;
+    hash ^= hash >> 16UL;
+    hash *= 0x85EBCA6BUL;
+    hash ^= hash >> 13UL;
+    hash *= 0xC2B2AE35UL;
+    return hash ^ (hash >> 16UL);
+}
+
+/*
+ * Gets the control byte which marks a slot as full for the specified hash.
+ */
+static unsigned char unordered_multiset_tag(const unsigned long hash)
+{
+    return (unsigned char) (BKTHOMPS_U_MULTISET_CTRL_FULL
+                            | (hash & BKTHOMPS_U_MULTISET_TAG_MASK));
+}
+
+/*
+ * Gets the slot at which the probe sequence for the specified hash starts. The
+ * capacity is a power of two, so masking picks the slot without a division.
+ */
+static size_t unordered_multiset_home(unordered_multiset me,
+                                      const unsigned long hash)
+{
+    return (size_t) (hash >> BKTHOMPS_U_MULTISET_TAG_BITS) & (me->capacity - 1);
+}
+
+/*
+ * Gets a bit mask of the slots in the group which have the control byte.
+ */
+static unsigned int
+unordered_multiset_group_match(const unsigned char *const group,
+                               const unsigned char ctrl)
+{
+#ifdef BKTHOMPS_U_MULTISET_SSE2
+    const __m128i bytes = _mm_loadu_si128((const __m128i *) group);
+    const __m128i match = _mm_cmpeq_epi8(bytes, _mm_set1_epi8((char) ctrl));
+    return (unsigned int) _mm_movemask_epi8(match);
+#else
+    unsigned int mask = 0;
+    int i;
+    for (i = 0; i < BKTHOMPS_U_MULTISET_GROUP_WIDTH; i++) {
+        if (group[i] == ctrl) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Gets a bit mask of the slots in the group which are empty.
+ */
+static unsigned int
+unordered_multiset_group_match_free(const unsigned char *group)
+{
+#ifdef BKTHOMPS_U_MULTISET_SSE2
+    const __m128i bytes = _mm_loadu_si128((const __m128i *) group);
+    return (unsigned int) _mm_movemask_epi8(bytes) ^ 0xFFFFU;
+#else
+    unsigned int mask = 0;
+    int i;
+    for (i = 0; i < BKTHOMPS_U_MULTISET_GROUP_WIDTH; i++) {
+        if (!(group[i] & BKTHOMPS_U_MULTISET_CTRL_FULL)) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Gets the index of the lowest set bit of the non-zero mask.
+ */
+static size_t unordered_multiset_lowest_bit(unsigned int mask)
+{
+#ifdef __GNUC__
+    return (size_t) __builtin_ctz(mask);
+#else
+    size_t i = 0;
+    while (!(mask & 1U)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+/*
+ * Gets the slot index which is the specified offset into the group.
+ */
+static size_t unordered_multiset_group_index(unordered_multiset me,
+                                             const size_t group,
+                                             const size_t offset)
+{
+    return (group + offset) & (me->capacity - 1);
+}
+
+/*
+ * Sets the control byte of a slot, as well as its mirror if it has one.
+ */
+static void unordered_multiset_set_ctrl(unordered_multiset me,
+                                        const size_t index,
+                                        const unsigned char ctrl)
+{
+    me->ctrl[index] = ctrl;
+    if (index < BKTHOMPS_U_MULTISET_GROUP_WIDTH - 1) {
+        me->ctrl[me->capacity + index] = ctrl;
+    }
+}
+
+/*
+ * Gets the slot at the specified index.
+ */
+static char *unordered_multiset_slot(unordered_multiset me, const size_t index)
+{
+    return me->slots + index * me->slot_size;
+}
+
+/*
+ * Empties the slot at the specified index without leaving a tombstone. Every
+ * entry sits in the run of non-empty slots which starts at its home slot, so
+ * the entries after the slot, up to the end of its run, are shifted back into
+ * the gap whenever doing so does not move them before their home slot. Probe
+ * lengths therefore do not grow as entries are removed and added over time.
+ */
+static void unordered_multiset_erase(unordered_multiset me, size_t index)
+{
+    const size_t mask = me->capacity - 1;
+    size_t next = (index + 1) & mask;
+    while (me->ctrl[next] != BKTHOMPS_U_MULTISET_CTRL_EMPTY) {
+        char *const slot = unordered_multiset_slot(me, next);
+        unsigned long hash;
+        size_t home;
+        memcpy(&hash, slot + me->hash_offset, hash_size);
+        home = unordered_multiset_home(me, hash);
+        if (((next - home) & mask) >= ((next - index) & mask)) {
+            memcpy(unordered_multiset_slot(me, index), slot, me->slot_size);
+            unordered_multiset_set_ctrl(me, index, me->ctrl[next]);
+            index = next;
+        }
+        next = (next + 1) & mask;
+    }
+    unordered_multiset_set_ctrl(me, index, BKTHOMPS_U_MULTISET_CTRL_EMPTY);
+}
+
+/*
+ * Allocates a table of the specified capacity, with every slot empty. The slots
+ * and the control bytes share one allocation.
+ */
+static bk_err unordered_multiset_alloc_table(unordered_multiset me,
+                                             const size_t capacity)
+{
+    char *block;
+    const size_t ctrl_size = capacity + BKTHOMPS_U_MULTISET_GROUP_WIDTH - 1;
+    if (capacity > ((size_t) -1 - ctrl_size) / me->slot_size) {
+        return -BK_ENOMEM;
+    }
+    BKTHOMPS_U_MULTISET_STAT(me, bytes_allocated,
+                             capacity * me->slot_size + ctrl_size);
+    block = unordered_multiset_zero_allocate(
+            &me->allocator, capacity * me->slot_size + ctrl_size);
+    if (!block) {
+        return -BK_ENOMEM;
+    }
+    me->slots = block;
+    me->ctrl = (unsigned char *) block + capacity * me->slot_size;
+    me->capacity = capacity;
+    return BK_OK;
 }
 
 /**
@@ -77,55 +398,247 @@ unordered_multiset
 unordered_multiset_init(const size_t key_size,
                         unsigned long (*hash)(const void *const),
                         int (*comparator)(const void *const, const void *const))
+{
+    return unordered_multiset_init_with_allocator(key_size, hash, comparator,
+                                                  NULL);
+}
+
+/*
+ * Initializes an unordered multi-set, which manages its memory with the given
+ * allocator unless it is NULL. If the hash is NULL, the built-in hash of the
+ * key size is used, and if the key comparator is NULL, keys are compared byte
+ * by byte.
+ */
+static unordered_multiset
+unordered_multiset_create(const size_t key_size,
+                          unsigned long (*hash)(const void *const),
+                          int (*comparator)(const void *const,
+                                            const void *const),
+                          const struct bk_allocator *allocator)
 {
     struct internal_unordered_multiset *init;
-    if (key_size == 0 || !hash || !comparator) {
+    size_t count_alignment;
+    size_t hash_alignment;
+    size_t slot_alignment;
+    size_t count_offset;
+    size_t hash_offset;
+    size_t slot_size;
+    if (key_size == 0) {
         return NULL;
     }
-    if (node_key_offset + key_size < node_key_offset) {
+    if (!allocator) {
+        allocator = &unordered_multiset_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
         return NULL;
     }
-    init = malloc(sizeof *init);
+    count_alignment = unordered_multiset_alignment(count_size);
+    hash_alignment = unordered_multiset_alignment(hash_size);
+    slot_alignment = unordered_multiset_alignment(key_size);
+    if (slot_alignment < count_alignment) {
+        slot_alignment = count_alignment;
+    }
+    if (slot_alignment < hash_alignment) {
+        slot_alignment = hash_alignment;
+    }
+    count_offset = unordered_multiset_align(slot_key_offset + key_size,
+                                            count_alignment);
+    if (count_offset == 0 || count_offset + count_size < count_offset) {
+        return NULL;
+    }
+    hash_offset = unordered_multiset_align(count_offset + count_size,
+                                           hash_alignment);
+    if (hash_offset == 0 || hash_offset + hash_size < hash_offset) {
+        return NULL;
+    }
+    slot_size = unordered_multiset_align(hash_offset + hash_size,
+                                         slot_alignment);
+    if (slot_size == 0) {
+        return NULL;
+    }
+    init = unordered_multiset_allocate(allocator, sizeof *init);
     if (!init) {
         return NULL;
     }
+    init->allocator = *allocator;
+#ifdef BK_STATS
+    memset(&init->stats, 0, sizeof init->stats);
+#endif
+    BKTHOMPS_U_MULTISET_STAT(init, bytes_allocated, sizeof *init);
     init->key_size = key_size;
+    init->slot_size = slot_size;
+    init->count_offset = count_offset;
+    init->hash_offset = hash_offset;
     init->hash = hash;
     init->comparator = comparator;
     init->size = 0;
-    init->capacity = BKTHOMPS_U_MULTISET_STARTING_BUCKETS;
-    init->used = 0;
-    init->buckets = calloc(BKTHOMPS_U_MULTISET_STARTING_BUCKETS, ptr_size);
-    if (!init->buckets) {
-        free(init);
+    init->entries = 0;
+    init->max_load_factor = BKTHOMPS_U_MULTISET_RESIZE_AT;
+    init->growth_factor = BKTHOMPS_U_MULTISET_RESIZE_RATIO;
+    init->initial_capacity = BKTHOMPS_U_MULTISET_STARTING_BUCKETS;
+    if (unordered_multiset_alloc_table(init, init->initial_capacity) != BK_OK) {
+        unordered_multiset_deallocate(allocator, init);
         return NULL;
     }
     return init;
 }
 
+/**
+ * Initializes an unordered multi-set, which manages its memory with the given
+ * allocator.
+ *
+ * @param key_size   the size of each key in the unordered multi-set; must be
+ *                   positive
+ * @param hash       the hash function which computes the hash from the key;
+ *                   must not be NULL
+ * @param comparator the comparator function which compares two keys; must not
+ *                   be NULL
+ * @param allocator  the allocator which manages the memory of the unordered
+ *                   multi-set, or NULL to use the standard library; if not
+ *                   NULL, its allocate and deallocate functions must not be
+ *                   NULL
+ *
+ * @return the newly-initialized unordered multi-set, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+unordered_multiset
+unordered_multiset_init_with_allocator(const size_t key_size,
+                                       unsigned long (*hash)(const void *const),
+                                       int (*comparator)(const void *const,
+                                                         const void *const),
+                                       const struct bk_allocator *allocator)
+{
+    if (!hash || !comparator) {
+        return NULL;
+    }
+    return unordered_multiset_create(key_size, hash, comparator, allocator);
+}
+
+/**
+ * Initializes an unordered multi-set, with its table sized up front for the
+ * expected number of distinct keys, and with the specified load factor and
+ * growth factor.
+ *
+ * @param key_size        the size of each key in the unordered multi-set; must
+ *                        be positive
+ * @param hash            the hash function which computes the hash from the
+ *                        key, or NULL to use the built-in hash of the key size,
+ *                        which is bk_hash_bytes
+ * @param comparator      the comparator function which compares two keys, or
+ *                        NULL to compare the bytes of the keys
+ * @param expected_count  the number of distinct keys which the unordered multi-
+ *                        set is expected to hold; space for them is reserved up
+ *                        front
+ * @param max_load_factor the fraction of slots which may be used before the
+ *                        table grows; must be greater than zero and less than
+ *                        one
+ * @param growth_factor   the least factor by which the table grows, as its
+ *                        capacity is rounded up to a power of two; must be
+ *                        greater than one
+ *
+ * @return the newly-initialized unordered multi-set, or NULL if it was not
+ *         successfully initialized due to either invalid input arguments or
+ *         memory allocation error
+ */
+unordered_multiset
+unordered_multiset_init_ex(const size_t key_size,
+                           unsigned long (*hash)(const void *const),
+                           int (*comparator)(const void *const,
+                                             const void *const),
+                           const size_t expected_count,
+                           const double max_load_factor,
+                           const double growth_factor)
+{
+    unordered_multiset me;
+    if (!(max_load_factor > 0 && max_load_factor < 1) || !(growth_factor > 1)) {
+        return NULL;
+    }
+    me = unordered_multiset_create(key_size, hash, comparator, NULL);
+    if (!me) {
+        return NULL;
+    }
+    me->max_load_factor = max_load_factor;
+    me->growth_factor = growth_factor;
+    if (unordered_multiset_reserve(me, expected_count) != BK_OK) {
+        return unordered_multiset_destroy(me);
+    }
+    me->initial_capacity = me->capacity;
+    return me;
+}
+
+/*
+ * Gets the index of the first slot in the probe sequence of the hash which is
+ * empty, and marks it as full. The multi-set must have a free slot.
+ */
+static size_t unordered_multiset_claim_slot(unordered_multiset me,
+                                            const unsigned long hash)
+{
+    size_t group = unordered_multiset_home(me, hash);
+    for (;;) {
+        const unsigned int free_slots =
+                unordered_multiset_group_match_free(me->ctrl + group);
+        if (free_slots) {
+            const size_t index = unordered_multiset_group_index(
+                    me, group, unordered_multiset_lowest_bit(free_slots));
+            unordered_multiset_set_ctrl(me, index,
+                                        unordered_multiset_tag(hash));
+            return index;
+        }
+        group = unordered_multiset_group_index(me, group,
+                                               BKTHOMPS_U_MULTISET_GROUP_WIDTH);
+    }
+}
+
 /*
- * Adds the specified node to the multi-set.
+ * Places the slot into the first free position of its probe sequence. The key
+ * must not already be in the multi-set, and the multi-set must have a free
+ * slot.
  */
-static void unordered_multiset_add_item(unordered_multiset me, char *const add)
+static void unordered_multiset_add_item(unordered_multiset me,
+                                        const char *const slot)
 {
-    char *traverse;
-    char *traverse_next;
     unsigned long hash;
     size_t index;
-    memcpy(&hash, add + node_hash_offset, hash_size);
-    index = hash % me->capacity;
-    memset(add + node_next_offset, 0, ptr_size);
-    if (!me->buckets[index]) {
-        me->buckets[index] = add;
-        return;
+    memcpy(&hash, slot + me->hash_offset, hash_size);
+    index = unordered_multiset_claim_slot(me, hash);
+    memcpy(unordered_multiset_slot(me, index), slot, me->slot_size);
+}
+
+/*
+ * Moves every entry into a newly-allocated table of the specified capacity. If
+ * specified, the hashes are recomputed.
+ */
+static bk_err unordered_multiset_rebuild(unordered_multiset me,
+                                         const size_t capacity,
+                                         const bk_bool recompute_hash)
+{
+    size_t i;
+    unsigned char *const old_ctrl = me->ctrl;
+    char *const old_slots = me->slots;
+    const size_t old_capacity = me->capacity;
+    const bk_err rc = unordered_multiset_alloc_table(me, capacity);
+    if (rc != BK_OK) {
+        me->ctrl = old_ctrl;
+        me->slots = old_slots;
+        me->capacity = old_capacity;
+        return rc;
     }
-    traverse = me->buckets[index];
-    memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-    while (traverse_next) {
-        traverse = traverse_next;
-        memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
+    BKTHOMPS_U_MULTISET_STAT(me, rehashes, 1);
+    BKTHOMPS_U_MULTISET_STAT(me, resizes, capacity != old_capacity);
+    for (i = 0; i < old_capacity; i++) {
+        char *const slot = old_slots + i * me->slot_size;
+        if (!(old_ctrl[i] & BKTHOMPS_U_MULTISET_CTRL_FULL)) {
+            continue;
+        }
+        if (recompute_hash) {
+            const unsigned long hash =
+                    unordered_multiset_hash(me, slot + slot_key_offset);
+            memcpy(slot + me->hash_offset, &hash, hash_size);
+        }
+        unordered_multiset_add_item(me, slot);
     }
-    memcpy(traverse + node_next_offset, &add, ptr_size);
+    unordered_multiset_deallocate(&me->allocator, old_slots);
+    return BK_OK;
 }
 
 /**
@@ -139,27 +652,47 @@ static void unordered_multiset_add_item(unordered_multiset me, char *const add)
  */
 bk_err unordered_multiset_rehash(unordered_multiset me)
 {
-    size_t i;
-    char **old_buckets = me->buckets;
-    me->buckets = calloc(me->capacity, ptr_size);
-    if (!me->buckets) {
-        me->buckets = old_buckets;
+    return unordered_multiset_rebuild(me, me->capacity, BK_TRUE);
+}
+
+/*
+ * Gets the smallest power of two capacity at which the specified number of
+ * entries fit without the table growing, or zero if it is not representable.
+ */
+static size_t
+unordered_multiset_capacity_for(unordered_multiset me, const size_t count)
+{
+    size_t capacity = BKTHOMPS_U_MULTISET_STARTING_BUCKETS;
+    while ((size_t) (me->max_load_factor * capacity) <= count) {
+        if (capacity > (size_t) -1 / 2) {
+            return 0;
+        }
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+/**
+ * Reserves space for the specified number of distinct keys, so that the
+ * unordered multi-set does not grow until it holds more than that. If there
+ * already is enough space, nothing is done.
+ *
+ * @param me    the unordered multi-set to reserve space in
+ * @param count the number of distinct keys to reserve space for
+ *
+ * @return  BK_OK     if no error
+ * @return -BK_ENOMEM if out of memory
+ */
+bk_err unordered_multiset_reserve(unordered_multiset me, const size_t count)
+{
+    const size_t capacity = unordered_multiset_capacity_for(me, count);
+    if (capacity == 0) {
         return -BK_ENOMEM;
     }
-    for (i = 0; i < me->capacity; i++) {
-        char *traverse = old_buckets[i];
-        while (traverse) {
-            char *backup;
-            unsigned long hash;
-            memcpy(&backup, traverse + node_next_offset, ptr_size);
-            hash = unordered_multiset_hash(me, traverse + node_key_offset);
-            memcpy(traverse + node_hash_offset, &hash, hash_size);
-            unordered_multiset_add_item(me, traverse);
-            traverse = backup;
-        }
+    if (capacity <= me->capacity) {
+        return BK_OK;
     }
-    free(old_buckets);
-    return BK_OK;
+    return unordered_multiset_rebuild(me, capacity, BK_FALSE);
 }
 
 /**
@@ -186,65 +719,195 @@ bk_bool unordered_multiset_is_empty(unordered_multiset me)
     return unordered_multiset_size(me) == 0;
 }
 
-/*
- * Increases the size of the multi-set and redistributes the nodes.
+/**
+ * Gets the statistics of the unordered multi-set. They are only tracked if the
+ * library is compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the unordered multi-set to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void unordered_multiset_get_stats(unordered_multiset me,
+                                  struct bk_stats *const stats)
+{
+#ifdef BK_STATS
+    *stats = me->stats;
+#else
+    (void) me;
+    memset(stats, 0, sizeof *stats);
+#endif
+}
+
+/**
+ * Gets a histogram of how many groups of slots a lookup of each entry of the
+ * unordered multi-set scans, as well as how its slots are occupied. With a good
+ * hash function, nearly every entry is in the first group of its probe
+ * sequence. Many entries which are further away mean that the hash function
+ * clusters.
+ *
+ * @param me        the unordered multi-set to get the histogram of
+ * @param histogram the histogram to copy to
  */
-static bk_err unordered_multiset_resize(unordered_multiset me)
+void
+unordered_multiset_probe_histogram(unordered_multiset me,
+                                   struct bk_probe_histogram *const histogram)
 {
     size_t i;
-    const size_t old_capacity = me->capacity;
-    const size_t new_capacity = me->capacity * BKTHOMPS_U_MULTISET_RESIZE_RATIO;
-    char **old_buckets = me->buckets;
-    me->buckets = calloc(new_capacity, ptr_size);
-    if (!me->buckets) {
-        me->buckets = old_buckets;
-        return -BK_ENOMEM;
+    size_t total = 0;
+    memset(histogram, 0, sizeof *histogram);
+    histogram->capacity = me->capacity;
+    for (i = 0; i < me->capacity; i++) {
+        unsigned long hash;
+        size_t distance;
+        size_t groups;
+        if (!(me->ctrl[i] & BKTHOMPS_U_MULTISET_CTRL_FULL)) {
+            continue;
+        }
+        memcpy(&hash, unordered_multiset_slot(me, i) + me->hash_offset,
+               hash_size);
+        distance = i + me->capacity - unordered_multiset_home(me, hash);
+        groups = (distance & (me->capacity - 1))
+                 / BKTHOMPS_U_MULTISET_GROUP_WIDTH + 1;
+        if (groups > histogram->longest_probe) {
+            histogram->longest_probe = groups;
+        }
+        if (groups > BK_PROBE_HISTOGRAM_BUCKETS) {
+            histogram->counts[BK_PROBE_HISTOGRAM_BUCKETS - 1]++;
+        } else {
+            histogram->counts[groups - 1]++;
+        }
+        histogram->full++;
+        total += groups;
     }
-    me->capacity = new_capacity;
-    for (i = 0; i < old_capacity; i++) {
-        char *traverse = old_buckets[i];
-        while (traverse) {
-            char *backup;
-            memcpy(&backup, traverse + node_next_offset, ptr_size);
-            unordered_multiset_add_item(me, traverse);
-            traverse = backup;
+    if (histogram->full > 0) {
+        histogram->average_probe = (double) total / (double) histogram->full;
+    }
+}
+
+/*
+ * Makes room for one more entry. Grows the table by at least the growth factor,
+ * to the next power of two, when it is mostly full.
+ */
+static bk_err unordered_multiset_make_room(unordered_multiset me)
+{
+    const size_t limit = (size_t) (me->max_load_factor * me->capacity);
+    double grown;
+    size_t capacity;
+    if (me->size + 1 < limit) {
+        return BK_OK;
+    }
+    grown = me->growth_factor * me->capacity;
+    capacity = me->capacity;
+    do {
+        if (capacity > (size_t) -1 / 2) {
+            return -BK_ENOMEM;
         }
+        capacity *= 2;
+    } while ((double) capacity < grown);
+    return unordered_multiset_rebuild(me, capacity, BK_FALSE);
+}
+
+/*
+ * Determines if two keys are equal. Without a comparator, keys the size of an
+ * integer type are compared as that type, and other keys byte by byte.
+ */
+static bk_bool
+unordered_multiset_keys_equal(unordered_multiset me, const void *const one,
+                              const void *const two)
+{
+    BKTHOMPS_U_MULTISET_STAT(me, comparator_calls, 1);
+    if (me->comparator) {
+        return me->comparator(one, two) == 0;
     }
-    free(old_buckets);
-    return BK_OK;
+    if (me->key_size == sizeof(unsigned long)) {
+        unsigned long a;
+        unsigned long b;
+        memcpy(&a, one, sizeof(unsigned long));
+        memcpy(&b, two, sizeof(unsigned long));
+        return a == b;
+    }
+    if (me->key_size == sizeof(unsigned int)) {
+        unsigned int a;
+        unsigned int b;
+        memcpy(&a, one, sizeof(unsigned int));
+        memcpy(&b, two, sizeof(unsigned int));
+        return a == b;
+    }
+    return memcmp(one, two, me->key_size) == 0;
 }
 
 /*
- * Determines if an element is equal to the key.
+ * Determines if the slot at the specified index holds the key.
  */
 static bk_bool unordered_multiset_is_equal(unordered_multiset me,
-                                           char *const item,
+                                           const size_t index,
                                            const unsigned long hash,
                                            const void *const key)
 {
-    unsigned long item_hash;
-    memcpy(&item_hash, item + node_hash_offset, hash_size);
-    return item_hash == hash &&
-           me->comparator(item + node_key_offset, key) == 0;
+    const char *const slot = unordered_multiset_slot(me, index);
+    unsigned long slot_hash;
+    memcpy(&slot_hash, slot + me->hash_offset, hash_size);
+    if (slot_hash != hash) {
+        return BK_FALSE;
+    }
+    return unordered_multiset_keys_equal(me, slot + slot_key_offset, key);
 }
 
 /*
- * Creates an element to add.
+ * Counts the groups which a lookup of the unordered multi-set scanned.
  */
-static char *unordered_multiset_create_element(unordered_multiset me,
-                                               const unsigned long hash,
-                                               const void *const key)
+static void unordered_multiset_count_probe(unordered_multiset me,
+                                           const size_t groups)
 {
-    const size_t one = 1;
-    char *init = malloc(ptr_size + count_size + hash_size + me->key_size);
-    if (!init) {
-        return NULL;
+#ifdef BK_STATS
+    me->stats.probes += groups;
+    if (groups > me->stats.longest_probe) {
+        me->stats.longest_probe = groups;
+    }
+#else
+    (void) me;
+    (void) groups;
+#endif
+}
+
+/*
+ * Gets the index of the slot which holds the key, or the capacity if the key is
+ * not in the multi-set. Only the slots whose tag matches are compared, and the
+ * probe stops at the first group which has an empty slot.
+ */
+static size_t unordered_multiset_find(unordered_multiset me,
+                                      const unsigned long hash,
+                                      const void *const key)
+{
+    const unsigned char tag = unordered_multiset_tag(hash);
+    size_t group = unordered_multiset_home(me, hash);
+    size_t groups = 1;
+    for (;;) {
+        const unsigned char *const ctrl = me->ctrl + group;
+        unsigned int match = unordered_multiset_group_match(ctrl, tag);
+        const unsigned int empty =
+                unordered_multiset_group_match(ctrl,
+                                               BKTHOMPS_U_MULTISET_CTRL_EMPTY);
+        if (empty) {
+            /* Slots after the first empty slot are not in the sequence. */
+            match &= (empty & (0U - empty)) - 1U;
+        }
+        while (match) {
+            const size_t index = unordered_multiset_group_index(
+                    me, group, unordered_multiset_lowest_bit(match));
+            if (unordered_multiset_is_equal(me, index, hash, key)) {
+                unordered_multiset_count_probe(me, groups);
+                return index;
+            }
+            match &= match - 1U;
+        }
+        if (empty) {
+            unordered_multiset_count_probe(me, groups);
+            return me->capacity;
+        }
+        groups++;
+        group = unordered_multiset_group_index(me, group,
+                                               BKTHOMPS_U_MULTISET_GROUP_WIDTH);
     }
-    memset(init + node_next_offset, 0, ptr_size);
-    memcpy(init + node_count_offset, &one, count_size);
-    memcpy(init + node_hash_offset, &hash, hash_size);
-    memcpy(init + node_key_offset, key, me->key_size);
-    return init;
 }
 
 /**
@@ -263,52 +926,28 @@ static char *unordered_multiset_create_element(unordered_multiset me,
 bk_err unordered_multiset_put(unordered_multiset me, void *const key)
 {
     const unsigned long hash = unordered_multiset_hash(me, key);
-    size_t index;
-    if (me->used + 1 >=
-        (size_t) (BKTHOMPS_U_MULTISET_RESIZE_AT * me->capacity)) {
-        const bk_err rc = unordered_multiset_resize(me);
-        if (rc != BK_OK) {
-            return rc;
-        }
+    const size_t one = 1;
+    size_t index = unordered_multiset_find(me, hash, key);
+    char *slot;
+    if (index != me->capacity) {
+        size_t count;
+        slot = unordered_multiset_slot(me, index);
+        memcpy(&count, slot + me->count_offset, count_size);
+        count++;
+        memcpy(slot + me->count_offset, &count, count_size);
+        me->size++;
+        return BK_OK;
     }
-    index = hash % me->capacity;
-    if (!me->buckets[index]) {
-        me->buckets[index] = unordered_multiset_create_element(me, hash, key);
-        if (!me->buckets[index]) {
-            return -BK_ENOMEM;
-        }
-    } else {
-        char *traverse = me->buckets[index];
-        char *traverse_next;
-        if (unordered_multiset_is_equal(me, traverse, hash, key)) {
-            size_t count;
-            memcpy(&count, traverse + node_count_offset, count_size);
-            count++;
-            memcpy(traverse + node_count_offset, &count, count_size);
-            me->size++;
-            return BK_OK;
-        }
-        memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-        while (traverse_next) {
-            traverse = traverse_next;
-            memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-            if (unordered_multiset_is_equal(me, traverse, hash, key)) {
-                size_t count;
-                memcpy(&count, traverse + node_count_offset, count_size);
-                count++;
-                memcpy(traverse + node_count_offset, &count, count_size);
-                me->size++;
-                return BK_OK;
-            }
-        }
-        traverse_next = unordered_multiset_create_element(me, hash, key);
-        if (!traverse_next) {
-            return -BK_ENOMEM;
-        }
-        memcpy(traverse + node_next_offset, &traverse_next, ptr_size);
+    if (unordered_multiset_make_room(me) != BK_OK) {
+        return -BK_ENOMEM;
     }
+    index = unordered_multiset_claim_slot(me, hash);
+    slot = unordered_multiset_slot(me, index);
+    memcpy(slot + me->hash_offset, &hash, hash_size);
+    memcpy(slot + me->count_offset, &one, count_size);
+    memcpy(slot + slot_key_offset, key, me->key_size);
     me->size++;
-    me->used++;
+    me->entries++;
     return BK_OK;
 }
 
@@ -327,16 +966,14 @@ bk_err unordered_multiset_put(unordered_multiset me, void *const key)
 size_t unordered_multiset_count(unordered_multiset me, void *const key)
 {
     const unsigned long hash = unordered_multiset_hash(me, key);
-    char *traverse = me->buckets[hash % me->capacity];
-    while (traverse) {
-        if (unordered_multiset_is_equal(me, traverse, hash, key)) {
-            size_t count;
-            memcpy(&count, traverse + node_count_offset, count_size);
-            return count;
-        }
-        memcpy(&traverse, traverse + node_next_offset, ptr_size);
+    const size_t index = unordered_multiset_find(me, hash, key);
+    size_t count;
+    if (index == me->capacity) {
+        return 0;
     }
-    return 0;
+    memcpy(&count, unordered_multiset_slot(me, index) + me->count_offset,
+           count_size);
+    return count;
 }
 
 /**
@@ -372,49 +1009,24 @@ bk_bool unordered_multiset_contains(unordered_multiset me, void *const key)
  */
 bk_bool unordered_multiset_remove(unordered_multiset me, void *const key)
 {
-    char *traverse;
-    char *traverse_next;
     const unsigned long hash = unordered_multiset_hash(me, key);
-    const size_t index = hash % me->capacity;
-    if (!me->buckets[index]) {
+    const size_t index = unordered_multiset_find(me, hash, key);
+    char *slot;
+    size_t count;
+    if (index == me->capacity) {
         return BK_FALSE;
     }
-    traverse = me->buckets[index];
-    if (unordered_multiset_is_equal(me, traverse, hash, key)) {
-        size_t count;
-        memcpy(&count, traverse + node_count_offset, count_size);
-        if (count == 1) {
-            memcpy(me->buckets + index, traverse + node_next_offset, ptr_size);
-            free(traverse);
-            me->used--;
-        } else {
-            count--;
-            memcpy(traverse + node_count_offset, &count, count_size);
-        }
-        me->size--;
-        return BK_TRUE;
-    }
-    memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-    while (traverse_next) {
-        if (unordered_multiset_is_equal(me, traverse_next, hash, key)) {
-            size_t count;
-            memcpy(&count, traverse_next + node_count_offset, count_size);
-            if (count == 1) {
-                memcpy(traverse + node_next_offset,
-                       traverse_next + node_next_offset, ptr_size);
-                free(traverse_next);
-                me->used--;
-            } else {
-                count--;
-                memcpy(traverse_next + node_count_offset, &count, count_size);
-            }
-            me->size--;
-            return BK_TRUE;
-        }
-        traverse = traverse_next;
-        memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
+    slot = unordered_multiset_slot(me, index);
+    memcpy(&count, slot + me->count_offset, count_size);
+    if (count == 1) {
+        unordered_multiset_erase(me, index);
+        me->entries--;
+    } else {
+        count--;
+        memcpy(slot + me->count_offset, &count, count_size);
     }
-    return BK_FALSE;
+    me->size--;
+    return BK_TRUE;
 }
 
 /**
@@ -432,39 +1044,18 @@ bk_bool unordered_multiset_remove(unordered_multiset me, void *const key)
  */
 bk_bool unordered_multiset_remove_all(unordered_multiset me, void *const key)
 {
-    char *traverse;
-    char *traverse_next;
     const unsigned long hash = unordered_multiset_hash(me, key);
-    const size_t index = hash % me->capacity;
-    if (!me->buckets[index]) {
+    const size_t index = unordered_multiset_find(me, hash, key);
+    size_t count;
+    if (index == me->capacity) {
         return BK_FALSE;
     }
-    traverse = me->buckets[index];
-    if (unordered_multiset_is_equal(me, traverse, hash, key)) {
-        size_t count;
-        memcpy(&count, traverse + node_count_offset, count_size);
-        memcpy(me->buckets + index, traverse + node_next_offset, ptr_size);
-        free(traverse);
-        me->used--;
-        me->size -= count;
-        return BK_TRUE;
-    }
-    memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-    while (traverse_next) {
-        if (unordered_multiset_is_equal(me, traverse_next, hash, key)) {
-            size_t count;
-            memcpy(&count, traverse_next + node_count_offset, count_size);
-            memcpy(traverse + node_next_offset,
-                   traverse_next + node_next_offset, ptr_size);
-            free(traverse_next);
-            me->used--;
-            me->size -= count;
-            return BK_TRUE;
-        }
-        traverse = traverse_next;
-        memcpy(&traverse_next, traverse + node_next_offset, ptr_size);
-    }
-    return BK_FALSE;
+    memcpy(&count, unordered_multiset_slot(me, index) + me->count_offset,
+           count_size);
+    unordered_multiset_erase(me, index);
+    me->entries--;
+    me->size -= count;
+    return BK_TRUE;
 }
 
 /**
@@ -477,25 +1068,18 @@ bk_bool unordered_multiset_remove_all(unordered_multiset me, void *const key)
  */
 bk_err unordered_multiset_clear(unordered_multiset me)
 {
-    size_t i;
-    char **updated_buckets = calloc(BKTHOMPS_U_MULTISET_STARTING_BUCKETS,
-                                    ptr_size);
-    if (!updated_buckets) {
+    unsigned char *const old_ctrl = me->ctrl;
+    char *const old_slots = me->slots;
+    const size_t old_capacity = me->capacity;
+    if (unordered_multiset_alloc_table(me, me->initial_capacity) != BK_OK) {
+        me->ctrl = old_ctrl;
+        me->slots = old_slots;
+        me->capacity = old_capacity;
         return -BK_ENOMEM;
     }
-    for (i = 0; i < me->capacity; i++) {
-        char *traverse = me->buckets[i];
-        while (traverse) {
-            char *backup = traverse;
-            memcpy(&traverse, traverse + node_next_offset, ptr_size);
-            free(backup);
-        }
-    }
-    free(me->buckets);
+    unordered_multiset_deallocate(&me->allocator, old_slots);
     me->size = 0;
-    me->capacity = BKTHOMPS_U_MULTISET_STARTING_BUCKETS;
-    me->used = 0;
-    me->buckets = updated_buckets;
+    me->entries = 0;
     return BK_OK;
 }
 
@@ -511,9 +1095,8 @@ bk_err unordered_multiset_clear(unordered_multiset me)
 unordered_multiset unordered_multiset_destroy(unordered_multiset me)
 {
     if (me) {
-        unordered_multiset_clear(me);
-        free(me->buckets);
-        free(me);
+        unordered_multiset_deallocate(&me->allocator, me->slots);
+        unordered_multiset_deallocate(&me->allocator, me);
     }
     return NULL;
 }
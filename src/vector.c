@@ -26,13 +26,79 @@
 #define BKTHOMPS_VECTOR_START_SPACE 8
 #define BKTHOMPS_VECTOR_RESIZE_RATIO 1.5
 
+#ifdef BK_STATS
+#define BKTHOMPS_VECTOR_STAT(me, counter, amount) \
+    ((me)->stats.counter += (amount))
+#else
+#define BKTHOMPS_VECTOR_STAT(me, counter, amount) ((void) 0)
+#endif
+
 struct internal_vector {
     size_t item_count;
     size_t item_capacity;
     size_t bytes_per_item;
     char *data;
+#ifdef BK_STATS
+    struct bk_stats stats;
+#endif
+    struct bk_allocator allocator;
 };
 
+/*
+ * Used when the vector is initialized without an allocator. Its function
+ * pointers are all NULL, which means memory is managed by the standard library.
+ */
+static const struct bk_allocator vector_standard_allocator;
+
+/*
+ * Allocates memory with the allocator of the vector.
+ */
+static void *vector_allocate(const struct bk_allocator *const allocator,
+                             const size_t size)
+{
+    if (!allocator->allocate) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator->context, size);
+}
+
+/*
+ * Resizes memory with the allocator of the vector. If the allocator cannot
+ * resize memory, a new block is allocated and the old block is copied into it.
+ */
+static void *vector_reallocate(const struct bk_allocator *const allocator,
+                               void *const ptr, const size_t old_size,
+                               const size_t size)
+{
+    void *temp;
+    if (!allocator->allocate) {
+        return realloc(ptr, size);
+    }
+    if (allocator->reallocate) {
+        return allocator->reallocate(allocator->context, ptr, size);
+    }
+    temp = allocator->allocate(allocator->context, size);
+    if (!temp) {
+        return NULL;
+    }
+    memcpy(temp, ptr, old_size < size ? old_size : size);
+    allocator->deallocate(allocator->context, ptr);
+    return temp;
+}
+
+/*
+ * Frees memory with the allocator of the vector.
+ */
+static void vector_deallocate(const struct bk_allocator *const allocator,
+                              void *const ptr)
+{
+    if (!allocator->deallocate) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator->context, ptr);
+}
+
 /**
  * Initializes a vector.
  *
@@ -43,25 +109,56 @@ struct internal_vector {
  *         allocation error
  */
 vector vector_init(const size_t data_size)
+{
+    return vector_init_with_allocator(data_size, NULL);
+}
+
+/**
+ * Initializes a vector, which manages its memory with the given allocator.
+ *
+ * @param data_size the size of each element in the vector; must be positive
+ * @param allocator the allocator which manages the memory of the vector, or
+ *                  NULL to use the standard library; if not NULL, its allocate
+ *                  and deallocate functions must not be NULL
+ *
+ * @return the newly-initialized vector, or NULL if it was not successfully
+ *         initialized due to either invalid input arguments or memory
+ *         allocation error
+ */
+vector vector_init_with_allocator(const size_t data_size,
+                                  const struct bk_allocator *allocator)
 {
     struct internal_vector *init;
     if (data_size == 0) {
         return NULL;
     }
-    init = malloc(sizeof *init);
+    if (!allocator) {
+        allocator = &vector_standard_allocator;
+    } else if (!allocator->allocate || !allocator->deallocate) {
+        return NULL;
+    }
+    init = vector_allocate(allocator, sizeof *init);
     if (!init) {
         return NULL;
     }
+    init->allocator = *allocator;
+#ifdef BK_STATS
+    memset(&init->stats, 0, sizeof init->stats);
+#endif
+    BKTHOMPS_VECTOR_STAT(init, bytes_allocated, sizeof *init);
     init->item_count = 0;
     init->item_capacity = BKTHOMPS_VECTOR_START_SPACE;
     init->bytes_per_item = data_size;
     if (init->item_capacity * data_size / data_size != init->item_capacity) {
-        free(init);
+        vector_deallocate(allocator, init);
         return NULL;
     }
-    init->data = malloc(init->item_capacity * init->bytes_per_item);
+    BKTHOMPS_VECTOR_STAT(init, bytes_allocated,
+                         init->item_capacity * init->bytes_per_item);
+    init->data = vector_allocate(allocator,
+                                 init->item_capacity * init->bytes_per_item);
     if (!init->data) {
-        free(init);
+        vector_deallocate(allocator, init);
         return NULL;
     }
     return init;
@@ -103,6 +200,23 @@ bk_bool vector_is_empty(vector me)
     return vector_size(me) == 0;
 }
 
+/**
+ * Gets the statistics of the vector. They are only tracked if the library is
+ * compiled with BK_STATS defined, otherwise they are all zero.
+ *
+ * @param me    the vector to get the statistics of
+ * @param stats the statistics to copy to
+ */
+void vector_get_stats(vector me, struct bk_stats *const stats)
+{
+#ifdef BK_STATS
+    *stats = me->stats;
+#else
+    (void) me;
+    memset(stats, 0, sizeof *stats);
+#endif
+}
+
 /*
  * Sets the space of the buffer. Assumes that size is at least the same as the
  * number of items currently in the vector.
@@ -113,10 +227,14 @@ static bk_err vector_set_space(vector me, const size_t size)
     if (size * me->bytes_per_item / me->bytes_per_item != size) {
         return -BK_ERANGE;
     }
-    temp = realloc(me->data, size * me->bytes_per_item);
+    BKTHOMPS_VECTOR_STAT(me, bytes_allocated, size * me->bytes_per_item);
+    temp = vector_reallocate(&me->allocator, me->data,
+                             me->item_count * me->bytes_per_item,
+                             size * me->bytes_per_item);
     if (!temp) {
         return -BK_ENOMEM;
     }
+    BKTHOMPS_VECTOR_STAT(me, resizes, 1);
     me->item_capacity = size;
     me->data = temp;
     return BK_OK;
@@ -272,10 +390,15 @@ bk_err vector_add_at(vector me, const size_t index, void *const data)
         if (new_space <= me->item_capacity) {
             new_space = item_limit;
         }
-        temp = realloc(me->data, new_space * me->bytes_per_item);
+        BKTHOMPS_VECTOR_STAT(me, bytes_allocated,
+                             new_space * me->bytes_per_item);
+        temp = vector_reallocate(&me->allocator, me->data,
+                                 me->item_count * me->bytes_per_item,
+                                 new_space * me->bytes_per_item);
         if (!temp) {
             return -BK_ENOMEM;
         }
+        BKTHOMPS_VECTOR_STAT(me, resizes, 1);
         me->data = temp;
         me->item_capacity = new_space;
     }
@@ -455,6 +578,25 @@ bk_err vector_get_at(void *const data, vector me, const size_t index)
     return BK_OK;
 }
 
+/**
+ * Gets a pointer to the element at index of the vector, so that the element can
+ * be read or modified in place without copying it. The pointer is invalidated
+ * by any operation which adds or removes elements, or which changes the
+ * capacity of the vector.
+ *
+ * @param me    the vector to get the element from
+ * @param index the index of the element in the vector
+ *
+ * @return a pointer to the element, or NULL if the index is out of bounds
+ */
+void *vector_get_at_ptr(vector me, const size_t index)
+{
+    if (index >= me->item_count) {
+        return NULL;
+    }
+    return me->data + index * me->bytes_per_item;
+}
+
 /**
  * Copies the last element of the vector to data. The pointer to the data being
  * obtained should point to the data type which this vector holds. For example,
@@ -499,8 +641,8 @@ bk_err vector_clear(vector me)
 vector vector_destroy(vector me)
 {
     if (me) {
-        free(me->data);
-        free(me);
+        vector_deallocate(&me->allocator, me->data);
+        vector_deallocate(&me->allocator, me);
     }
     return NULL;
 }
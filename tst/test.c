@@ -69,6 +69,44 @@ void *realloc(void *ptr, size_t new_size)
 
 #endif /* STUB_MALLOC */
 
+static void *counting_allocate(void *context, size_t size)
+{
+    long *const live = context;
+    void *const ptr = malloc(size);
+    if (ptr) {
+        (*live)++;
+    }
+    return ptr;
+}
+
+static void *counting_reallocate(void *context, void *ptr, size_t size)
+{
+    (void) context;
+    return realloc(ptr, size);
+}
+
+static void counting_deallocate(void *context, void *ptr)
+{
+    long *const live = context;
+    if (ptr) {
+        (*live)--;
+    }
+    free(ptr);
+}
+
+/*
+ * Sets up an allocator which keeps track of how many of its allocations have
+ * not yet been freed.
+ */
+void test_counting_allocator(struct bk_allocator *allocator, long *live)
+{
+    *live = 0;
+    allocator->allocate = counting_allocate;
+    allocator->reallocate = counting_reallocate;
+    allocator->deallocate = counting_deallocate;
+    allocator->context = live;
+}
+
 int main(void)
 {
     test_array();
@@ -80,6 +118,10 @@ int main(void)
     test_map();
     test_multiset();
     test_multimap();
+    test_btree_set();
+    test_btree_map();
+    test_btree_multiset();
+    test_btree_multimap();
     test_unordered_set();
     test_unordered_map();
     test_unordered_multiset();
@@ -87,6 +129,7 @@ int main(void)
     test_stack();
     test_queue();
     test_priority_queue();
+    test_bk_hash();
     printf("Tests Passed\n");
     return 0;
 }
@@ -5,7 +5,9 @@
 #include <errno.h>
 #include <assert.h>
 #include <limits.h>
+#include <stddef.h>
 #include <string.h>
+#include "../src/include/_bk_defines.h"
 
 #define STUB_MALLOC 1
 
@@ -21,6 +23,8 @@ extern int delay_fail_realloc;
 
 #endif /* STUB_MALLOC */
 
+void test_counting_allocator(struct bk_allocator *allocator, long *live);
+
 void test_array(void);
 void test_vector(void);
 void test_deque(void);
@@ -30,6 +34,10 @@ void test_set(void);
 void test_map(void);
 void test_multiset(void);
 void test_multimap(void);
+void test_btree_set(void);
+void test_btree_map(void);
+void test_btree_multiset(void);
+void test_btree_multimap(void);
 void test_unordered_set(void);
 void test_unordered_map(void);
 void test_unordered_multiset(void);
@@ -37,5 +45,6 @@ void test_unordered_multimap(void);
 void test_stack(void);
 void test_queue(void);
 void test_priority_queue(void);
+void test_bk_hash(void);
 
 #endif /* CONTAINERS_TEST_H */
@@ -150,9 +150,33 @@ static void test_add_all(void)
     array_destroy(me);
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    array me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = array_init_with_allocator(10, sizeof(int), &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 10; i++) {
+        assert(array_set(me, i, &i) == BK_OK);
+    }
+    assert(array_get(&get, me, 5) == BK_OK);
+    assert(get == 5);
+    assert(!array_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = array_init_with_allocator(10, sizeof(int), &allocator);
+    assert(!me);
+}
+
 void test_array(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
     test_empty_array();
     test_not_empty_array();
 #if STUB_MALLOC
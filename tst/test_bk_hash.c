@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include "test.h"
+#include "../src/include/bk_hash.h"
+
+#define BUCKETS 256
+#define KEYS (64 * BUCKETS)
+
+static void test_consistent(void)
+{
+    char bytes[40];
+    int i;
+    long number = 123456789;
+    for (i = 0; i < (int) sizeof(bytes); i++) {
+        bytes[i] = (char) (i * 7);
+    }
+    i = 42;
+    assert(bk_hash_int32(&i) == bk_hash_int32(&i));
+    assert(bk_hash_bytes(&i, 4) == bk_hash_int32(&i));
+    assert(bk_hash_bytes(bytes, 8) == bk_hash_int64(bytes));
+    assert(bk_hash_bytes(&number, sizeof(long))
+           == bk_hash_bytes(&number, sizeof(long)));
+    for (i = 0; i <= (int) sizeof(bytes); i++) {
+        const unsigned long hash = bk_hash_bytes(bytes, i);
+        assert(hash == bk_hash_bytes(bytes, i));
+        if (i > 0) {
+            bytes[i - 1]++;
+            assert(hash != bk_hash_bytes(bytes, i));
+            bytes[i - 1]--;
+        }
+    }
+}
+
+static void test_string(void)
+{
+    char one[16] = "hello";
+    char two[16] = "hello";
+    char three[16] = "hellp";
+    memset(one + 6, 'x', sizeof(one) - 6);
+    memset(two + 6, 'y', sizeof(two) - 6);
+    assert(bk_hash_string(one) == bk_hash_string(two));
+    assert(bk_hash_string(one) != bk_hash_string(three));
+    assert(bk_hash_string("") == bk_hash_string(""));
+}
+
+/*
+ * Hashes sequential keys, and checks that both the lowest bits and the bits
+ * which the unordered containers pick a slot with are evenly spread. A key size
+ * of zero means that the keys are decimal strings.
+ */
+static void test_distribution(unsigned long (*hash)(const void *const key),
+                              const size_t key_size)
+{
+    static size_t low[BUCKETS];
+    static size_t slot[BUCKETS];
+    char key[16];
+    unsigned long i;
+    memset(low, 0, sizeof(low));
+    memset(slot, 0, sizeof(slot));
+    for (i = 0; i < KEYS; i++) {
+        unsigned long hashed;
+        memset(key, 0, sizeof(key));
+        if (key_size == 0) {
+            sprintf(key, "%lu", i);
+        } else {
+            memcpy(key, &i, key_size < sizeof(i) ? key_size : sizeof(i));
+        }
+        hashed = hash(key);
+        low[hashed % BUCKETS]++;
+        slot[(hashed >> 7) % BUCKETS]++;
+    }
+    for (i = 0; i < BUCKETS; i++) {
+        assert(low[i] > KEYS / BUCKETS / 2);
+        assert(low[i] < KEYS / BUCKETS * 2);
+        assert(slot[i] > KEYS / BUCKETS / 2);
+        assert(slot[i] < KEYS / BUCKETS * 2);
+    }
+}
+
+void test_bk_hash(void)
+{
+    test_consistent();
+    test_string();
+    test_distribution(bk_hash_int32, 4);
+    test_distribution(bk_hash_int64, 8);
+    test_distribution(bk_hash_string, 0);
+}
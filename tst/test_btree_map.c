@@ -0,0 +1,521 @@
+#include "test.h"
+#include "../src/include/btree_map.h"
+
+/*
+ * Include this to verify the tree.
+ */
+struct internal_btree_map {
+    size_t size;
+    size_t key_size;
+    size_t value_size;
+    size_t height;
+    size_t leaf_capacity;
+    size_t inner_capacity;
+    size_t node_size;
+    int (*comparator)(const void *const one, const void *const two);
+    char *root;
+    size_t leaf_key_offset;
+    size_t leaf_value_offset;
+    size_t inner_key_offset;
+    size_t inner_child_offset;
+};
+
+/*
+ * Include this to verify the tree.
+ */
+static const size_t ptr_size = sizeof(char *);
+static const size_t leaf_prev_offset = sizeof(size_t);
+static const size_t leaf_next_offset = sizeof(size_t) + sizeof(char *);
+/* Assume the keys are ints. */
+
+static size_t btree_map_verify_count(const char *const node)
+{
+    size_t count;
+    memcpy(&count, node, sizeof(size_t));
+    return count;
+}
+
+static int btree_map_verify_key(btree_map me, const char *const node,
+                                const size_t level, const size_t index)
+{
+    int key;
+    memcpy(&key, node + (level == 1 ? me->leaf_key_offset
+                                    : me->inner_key_offset)
+                 + index * me->key_size, sizeof(int));
+    return key;
+}
+
+static char *btree_map_verify_child(btree_map me, const char *const node,
+                                    const size_t index)
+{
+    char *child;
+    memcpy(&child, node + me->inner_child_offset + index * ptr_size, ptr_size);
+    return child;
+}
+
+/*
+ * Verifies that the B+ tree rules are followed. Every node other than the root
+ * is at least half full, the keys of each node are ascending and lie between
+ * the separating keys around the node, and the leaves are linked in order.
+ * Returns the number of keys in the subtree.
+ */
+static size_t btree_map_verify_recursive(btree_map me, char *const node,
+                                         const size_t level,
+                                         const int *const low,
+                                         const int *const high,
+                                         char **const previous_leaf)
+{
+    const size_t count = btree_map_verify_count(node);
+    size_t total = 0;
+    size_t i;
+    if (node != me->root) {
+        assert(count >= (level == 1 ? me->leaf_capacity / 2
+                                    : (me->inner_capacity - 1) / 2));
+    }
+    assert(count <= (level == 1 ? me->leaf_capacity : me->inner_capacity));
+    for (i = 0; i < count; i++) {
+        const int key = btree_map_verify_key(me, node, level, i);
+        assert(!low || key >= *low);
+        assert(!high || key < *high);
+        if (i > 0) {
+            assert(btree_map_verify_key(me, node, level, i - 1) < key);
+        }
+    }
+    if (level == 1) {
+        char *link;
+        assert(count > 0);
+        memcpy(&link, node + leaf_prev_offset, ptr_size);
+        assert(link == *previous_leaf);
+        if (*previous_leaf) {
+            memcpy(&link, *previous_leaf + leaf_next_offset, ptr_size);
+            assert(link == node);
+        }
+        *previous_leaf = node;
+        return count;
+    }
+    for (i = 0; i <= count; i++) {
+        int child_low;
+        int child_high;
+        if (i > 0) {
+            child_low = btree_map_verify_key(me, node, level, i - 1);
+        }
+        if (i < count) {
+            child_high = btree_map_verify_key(me, node, level, i);
+        }
+        total += btree_map_verify_recursive(me,
+                                            btree_map_verify_child(me, node, i),
+                                            level - 1,
+                                            i > 0 ? &child_low : low,
+                                            i < count ? &child_high : high,
+                                            previous_leaf);
+    }
+    return total;
+}
+
+static void btree_map_verify(btree_map me)
+{
+    char *previous_leaf = NULL;
+    char *link;
+    if (!me->root) {
+        assert(me->height == 0);
+        assert(btree_map_size(me) == 0);
+        return;
+    }
+    assert(btree_map_verify_recursive(me, me->root, me->height, NULL, NULL,
+                                      &previous_leaf)
+           == btree_map_size(me));
+    memcpy(&link, previous_leaf + leaf_next_offset, ptr_size);
+    assert(!link);
+}
+
+static int compare_int(const void *const one, const void *const two)
+{
+    const int a = *(int *) one;
+    const int b = *(int *) two;
+    return a - b;
+}
+
+static void test_invalid_init(void)
+{
+    const size_t max_size = -1;
+    struct bk_allocator allocator = {NULL, NULL, NULL, NULL};
+    assert(!btree_map_init(0, sizeof(int), compare_int));
+    assert(!btree_map_init(sizeof(int), 0, compare_int));
+    assert(!btree_map_init(sizeof(int), sizeof(int), NULL));
+    assert(!btree_map_init(max_size, max_size, compare_int));
+    assert(!btree_map_init(1, max_size, compare_int));
+    assert(!btree_map_init_ex(sizeof(int), sizeof(int), compare_int, 16,
+                              NULL));
+    assert(!btree_map_init_ex(sizeof(int), sizeof(int), compare_int, 4096,
+                              &allocator));
+}
+
+static void test_basic(void)
+{
+    int key;
+    int value = 0;
+    btree_map me = btree_map_init(sizeof(int), sizeof(int), compare_int);
+    assert(me);
+    assert(btree_map_is_empty(me));
+    key = 4;
+    assert(!btree_map_get(&value, me, &key));
+    assert(!btree_map_contains(me, &key));
+    assert(!btree_map_remove(me, &key));
+    assert(!btree_map_first(me));
+    assert(!btree_map_last(me));
+    assert(!btree_map_lower(me, &key));
+    assert(!btree_map_higher(me, &key));
+    assert(!btree_map_floor(me, &key));
+    assert(!btree_map_ceiling(me, &key));
+    value = 40;
+    assert(btree_map_put(me, &key, &value) == BK_OK);
+    value = 41;
+    assert(btree_map_put(me, &key, &value) == BK_OK);
+    assert(btree_map_size(me) == 1);
+    value = 0;
+    assert(btree_map_get(&value, me, &key));
+    assert(value == 41);
+    assert(btree_map_contains(me, &key));
+    assert(*(int *) btree_map_first(me) == 4);
+    assert(*(int *) btree_map_last(me) == 4);
+    assert(btree_map_remove(me, &key));
+    assert(!btree_map_remove(me, &key));
+    assert(btree_map_is_empty(me));
+    btree_map_verify(me);
+    assert(!btree_map_destroy(me));
+}
+
+/*
+ * Puts and removes keys in a scattered order, and checks the btree_map against
+ * a plain array of which keys it should contain. A node size of zero picks the
+ * smallest nodes possible, which make the tree deep.
+ */
+static void test_put_remove(size_t node_size)
+{
+    char present[1000];
+    int i;
+    btree_map me = btree_map_init_ex(sizeof(int), sizeof(int), compare_int,
+                                     node_size, NULL);
+    if (node_size == 0) {
+        assert(!me);
+        while (!me) {
+            node_size++;
+            me = btree_map_init_ex(sizeof(int), sizeof(int), compare_int,
+                                   node_size, NULL);
+        }
+        assert(me->leaf_capacity == 3 || me->inner_capacity == 3);
+    }
+    assert(me);
+    memset(present, 0, sizeof present);
+    for (i = 0; i < 5000; i++) {
+        int key = (i * 7919) % 1000;
+        int value = key * 3;
+        if (i % 5 < 3) {
+            assert(btree_map_put(me, &key, &value) == BK_OK);
+            present[key] = 1;
+        } else {
+            assert(btree_map_remove(me, &key) == present[key]);
+            present[key] = 0;
+        }
+        if (i % 250 == 0) {
+            btree_map_verify(me);
+        }
+    }
+    btree_map_verify(me);
+    for (i = 0; i < 1000; i++) {
+        int value = -1;
+        assert(btree_map_contains(me, &i) == present[i]);
+        if (present[i]) {
+            assert(btree_map_get(&value, me, &i));
+            assert(value == i * 3);
+        }
+    }
+    for (i = 0; i < 1000; i++) {
+        const int key = (i * 271) % 1000;
+        assert(btree_map_remove(me, (void *) &key) == present[key]);
+        present[key] = 0;
+        if (i % 100 == 0) {
+            btree_map_verify(me);
+        }
+    }
+    assert(btree_map_is_empty(me));
+    btree_map_verify(me);
+    for (i = 0; i < 100; i++) {
+        assert(btree_map_put(me, &i, &i) == BK_OK);
+    }
+    btree_map_verify(me);
+    btree_map_clear(me);
+    assert(btree_map_is_empty(me));
+    btree_map_verify(me);
+    assert(!btree_map_destroy(me));
+}
+
+static void test_ordered_retrieval(void)
+{
+    int i;
+    int key;
+    btree_map me = btree_map_init_ex(sizeof(int), sizeof(int), compare_int, 1,
+                                     NULL);
+    assert(!me);
+    me = btree_map_init_ex(sizeof(int), sizeof(int), compare_int, 64, NULL);
+    assert(me);
+    for (i = 0; i < 500; i++) {
+        key = i * 2;
+        assert(btree_map_put(me, &key, &i) == BK_OK);
+    }
+    btree_map_verify(me);
+    assert(*(int *) btree_map_first(me) == 0);
+    assert(*(int *) btree_map_last(me) == 998);
+    for (key = -3; key <= 1001; key++) {
+        const int even_below = key % 2 == 0 ? key - 2 : key - 1;
+        const int even_above = key % 2 == 0 ? key + 2 : key + 1;
+        const int *const lower = btree_map_lower(me, &key);
+        const int *const higher = btree_map_higher(me, &key);
+        const int *const floor = btree_map_floor(me, &key);
+        const int *const ceiling = btree_map_ceiling(me, &key);
+        if (key <= 0) {
+            assert(!lower);
+        } else {
+            assert(*lower == (even_below > 998 ? 998 : even_below));
+        }
+        if (key >= 998) {
+            assert(!higher);
+        } else {
+            assert(*higher == (even_above < 0 ? 0 : even_above));
+        }
+        if (key < 0) {
+            assert(!floor);
+        } else {
+            assert(*floor == (key > 998 ? 998 : key - (key & 1)));
+        }
+        if (key > 998) {
+            assert(!ceiling);
+        } else {
+            assert(*ceiling == (key < 0 ? 0 : key + (key & 1)));
+        }
+    }
+    assert(!btree_map_destroy(me));
+}
+
+static void test_iteration(void)
+{
+    struct btree_map_iter iter;
+    void *key;
+    void *value;
+    int expected;
+    int i;
+    btree_map me = btree_map_init(sizeof(int), sizeof(int), compare_int);
+    assert(me);
+    btree_map_iter_init(&iter, me);
+    assert(!btree_map_iter_next(&key, &value, &iter));
+    for (i = 0; i < 1000; i++) {
+        const int k = (i * 37) % 1000 * 2;
+        const int v = k + 1;
+        assert(btree_map_put(me, (void *) &k, (void *) &v) == BK_OK);
+    }
+    expected = 0;
+    btree_map_iter_init(&iter, me);
+    while (btree_map_iter_next(&key, &value, &iter)) {
+        assert(*(int *) key == expected);
+        assert(*(int *) value == expected + 1);
+        expected += 2;
+    }
+    assert(expected == 2000);
+    i = 1001;
+    expected = 1002;
+    btree_map_iter_init_at(&iter, me, &i);
+    while (btree_map_iter_next(&key, NULL, &iter)) {
+        assert(*(int *) key == expected);
+        expected += 2;
+    }
+    assert(expected == 2000);
+    i = 5000;
+    btree_map_iter_init_at(&iter, me, &i);
+    assert(!btree_map_iter_next(&key, &value, &iter));
+    assert(!btree_map_destroy(me));
+}
+
+static void test_get_ptr(void)
+{
+    int i;
+    int *value;
+    btree_map me = btree_map_init(sizeof(int), sizeof(int), compare_int);
+    assert(me);
+    i = 5;
+    assert(!btree_map_get_ptr(me, &i));
+    for (i = 0; i < 1000; i++) {
+        assert(btree_map_put(me, &i, &i) == BK_OK);
+    }
+    i = 1000;
+    assert(!btree_map_get_ptr(me, &i));
+    for (i = 0; i < 1000; i++) {
+        value = btree_map_get_ptr(me, &i);
+        assert(value);
+        assert(*value == i);
+        *value = 2 * i;
+    }
+    for (i = 0; i < 1000; i++) {
+        int copy = 0;
+        assert(btree_map_get(&copy, me, &i));
+        assert(copy == 2 * i);
+    }
+    assert(!btree_map_destroy(me));
+}
+
+struct aligned_value {
+    double d;
+    long l;
+};
+
+struct aligned_value_probe {
+    char c;
+    struct aligned_value v;
+};
+
+static int compare_short_key(const void *const one, const void *const two)
+{
+    return memcmp(one, two, 3);
+}
+
+/*
+ * Uses keys whose size is odd, so that the values are only aligned if the
+ * btree_map pads the arrays of the leaves.
+ */
+static void test_get_ptr_aligned(void)
+{
+    int i;
+    char key[3];
+    struct aligned_value *value;
+    btree_map me = btree_map_init_ex(sizeof(key), sizeof(struct aligned_value),
+                                     compare_short_key, 256, NULL);
+    assert(me);
+    memset(key, 0, sizeof(key));
+    for (i = 0; i < 1000; i++) {
+        struct aligned_value put;
+        key[1] = (char) (i / 256);
+        key[2] = (char) (i % 256);
+        put.d = i;
+        put.l = i;
+        assert(btree_map_put(me, key, &put) == BK_OK);
+    }
+    for (i = 0; i < 1000; i++) {
+        key[1] = (char) (i / 256);
+        key[2] = (char) (i % 256);
+        value = btree_map_get_ptr(me, key);
+        assert(value);
+        assert((size_t) value % offsetof(struct aligned_value_probe, v) == 0);
+        assert(value->d == i);
+        assert(value->l == i);
+        value->l = -i;
+    }
+    assert(!btree_map_destroy(me));
+}
+
+#if STUB_MALLOC
+static void test_init_out_of_memory(void)
+{
+    fail_malloc = 1;
+    assert(!btree_map_init(sizeof(int), sizeof(int), compare_int));
+}
+#endif
+
+#if STUB_MALLOC
+static void test_put_out_of_memory(void)
+{
+    size_t height;
+    int i;
+    btree_map me = btree_map_init_ex(sizeof(int), sizeof(int), compare_int, 64,
+                                     NULL);
+    assert(me);
+    i = 0;
+    fail_malloc = 1;
+    assert(btree_map_put(me, &i, &i) == -BK_ENOMEM);
+    assert(btree_map_is_empty(me));
+    for (i = 0; i < 200; i++) {
+        assert(btree_map_put(me, &i, &i) == BK_OK);
+    }
+    /* Each put which splits a node fails, and leaves the tree unchanged. */
+    for (i = 200; i < 400; i++) {
+        fail_malloc = 1;
+        if (btree_map_put(me, &i, &i) == -BK_ENOMEM) {
+            assert(btree_map_size(me) == (size_t) i);
+            assert(!btree_map_contains(me, &i));
+            assert(btree_map_put(me, &i, &i) == BK_OK);
+        } else {
+            fail_malloc = 0;
+        }
+        btree_map_verify(me);
+    }
+    while (btree_map_verify_count(me->root) < me->inner_capacity) {
+        assert(btree_map_put(me, &i, &i) == BK_OK);
+        i++;
+    }
+    /* The new root is allocated, but splitting the old root fails. */
+    height = me->height;
+    delay_fail_malloc = 1;
+    fail_malloc = 1;
+    assert(btree_map_put(me, &i, &i) == -BK_ENOMEM);
+    assert(me->height == height);
+    btree_map_verify(me);
+    assert(btree_map_put(me, &i, &i) == BK_OK);
+    assert(me->height == height + 1);
+    btree_map_verify(me);
+    assert(!btree_map_destroy(me));
+}
+#endif
+
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    btree_map me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = btree_map_init_ex(sizeof(int), sizeof(int), compare_int, 128,
+                           &allocator);
+    assert(me);
+    assert(live == 1);
+    for (i = 0; i < 1000; i++) {
+        assert(btree_map_put(me, &i, &i) == BK_OK);
+    }
+    assert(live > 1);
+    for (i = 0; i < 1000; i += 2) {
+        assert(btree_map_remove(me, &i));
+    }
+    btree_map_verify(me);
+    btree_map_clear(me);
+    assert(live == 1);
+    for (i = 0; i < 1000; i++) {
+        assert(btree_map_put(me, &i, &i) == BK_OK);
+    }
+    assert(!btree_map_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = btree_map_init_ex(sizeof(int), sizeof(int), compare_int, 128,
+                           &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(btree_map_put(me, &i, &i) == BK_OK);
+    }
+    btree_map_verify(me);
+    assert(!btree_map_destroy(me));
+    assert(live == 0);
+}
+
+void test_btree_map(void)
+{
+    test_invalid_init();
+    test_basic();
+    test_put_remove(0);
+    test_put_remove(512);
+    test_put_remove(4096);
+    test_ordered_retrieval();
+    test_iteration();
+    test_get_ptr();
+    test_get_ptr_aligned();
+    test_init_with_allocator();
+#if STUB_MALLOC
+    test_init_out_of_memory();
+    test_put_out_of_memory();
+#endif
+}
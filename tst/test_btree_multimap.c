@@ -0,0 +1,568 @@
+#include "test.h"
+#include "../src/include/btree_multimap.h"
+
+/*
+ * Include this to verify the tree.
+ */
+struct internal_btree_multimap {
+    size_t size;
+    size_t key_size;
+    size_t value_size;
+    size_t pair_size;
+    size_t value_offset;
+    size_t height;
+    size_t leaf_capacity;
+    size_t inner_capacity;
+    size_t node_size;
+    int (*key_comparator)(const void *const one, const void *const two);
+    int (*value_ordering)(const void *const one, const void *const two);
+    char *root;
+    size_t leaf_pair_offset;
+    size_t leaf_occurrences_offset;
+    size_t inner_pair_offset;
+    size_t inner_child_offset;
+};
+
+/*
+ * Include this to verify the tree.
+ */
+static const size_t ptr_size = sizeof(char *);
+static const size_t leaf_prev_offset = sizeof(size_t);
+static const size_t leaf_next_offset = sizeof(size_t) + sizeof(char *);
+/* Assume the keys and values are ints from zero up to 9999. */
+
+static size_t btree_multimap_verify_count(const char *const node)
+{
+    size_t count;
+    memcpy(&count, node, sizeof(size_t));
+    return count;
+}
+
+/*
+ * Gets the key-value pair at the index of the node as one number, which orders
+ * the pairs by key and then by value.
+ */
+static long btree_multimap_verify_pair(btree_multimap me,
+                                       const char *const node,
+                                       const size_t level, const size_t index)
+{
+    const char *const pair = node + (level == 1 ? me->leaf_pair_offset
+                                                : me->inner_pair_offset)
+                             + index * me->pair_size;
+    int key;
+    int value;
+    memcpy(&key, pair, sizeof(int));
+    memcpy(&value, pair + me->value_offset, sizeof(int));
+    return key * 10000L + value;
+}
+
+static char *btree_multimap_verify_child(btree_multimap me,
+                                         const char *const node,
+                                         const size_t index)
+{
+    char *child;
+    memcpy(&child, node + me->inner_child_offset + index * ptr_size, ptr_size);
+    return child;
+}
+
+/*
+ * Verifies that the B+ tree rules are followed. Every node other than the root
+ * is at least half full, the key-value pairs of each node are ascending and lie
+ * between the separating pairs around the node, and the leaves are linked in
+ * order. Returns the number of times the pairs in the subtree occur.
+ */
+static size_t btree_multimap_verify_recursive(btree_multimap me,
+                                              char *const node,
+                                              const size_t level,
+                                              const long *const low,
+                                              const long *const high,
+                                              char **const previous_leaf)
+{
+    const size_t count = btree_multimap_verify_count(node);
+    size_t total = 0;
+    size_t i;
+    if (node != me->root) {
+        assert(count >= (level == 1 ? me->leaf_capacity / 2
+                                    : (me->inner_capacity - 1) / 2));
+    }
+    assert(count <= (level == 1 ? me->leaf_capacity : me->inner_capacity));
+    for (i = 0; i < count; i++) {
+        const long pair = btree_multimap_verify_pair(me, node, level, i);
+        assert(!low || pair >= *low);
+        assert(!high || pair < *high);
+        if (i > 0) {
+            assert(btree_multimap_verify_pair(me, node, level, i - 1) < pair);
+        }
+    }
+    if (level == 1) {
+        char *link;
+        assert(count > 0);
+        memcpy(&link, node + leaf_prev_offset, ptr_size);
+        assert(link == *previous_leaf);
+        if (*previous_leaf) {
+            memcpy(&link, *previous_leaf + leaf_next_offset, ptr_size);
+            assert(link == node);
+        }
+        *previous_leaf = node;
+        for (i = 0; i < count; i++) {
+            size_t occurrences;
+            memcpy(&occurrences,
+                   node + me->leaf_occurrences_offset + i * sizeof(size_t),
+                   sizeof(size_t));
+            assert(occurrences > 0);
+            total += occurrences;
+        }
+        return total;
+    }
+    for (i = 0; i <= count; i++) {
+        long child_low;
+        long child_high;
+        if (i > 0) {
+            child_low = btree_multimap_verify_pair(me, node, level, i - 1);
+        }
+        if (i < count) {
+            child_high = btree_multimap_verify_pair(me, node, level, i);
+        }
+        total += btree_multimap_verify_recursive(
+                me, btree_multimap_verify_child(me, node, i), level - 1,
+                i > 0 ? &child_low : low, i < count ? &child_high : high,
+                previous_leaf);
+    }
+    return total;
+}
+
+static void btree_multimap_verify(btree_multimap me)
+{
+    char *previous_leaf = NULL;
+    char *link;
+    if (!me->root) {
+        assert(me->height == 0);
+        assert(btree_multimap_size(me) == 0);
+        return;
+    }
+    assert(btree_multimap_verify_recursive(me, me->root, me->height, NULL,
+                                           NULL, &previous_leaf)
+           == btree_multimap_size(me));
+    memcpy(&link, previous_leaf + leaf_next_offset, ptr_size);
+    assert(!link);
+}
+
+static int compare_int(const void *const one, const void *const two)
+{
+    const int a = *(int *) one;
+    const int b = *(int *) two;
+    return a - b;
+}
+
+static void test_invalid_init(void)
+{
+    const size_t max_size = -1;
+    struct bk_allocator allocator = {NULL, NULL, NULL, NULL};
+    assert(!btree_multimap_init(0, sizeof(int), compare_int, compare_int));
+    assert(!btree_multimap_init(sizeof(int), 0, compare_int, compare_int));
+    assert(!btree_multimap_init(sizeof(int), sizeof(int), NULL, compare_int));
+    assert(!btree_multimap_init(sizeof(int), sizeof(int), compare_int, NULL));
+    assert(!btree_multimap_init(max_size, max_size, compare_int, compare_int));
+    assert(!btree_multimap_init(1, max_size, compare_int, compare_int));
+    assert(!btree_multimap_init_ex(sizeof(int), sizeof(int), compare_int,
+                                   compare_int, 16, NULL));
+    assert(!btree_multimap_init_ex(sizeof(int), sizeof(int), compare_int,
+                                   compare_int, 4096, &allocator));
+}
+
+static void test_basic(void)
+{
+    int key;
+    int value;
+    btree_multimap me = btree_multimap_init(sizeof(int), sizeof(int),
+                                            compare_int, compare_int);
+    assert(me);
+    assert(btree_multimap_is_empty(me));
+    key = 4;
+    value = 0;
+    assert(btree_multimap_count(me, &key) == 0);
+    assert(!btree_multimap_contains(me, &key));
+    assert(!btree_multimap_remove(me, &key, &value));
+    assert(!btree_multimap_remove_all(me, &key));
+    btree_multimap_get_start(me, &key);
+    assert(!btree_multimap_get_next(&value, me));
+    assert(!btree_multimap_first(me));
+    assert(!btree_multimap_last(me));
+    assert(!btree_multimap_lower(me, &key));
+    assert(!btree_multimap_higher(me, &key));
+    assert(!btree_multimap_floor(me, &key));
+    assert(!btree_multimap_ceiling(me, &key));
+    value = 41;
+    assert(btree_multimap_put(me, &key, &value) == BK_OK);
+    value = 40;
+    assert(btree_multimap_put(me, &key, &value) == BK_OK);
+    assert(btree_multimap_put(me, &key, &value) == BK_OK);
+    assert(btree_multimap_size(me) == 3);
+    assert(btree_multimap_count(me, &key) == 3);
+    assert(btree_multimap_contains(me, &key));
+    assert(*(int *) btree_multimap_first(me) == 4);
+    assert(*(int *) btree_multimap_last(me) == 4);
+    btree_multimap_get_start(me, &key);
+    assert(btree_multimap_get_next(&value, me));
+    assert(value == 40);
+    assert(btree_multimap_get_next(&value, me));
+    assert(value == 40);
+    assert(btree_multimap_get_next(&value, me));
+    assert(value == 41);
+    assert(!btree_multimap_get_next(&value, me));
+    value = 42;
+    assert(!btree_multimap_remove(me, &key, &value));
+    value = 40;
+    assert(btree_multimap_remove(me, &key, &value));
+    assert(btree_multimap_size(me) == 2);
+    assert(btree_multimap_count(me, &key) == 2);
+    btree_multimap_verify(me);
+    assert(btree_multimap_remove_all(me, &key));
+    assert(!btree_multimap_remove(me, &key, &value));
+    assert(btree_multimap_is_empty(me));
+    btree_multimap_verify(me);
+    assert(!btree_multimap_destroy(me));
+}
+
+/*
+ * Puts and removes key-value pairs in a scattered order, and checks the
+ * btree_multimap against a plain array of how many times each pair should
+ * occur. A node size of zero picks the smallest nodes possible, which make the
+ * tree deep.
+ */
+static void test_put_remove(size_t node_size)
+{
+    size_t counts[100][10];
+    size_t size = 0;
+    int i;
+    btree_multimap me = btree_multimap_init_ex(sizeof(int), sizeof(int),
+                                               compare_int, compare_int,
+                                               node_size, NULL);
+    if (node_size == 0) {
+        assert(!me);
+        while (!me) {
+            node_size++;
+            me = btree_multimap_init_ex(sizeof(int), sizeof(int), compare_int,
+                                        compare_int, node_size, NULL);
+        }
+        assert(me->leaf_capacity == 3 || me->inner_capacity == 3);
+    }
+    assert(me);
+    memset(counts, 0, sizeof counts);
+    for (i = 0; i < 5000; i++) {
+        int key = (i * 7919) % 100;
+        int value = (i * 13) % 10;
+        if (i % 5 < 3) {
+            assert(btree_multimap_put(me, &key, &value) == BK_OK);
+            counts[key][value]++;
+            size++;
+        } else if (i % 50 == 49) {
+            int j;
+            size_t key_count = 0;
+            for (j = 0; j < 10; j++) {
+                key_count += counts[key][j];
+                counts[key][j] = 0;
+            }
+            assert(btree_multimap_remove_all(me, &key) == (key_count > 0));
+            size -= key_count;
+        } else {
+            assert(btree_multimap_remove(me, &key, &value)
+                   == (counts[key][value] > 0));
+            if (counts[key][value] > 0) {
+                counts[key][value]--;
+                size--;
+            }
+        }
+        assert(btree_multimap_size(me) == size);
+        if (i % 250 == 0) {
+            btree_multimap_verify(me);
+        }
+    }
+    btree_multimap_verify(me);
+    for (i = 0; i < 100; i++) {
+        size_t key_count = 0;
+        int value;
+        int j;
+        for (j = 0; j < 10; j++) {
+            key_count += counts[i][j];
+        }
+        assert(btree_multimap_count(me, &i) == key_count);
+        assert(btree_multimap_contains(me, &i) == (key_count > 0));
+        btree_multimap_get_start(me, &i);
+        for (j = 0; j < 10; j++) {
+            size_t k;
+            for (k = 0; k < counts[i][j]; k++) {
+                assert(btree_multimap_get_next(&value, me));
+                assert(value == j);
+            }
+        }
+        assert(!btree_multimap_get_next(&value, me));
+    }
+    for (i = 0; i < 100; i++) {
+        const int key = (i * 31) % 100;
+        btree_multimap_remove_all(me, (void *) &key);
+        if (i % 10 == 0) {
+            btree_multimap_verify(me);
+        }
+    }
+    assert(btree_multimap_is_empty(me));
+    btree_multimap_verify(me);
+    for (i = 0; i < 100; i++) {
+        assert(btree_multimap_put(me, &i, &i) == BK_OK);
+    }
+    btree_multimap_verify(me);
+    btree_multimap_clear(me);
+    assert(btree_multimap_is_empty(me));
+    btree_multimap_verify(me);
+    assert(!btree_multimap_destroy(me));
+}
+
+static void test_ordered_retrieval(void)
+{
+    int i;
+    int key;
+    btree_multimap me = btree_multimap_init_ex(sizeof(int), sizeof(int),
+                                               compare_int, compare_int, 128,
+                                               NULL);
+    assert(me);
+    for (i = 0; i < 1500; i++) {
+        key = i % 500 * 2;
+        assert(btree_multimap_put(me, &key, &i) == BK_OK);
+    }
+    btree_multimap_verify(me);
+    assert(*(int *) btree_multimap_first(me) == 0);
+    assert(*(int *) btree_multimap_last(me) == 998);
+    for (key = -3; key <= 1001; key++) {
+        const int *const lower = btree_multimap_lower(me, &key);
+        const int *const higher = btree_multimap_higher(me, &key);
+        const int *const floor = btree_multimap_floor(me, &key);
+        const int *const ceiling = btree_multimap_ceiling(me, &key);
+        if (key <= 0) {
+            assert(!lower);
+        } else {
+            assert(*lower == (key > 998 ? 998 : (key - 1) - ((key - 1) & 1)));
+        }
+        if (key >= 998) {
+            assert(!higher);
+        } else {
+            assert(*higher == (key < 0 ? 0 : key + 2 - (key & 1)));
+        }
+        if (key < 0) {
+            assert(!floor);
+        } else {
+            assert(*floor == (key > 998 ? 998 : key - (key & 1)));
+        }
+        if (key > 998) {
+            assert(!ceiling);
+        } else {
+            assert(*ceiling == (key < 0 ? 0 : key + (key & 1)));
+        }
+    }
+    assert(!btree_multimap_destroy(me));
+}
+
+static void test_iteration(void)
+{
+    struct btree_multimap_iter iter;
+    void *key;
+    void *value;
+    int expected;
+    int i;
+    btree_multimap me = btree_multimap_init(sizeof(int), sizeof(int),
+                                            compare_int, compare_int);
+    assert(me);
+    btree_multimap_iter_init(&iter, me);
+    assert(!btree_multimap_iter_next(&key, &value, &iter));
+    for (i = 0; i < 1000; i++) {
+        const int k = (i * 37) % 1000 * 2;
+        const int v = 1;
+        int w = 0;
+        assert(btree_multimap_put(me, (void *) &k, (void *) &v) == BK_OK);
+        assert(btree_multimap_put(me, (void *) &k, (void *) &v) == BK_OK);
+        assert(btree_multimap_put(me, (void *) &k, &w) == BK_OK);
+    }
+    expected = 0;
+    btree_multimap_iter_init(&iter, me);
+    while (btree_multimap_iter_next(&key, &value, &iter)) {
+        assert(*(int *) key == expected / 3 * 2);
+        assert(*(int *) value == (expected % 3 == 0 ? 0 : 1));
+        expected++;
+    }
+    assert(expected == 3000);
+    i = 1001;
+    expected = 1002;
+    btree_multimap_iter_init_at(&iter, me, &i);
+    while (btree_multimap_iter_next(&key, NULL, &iter)) {
+        assert(*(int *) key == expected);
+        assert(btree_multimap_iter_next(&key, NULL, &iter));
+        assert(*(int *) key == expected);
+        assert(btree_multimap_iter_next(&key, NULL, &iter));
+        assert(*(int *) key == expected);
+        expected += 2;
+    }
+    assert(expected == 2000);
+    i = 5000;
+    btree_multimap_iter_init_at(&iter, me, &i);
+    assert(!btree_multimap_iter_next(&key, &value, &iter));
+    assert(!btree_multimap_destroy(me));
+}
+
+struct aligned_value {
+    double d;
+    long l;
+};
+
+struct aligned_value_probe {
+    char c;
+    struct aligned_value v;
+};
+
+static int compare_short_key(const void *const one, const void *const two)
+{
+    return memcmp(one, two, 3);
+}
+
+static int compare_aligned_value(const void *const one, const void *const two)
+{
+    const long a = ((const struct aligned_value *) one)->l;
+    const long b = ((const struct aligned_value *) two)->l;
+    return (a > b) - (a < b);
+}
+
+/*
+ * Uses keys whose size is odd, so that the values are only aligned if the
+ * btree_multimap pads its key-value pairs.
+ */
+static void test_aligned(void)
+{
+    struct btree_multimap_iter iter;
+    void *key;
+    void *value;
+    int i;
+    char short_key[3];
+    btree_multimap me = btree_multimap_init_ex(sizeof(short_key),
+                                               sizeof(struct aligned_value),
+                                               compare_short_key,
+                                               compare_aligned_value, 256,
+                                               NULL);
+    assert(me);
+    memset(short_key, 0, sizeof(short_key));
+    for (i = 0; i < 1000; i++) {
+        struct aligned_value put;
+        short_key[1] = (char) (i % 100 / 16);
+        short_key[2] = (char) (i % 100 % 16);
+        put.d = i;
+        put.l = i;
+        assert(btree_multimap_put(me, short_key, &put) == BK_OK);
+    }
+    btree_multimap_iter_init(&iter, me);
+    i = 0;
+    while (btree_multimap_iter_next(&key, &value, &iter)) {
+        const struct aligned_value *const found = value;
+        assert((size_t) found % offsetof(struct aligned_value_probe, v) == 0);
+        assert(found->d == found->l);
+        assert(found->l % 100 == i / 10);
+        i++;
+    }
+    assert(i == 1000);
+    assert(!btree_multimap_destroy(me));
+}
+
+#if STUB_MALLOC
+static void test_init_out_of_memory(void)
+{
+    fail_malloc = 1;
+    assert(!btree_multimap_init(sizeof(int), sizeof(int), compare_int,
+                                compare_int));
+    delay_fail_malloc = 1;
+    fail_malloc = 1;
+    assert(!btree_multimap_init(sizeof(int), sizeof(int), compare_int,
+                                compare_int));
+}
+
+static void test_put_out_of_memory(void)
+{
+    int i;
+    btree_multimap me = btree_multimap_init_ex(sizeof(int), sizeof(int),
+                                               compare_int, compare_int, 128,
+                                               NULL);
+    assert(me);
+    i = 0;
+    fail_malloc = 1;
+    assert(btree_multimap_put(me, &i, &i) == -BK_ENOMEM);
+    assert(btree_multimap_is_empty(me));
+    for (i = 0; i < 200; i++) {
+        assert(btree_multimap_put(me, &i, &i) == BK_OK);
+    }
+    /* Each put which splits a node fails, and leaves the tree unchanged. */
+    for (i = 200; i < 400; i++) {
+        fail_malloc = 1;
+        if (btree_multimap_put(me, &i, &i) == -BK_ENOMEM) {
+            assert(btree_multimap_size(me) == (size_t) i);
+            assert(!btree_multimap_contains(me, &i));
+            assert(btree_multimap_put(me, &i, &i) == BK_OK);
+        } else {
+            fail_malloc = 0;
+        }
+        btree_multimap_verify(me);
+    }
+    assert(!btree_multimap_destroy(me));
+}
+#endif
+
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    btree_multimap me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = btree_multimap_init_ex(sizeof(int), sizeof(int), compare_int,
+                                compare_int, 128, &allocator);
+    assert(me);
+    assert(live == 2);
+    for (i = 0; i < 1000; i++) {
+        const int value = i % 7;
+        assert(btree_multimap_put(me, &i, &i) == BK_OK);
+        assert(btree_multimap_put(me, &i, (void *) &value) == BK_OK);
+    }
+    assert(live > 2);
+    for (i = 0; i < 1000; i += 2) {
+        assert(btree_multimap_remove_all(me, &i));
+    }
+    btree_multimap_verify(me);
+    btree_multimap_clear(me);
+    assert(live == 2);
+    for (i = 0; i < 1000; i++) {
+        assert(btree_multimap_put(me, &i, &i) == BK_OK);
+    }
+    assert(!btree_multimap_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = btree_multimap_init_ex(sizeof(int), sizeof(int), compare_int,
+                                compare_int, 128, &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(btree_multimap_put(me, &i, &i) == BK_OK);
+    }
+    btree_multimap_verify(me);
+    assert(!btree_multimap_destroy(me));
+    assert(live == 0);
+}
+
+void test_btree_multimap(void)
+{
+    test_invalid_init();
+    test_basic();
+    test_put_remove(0);
+    test_put_remove(512);
+    test_put_remove(4096);
+    test_ordered_retrieval();
+    test_iteration();
+    test_aligned();
+    test_init_with_allocator();
+#if STUB_MALLOC
+    test_init_out_of_memory();
+    test_put_out_of_memory();
+#endif
+}
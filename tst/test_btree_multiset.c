@@ -0,0 +1,438 @@
+#include "test.h"
+#include "../src/include/btree_multiset.h"
+
+/*
+ * Include this to verify the tree.
+ */
+struct internal_btree_multiset {
+    size_t size;
+    size_t key_size;
+    size_t height;
+    size_t leaf_capacity;
+    size_t inner_capacity;
+    size_t node_size;
+    int (*comparator)(const void *const one, const void *const two);
+    char *root;
+    size_t leaf_key_offset;
+    size_t leaf_occurrences_offset;
+    size_t inner_key_offset;
+    size_t inner_child_offset;
+};
+
+/*
+ * Include this to verify the tree.
+ */
+static const size_t ptr_size = sizeof(char *);
+static const size_t leaf_prev_offset = sizeof(size_t);
+static const size_t leaf_next_offset = sizeof(size_t) + sizeof(char *);
+/* Assume the keys are ints. */
+
+static size_t btree_multiset_verify_count(const char *const node)
+{
+    size_t count;
+    memcpy(&count, node, sizeof(size_t));
+    return count;
+}
+
+static int btree_multiset_verify_key(btree_multiset me, const char *const node,
+                                     const size_t level, const size_t index)
+{
+    int key;
+    memcpy(&key, node + (level == 1 ? me->leaf_key_offset
+                                    : me->inner_key_offset)
+                 + index * me->key_size, sizeof(int));
+    return key;
+}
+
+static char *btree_multiset_verify_child(btree_multiset me,
+                                         const char *const node,
+                                         const size_t index)
+{
+    char *child;
+    memcpy(&child, node + me->inner_child_offset + index * ptr_size, ptr_size);
+    return child;
+}
+
+/*
+ * Verifies that the B+ tree rules are followed. Every node other than the root
+ * is at least half full, the keys of each node are ascending and lie between
+ * the separating keys around the node, and the leaves are linked in order.
+ * Returns the number of times the keys in the subtree occur.
+ */
+static size_t btree_multiset_verify_recursive(btree_multiset me,
+                                              char *const node,
+                                              const size_t level,
+                                              const int *const low,
+                                              const int *const high,
+                                              char **const previous_leaf)
+{
+    const size_t count = btree_multiset_verify_count(node);
+    size_t total = 0;
+    size_t i;
+    if (node != me->root) {
+        assert(count >= (level == 1 ? me->leaf_capacity / 2
+                                    : (me->inner_capacity - 1) / 2));
+    }
+    assert(count <= (level == 1 ? me->leaf_capacity : me->inner_capacity));
+    for (i = 0; i < count; i++) {
+        const int key = btree_multiset_verify_key(me, node, level, i);
+        assert(!low || key >= *low);
+        assert(!high || key < *high);
+        if (i > 0) {
+            assert(btree_multiset_verify_key(me, node, level, i - 1) < key);
+        }
+    }
+    if (level == 1) {
+        char *link;
+        assert(count > 0);
+        memcpy(&link, node + leaf_prev_offset, ptr_size);
+        assert(link == *previous_leaf);
+        if (*previous_leaf) {
+            memcpy(&link, *previous_leaf + leaf_next_offset, ptr_size);
+            assert(link == node);
+        }
+        *previous_leaf = node;
+        for (i = 0; i < count; i++) {
+            size_t occurrences;
+            memcpy(&occurrences,
+                   node + me->leaf_occurrences_offset + i * sizeof(size_t),
+                   sizeof(size_t));
+            assert(occurrences > 0);
+            total += occurrences;
+        }
+        return total;
+    }
+    for (i = 0; i <= count; i++) {
+        int child_low;
+        int child_high;
+        if (i > 0) {
+            child_low = btree_multiset_verify_key(me, node, level, i - 1);
+        }
+        if (i < count) {
+            child_high = btree_multiset_verify_key(me, node, level, i);
+        }
+        total += btree_multiset_verify_recursive(
+                me, btree_multiset_verify_child(me, node, i), level - 1,
+                i > 0 ? &child_low : low, i < count ? &child_high : high,
+                previous_leaf);
+    }
+    return total;
+}
+
+static void btree_multiset_verify(btree_multiset me)
+{
+    char *previous_leaf = NULL;
+    char *link;
+    if (!me->root) {
+        assert(me->height == 0);
+        assert(btree_multiset_size(me) == 0);
+        return;
+    }
+    assert(btree_multiset_verify_recursive(me, me->root, me->height, NULL,
+                                           NULL, &previous_leaf)
+           == btree_multiset_size(me));
+    memcpy(&link, previous_leaf + leaf_next_offset, ptr_size);
+    assert(!link);
+}
+
+static int compare_int(const void *const one, const void *const two)
+{
+    const int a = *(int *) one;
+    const int b = *(int *) two;
+    return a - b;
+}
+
+static void test_invalid_init(void)
+{
+    const size_t max_size = -1;
+    struct bk_allocator allocator = {NULL, NULL, NULL, NULL};
+    assert(!btree_multiset_init(0, compare_int));
+    assert(!btree_multiset_init(sizeof(int), NULL));
+    assert(!btree_multiset_init(max_size, compare_int));
+    assert(!btree_multiset_init_ex(sizeof(int), compare_int, 16, NULL));
+    assert(!btree_multiset_init_ex(sizeof(int), compare_int, 4096,
+                                   &allocator));
+}
+
+static void test_basic(void)
+{
+    int key;
+    btree_multiset me = btree_multiset_init(sizeof(int), compare_int);
+    assert(me);
+    assert(btree_multiset_is_empty(me));
+    key = 4;
+    assert(btree_multiset_count(me, &key) == 0);
+    assert(!btree_multiset_contains(me, &key));
+    assert(!btree_multiset_remove(me, &key));
+    assert(!btree_multiset_remove_all(me, &key));
+    assert(!btree_multiset_first(me));
+    assert(!btree_multiset_last(me));
+    assert(!btree_multiset_lower(me, &key));
+    assert(!btree_multiset_higher(me, &key));
+    assert(!btree_multiset_floor(me, &key));
+    assert(!btree_multiset_ceiling(me, &key));
+    assert(btree_multiset_put(me, &key) == BK_OK);
+    assert(btree_multiset_put(me, &key) == BK_OK);
+    assert(btree_multiset_put(me, &key) == BK_OK);
+    assert(btree_multiset_size(me) == 3);
+    assert(btree_multiset_count(me, &key) == 3);
+    assert(btree_multiset_contains(me, &key));
+    assert(*(int *) btree_multiset_first(me) == 4);
+    assert(*(int *) btree_multiset_last(me) == 4);
+    assert(btree_multiset_remove(me, &key));
+    assert(btree_multiset_size(me) == 2);
+    assert(btree_multiset_count(me, &key) == 2);
+    btree_multiset_verify(me);
+    assert(btree_multiset_remove_all(me, &key));
+    assert(!btree_multiset_remove(me, &key));
+    assert(btree_multiset_is_empty(me));
+    btree_multiset_verify(me);
+    assert(btree_multiset_put(me, &key) == BK_OK);
+    assert(btree_multiset_remove(me, &key));
+    assert(btree_multiset_is_empty(me));
+    btree_multiset_verify(me);
+    assert(!btree_multiset_destroy(me));
+}
+
+/*
+ * Puts and removes keys in a scattered order, and checks the btree_multiset
+ * against a plain array of how many times each key should occur. A node size
+ * of zero picks the smallest nodes possible, which make the tree deep.
+ */
+static void test_put_remove(size_t node_size)
+{
+    size_t counts[500];
+    size_t size = 0;
+    int i;
+    btree_multiset me = btree_multiset_init_ex(sizeof(int), compare_int,
+                                               node_size, NULL);
+    if (node_size == 0) {
+        assert(!me);
+        while (!me) {
+            node_size++;
+            me = btree_multiset_init_ex(sizeof(int), compare_int, node_size,
+                                        NULL);
+        }
+        assert(me->leaf_capacity == 3 || me->inner_capacity == 3);
+    }
+    assert(me);
+    memset(counts, 0, sizeof counts);
+    for (i = 0; i < 5000; i++) {
+        int key = (i * 7919) % 500;
+        if (i % 5 < 3) {
+            assert(btree_multiset_put(me, &key) == BK_OK);
+            counts[key]++;
+            size++;
+        } else if (i % 10 == 9) {
+            assert(btree_multiset_remove_all(me, &key) == (counts[key] > 0));
+            size -= counts[key];
+            counts[key] = 0;
+        } else {
+            assert(btree_multiset_remove(me, &key) == (counts[key] > 0));
+            if (counts[key] > 0) {
+                counts[key]--;
+                size--;
+            }
+        }
+        assert(btree_multiset_size(me) == size);
+        if (i % 250 == 0) {
+            btree_multiset_verify(me);
+        }
+    }
+    btree_multiset_verify(me);
+    for (i = 0; i < 500; i++) {
+        assert(btree_multiset_count(me, &i) == counts[i]);
+        assert(btree_multiset_contains(me, &i) == (counts[i] > 0));
+    }
+    for (i = 0; i < 500; i++) {
+        const int key = (i * 271) % 500;
+        assert(btree_multiset_remove_all(me, (void *) &key)
+               == (counts[key] > 0));
+        counts[key] = 0;
+        if (i % 50 == 0) {
+            btree_multiset_verify(me);
+        }
+    }
+    assert(btree_multiset_is_empty(me));
+    btree_multiset_verify(me);
+    for (i = 0; i < 100; i++) {
+        assert(btree_multiset_put(me, &i) == BK_OK);
+    }
+    btree_multiset_verify(me);
+    btree_multiset_clear(me);
+    assert(btree_multiset_is_empty(me));
+    btree_multiset_verify(me);
+    assert(!btree_multiset_destroy(me));
+}
+
+static void test_ordered_retrieval(void)
+{
+    int i;
+    int key;
+    btree_multiset me = btree_multiset_init_ex(sizeof(int), compare_int, 64,
+                                               NULL);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        key = i / 2 * 2;
+        assert(btree_multiset_put(me, &key) == BK_OK);
+    }
+    btree_multiset_verify(me);
+    assert(*(int *) btree_multiset_first(me) == 0);
+    assert(*(int *) btree_multiset_last(me) == 998);
+    for (key = -3; key <= 1001; key++) {
+        const int *const lower = btree_multiset_lower(me, &key);
+        const int *const higher = btree_multiset_higher(me, &key);
+        const int *const floor = btree_multiset_floor(me, &key);
+        const int *const ceiling = btree_multiset_ceiling(me, &key);
+        if (key <= 0) {
+            assert(!lower);
+        } else {
+            assert(*lower == (key > 998 ? 998 : (key - 1) - ((key - 1) & 1)));
+        }
+        if (key >= 998) {
+            assert(!higher);
+        } else {
+            assert(*higher == (key < 0 ? 0 : key + 2 - (key & 1)));
+        }
+        if (key < 0) {
+            assert(!floor);
+        } else {
+            assert(*floor == (key > 998 ? 998 : key - (key & 1)));
+        }
+        if (key > 998) {
+            assert(!ceiling);
+        } else {
+            assert(*ceiling == (key < 0 ? 0 : key + (key & 1)));
+        }
+    }
+    assert(!btree_multiset_destroy(me));
+}
+
+static void test_iteration(void)
+{
+    struct btree_multiset_iter iter;
+    void *key;
+    size_t count;
+    int expected;
+    int i;
+    btree_multiset me = btree_multiset_init(sizeof(int), compare_int);
+    assert(me);
+    btree_multiset_iter_init(&iter, me);
+    assert(!btree_multiset_iter_next(&key, &count, &iter));
+    for (i = 0; i < 1000; i++) {
+        const int k = (i * 37) % 1000 * 2;
+        int j;
+        for (j = 0; j <= k % 3; j++) {
+            assert(btree_multiset_put(me, (void *) &k) == BK_OK);
+        }
+    }
+    expected = 0;
+    btree_multiset_iter_init(&iter, me);
+    while (btree_multiset_iter_next(&key, &count, &iter)) {
+        assert(*(int *) key == expected);
+        assert(count == (size_t) (expected % 3 + 1));
+        expected += 2;
+    }
+    assert(expected == 2000);
+    i = 1001;
+    expected = 1002;
+    btree_multiset_iter_init_at(&iter, me, &i);
+    while (btree_multiset_iter_next(&key, NULL, &iter)) {
+        assert(*(int *) key == expected);
+        expected += 2;
+    }
+    assert(expected == 2000);
+    i = 5000;
+    btree_multiset_iter_init_at(&iter, me, &i);
+    assert(!btree_multiset_iter_next(&key, &count, &iter));
+    assert(!btree_multiset_destroy(me));
+}
+
+#if STUB_MALLOC
+static void test_init_out_of_memory(void)
+{
+    fail_malloc = 1;
+    assert(!btree_multiset_init(sizeof(int), compare_int));
+}
+
+static void test_put_out_of_memory(void)
+{
+    int i;
+    btree_multiset me = btree_multiset_init_ex(sizeof(int), compare_int, 64,
+                                               NULL);
+    assert(me);
+    i = 0;
+    fail_malloc = 1;
+    assert(btree_multiset_put(me, &i) == -BK_ENOMEM);
+    assert(btree_multiset_is_empty(me));
+    for (i = 0; i < 200; i++) {
+        assert(btree_multiset_put(me, &i) == BK_OK);
+    }
+    /* Each put which splits a node fails, and leaves the tree unchanged. */
+    for (i = 200; i < 400; i++) {
+        fail_malloc = 1;
+        if (btree_multiset_put(me, &i) == -BK_ENOMEM) {
+            assert(btree_multiset_size(me) == (size_t) i);
+            assert(!btree_multiset_contains(me, &i));
+            assert(btree_multiset_put(me, &i) == BK_OK);
+        } else {
+            fail_malloc = 0;
+        }
+        btree_multiset_verify(me);
+    }
+    assert(!btree_multiset_destroy(me));
+}
+#endif
+
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    btree_multiset me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = btree_multiset_init_ex(sizeof(int), compare_int, 128, &allocator);
+    assert(me);
+    assert(live == 1);
+    for (i = 0; i < 1000; i++) {
+        assert(btree_multiset_put(me, &i) == BK_OK);
+        assert(btree_multiset_put(me, &i) == BK_OK);
+    }
+    assert(live > 1);
+    for (i = 0; i < 1000; i += 2) {
+        assert(btree_multiset_remove_all(me, &i));
+    }
+    btree_multiset_verify(me);
+    btree_multiset_clear(me);
+    assert(live == 1);
+    for (i = 0; i < 1000; i++) {
+        assert(btree_multiset_put(me, &i) == BK_OK);
+    }
+    assert(!btree_multiset_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = btree_multiset_init_ex(sizeof(int), compare_int, 128, &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(btree_multiset_put(me, &i) == BK_OK);
+    }
+    btree_multiset_verify(me);
+    assert(!btree_multiset_destroy(me));
+    assert(live == 0);
+}
+
+void test_btree_multiset(void)
+{
+    test_invalid_init();
+    test_basic();
+    test_put_remove(0);
+    test_put_remove(512);
+    test_put_remove(4096);
+    test_ordered_retrieval();
+    test_iteration();
+    test_init_with_allocator();
+#if STUB_MALLOC
+    test_init_out_of_memory();
+    test_put_out_of_memory();
+#endif
+}
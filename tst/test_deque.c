@@ -466,6 +466,32 @@ struct big_object {
     signed char c[8];
 };
 
+static void test_get_at_ptr(void)
+{
+    int i;
+    int *value;
+    deque me = deque_init(sizeof(int));
+    assert(me);
+    assert(!deque_get_at_ptr(me, 0));
+    for (i = 0; i < 1000; i++) {
+        assert(deque_push_back(me, &i) == BK_OK);
+        assert(deque_push_front(me, &i) == BK_OK);
+    }
+    assert(!deque_get_at_ptr(me, 2000));
+    for (i = 0; i < 2000; i++) {
+        value = deque_get_at_ptr(me, i);
+        assert(value);
+        assert(*value == (i < 1000 ? 999 - i : i - 1000));
+        *value = i;
+    }
+    for (i = 0; i < 2000; i++) {
+        int copy = -1;
+        assert(deque_get_at(&copy, me, i) == BK_OK);
+        assert(copy == i);
+    }
+    assert(!deque_destroy(me));
+}
+
 static void test_big_object(void)
 {
     int i;
@@ -641,10 +667,72 @@ static void test_trim_both_sides(void)
     deque_destroy(me);
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    deque me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = deque_init_with_allocator(sizeof(int), &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(deque_push_front(me, &i) == BK_OK);
+        assert(deque_push_back(me, &i) == BK_OK);
+    }
+    assert(deque_get_first(&get, me) == BK_OK);
+    assert(get == 999);
+    assert(deque_trim(me) == BK_OK);
+    assert(!deque_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = deque_init_with_allocator(sizeof(int), &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(deque_push_front(me, &i) == BK_OK);
+        assert(deque_push_back(me, &i) == BK_OK);
+    }
+    assert(deque_get_first(&get, me) == BK_OK);
+    assert(get == 999);
+    assert(deque_trim(me) == BK_OK);
+    assert(!deque_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = deque_init_with_allocator(sizeof(int), &allocator);
+    assert(!me);
+}
+
+static void test_stats(void)
+{
+    struct bk_stats stats;
+    int i;
+    deque me = deque_init(sizeof(int));
+    assert(me);
+    for (i = 0; i < 10000; i++) {
+        assert(deque_push_back(me, &i) == BK_OK);
+    }
+    deque_get_stats(me, &stats);
+#ifdef BK_STATS
+    assert(stats.block_allocations > 1);
+    assert(stats.resizes > 0);
+    assert(stats.bytes_allocated > 10000 * sizeof(int));
+#else
+    assert(stats.block_allocations == 0);
+    assert(stats.resizes == 0);
+    assert(stats.bytes_allocated == 0);
+#endif
+    assert(stats.hash_calls == 0);
+    assert(!deque_destroy(me));
+}
+
 void test_deque(void)
 {
     int i;
     test_invalid_init();
+    test_init_with_allocator();
+    test_stats();
     test_basic();
     test_trim();
     test_stress();
@@ -667,6 +755,7 @@ void test_deque(void)
     assert(test_puzzle_backwards(2, 10) == 5);
     assert(test_puzzle_backwards(100, 1000) == 42);
     test_big_object();
+    test_get_at_ptr();
     for (i = 1; i < 6000; i++) {
         test_add_all(i);
     }
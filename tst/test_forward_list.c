@@ -427,9 +427,72 @@ static void test_add_all(void)
     forward_list_destroy(me);
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    forward_list me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = forward_list_init_with_allocator(sizeof(int), &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(forward_list_add_last(me, &i) == BK_OK);
+    }
+    assert(forward_list_get_at(&get, me, 500) == BK_OK);
+    assert(get == 500);
+    assert(!forward_list_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = forward_list_init_with_allocator(sizeof(int), &allocator);
+    assert(!me);
+}
+
+static void test_node_pool(void)
+{
+    long live;
+    long slabs;
+    struct bk_allocator allocator;
+    forward_list me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = forward_list_init_with_allocator(sizeof(int), &allocator);
+    assert(me);
+    assert(forward_list_use_node_pool(me) == BK_OK);
+    for (i = 0; i < 1000; i++) {
+        assert(forward_list_add_last(me, &i) == BK_OK);
+    }
+    assert(live < 100);
+    assert(forward_list_use_node_pool(me) == -BK_EINVAL);
+    for (i = 0; i < 500; i++) {
+        assert(forward_list_remove_first(me) == BK_OK);
+    }
+    assert(forward_list_size(me) == 500);
+    assert(forward_list_get_first(&get, me) == BK_OK);
+    assert(get == 500);
+    slabs = live;
+    for (i = 0; i < 500; i++) {
+        assert(forward_list_add_last(me, &i) == BK_OK);
+    }
+    assert(forward_list_size(me) == 1000);
+    assert(live == slabs);
+    forward_list_clear(me);
+    assert(live == 1);
+    for (i = 0; i < 10; i++) {
+        assert(forward_list_add_last(me, &i) == BK_OK);
+    }
+    assert(!forward_list_destroy(me));
+    assert(live == 0);
+}
+
 void test_forward_list(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
+    test_node_pool();
     test_basic();
     test_add_back();
 #if STUB_MALLOC
@@ -343,6 +343,37 @@ struct big_object {
     signed char c[8];
 };
 
+static void test_get_at_ptr(void)
+{
+    int i;
+    int *first;
+    int *data;
+    list me = list_init(sizeof(int));
+    assert(me);
+    assert(!list_get_at_ptr(me, 0));
+    for (i = 0; i < 10; i++) {
+        assert(list_add_last(me, &i) == BK_OK);
+    }
+    assert(!list_get_at_ptr(me, 10));
+    first = list_get_at_ptr(me, 0);
+    for (i = 0; i < 10; i++) {
+        data = list_get_at_ptr(me, i);
+        assert(data);
+        assert(*data == i);
+        *data = -i;
+    }
+    for (i = 0; i < 10; i++) {
+        int value = 1;
+        assert(list_get_at(&value, me, i) == BK_OK);
+        assert(value == -i);
+    }
+    i = 42;
+    assert(list_add_first(me, &i) == BK_OK);
+    assert(list_remove_last(me) == BK_OK);
+    assert(list_get_at_ptr(me, 1) == first);
+    assert(!list_destroy(me));
+}
+
 static void test_big_object(void)
 {
     int i;
@@ -415,9 +446,72 @@ static void test_add_all(void)
     list_destroy(me);
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    list me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = list_init_with_allocator(sizeof(int), &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(list_add_last(me, &i) == BK_OK);
+    }
+    assert(list_get_at(&get, me, 500) == BK_OK);
+    assert(get == 500);
+    assert(!list_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = list_init_with_allocator(sizeof(int), &allocator);
+    assert(!me);
+}
+
+static void test_node_pool(void)
+{
+    long live;
+    long slabs;
+    struct bk_allocator allocator;
+    list me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = list_init_with_allocator(sizeof(int), &allocator);
+    assert(me);
+    assert(list_use_node_pool(me) == BK_OK);
+    for (i = 0; i < 1000; i++) {
+        assert(list_add_last(me, &i) == BK_OK);
+    }
+    assert(live < 100);
+    assert(list_use_node_pool(me) == -BK_EINVAL);
+    for (i = 0; i < 500; i++) {
+        assert(list_remove_first(me) == BK_OK);
+    }
+    assert(list_size(me) == 500);
+    assert(list_get_first(&get, me) == BK_OK);
+    assert(get == 500);
+    slabs = live;
+    for (i = 0; i < 500; i++) {
+        assert(list_add_last(me, &i) == BK_OK);
+    }
+    assert(list_size(me) == 1000);
+    assert(live == slabs);
+    list_clear(me);
+    assert(live == 1);
+    for (i = 0; i < 10; i++) {
+        assert(list_add_last(me, &i) == BK_OK);
+    }
+    assert(!list_destroy(me));
+    assert(live == 0);
+}
+
 void test_list(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
+    test_node_pool();
     test_basic();
 #if STUB_MALLOC
     test_init_out_of_memory();
@@ -431,6 +525,7 @@ void test_list(void)
     assert(test_puzzle_backwards(2, 5) == 4);
     assert(test_puzzle_backwards(2, 10) == 5);
     test_big_object();
+    test_get_at_ptr();
     test_add_all();
     list_destroy(NULL);
 }
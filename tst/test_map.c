@@ -16,12 +16,14 @@ struct internal_map {
  * Include this to verify the tree.
  */
 static const size_t ptr_size = sizeof(char *);
-/* Node balance is always the first byte (at index 0). */
-static const size_t node_parent_offset = sizeof(signed char);
-static const size_t node_left_child_offset = 1 + sizeof(char *);
-static const size_t node_right_child_offset = 1 + 2 * sizeof(char *);
-static const size_t node_key_offset = 1 + 3 * sizeof(char *);
+static const size_t node_parent_offset = 0;
+static const size_t node_left_child_offset = sizeof(char *);
+static const size_t node_right_child_offset = 2 * sizeof(char *);
+static const size_t node_key_offset = 3 * sizeof(char *);
 /* Assume the value starts right after the key ends. */
+/* Node balance is the last byte, which assumes the keys and values are ints. */
+static const size_t node_balance_offset =
+        3 * sizeof(char *) + 2 * sizeof(int);
 
 /*
  * Verifies that the AVL tree rules are followed. The balance factor of an item
@@ -43,7 +45,7 @@ static int map_verify_recursive(char *const item)
     left = map_verify_recursive(item_left);
     right = map_verify_recursive(item_right);
     max = left > right ? left : right;
-    assert(right - left == item[0]);
+    assert(right - left == item[node_balance_offset]);
     if (item_left && item_right) {
         const int left_val = *(int *) (item_left + node_key_offset);
         const int right_val = *(int *) (item_right + node_key_offset);
@@ -541,6 +543,25 @@ static void test_put_on_right_out_of_memory(map me)
 #endif
 
 #if STUB_MALLOC
+static void test_emplace_out_of_memory(void)
+{
+    int key = 2;
+    bk_bool inserted = BK_TRUE;
+    map me = map_init(sizeof(int), sizeof(int), compare_int);
+    assert(me);
+    fail_malloc = 1;
+    assert(!map_emplace(me, &key, &inserted));
+    assert(!inserted);
+    assert(map_emplace(me, &key, &inserted));
+    assert(inserted);
+    key = 3;
+    fail_malloc = 1;
+    assert(!map_emplace(me, &key, &inserted));
+    assert(!inserted);
+    assert(map_size(me) == 1);
+    assert(!map_destroy(me));
+}
+
 static void test_put_out_of_memory(void)
 {
     int key = 2;
@@ -554,6 +575,46 @@ static void test_put_out_of_memory(void)
 }
 #endif
 
+#if STUB_MALLOC
+static void test_node_pool_out_of_memory(void)
+{
+    int i;
+    map me = map_init(sizeof(int), sizeof(int), compare_int);
+    assert(me);
+    assert(map_use_node_pool(me) == BK_OK);
+    fail_malloc = 1;
+    i = 0;
+    assert(map_put(me, &i, &i) == -BK_ENOMEM);
+    assert(map_is_empty(me));
+    for (i = 0; i < 64; i++) {
+        assert(map_put(me, &i, &i) == BK_OK);
+    }
+    fail_malloc = 1;
+    assert(map_put(me, &i, &i) == -BK_ENOMEM);
+    assert(map_size(me) == 64);
+    assert(!map_destroy(me));
+}
+
+static void test_init_from_sorted_out_of_memory(void)
+{
+    int keys[10];
+    int values[10];
+    int i;
+    for (i = 0; i < 10; i++) {
+        keys[i] = i;
+        values[i] = i;
+    }
+    for (i = 0; i <= 10; i++) {
+        fail_malloc = 1;
+        delay_fail_malloc = i;
+        assert(!map_init_from_sorted(sizeof(int), sizeof(int), compare_int,
+                                     keys, values, 10));
+    }
+    fail_malloc = 0;
+    delay_fail_malloc = 0;
+}
+#endif
+
 struct big_object {
     int n;
     double d;
@@ -567,6 +628,262 @@ static int compare_big_object(const void *const one, const void *const two)
     return a->n - b->n;
 }
 
+static void test_get_ptr(void)
+{
+    int i;
+    int *value;
+    int *kept;
+    map me = map_init(sizeof(int), sizeof(int), compare_int);
+    assert(me);
+    i = 5;
+    assert(!map_get_ptr(me, &i));
+    for (i = 0; i < 100; i++) {
+        assert(map_put(me, &i, &i) == BK_OK);
+    }
+    i = 100;
+    assert(!map_get_ptr(me, &i));
+    for (i = 0; i < 100; i++) {
+        value = map_get_ptr(me, &i);
+        assert(value);
+        assert(*value == i);
+        *value = 2 * i;
+    }
+    i = 50;
+    kept = map_get_ptr(me, &i);
+    for (i = 0; i < 100; i++) {
+        int copy = 0;
+        assert(map_get(&copy, me, &i));
+        assert(copy == 2 * i);
+        if (i != 50) {
+            assert(map_remove(me, &i));
+        }
+    }
+    assert(map_size(me) == 1);
+    i = 50;
+    assert(map_get_ptr(me, &i) == kept);
+    assert(*kept == 100);
+    assert(!map_destroy(me));
+}
+
+static void test_emplace(void)
+{
+    int i;
+    int *count;
+    bk_bool inserted;
+    map me = map_init(sizeof(int), sizeof(int), compare_int);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        int key = (i * 37) % 100;
+        count = map_emplace(me, &key, &inserted);
+        assert(count);
+        assert(inserted == (i < 100));
+        assert(*count == i / 100);
+        (*count)++;
+    }
+    assert(map_size(me) == 100);
+    for (i = 0; i < 100; i++) {
+        int value = 0;
+        assert(map_get(&value, me, &i));
+        assert(value == 10);
+    }
+    i = 7;
+    count = map_emplace(me, &i, NULL);
+    assert(count == map_get_ptr(me, &i));
+    assert(map_size(me) == 100);
+    assert(!map_destroy(me));
+}
+
+struct aligned_value {
+    double d;
+    long l;
+};
+
+struct aligned_value_probe {
+    char c;
+    struct aligned_value v;
+};
+
+static int compare_short_key(const void *const one, const void *const two)
+{
+    return memcmp(one, two, 3);
+}
+
+/*
+ * Uses keys whose size is odd, so that the values are only aligned if the
+ * map pads its nodes.
+ */
+static void test_emplace_aligned(void)
+{
+    int i;
+    char key[3];
+    struct aligned_value *value;
+    map me = map_init(sizeof(key), sizeof(struct aligned_value),
+                    compare_short_key);
+    assert(me);
+    memset(key, 0, sizeof(key));
+    for (i = 0; i < 1000; i++) {
+        key[1] = (char) (i / 256);
+        key[2] = (char) (i % 256);
+        value = map_emplace(me, key, NULL);
+        assert(value);
+        assert((size_t) value % offsetof(struct aligned_value_probe, v) == 0);
+        value->d = i;
+        value->l = i;
+    }
+    for (i = 0; i < 1000; i++) {
+        key[1] = (char) (i / 256);
+        key[2] = (char) (i % 256);
+        value = map_get_ptr(me, key);
+        assert(value);
+        assert((size_t) value % offsetof(struct aligned_value_probe, v) == 0);
+        assert(value->d == i);
+        assert(value->l == i);
+    }
+    assert(!map_destroy(me));
+}
+
+/*
+ * Checks the order statistics of the map against a map which walks its keys.
+ */
+static void check_order_statistics(map me, map plain)
+{
+    size_t i;
+    int key;
+    assert(map_size(me) == map_size(plain));
+    for (i = 0; i < map_size(me); i++) {
+        assert(*(int *) map_select(me, i) == *(int *) map_select(plain, i));
+    }
+    assert(!map_select(me, map_size(me)));
+    for (key = -1; key <= 2000; key += 7) {
+        assert(map_rank(me, &key) == map_rank(plain, &key));
+    }
+}
+
+static void test_order_statistics(void)
+{
+    int i;
+    int key;
+    map me = map_init(sizeof(int), sizeof(int), compare_int);
+    map plain = map_init(sizeof(int), sizeof(int), compare_int);
+    assert(me);
+    assert(plain);
+    assert(!map_select(me, 0));
+    key = 5;
+    assert(map_rank(me, &key) == 0);
+    assert(map_use_node_pool(me) == BK_OK);
+    assert(map_put(me, &key, &i) == BK_OK);
+    assert(map_use_order_statistics(me) == -BK_EINVAL);
+    assert(map_remove(me, &key));
+    assert(map_use_order_statistics(me) == BK_OK);
+    assert(map_use_order_statistics(me) == BK_OK);
+    for (i = 0; i < 1000; i++) {
+        key = (i * 37) % 1000 * 2;
+        assert(map_put(me, &key, &i) == BK_OK);
+        assert(map_put(plain, &key, &i) == BK_OK);
+    }
+    check_order_statistics(me, plain);
+    assert(*(int *) map_select(me, 0) == 0);
+    assert(*(int *) map_select(me, 990) == 1980);
+    key = 1001;
+    assert(map_rank(me, &key) == 501);
+    key = 1002;
+    assert(map_rank(me, &key) == 501);
+    for (i = 0; i < 1000; i++) {
+        key = (i * 59) % 1000 * 2;
+        if (key % 3 != 0) {
+            assert(map_remove(me, &key));
+            assert(map_remove(plain, &key));
+        }
+        if (i % 100 == 0) {
+            check_order_statistics(me, plain);
+        }
+    }
+    check_order_statistics(me, plain);
+    for (i = 0; i < 1000; i++) {
+        key = (i * 71) % 1000 * 2 + 1;
+        assert(map_put(me, &key, &i) == BK_OK);
+        assert(map_put(plain, &key, &i) == BK_OK);
+    }
+    check_order_statistics(me, plain);
+    assert(!map_destroy(me));
+    assert(!map_destroy(plain));
+}
+
+static void sum_range(const void *const key, void *const value,
+                      void *const context)
+{
+    int *const sum = context;
+    assert(*(const int *) key == *(int *) value);
+    *sum += *(const int *) key;
+}
+
+static void test_iteration(void)
+{
+    struct map_iter iter;
+    void *key;
+    void *value;
+    int expected;
+    int sum = 0;
+    int low;
+    int high;
+    int i;
+    map me = map_init(sizeof(int), sizeof(int), compare_int);
+    assert(me);
+    map_iter_init(&iter, me);
+    assert(!map_iter_next(&key, &value, &iter));
+    for (i = 0; i < 1000; i++) {
+        const int k = (i * 37) % 1000 * 2;
+        assert(map_put(me, (void *) &k, (void *) &k) == BK_OK);
+    }
+    expected = 0;
+    map_iter_init(&iter, me);
+    while (map_iter_next(&key, &value, &iter)) {
+        assert(*(int *) key == expected);
+        assert(*(int *) value == expected);
+        expected += 2;
+    }
+    assert(expected == 2000);
+    expected = 1998;
+    map_iter_init_last(&iter, me);
+    while (map_iter_prev(&key, NULL, &iter)) {
+        assert(*(int *) key == expected);
+        expected -= 2;
+    }
+    assert(expected == -2);
+    low = 101;
+    map_iter_init_at(&iter, me, &low);
+    assert(map_iter_next(&key, &value, &iter));
+    assert(*(int *) key == 102);
+    assert(map_iter_prev(&key, &value, &iter));
+    assert(*(int *) key == 104);
+    assert(map_iter_prev(&key, &value, &iter));
+    assert(*(int *) key == 102);
+    low = 5000;
+    map_iter_init_at(&iter, me, &low);
+    assert(!map_iter_next(&key, &value, &iter));
+    low = 101;
+    high = 200;
+    map_range(me, &low, &high, sum_range, &sum);
+    assert(sum == (102 + 200) * 50 / 2);
+    sum = 0;
+    map_range(me, &high, &low, sum_range, &sum);
+    assert(sum == 0);
+    map_iter_init(&iter, me);
+    while (map_iter_next(&key, &value, &iter)) {
+        if (*(int *) key % 4 == 0) {
+            assert(map_remove(me, key));
+        }
+    }
+    assert(map_size(me) == 500);
+    expected = 2;
+    map_iter_init(&iter, me);
+    while (map_iter_next(&key, &value, &iter)) {
+        assert(*(int *) key == expected);
+        expected += 4;
+    }
+    assert(!map_destroy(me));
+}
+
 static void test_big_object(void)
 {
     int i;
@@ -694,9 +1011,225 @@ static void test_ordered_retrieval(void)
     map_destroy(me);
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    map me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = map_init_with_allocator(sizeof(int), sizeof(int), compare_int,
+                                 &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(map_put(me, &i, &i) == BK_OK);
+    }
+    i = 500;
+    assert(map_get(&get, me, &i));
+    assert(get == 500);
+    assert(map_remove(me, &i));
+    assert(!map_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = map_init_with_allocator(sizeof(int), sizeof(int), compare_int,
+                                 &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(map_put(me, &i, &i) == BK_OK);
+    }
+    i = 500;
+    assert(map_get(&get, me, &i));
+    assert(get == 500);
+    assert(!map_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = map_init_with_allocator(sizeof(int), sizeof(int), compare_int,
+                                 &allocator);
+    assert(!me);
+}
+
+static void test_node_pool(void)
+{
+    long live;
+    long slabs;
+    struct bk_allocator allocator;
+    map me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = map_init_with_allocator(sizeof(int), sizeof(int), compare_int,
+                                 &allocator);
+    assert(me);
+    assert(map_use_node_pool(me) == BK_OK);
+    for (i = 0; i < 1000; i++) {
+        assert(map_put(me, &i, &i) == BK_OK);
+    }
+    assert(live < 100);
+    assert(map_use_node_pool(me) == -BK_EINVAL);
+    for (i = 0; i < 1000; i += 2) {
+        assert(map_remove(me, &i));
+    }
+    assert(map_size(me) == 500);
+    slabs = live;
+    for (i = 0; i < 1000; i += 2) {
+        assert(map_put(me, &i, &i) == BK_OK);
+    }
+    assert(map_size(me) == 1000);
+    assert(live == slabs);
+    i = 500;
+    assert(map_get(&get, me, &i));
+    assert(get == 500);
+    map_clear(me);
+    assert(live == 1);
+    for (i = 0; i < 10; i++) {
+        assert(map_put(me, &i, &i) == BK_OK);
+    }
+    assert(!map_destroy(me));
+    assert(live == 0);
+}
+
+static void test_clear_frees_nodes(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    map me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = map_init_with_allocator(sizeof(int), sizeof(int), compare_int,
+                                 &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(map_put(me, &i, &i) == BK_OK);
+    }
+    map_clear(me);
+    assert(map_is_empty(me));
+    assert(live == 1);
+    i = 500;
+    assert(!map_contains(me, &i));
+    assert(map_put(me, &i, &i) == BK_OK);
+    assert(map_size(me) == 1);
+    assert(!map_destroy(me));
+    assert(live == 0);
+}
+
+static void test_init_pod(void)
+{
+    int key;
+    long big;
+    char bytes[3];
+    int i;
+    map me = map_init_pod(sizeof(int), sizeof(int));
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        key = (i * 37) % 1000 - 500;
+        assert(map_put(me, &key, &key) == BK_OK);
+    }
+    assert(map_size(me) == 1000);
+    map_verify(me);
+    assert(*(int *) map_first(me) == -500);
+    assert(*(int *) map_last(me) == 499);
+    key = -1;
+    assert(*(int *) map_higher(me, &key) == 0);
+    assert(*(int *) map_lower(me, &key) == -2);
+    assert(map_remove(me, &key));
+    assert(!map_contains(me, &key));
+    assert(!map_destroy(me));
+    me = map_init_pod(sizeof(long), sizeof(int));
+    assert(me);
+    for (i = 0; i < 100; i++) {
+        big = (long) (i % 2 ? i : -i) * 100000;
+        assert(map_put(me, &big, &key) == BK_OK);
+    }
+    assert(*(long *) map_first(me) == -9800000);
+    assert(*(long *) map_last(me) == 9900000);
+    assert(!map_destroy(me));
+    me = map_init_pod(3, sizeof(int));
+    assert(me);
+    for (i = 0; i < 256; i++) {
+        bytes[0] = (char) (255 - i);
+        bytes[1] = (char) i;
+        bytes[2] = 0;
+        assert(map_put(me, bytes, &key) == BK_OK);
+    }
+    assert(((unsigned char *) map_first(me))[0] == 0);
+    assert(((unsigned char *) map_last(me))[0] == 255);
+    assert(!map_destroy(me));
+    assert(!map_init_pod(0, sizeof(int)));
+}
+
+static void test_init_from_sorted(void)
+{
+    int keys[1000];
+    int values[1000];
+    int i;
+    map me;
+    for (i = 0; i < 1000; i++) {
+        keys[i] = 2 * i;
+        values[i] = -i;
+    }
+    for (i = 0; i <= 1000; i += 111) {
+        int j;
+        me = map_init_from_sorted(sizeof(int), sizeof(int), compare_int, keys,
+                                  values, (size_t) i);
+        assert(me);
+        assert(map_size(me) == (size_t) i);
+        map_verify(me);
+        for (j = 0; j < i; j++) {
+            int value = 0;
+            assert(map_get(&value, me, &keys[j]));
+            assert(value == -j);
+        }
+        j = 1;
+        assert(!map_contains(me, &j));
+        assert(map_put(me, &j, &j) == BK_OK);
+        map_verify(me);
+        assert(!map_destroy(me));
+    }
+    keys[500] = keys[499];
+    assert(!map_init_from_sorted(sizeof(int), sizeof(int), compare_int, keys,
+                                 values, 1000));
+    keys[500] = keys[498];
+    assert(!map_init_from_sorted(sizeof(int), sizeof(int), compare_int, keys,
+                                 values, 1000));
+    assert(!map_init_from_sorted(0, sizeof(int), compare_int, keys, values,
+                                 1000));
+}
+
+static void test_stats(void)
+{
+    struct bk_stats stats;
+    int i;
+    map me = map_init(sizeof(int), sizeof(int), compare_int);
+    assert(me);
+    for (i = 0; i < 100; i++) {
+        assert(map_put(me, &i, &i) == BK_OK);
+    }
+    map_get_stats(me, &stats);
+#ifdef BK_STATS
+    assert(stats.comparator_calls > 0);
+    assert(stats.rotations > 0);
+    assert(stats.bytes_allocated > 100 * sizeof(int));
+#else
+    assert(stats.comparator_calls == 0);
+    assert(stats.rotations == 0);
+    assert(stats.bytes_allocated == 0);
+#endif
+    assert(stats.hash_calls == 0);
+    assert(stats.rehashes == 0);
+    assert(!map_destroy(me));
+}
+
 void test_map(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
+    test_stats();
+    test_node_pool();
+    test_clear_frees_nodes();
+    test_init_from_sorted();
+    test_init_pod();
     test_auto_balancing();
     test_put_already_existing();
     test_remove_nothing();
@@ -708,8 +1241,16 @@ void test_map(void)
 #if STUB_MALLOC
     test_init_out_of_memory();
     test_put_out_of_memory();
+    test_emplace_out_of_memory();
+    test_node_pool_out_of_memory();
+    test_init_from_sorted_out_of_memory();
 #endif
     test_big_object();
+    test_get_ptr();
+    test_emplace();
+    test_emplace_aligned();
+    test_iteration();
+    test_order_statistics();
     test_ordered_retrieval();
     map_destroy(NULL);
 }
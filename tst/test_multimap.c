@@ -19,15 +19,15 @@ struct internal_multimap {
  */
 static const size_t ptr_size = sizeof(char *);
 /* static const size_t count_size = sizeof(size_t); */
-/* Node balance is always the first byte (at index 0). */
-/* static const size_t node_value_count_offset = sizeof(signed char); */
-/* static const size_t node_value_head_offset = 1 + sizeof(size_t); */
-static const size_t node_parent_offset = 1 + sizeof(size_t) + sizeof(char *);
-static const size_t node_left_child_offset =
-        1 + sizeof(size_t) + 2 * sizeof(char *);
-static const size_t node_right_child_offset =
-        1 + sizeof(size_t) + 3 * sizeof(char *);
-static const size_t node_key_offset = 1 + sizeof(size_t) + 4 * sizeof(char *);
+static const size_t node_parent_offset = 0;
+static const size_t node_left_child_offset = sizeof(char *);
+static const size_t node_right_child_offset = 2 * sizeof(char *);
+/* static const size_t node_value_head_offset = 3 * sizeof(char *); */
+/* static const size_t node_value_count_offset = 4 * sizeof(char *); */
+static const size_t node_key_offset = 4 * sizeof(char *) + sizeof(size_t);
+/* Node balance is the last byte, which assumes the keys are integers. */
+static const size_t node_balance_offset =
+        4 * sizeof(char *) + sizeof(size_t) + sizeof(int);
 
 /*
  * Verifies that the AVL tree rules are followed. The balance factor of an item
@@ -49,7 +49,7 @@ static int multimap_verify_recursive(char *const item)
     left = multimap_verify_recursive(item_left);
     right = multimap_verify_recursive(item_right);
     max = left > right ? left : right;
-    assert(right - left == item[0]);
+    assert(right - left == item[node_balance_offset]);
     if (item_left && item_right) {
         const int left_val = *(int *) (item_left + node_key_offset);
         const int right_val = *(int *) (item_right + node_key_offset);
@@ -618,6 +618,26 @@ static void test_put_out_of_memory(void)
     test_put_on_right_out_of_memory(me);
     assert(!multimap_destroy(me));
 }
+
+static void test_init_from_sorted_out_of_memory(void)
+{
+    int keys[10];
+    int values[10];
+    int i;
+    for (i = 0; i < 10; i++) {
+        keys[i] = i / 2;
+        values[i] = i;
+    }
+    for (i = 0; i <= 15; i++) {
+        fail_malloc = 1;
+        delay_fail_malloc = i;
+        assert(!multimap_init_from_sorted(sizeof(int), sizeof(int),
+                                          compare_int, compare_int, keys,
+                                          values, 10));
+    }
+    fail_malloc = 0;
+    delay_fail_malloc = 0;
+}
 #endif
 
 struct big_object {
@@ -641,6 +661,62 @@ static int compare_placeholder(const void *const one, const void *const two)
     return 5;
 }
 
+static void sum_range(const void *const key, void *const value,
+                      void *const context)
+{
+    int *const sum = context;
+    assert(*(int *) value / 100 == *(const int *) key);
+    *sum += *(int *) value % 100;
+}
+
+static void test_iteration(void)
+{
+    struct multimap_iter iter;
+    void *key;
+    void *value;
+    int expected;
+    int sum = 0;
+    int low;
+    int high;
+    int i;
+    multimap me = multimap_init(sizeof(int), sizeof(int), compare_int,
+                                compare_int);
+    assert(me);
+    multimap_iter_init(&iter, me);
+    assert(!multimap_iter_next(&key, &value, &iter));
+    for (i = 0; i < 300; i++) {
+        const int k = (i * 37) % 100;
+        const int v = k * 100 + i / 100;
+        assert(multimap_put(me, (void *) &k, (void *) &v) == BK_OK);
+    }
+    expected = 0;
+    multimap_iter_init(&iter, me);
+    while (multimap_iter_next(&key, &value, &iter)) {
+        assert(*(int *) key == expected / 3);
+        assert(*(int *) value == expected / 3 * 100 + expected % 3);
+        expected++;
+    }
+    assert(expected == 300);
+    expected = 0;
+    multimap_iter_init_last(&iter, me);
+    while (multimap_iter_prev(&key, &value, &iter)) {
+        assert(*(int *) key == 99 - expected / 3);
+        assert(*(int *) value % 100 == expected % 3);
+        expected++;
+    }
+    assert(expected == 300);
+    low = 50;
+    multimap_iter_init_at(&iter, me, &low);
+    assert(multimap_iter_next(&key, &value, &iter));
+    assert(*(int *) key == 50);
+    assert(*(int *) value == 5000);
+    low = 10;
+    high = 19;
+    multimap_range(me, &low, &high, sum_range, &sum);
+    assert(sum == 10 * (0 + 1 + 2));
+    assert(!multimap_destroy(me));
+}
+
 static void test_big_object(void)
 {
     int i;
@@ -771,9 +847,164 @@ static void test_ordered_retrieval(void)
     multimap_destroy(me);
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    multimap me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = multimap_init_with_allocator(sizeof(int), sizeof(int), compare_int,
+                                      compare_int, &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(multimap_put(me, &i, &i) == BK_OK);
+        assert(multimap_put(me, &i, &i) == BK_OK);
+    }
+    i = 500;
+    assert(multimap_count(me, &i) == 2);
+    assert(multimap_remove(me, &i, &i));
+    assert(!multimap_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = multimap_init_with_allocator(sizeof(int), sizeof(int), compare_int,
+                                      compare_int, &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(multimap_put(me, &i, &i) == BK_OK);
+        assert(multimap_put(me, &i, &i) == BK_OK);
+    }
+    i = 500;
+    assert(multimap_count(me, &i) == 2);
+    assert(!multimap_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = multimap_init_with_allocator(sizeof(int), sizeof(int), compare_int,
+                                      compare_int, &allocator);
+    assert(!me);
+}
+
+static void test_node_pool(void)
+{
+    long live;
+    long slabs;
+    struct bk_allocator allocator;
+    multimap me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = multimap_init_with_allocator(sizeof(int), sizeof(int), compare_int,
+                                      compare_int, &allocator);
+    assert(me);
+    assert(multimap_use_node_pool(me) == BK_OK);
+    for (i = 0; i < 1000; i++) {
+        assert(multimap_put(me, &i, &i) == BK_OK);
+    }
+    assert(live < 100);
+    assert(multimap_use_node_pool(me) == -BK_EINVAL);
+    for (i = 0; i < 1000; i += 2) {
+        assert(multimap_remove(me, &i, &i));
+    }
+    assert(multimap_size(me) == 500);
+    slabs = live;
+    for (i = 0; i < 1000; i += 2) {
+        assert(multimap_put(me, &i, &i) == BK_OK);
+    }
+    assert(multimap_size(me) == 1000);
+    assert(live == slabs);
+    i = 500;
+    assert(multimap_count(me, &i) == 1);
+    multimap_clear(me);
+    assert(live == 1);
+    for (i = 0; i < 10; i++) {
+        assert(multimap_put(me, &i, &i) == BK_OK);
+    }
+    assert(!multimap_destroy(me));
+    assert(live == 0);
+}
+
+static void test_clear_frees_nodes(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    multimap me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = multimap_init_with_allocator(sizeof(int), sizeof(int), compare_int,
+                                      compare_int, &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(multimap_put(me, &i, &i) == BK_OK);
+        assert(multimap_put(me, &i, &i) == BK_OK);
+    }
+    multimap_clear(me);
+    assert(multimap_is_empty(me));
+    assert(live == 1);
+    i = 500;
+    assert(!multimap_contains(me, &i));
+    assert(multimap_put(me, &i, &i) == BK_OK);
+    assert(multimap_size(me) == 1);
+    assert(!multimap_destroy(me));
+    assert(live == 0);
+}
+
+static void test_init_from_sorted(void)
+{
+    int keys[1000];
+    int values[1000];
+    int i;
+    multimap me;
+    for (i = 0; i < 1000; i++) {
+        keys[i] = i / 3;
+        values[i] = 1000 - i;
+    }
+    me = multimap_init_from_sorted(sizeof(int), sizeof(int), compare_int,
+                                   compare_int, keys, values, 1000);
+    assert(me);
+    assert(multimap_size(me) == 1000);
+    multimap_verify_recursive(me->root);
+    for (i = 0; i < 333; i++) {
+        int value;
+        assert(multimap_count(me, &i) == 3);
+        multimap_get_start(me, &i);
+        assert(multimap_get_next(&value, me));
+        assert(value == 1000 - 3 * i);
+        assert(multimap_get_next(&value, me));
+        assert(value == 1000 - 3 * i - 1);
+        assert(multimap_get_next(&value, me));
+        assert(value == 1000 - 3 * i - 2);
+        assert(!multimap_get_next(&value, me));
+    }
+    assert(multimap_count(me, &i) == 1);
+    assert(multimap_put(me, &i, &i) == BK_OK);
+    assert(multimap_count(me, &i) == 2);
+    i++;
+    assert(multimap_put(me, &i, &i) == BK_OK);
+    multimap_verify_recursive(me->root);
+    assert(!multimap_destroy(me));
+    for (i = 0; i < 1000; i++) {
+        keys[i] = i;
+    }
+    for (i = 0; i <= 1000; i += 111) {
+        me = multimap_init_from_sorted(sizeof(int), sizeof(int), compare_int,
+                                       compare_int, keys, values, (size_t) i);
+        assert(me);
+        assert(multimap_size(me) == (size_t) i);
+        multimap_verify(me);
+        assert(!multimap_destroy(me));
+    }
+    keys[500] = keys[498];
+    assert(!multimap_init_from_sorted(sizeof(int), sizeof(int), compare_int,
+                                      compare_int, keys, values, 1000));
+}
+
 void test_multimap(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
+    test_node_pool();
+    test_clear_frees_nodes();
+    test_init_from_sorted();
     test_auto_balancing();
     test_put_already_existing();
     test_remove_nothing();
@@ -786,8 +1017,10 @@ void test_multimap(void)
 #if STUB_MALLOC
     test_init_out_of_memory();
     test_put_out_of_memory();
+    test_init_from_sorted_out_of_memory();
 #endif
     test_big_object();
+    test_iteration();
     test_ordered_retrieval();
     multimap_destroy(NULL);
 }
@@ -16,14 +16,14 @@ struct internal_multiset {
  */
 static const size_t ptr_size = sizeof(char *);
 /* static const size_t count_size = sizeof(size_t); */
-/* Node balance is always the first byte (at index 0). */
-/* static const size_t node_count_offset = sizeof(signed char); */
-static const size_t node_parent_offset = 1 + sizeof(size_t);
-static const size_t node_left_child_offset =
-        1 + sizeof(size_t) + sizeof(char *);
-static const size_t node_right_child_offset =
-        1 + sizeof(size_t) + 2 * sizeof(char *);
-static const size_t node_key_offset = 1 + sizeof(size_t) + 3 * sizeof(char *);
+static const size_t node_parent_offset = 0;
+static const size_t node_left_child_offset = sizeof(char *);
+static const size_t node_right_child_offset = 2 * sizeof(char *);
+/* static const size_t node_count_offset = 3 * sizeof(char *); */
+static const size_t node_key_offset = 3 * sizeof(char *) + sizeof(size_t);
+/* Node balance is the last byte, which assumes the keys are integers. */
+static const size_t node_balance_offset =
+        3 * sizeof(char *) + sizeof(size_t) + sizeof(int);
 
 /*
  * Verifies that the AVL tree rules are followed. The balance factor of an item
@@ -45,7 +45,7 @@ static int multiset_verify_recursive(char *const item)
     left = multiset_verify_recursive(item_left);
     right = multiset_verify_recursive(item_right);
     max = left > right ? left : right;
-    assert(right - left == item[0]);
+    assert(right - left == item[node_balance_offset]);
     if (item_left && item_right) {
         const int left_val = *(int *) (item_left + node_key_offset);
         const int right_val = *(int *) (item_right + node_key_offset);
@@ -567,6 +567,125 @@ static int compare_big_object(const void *const one, const void *const two)
     return a->n - b->n;
 }
 
+/*
+ * Checks the order statistics of the multi-set against a multi-set which walks
+ * its keys.
+ */
+static void check_order_statistics(multiset me, multiset plain)
+{
+    size_t i;
+    int key;
+    assert(multiset_size(me) == multiset_size(plain));
+    for (i = 0; i < multiset_size(me); i++) {
+        assert(*(int *) multiset_select(me, i)
+               == *(int *) multiset_select(plain, i));
+    }
+    assert(!multiset_select(me, multiset_size(me)));
+    for (key = -1; key <= 200; key += 3) {
+        assert(multiset_rank(me, &key) == multiset_rank(plain, &key));
+    }
+}
+
+static void test_order_statistics(void)
+{
+    int i;
+    int key;
+    multiset me = multiset_init(sizeof(int), compare_int);
+    multiset plain = multiset_init(sizeof(int), compare_int);
+    assert(me);
+    assert(plain);
+    assert(!multiset_select(me, 0));
+    key = 5;
+    assert(multiset_rank(me, &key) == 0);
+    assert(multiset_use_node_pool(me) == BK_OK);
+    assert(multiset_put(me, &key) == BK_OK);
+    assert(multiset_use_order_statistics(me) == -BK_EINVAL);
+    assert(multiset_remove(me, &key));
+    assert(multiset_use_order_statistics(me) == BK_OK);
+    for (i = 0; i < 1000; i++) {
+        key = (i * 37) % 100 * 2;
+        assert(multiset_put(me, &key) == BK_OK);
+        assert(multiset_put(plain, &key) == BK_OK);
+    }
+    check_order_statistics(me, plain);
+    assert(*(int *) multiset_select(me, 0) == 0);
+    assert(*(int *) multiset_select(me, 9) == 0);
+    assert(*(int *) multiset_select(me, 10) == 2);
+    key = 11;
+    assert(multiset_rank(me, &key) == 60);
+    key = 12;
+    assert(multiset_rank(me, &key) == 60);
+    for (i = 0; i < 1000; i++) {
+        key = (i * 59) % 100 * 2;
+        if (i % 3 == 0) {
+            assert(multiset_remove_all(me, &key)
+                   == multiset_remove_all(plain, &key));
+        } else {
+            assert(multiset_remove(me, &key) == multiset_remove(plain, &key));
+        }
+        if (i % 100 == 0) {
+            check_order_statistics(me, plain);
+        }
+        key = (i * 71) % 100 * 2 + 1;
+        assert(multiset_put(me, &key) == BK_OK);
+        assert(multiset_put(plain, &key) == BK_OK);
+    }
+    check_order_statistics(me, plain);
+    assert(!multiset_destroy(me));
+    assert(!multiset_destroy(plain));
+}
+
+static void sum_range(const void *const key, const size_t count,
+                      void *const context)
+{
+    int *const sum = context;
+    *sum += *(const int *) key * (int) count;
+}
+
+static void test_iteration(void)
+{
+    struct multiset_iter iter;
+    void *key;
+    size_t count;
+    int expected;
+    int sum = 0;
+    int low;
+    int high;
+    int i;
+    multiset me = multiset_init(sizeof(int), compare_int);
+    assert(me);
+    multiset_iter_init(&iter, me);
+    assert(!multiset_iter_next(&key, &count, &iter));
+    for (i = 0; i < 300; i++) {
+        const int k = (i * 37) % 100;
+        assert(multiset_put(me, (void *) &k) == BK_OK);
+    }
+    expected = 0;
+    multiset_iter_init(&iter, me);
+    while (multiset_iter_next(&key, &count, &iter)) {
+        assert(*(int *) key == expected);
+        assert(count == 3);
+        expected++;
+    }
+    assert(expected == 100);
+    expected = 99;
+    multiset_iter_init_last(&iter, me);
+    while (multiset_iter_prev(&key, NULL, &iter)) {
+        assert(*(int *) key == expected);
+        expected--;
+    }
+    assert(expected == -1);
+    low = 50;
+    multiset_iter_init_at(&iter, me, &low);
+    assert(multiset_iter_next(&key, &count, &iter));
+    assert(*(int *) key == 50);
+    low = 10;
+    high = 19;
+    multiset_range(me, &low, &high, sum_range, &sum);
+    assert(sum == 3 * (10 + 19) * 10 / 2);
+    assert(!multiset_destroy(me));
+}
+
 static void test_big_object(void)
 {
     int i;
@@ -698,9 +817,146 @@ static void test_ordered_retrieval(void)
     multiset_destroy(me);
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    multiset me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = multiset_init_with_allocator(sizeof(int), compare_int, &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(multiset_put(me, &i) == BK_OK);
+        assert(multiset_put(me, &i) == BK_OK);
+    }
+    i = 500;
+    assert(multiset_count(me, &i) == 2);
+    assert(multiset_remove_all(me, &i));
+    assert(!multiset_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = multiset_init_with_allocator(sizeof(int), compare_int, &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(multiset_put(me, &i) == BK_OK);
+        assert(multiset_put(me, &i) == BK_OK);
+    }
+    i = 500;
+    assert(multiset_count(me, &i) == 2);
+    assert(!multiset_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = multiset_init_with_allocator(sizeof(int), compare_int, &allocator);
+    assert(!me);
+}
+
+static void test_node_pool(void)
+{
+    long live;
+    long slabs;
+    struct bk_allocator allocator;
+    multiset me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = multiset_init_with_allocator(sizeof(int), compare_int, &allocator);
+    assert(me);
+    assert(multiset_use_node_pool(me) == BK_OK);
+    for (i = 0; i < 1000; i++) {
+        assert(multiset_put(me, &i) == BK_OK);
+    }
+    assert(live < 100);
+    assert(multiset_use_node_pool(me) == -BK_EINVAL);
+    for (i = 0; i < 1000; i += 2) {
+        assert(multiset_remove(me, &i));
+    }
+    assert(multiset_size(me) == 500);
+    slabs = live;
+    for (i = 0; i < 1000; i += 2) {
+        assert(multiset_put(me, &i) == BK_OK);
+    }
+    assert(multiset_size(me) == 1000);
+    assert(live == slabs);
+    i = 500;
+    assert(multiset_count(me, &i) == 1);
+    multiset_clear(me);
+    assert(live == 1);
+    for (i = 0; i < 10; i++) {
+        assert(multiset_put(me, &i) == BK_OK);
+    }
+    assert(!multiset_destroy(me));
+    assert(live == 0);
+}
+
+static void test_clear_frees_nodes(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    multiset me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = multiset_init_with_allocator(sizeof(int), compare_int, &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(multiset_put(me, &i) == BK_OK);
+        assert(multiset_put(me, &i) == BK_OK);
+    }
+    multiset_clear(me);
+    assert(multiset_is_empty(me));
+    assert(live == 1);
+    i = 500;
+    assert(!multiset_contains(me, &i));
+    assert(multiset_put(me, &i) == BK_OK);
+    assert(multiset_size(me) == 1);
+    assert(!multiset_destroy(me));
+    assert(live == 0);
+}
+
+static void test_init_from_sorted(void)
+{
+    int keys[1000];
+    int i;
+    multiset me;
+    for (i = 0; i < 1000; i++) {
+        keys[i] = i / 3;
+    }
+    me = multiset_init_from_sorted(sizeof(int), compare_int, keys, 1000);
+    assert(me);
+    assert(multiset_size(me) == 1000);
+    multiset_verify_recursive(me->root);
+    for (i = 0; i < 333; i++) {
+        assert(multiset_count(me, &i) == 3);
+    }
+    assert(multiset_count(me, &i) == 1);
+    i++;
+    assert(!multiset_contains(me, &i));
+    assert(multiset_put(me, &i) == BK_OK);
+    multiset_verify_recursive(me->root);
+    assert(!multiset_destroy(me));
+    for (i = 0; i < 1000; i++) {
+        keys[i] = i;
+    }
+    for (i = 0; i <= 1000; i += 111) {
+        me = multiset_init_from_sorted(sizeof(int), compare_int, keys,
+                                       (size_t) i);
+        assert(me);
+        assert(multiset_size(me) == (size_t) i);
+        multiset_verify(me);
+        assert(!multiset_destroy(me));
+    }
+    keys[500] = keys[498];
+    assert(!multiset_init_from_sorted(sizeof(int), compare_int, keys, 1000));
+    assert(!multiset_init_from_sorted(0, compare_int, keys, 1000));
+}
+
 void test_multiset(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
+    test_node_pool();
+    test_clear_frees_nodes();
+    test_init_from_sorted();
     test_auto_balancing();
     test_put_already_existing();
     test_remove_nothing();
@@ -714,6 +970,8 @@ void test_multiset(void)
     test_put_out_of_memory();
 #endif
     test_big_object();
+    test_iteration();
+    test_order_statistics();
     test_ordered_retrieval();
     multiset_destroy(NULL);
 }
@@ -230,9 +230,35 @@ static void test_big_object(void)
     assert(!priority_queue_destroy(me));
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    priority_queue me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = priority_queue_init_with_allocator(sizeof(int), compare_int,
+                                            &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(priority_queue_push(me, &i) == BK_OK);
+    }
+    assert(priority_queue_pop(&get, me));
+    assert(get == 999);
+    assert(!priority_queue_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = priority_queue_init_with_allocator(sizeof(int), compare_int,
+                                            &allocator);
+    assert(!me);
+}
+
 void test_priority_queue(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
     test_basic();
 #if STUB_MALLOC
     test_init_out_of_memory();
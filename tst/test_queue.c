@@ -179,9 +179,33 @@ static void test_big_object(void)
     assert(!queue_destroy(me));
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    queue me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = queue_init_with_allocator(sizeof(int), &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(queue_push(me, &i) == BK_OK);
+    }
+    assert(queue_pop(&get, me));
+    assert(get == 0);
+    assert(!queue_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = queue_init_with_allocator(sizeof(int), &allocator);
+    assert(!me);
+}
+
 void test_queue(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
     test_basic();
     test_large_alloc();
     test_automated_trim();
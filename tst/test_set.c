@@ -15,11 +15,12 @@ struct internal_set {
  * Include this to verify the tree.
  */
 static const size_t ptr_size = sizeof(char *);
-/* Node balance is always the first byte (at index 0). */
-static const size_t node_parent_offset = sizeof(signed char);
-static const size_t node_left_child_offset = 1 + sizeof(char *);
-static const size_t node_right_child_offset = 1 + 2 * sizeof(char *);
-static const size_t node_key_offset = 1 + 3 * sizeof(char *);
+static const size_t node_parent_offset = 0;
+static const size_t node_left_child_offset = sizeof(char *);
+static const size_t node_right_child_offset = 2 * sizeof(char *);
+static const size_t node_key_offset = 3 * sizeof(char *);
+/* Node balance is the last byte, which assumes the keys are integers. */
+static const size_t node_balance_offset = 3 * sizeof(char *) + sizeof(int);
 
 /*
  * Verifies that the AVL tree rules are followed. The balance factor of an item
@@ -41,7 +42,7 @@ static int set_verify_recursive(char *const item)
     left = set_verify_recursive(item_left);
     right = set_verify_recursive(item_right);
     max = left > right ? left : right;
-    assert(right - left == item[0]);
+    assert(right - left == item[node_balance_offset]);
     if (item_left && item_right) {
         const int left_val = *(int *) (item_left + node_key_offset);
         const int right_val = *(int *) (item_right + node_key_offset);
@@ -536,6 +537,134 @@ static int compare_big_object(const void *const one, const void *const two)
     return a->n - b->n;
 }
 
+static void sum_range(const void *const key, void *const context)
+{
+    int *const sum = context;
+    *sum += *(const int *) key;
+}
+
+static void test_iteration(void)
+{
+    struct set_iter iter;
+    void *key;
+    int expected;
+    int sum = 0;
+    int low;
+    int high;
+    int i;
+    set me = set_init(sizeof(int), compare_int);
+    assert(me);
+    set_iter_init(&iter, me);
+    assert(!set_iter_next(&key, &iter));
+    for (i = 0; i < 1000; i++) {
+        const int k = (i * 37) % 1000 * 2;
+        assert(set_put(me, (void *) &k) == BK_OK);
+    }
+    expected = 0;
+    set_iter_init(&iter, me);
+    while (set_iter_next(&key, &iter)) {
+        assert(*(int *) key == expected);
+        expected += 2;
+    }
+    assert(expected == 2000);
+    expected = 1998;
+    set_iter_init_last(&iter, me);
+    while (set_iter_prev(&key, &iter)) {
+        assert(*(int *) key == expected);
+        expected -= 2;
+    }
+    assert(expected == -2);
+    low = 101;
+    set_iter_init_at(&iter, me, &low);
+    assert(set_iter_next(&key, &iter));
+    assert(*(int *) key == 102);
+    low = 101;
+    high = 200;
+    set_range(me, &low, &high, sum_range, &sum);
+    assert(sum == (102 + 200) * 50 / 2);
+    set_iter_init(&iter, me);
+    while (set_iter_next(&key, &iter)) {
+        if (*(int *) key % 4 == 0) {
+            assert(set_remove(me, key));
+        }
+    }
+    assert(set_size(me) == 500);
+    expected = 2;
+    set_iter_init(&iter, me);
+    while (set_iter_next(&key, &iter)) {
+        assert(*(int *) key == expected);
+        expected += 4;
+    }
+    assert(!set_destroy(me));
+}
+
+/*
+ * Checks the order statistics of the set against a set which walks its keys.
+ */
+static void check_order_statistics(set me, set plain)
+{
+    size_t i;
+    int key;
+    assert(set_size(me) == set_size(plain));
+    for (i = 0; i < set_size(me); i++) {
+        assert(*(int *) set_select(me, i) == *(int *) set_select(plain, i));
+    }
+    assert(!set_select(me, set_size(me)));
+    for (key = -1; key <= 2000; key += 7) {
+        assert(set_rank(me, &key) == set_rank(plain, &key));
+    }
+}
+
+static void test_order_statistics(void)
+{
+    int i;
+    int key;
+    set me = set_init(sizeof(int), compare_int);
+    set plain = set_init(sizeof(int), compare_int);
+    assert(me);
+    assert(plain);
+    assert(!set_select(me, 0));
+    key = 5;
+    assert(set_rank(me, &key) == 0);
+    assert(set_use_node_pool(me) == BK_OK);
+    assert(set_put(me, &key) == BK_OK);
+    assert(set_use_order_statistics(me) == -BK_EINVAL);
+    assert(set_remove(me, &key));
+    assert(set_use_order_statistics(me) == BK_OK);
+    assert(set_use_order_statistics(me) == BK_OK);
+    for (i = 0; i < 1000; i++) {
+        key = (i * 37) % 1000 * 2;
+        assert(set_put(me, &key) == BK_OK);
+        assert(set_put(plain, &key) == BK_OK);
+    }
+    check_order_statistics(me, plain);
+    assert(*(int *) set_select(me, 0) == 0);
+    assert(*(int *) set_select(me, 990) == 1980);
+    key = 1001;
+    assert(set_rank(me, &key) == 501);
+    key = 1002;
+    assert(set_rank(me, &key) == 501);
+    for (i = 0; i < 1000; i++) {
+        key = (i * 59) % 1000 * 2;
+        if (key % 3 != 0) {
+            assert(set_remove(me, &key));
+            assert(set_remove(plain, &key));
+        }
+        if (i % 100 == 0) {
+            check_order_statistics(me, plain);
+        }
+    }
+    check_order_statistics(me, plain);
+    for (i = 0; i < 1000; i++) {
+        key = (i * 71) % 1000 * 2 + 1;
+        assert(set_put(me, &key) == BK_OK);
+        assert(set_put(plain, &key) == BK_OK);
+    }
+    check_order_statistics(me, plain);
+    assert(!set_destroy(me));
+    assert(!set_destroy(plain));
+}
+
 static void test_big_object(void)
 {
     int i;
@@ -667,9 +796,184 @@ static void test_ordered_retrieval(void)
     set_destroy(me);
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    set me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = set_init_with_allocator(sizeof(int), compare_int, &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(set_put(me, &i) == BK_OK);
+    }
+    i = 500;
+    assert(set_contains(me, &i));
+    assert(set_remove(me, &i));
+    assert(!set_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = set_init_with_allocator(sizeof(int), compare_int, &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(set_put(me, &i) == BK_OK);
+    }
+    i = 500;
+    assert(set_contains(me, &i));
+    assert(!set_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = set_init_with_allocator(sizeof(int), compare_int, &allocator);
+    assert(!me);
+}
+
+static void test_node_pool(void)
+{
+    long live;
+    long slabs;
+    struct bk_allocator allocator;
+    set me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = set_init_with_allocator(sizeof(int), compare_int, &allocator);
+    assert(me);
+    assert(set_use_node_pool(me) == BK_OK);
+    for (i = 0; i < 1000; i++) {
+        assert(set_put(me, &i) == BK_OK);
+    }
+    assert(live < 100);
+    assert(set_use_node_pool(me) == -BK_EINVAL);
+    for (i = 0; i < 1000; i += 2) {
+        assert(set_remove(me, &i));
+    }
+    assert(set_size(me) == 500);
+    slabs = live;
+    for (i = 0; i < 1000; i += 2) {
+        assert(set_put(me, &i) == BK_OK);
+    }
+    assert(set_size(me) == 1000);
+    assert(live == slabs);
+    i = 500;
+    assert(set_contains(me, &i));
+    set_clear(me);
+    assert(live == 1);
+    for (i = 0; i < 10; i++) {
+        assert(set_put(me, &i) == BK_OK);
+    }
+    assert(!set_destroy(me));
+    assert(live == 0);
+}
+
+static void test_clear_frees_nodes(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    set me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = set_init_with_allocator(sizeof(int), compare_int, &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(set_put(me, &i) == BK_OK);
+    }
+    set_clear(me);
+    assert(set_is_empty(me));
+    assert(live == 1);
+    i = 500;
+    assert(!set_contains(me, &i));
+    assert(set_put(me, &i) == BK_OK);
+    assert(set_size(me) == 1);
+    assert(!set_destroy(me));
+    assert(live == 0);
+}
+
+static void test_init_pod(void)
+{
+    int key;
+    long big;
+    char bytes[3];
+    int i;
+    set me = set_init_pod(sizeof(int));
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        key = (i * 37) % 1000 - 500;
+        assert(set_put(me, &key) == BK_OK);
+    }
+    assert(set_size(me) == 1000);
+    set_verify(me);
+    assert(*(int *) set_first(me) == -500);
+    assert(*(int *) set_last(me) == 499);
+    key = -1;
+    assert(*(int *) set_higher(me, &key) == 0);
+    assert(*(int *) set_lower(me, &key) == -2);
+    assert(set_remove(me, &key));
+    assert(!set_contains(me, &key));
+    assert(!set_destroy(me));
+    me = set_init_pod(sizeof(long));
+    assert(me);
+    for (i = 0; i < 100; i++) {
+        big = (long) (i % 2 ? i : -i) * 100000;
+        assert(set_put(me, &big) == BK_OK);
+    }
+    assert(*(long *) set_first(me) == -9800000);
+    assert(*(long *) set_last(me) == 9900000);
+    assert(!set_destroy(me));
+    me = set_init_pod(3);
+    assert(me);
+    for (i = 0; i < 256; i++) {
+        bytes[0] = (char) (255 - i);
+        bytes[1] = (char) i;
+        bytes[2] = 0;
+        assert(set_put(me, bytes) == BK_OK);
+    }
+    assert(((unsigned char *) set_first(me))[0] == 0);
+    assert(((unsigned char *) set_last(me))[0] == 255);
+    assert(!set_destroy(me));
+    assert(!set_init_pod(0));
+}
+
+static void test_init_from_sorted(void)
+{
+    int keys[1000];
+    int i;
+    set me;
+    for (i = 0; i < 1000; i++) {
+        keys[i] = 2 * i;
+    }
+    for (i = 0; i <= 1000; i += 111) {
+        int j;
+        me = set_init_from_sorted(sizeof(int), compare_int, keys, (size_t) i);
+        assert(me);
+        assert(set_size(me) == (size_t) i);
+        set_verify(me);
+        for (j = 0; j < i; j++) {
+            assert(set_contains(me, &keys[j]));
+        }
+        j = 1;
+        assert(!set_contains(me, &j));
+        assert(set_put(me, &j) == BK_OK);
+        set_verify(me);
+        assert(!set_destroy(me));
+    }
+    keys[500] = keys[499];
+    assert(!set_init_from_sorted(sizeof(int), compare_int, keys, 1000));
+    keys[500] = keys[498];
+    assert(!set_init_from_sorted(sizeof(int), compare_int, keys, 1000));
+    assert(!set_init_from_sorted(0, compare_int, keys, 1000));
+}
+
 void test_set(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
+    test_node_pool();
+    test_clear_frees_nodes();
+    test_init_from_sorted();
+    test_init_pod();
+    test_iteration();
+    test_order_statistics();
     test_auto_balancing();
     test_put_already_existing();
     test_remove_nothing();
@@ -106,9 +106,33 @@ static void test_big_object(void)
     assert(!stack_destroy(me));
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    stack me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = stack_init_with_allocator(sizeof(int), &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(stack_push(me, &i) == BK_OK);
+    }
+    assert(stack_pop(&get, me));
+    assert(get == 999);
+    assert(!stack_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = stack_init_with_allocator(sizeof(int), &allocator);
+    assert(!me);
+}
+
 void test_stack(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
     test_basic();
     test_automated_trim();
     test_big_object();
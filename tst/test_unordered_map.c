@@ -24,6 +24,11 @@ static unsigned long bad_hash_int(const void *const key)
     return 5;
 }
 
+static unsigned long clustered_hash_int(const void *const key)
+{
+    return *(int *) key % 7;
+}
+
 static void test_invalid_init(void)
 {
     const size_t max_size = -1;
@@ -206,6 +211,42 @@ static void test_bad_hash(void)
     assert(!unordered_map_destroy(me));
 }
 
+static void test_churn(void)
+{
+    int i;
+    int j;
+    unordered_map me = unordered_map_init(sizeof(int), sizeof(int), hash_int,
+                                          compare_int);
+    assert(me);
+    for (i = 0; i < 100; i++) {
+        for (j = 0; j < 10; j++) {
+            const int key = 10 * i + j;
+            assert(unordered_map_put(me, (void *) &key, (void *) &i) == 0);
+        }
+        for (j = 0; j < 10; j++) {
+            const int key = 10 * i + j;
+            if (j % 2 == 0) {
+                assert(unordered_map_remove(me, (void *) &key));
+            }
+        }
+    }
+    assert(unordered_map_size(me) == 500);
+    for (i = 0; i < 1000; i++) {
+        int value = -1;
+        const bk_bool is_present = i % 2 == 1;
+        assert(unordered_map_get(&value, me, &i) == is_present);
+        assert(value == (is_present ? i / 10 : -1));
+    }
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_map_remove(me, &i) == (i % 2 == 1));
+    }
+    assert(unordered_map_is_empty(me));
+    for (i = 0; i < 1000; i++) {
+        assert(!unordered_map_contains(me, &i));
+    }
+    assert(!unordered_map_destroy(me));
+}
+
 #if STUB_MALLOC
 static void test_init_out_of_memory(void)
 {
@@ -246,16 +287,68 @@ static void test_put_out_of_memory(void)
                                           bad_hash_int, compare_int);
     assert(me);
     fail_malloc = 1;
-    assert(unordered_map_put(me, &key, &value) == -ENOMEM);
+    fail_calloc = 1;
     assert(unordered_map_put(me, &key, &value) == 0);
     key = 7;
-    fail_malloc = 1;
-    assert(unordered_map_put(me, &key, &value) == -ENOMEM);
+    assert(unordered_map_put(me, &key, &value) == 0);
+    assert(fail_malloc == 1);
+    assert(fail_calloc == 1);
+    fail_malloc = 0;
+    fail_calloc = 0;
+    assert(unordered_map_size(me) == 2);
     assert(!unordered_map_destroy(me));
 }
 #endif
 
 #if STUB_MALLOC
+static void test_put_all_out_of_memory(void)
+{
+    int keys[100];
+    int values[100];
+    int i;
+    unordered_map me = unordered_map_init(sizeof(int), sizeof(int), hash_int,
+                                          compare_int);
+    assert(me);
+    for (i = 0; i < 100; i++) {
+        keys[i] = i;
+        values[i] = i;
+    }
+    fail_malloc = 1;
+    fail_calloc = 1;
+    assert(unordered_map_put_all(me, keys, values, 100) == -BK_ENOMEM);
+    fail_malloc = 0;
+    fail_calloc = 0;
+    assert(unordered_map_is_empty(me));
+    assert(unordered_map_put_all(me, keys, values, 100) == BK_OK);
+    assert(unordered_map_size(me) == 100);
+    assert(!unordered_map_destroy(me));
+}
+
+static void test_emplace_out_of_memory(void)
+{
+    int i;
+    bk_bool inserted = BK_TRUE;
+    unordered_map me = unordered_map_init(sizeof(int), sizeof(int), hash_int,
+                                          compare_int);
+    assert(me);
+    for (i = 0; unordered_map_size(me) < 1000; i++) {
+        fail_malloc = 1;
+        fail_calloc = 1;
+        if (!unordered_map_emplace(me, &i, &inserted)) {
+            break;
+        }
+        assert(inserted);
+    }
+    fail_malloc = 0;
+    fail_calloc = 0;
+    assert(!inserted);
+    assert(unordered_map_size(me) == (size_t) i);
+    assert(!unordered_map_get_ptr(me, &i));
+    assert(unordered_map_emplace(me, &i, &inserted));
+    assert(inserted);
+    assert(!unordered_map_destroy(me));
+}
+
 static void test_resize_out_of_memory(void)
 {
     int i;
@@ -272,6 +365,15 @@ static void test_resize_out_of_memory(void)
     for (i = 0; i < 11; i++) {
         assert(unordered_map_contains(me, &i));
     }
+    unordered_map_set_incremental_rehash(me, BK_TRUE);
+    fail_calloc = 1;
+    assert(unordered_map_put(me, &i, &i) == -ENOMEM);
+    assert(unordered_map_size(me) == 11);
+    assert(unordered_map_put(me, &i, &i) == BK_OK);
+    assert(unordered_map_size(me) == 12);
+    for (i = 0; i < 12; i++) {
+        assert(unordered_map_contains(me, &i));
+    }
     assert(!unordered_map_destroy(me));
 }
 #endif
@@ -308,6 +410,171 @@ static int compare_big_object(const void *const one, const void *const two)
     return a->n - b->n;
 }
 
+static void test_get_ptr(void)
+{
+    int i;
+    int *value;
+    unordered_map me = unordered_map_init(sizeof(int), sizeof(int), hash_int,
+                                          compare_int);
+    assert(me);
+    i = 5;
+    assert(!unordered_map_get_ptr(me, &i));
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_map_put(me, &i, &i) == BK_OK);
+    }
+    i = 1000;
+    assert(!unordered_map_get_ptr(me, &i));
+    for (i = 0; i < 1000; i++) {
+        value = unordered_map_get_ptr(me, &i);
+        assert(value);
+        assert(*value == i);
+        *value = -i;
+    }
+    for (i = 0; i < 1000; i++) {
+        int copy = 0;
+        assert(unordered_map_get(&copy, me, &i));
+        assert(copy == -i);
+    }
+    unordered_map_set_incremental_rehash(me, BK_TRUE);
+    for (i = 1000; i < 5000; i++) {
+        assert(unordered_map_put(me, &i, &i) == BK_OK);
+    }
+    for (i = 0; i < 5000; i++) {
+        value = unordered_map_get_ptr(me, &i);
+        assert(value);
+        assert(*value == (i < 1000 ? -i : i));
+    }
+    assert(!unordered_map_destroy(me));
+}
+
+static void test_emplace(void)
+{
+    int i;
+    int *count;
+    bk_bool inserted;
+    unordered_map me = unordered_map_init(sizeof(int), sizeof(int), hash_int,
+                                          compare_int);
+    assert(me);
+    for (i = 0; i < 10000; i++) {
+        int key = (i * 37) % 1000;
+        count = unordered_map_emplace(me, &key, &inserted);
+        assert(count);
+        assert(inserted == (i < 1000));
+        assert(*count == i / 1000);
+        (*count)++;
+    }
+    assert(unordered_map_size(me) == 1000);
+    for (i = 0; i < 1000; i++) {
+        int value = 0;
+        assert(unordered_map_get(&value, me, &i));
+        assert(value == 10);
+    }
+    i = 7;
+    count = unordered_map_emplace(me, &i, NULL);
+    assert(count == unordered_map_get_ptr(me, &i));
+    assert(unordered_map_size(me) == 1000);
+    assert(!unordered_map_destroy(me));
+}
+
+struct aligned_value {
+    double d;
+    long l;
+};
+
+struct aligned_value_probe {
+    char c;
+    struct aligned_value v;
+};
+
+static unsigned long hash_short_key(const void *const key)
+{
+    const unsigned char *const bytes = key;
+    return bytes[0] * 65536UL + bytes[1] * 256UL + bytes[2];
+}
+
+static int compare_short_key(const void *const one, const void *const two)
+{
+    return memcmp(one, two, 3);
+}
+
+/*
+ * Uses keys whose size is odd, so that the values are only aligned if the
+ * unordered map pads its slots.
+ */
+static void test_emplace_aligned(void)
+{
+    int i;
+    char key[3];
+    struct aligned_value *value;
+    unordered_map me = unordered_map_init(sizeof(key),
+                                          sizeof(struct aligned_value),
+                                          hash_short_key, compare_short_key);
+    assert(me);
+    memset(key, 0, sizeof(key));
+    for (i = 0; i < 1000; i++) {
+        key[1] = (char) (i / 256);
+        key[2] = (char) (i % 256);
+        value = unordered_map_emplace(me, key, NULL);
+        assert(value);
+        assert((size_t) value % offsetof(struct aligned_value_probe, v) == 0);
+        value->d = i;
+        value->l = i;
+    }
+    for (i = 0; i < 1000; i++) {
+        key[1] = (char) (i / 256);
+        key[2] = (char) (i % 256);
+        value = unordered_map_get_ptr(me, key);
+        assert(value);
+        assert((size_t) value % offsetof(struct aligned_value_probe, v) == 0);
+        assert(value->d == i);
+        assert(value->l == i);
+    }
+    assert(!unordered_map_destroy(me));
+}
+
+/*
+ * Removes and re-adds keys which share a few long runs of slots, so that the
+ * entries after each removed one are shifted back, and checks that every key
+ * is still found and that only the live entries occupy slots.
+ */
+static void test_churn_without_tombstones(void)
+{
+    struct bk_probe_histogram histogram;
+    int round;
+    int i;
+    unordered_map me = unordered_map_init(sizeof(int), sizeof(int),
+                                          clustered_hash_int, compare_int);
+    assert(me);
+    for (i = 0; i < 200; i++) {
+        assert(unordered_map_put(me, &i, &i) == BK_OK);
+    }
+    for (round = 0; round < 50; round++) {
+        for (i = 0; i < 200; i++) {
+            int key = (i * 79 + round) % 200;
+            if (key % 3 == round % 3) {
+                assert(unordered_map_remove(me, &key));
+                assert(!unordered_map_contains(me, &key));
+            }
+        }
+        for (i = 0; i < 200; i++) {
+            int value = -1;
+            assert(unordered_map_get(&value, me, &i) == (i % 3 != round % 3));
+            if (i % 3 == round % 3) {
+                value = round;
+                assert(unordered_map_put(me, &i, &value) == BK_OK);
+            }
+        }
+        unordered_map_probe_histogram(me, &histogram);
+        assert(histogram.full == 200);
+    }
+    for (i = 0; i < 200; i++) {
+        int value = -1;
+        assert(unordered_map_get(&value, me, &i));
+        assert(value >= 47 && value % 3 == i % 3);
+    }
+    assert(!unordered_map_destroy(me));
+}
+
 static void test_big_object(void)
 {
     int i;
@@ -343,18 +610,516 @@ static void test_big_object(void)
     assert(!unordered_map_destroy(me));
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    unordered_map me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = unordered_map_init_with_allocator(sizeof(int), sizeof(int), hash_int,
+                                           compare_int, &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_map_put(me, &i, &i) == BK_OK);
+    }
+    i = 500;
+    assert(unordered_map_get(&get, me, &i));
+    assert(get == 500);
+    assert(unordered_map_remove(me, &i));
+    assert(unordered_map_clear(me) == BK_OK);
+    assert(!unordered_map_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = unordered_map_init_with_allocator(sizeof(int), sizeof(int), hash_int,
+                                           compare_int, &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_map_put(me, &i, &i) == BK_OK);
+    }
+    i = 500;
+    assert(unordered_map_get(&get, me, &i));
+    assert(get == 500);
+    assert(!unordered_map_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = unordered_map_init_with_allocator(sizeof(int), sizeof(int), hash_int,
+                                           compare_int, &allocator);
+    assert(!me);
+}
+
+static void test_stats(void)
+{
+    struct bk_stats stats;
+    int i;
+    unordered_map me = unordered_map_init(sizeof(int), sizeof(int), hash_int,
+                                          compare_int);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_map_put(me, &i, &i) == BK_OK);
+    }
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_map_contains(me, &i));
+    }
+    unordered_map_get_stats(me, &stats);
+#ifdef BK_STATS
+    assert(stats.hash_calls == 2000);
+    assert(stats.comparator_calls >= 1000);
+    assert(stats.probes >= 2000);
+    assert(stats.longest_probe >= 1);
+    assert(stats.resizes > 0);
+    assert(stats.rehashes >= stats.resizes);
+    assert(stats.bytes_allocated > 1000 * 2 * sizeof(int));
+#else
+    assert(stats.hash_calls == 0);
+    assert(stats.probes == 0);
+    assert(stats.resizes == 0);
+#endif
+    assert(stats.rotations == 0);
+    assert(!unordered_map_destroy(me));
+}
+
+static void test_init_ex(void)
+{
+    struct bk_probe_histogram histogram;
+    size_t capacity;
+    int triple[3];
+    int i;
+    unordered_map me;
+    assert(!unordered_map_init_ex(sizeof(int), sizeof(int), hash_int,
+                                  compare_int, 10, 0, 2));
+    assert(!unordered_map_init_ex(sizeof(int), sizeof(int), hash_int,
+                                  compare_int, 10, 1, 2));
+    assert(!unordered_map_init_ex(sizeof(int), sizeof(int), hash_int,
+                                  compare_int, 10, 0.5, 1));
+    me = unordered_map_init_ex(sizeof(int), sizeof(int), hash_int,
+                               compare_int, 1000, 0.5, 1.5);
+    assert(me);
+    unordered_map_probe_histogram(me, &histogram);
+    capacity = histogram.capacity;
+    assert(capacity >= 2000);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_map_put(me, &i, &i) == BK_OK);
+    }
+    unordered_map_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    assert(unordered_map_clear(me) == BK_OK);
+    unordered_map_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    assert(!unordered_map_destroy(me));
+    me = unordered_map_init_ex(sizeof(int), sizeof(int), NULL, NULL, 0, 0.75,
+                               2);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_map_put(me, &i, &i) == BK_OK);
+    }
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_map_contains(me, &i));
+    }
+    i = 1000;
+    assert(!unordered_map_contains(me, &i));
+    assert(!unordered_map_destroy(me));
+    me = unordered_map_init_ex(sizeof(triple), sizeof(int), NULL, NULL,
+                               0, 0.75, 2);
+    assert(me);
+    memset(triple, 0, sizeof(triple));
+    for (i = 0; i < 1000; i++) {
+        triple[i % 3] = i;
+        assert(unordered_map_put(me, triple, &i) == BK_OK);
+        assert(unordered_map_contains(me, triple));
+    }
+    triple[0] = -1;
+    assert(!unordered_map_contains(me, triple));
+    assert(!unordered_map_destroy(me));
+}
+
+static void test_reserve(void)
+{
+    struct bk_probe_histogram histogram;
+    size_t capacity;
+    int i;
+    unordered_map me = unordered_map_init(sizeof(int), sizeof(int), hash_int,
+                                          compare_int);
+    assert(me);
+    assert(unordered_map_reserve(me, 0) == BK_OK);
+    assert(unordered_map_reserve(me, 5000) == BK_OK);
+    unordered_map_probe_histogram(me, &histogram);
+    capacity = histogram.capacity;
+    assert(capacity > 5000);
+    for (i = 0; i < 5000; i++) {
+        assert(unordered_map_put(me, &i, &i) == BK_OK);
+    }
+    assert(unordered_map_reserve(me, 10) == BK_OK);
+    unordered_map_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    assert(histogram.full == 5000);
+    assert(unordered_map_reserve(me, (size_t) -1) == -BK_ENOMEM);
+    assert(!unordered_map_destroy(me));
+}
+
+static void test_batch(void)
+{
+    int keys[1500];
+    int values[1500];
+    bk_bool found[1500];
+    int i;
+    unordered_map me = unordered_map_init(sizeof(int), sizeof(int), hash_int,
+                                          compare_int);
+    assert(me);
+    assert(unordered_map_put_batch(me, keys, values, 0) == BK_OK);
+    for (i = 0; i < 1000; i++) {
+        keys[i] = i;
+        values[i] = 2 * i;
+    }
+    assert(unordered_map_put_batch(me, keys, values, 1000) == BK_OK);
+    assert(unordered_map_size(me) == 1000);
+    for (i = 0; i < 1500; i++) {
+        keys[i] = 1499 - i;
+        values[i] = -1;
+    }
+    assert(unordered_map_get_batch(values, found, me, keys, 1500) == 1000);
+    for (i = 0; i < 1500; i++) {
+        if (keys[i] < 1000) {
+            assert(found[i]);
+            assert(values[i] == 2 * keys[i]);
+        } else {
+            assert(!found[i]);
+            assert(values[i] == -1);
+        }
+    }
+    assert(unordered_map_get_batch(values, NULL, me, keys, 1500) == 1000);
+    assert(unordered_map_get_batch(values, NULL, me, keys, 0) == 0);
+    for (i = 0; i < 1500; i++) {
+        values[i] = keys[i];
+    }
+    assert(unordered_map_put_batch(me, keys, values, 1500) == BK_OK);
+    assert(unordered_map_size(me) == 1500);
+    for (i = 0; i < 1500; i++) {
+        int value = 0;
+        assert(unordered_map_get(&value, me, &i));
+        assert(value == i);
+    }
+    assert(!unordered_map_destroy(me));
+}
+
+static void test_put_all(void)
+{
+    struct bk_probe_histogram histogram;
+    int keys[1000];
+    int values[1000];
+    size_t capacity;
+    int i;
+    unordered_map me = unordered_map_init(sizeof(int), sizeof(int), hash_int,
+                                          compare_int);
+    assert(me);
+    assert(unordered_map_put_all(me, keys, values, 0) == BK_OK);
+    assert(unordered_map_is_empty(me));
+    for (i = 0; i < 1000; i++) {
+        keys[i] = i;
+        values[i] = -i;
+    }
+    assert(unordered_map_put_all(me, keys, values, 1000) == BK_OK);
+    assert(unordered_map_size(me) == 1000);
+    unordered_map_probe_histogram(me, &histogram);
+    capacity = histogram.capacity;
+    for (i = 0; i < 1000; i++) {
+        int value = 0;
+        assert(unordered_map_get(&value, me, &i));
+        assert(value == -i);
+    }
+    for (i = 0; i < 1000; i += 2) {
+        assert(unordered_map_remove(me, &i));
+    }
+    for (i = 0; i < 1000; i++) {
+        keys[i] = i / 2;
+        values[i] = i;
+    }
+    assert(unordered_map_put_all(me, keys, values, 1000) == BK_OK);
+    assert(unordered_map_size(me) == 750);
+    unordered_map_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    for (i = 0; i < 500; i++) {
+        int value = 0;
+        assert(unordered_map_get(&value, me, &i));
+        assert(value == 2 * i + 1);
+    }
+    assert(unordered_map_put_all(me, keys, values, (size_t) -1) == -BK_ENOMEM);
+    assert(unordered_map_size(me) == 750);
+    unordered_map_set_incremental_rehash(me, BK_TRUE);
+    for (i = 0; i < 1000; i++) {
+        keys[i] = 1000 + i;
+    }
+    assert(unordered_map_put_all(me, keys, values, 1000) == BK_OK);
+    assert(unordered_map_size(me) == 1750);
+    unordered_map_probe_histogram(me, &histogram);
+    assert(histogram.full == 1750);
+    assert(!unordered_map_destroy(me));
+}
+
+/*
+ * Puts keys counting up from next, until an incremental rehash is in progress,
+ * which is when the new table does not hold every entry.
+ */
+static void put_until_migrating(unordered_map me, int *const next)
+{
+    struct bk_probe_histogram histogram;
+    do {
+        assert(unordered_map_put(me, next, next) == BK_OK);
+        (*next)++;
+        unordered_map_probe_histogram(me, &histogram);
+    } while (histogram.full == unordered_map_size(me));
+}
+
+static void test_incremental_rehash(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    unordered_map me;
+    int next = 0;
+    int end;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = unordered_map_init_with_allocator(sizeof(int), sizeof(int), hash_int,
+                                           compare_int, &allocator);
+    assert(me);
+    for (; next < 2000; next++) {
+        assert(unordered_map_put(me, &next, &next) == BK_OK);
+    }
+    unordered_map_set_incremental_rehash(me, BK_TRUE);
+    put_until_migrating(me, &next);
+    for (i = 0; i < next; i++) {
+        assert(unordered_map_contains(me, &i));
+        assert(unordered_map_get(&get, me, &i));
+        assert(get == i);
+    }
+    put_until_migrating(me, &next);
+    for (i = next - 1; i >= 0; i--) {
+        get = -i;
+        assert(unordered_map_put(me, &i, &get) == BK_OK);
+    }
+    assert(unordered_map_size(me) == (size_t) next);
+    put_until_migrating(me, &next);
+    for (i = next - 2 + next % 2; i >= 0; i -= 2) {
+        assert(unordered_map_remove(me, &i));
+        assert(!unordered_map_remove(me, &i));
+    }
+    assert(unordered_map_size(me) == (size_t) next / 2);
+    end = next;
+    put_until_migrating(me, &next);
+    for (i = end - 1; i >= 0; i--) {
+        assert(unordered_map_contains(me, &i) == (i % 2 == 1));
+    }
+    put_until_migrating(me, &next);
+    unordered_map_set_incremental_rehash(me, BK_FALSE);
+    for (i = 1; i < next; i += 2) {
+        assert(unordered_map_get(&get, me, &i));
+    }
+    unordered_map_set_incremental_rehash(me, BK_TRUE);
+    put_until_migrating(me, &next);
+    assert(unordered_map_rehash(me) == BK_OK);
+    put_until_migrating(me, &next);
+    assert(unordered_map_clear(me) == BK_OK);
+    assert(unordered_map_is_empty(me));
+    put_until_migrating(me, &next);
+    assert(!unordered_map_destroy(me));
+    assert(live == 0);
+}
+
+/*
+ * Checks that a pointer to a value in the old table of an incremental rehash
+ * stays valid when the next emplace finds its key, and when a missing key is
+ * removed. The iterator visits the new table first, so the first pair after
+ * those is the next one which a migration would move.
+ */
+static void test_emplace_while_migrating(void)
+{
+    struct bk_probe_histogram histogram;
+    struct unordered_map_iter iter;
+    unordered_map me;
+    bk_bool inserted = BK_TRUE;
+    void *key = NULL;
+    void *value = NULL;
+    int next = 0;
+    int old_key;
+    int other;
+    int get = 0;
+    size_t i;
+    me = unordered_map_init(sizeof(int), sizeof(int), hash_int, compare_int);
+    assert(me);
+    for (; next < 2000; next++) {
+        assert(unordered_map_put(me, &next, &next) == BK_OK);
+    }
+    unordered_map_set_incremental_rehash(me, BK_TRUE);
+    put_until_migrating(me, &next);
+    unordered_map_probe_histogram(me, &histogram);
+    unordered_map_iter_init(&iter, me);
+    for (i = 0; i <= histogram.full; i++) {
+        assert(unordered_map_iter_next(&key, &value, &iter));
+    }
+    old_key = *(int *) key;
+    other = old_key == 0 ? 1 : 0;
+    assert(unordered_map_emplace(me, &old_key, &inserted) == value);
+    assert(!inserted);
+    assert(unordered_map_emplace(me, &other, &inserted));
+    assert(!inserted);
+    assert(!unordered_map_remove(me, &next));
+    *(int *) value += 1;
+    assert(unordered_map_get_ptr(me, &old_key) == value);
+    assert(unordered_map_get(&get, me, &old_key));
+    assert(get == old_key + 1);
+    unordered_map_probe_histogram(me, &histogram);
+    assert(histogram.full < unordered_map_size(me));
+    assert(!unordered_map_destroy(me));
+}
+
+static void sum_entries(const void *const key, void *const value,
+                        void *const context)
+{
+    long *const sum = context;
+    *sum += *(const int *) key;
+    *(int *) value += 1;
+}
+
+/*
+ * Checks that iterating visits each of the first count keys exactly once, and
+ * that each value is the key plus the offset.
+ */
+static void check_iteration(unordered_map me, const int count,
+                            const int offset)
+{
+    struct unordered_map_iter iter;
+    char seen[5000];
+    void *key;
+    void *value;
+    int visited = 0;
+    memset(seen, 0, sizeof(seen));
+    unordered_map_iter_init(&iter, me);
+    while (unordered_map_iter_next(&key, &value, &iter)) {
+        const int k = *(int *) key;
+        assert(k >= 0 && k < count);
+        assert(!seen[k]);
+        assert(*(int *) value == k + offset);
+        seen[k] = 1;
+        visited++;
+    }
+    assert(visited == count);
+    assert(!unordered_map_iter_next(&key, &value, &iter));
+}
+
+static void test_iteration(void)
+{
+    struct unordered_map_iter iter;
+    void *key;
+    void *value;
+    long sum = 0;
+    int next = 0;
+    unordered_map me = unordered_map_init(sizeof(int), sizeof(int), hash_int,
+                                          compare_int);
+    assert(me);
+    unordered_map_iter_init(&iter, me);
+    assert(!unordered_map_iter_next(&key, NULL, &iter));
+    unordered_map_for_each(me, sum_entries, &sum);
+    assert(sum == 0);
+    while (next < 1000) {
+        assert(unordered_map_put(me, &next, &next) == BK_OK);
+        next++;
+    }
+    check_iteration(me, 1000, 0);
+    unordered_map_iter_init(&iter, me);
+    while (unordered_map_iter_next(&key, &value, &iter)) {
+        *(int *) value += 1;
+    }
+    check_iteration(me, 1000, 1);
+    unordered_map_for_each(me, sum_entries, &sum);
+    assert(sum == 999 * 1000 / 2);
+    check_iteration(me, 1000, 2);
+    unordered_map_set_incremental_rehash(me, BK_TRUE);
+    put_until_migrating(me, &next);
+    unordered_map_iter_init(&iter, me);
+    while (unordered_map_iter_next(&key, &value, &iter)) {
+        if (*(int *) key >= 1000) {
+            *(int *) value = *(int *) key + 2;
+        }
+    }
+    check_iteration(me, next, 2);
+    sum = 0;
+    unordered_map_for_each(me, sum_entries, &sum);
+    assert(sum == (long) (next - 1) * next / 2);
+    check_iteration(me, next, 3);
+    assert(!unordered_map_destroy(me));
+}
+
+static void test_probe_histogram(void)
+{
+    struct bk_probe_histogram histogram;
+    size_t total = 0;
+    int i;
+    unordered_map me = unordered_map_init(sizeof(int), sizeof(int), hash_int,
+                                          compare_int);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_map_put(me, &i, &i) == BK_OK);
+    }
+    for (i = 0; i < 100; i++) {
+        assert(unordered_map_remove(me, &i));
+    }
+    unordered_map_probe_histogram(me, &histogram);
+    assert(histogram.full == 900);
+    assert(histogram.capacity >= histogram.full);
+    for (i = 0; i < BK_PROBE_HISTOGRAM_BUCKETS; i++) {
+        total += histogram.counts[i];
+    }
+    assert(total == histogram.full);
+    assert(histogram.average_probe >= 1.0);
+    assert(histogram.average_probe <= (double) histogram.longest_probe);
+    assert(histogram.counts[0] >= histogram.full * 9 / 10);
+    assert(!unordered_map_destroy(me));
+    me = unordered_map_init(sizeof(int), sizeof(int), bad_hash_int,
+                            compare_int);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_map_put(me, &i, &i) == BK_OK);
+    }
+    unordered_map_probe_histogram(me, &histogram);
+    assert(histogram.full == 1000);
+    assert(histogram.longest_probe >= 1000 / 16);
+    assert(histogram.counts[BK_PROBE_HISTOGRAM_BUCKETS - 1] > 0);
+    assert(histogram.average_probe > BK_PROBE_HISTOGRAM_BUCKETS);
+    assert(!unordered_map_destroy(me));
+}
+
 void test_unordered_map(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
+    test_init_ex();
+    test_reserve();
+    test_batch();
+    test_put_all();
+    test_incremental_rehash();
+    test_emplace_while_migrating();
+    test_iteration();
+    test_probe_histogram();
+    test_stats();
     test_basic();
     test_bad_hash();
+    test_churn();
+    test_churn_without_tombstones();
 #if STUB_MALLOC
     test_init_out_of_memory();
     test_rehash_out_of_memory();
     test_put_out_of_memory();
+    test_put_all_out_of_memory();
+    test_emplace_out_of_memory();
     test_resize_out_of_memory();
     test_clear_out_of_memory();
 #endif
     test_big_object();
+    test_get_ptr();
+    test_emplace();
+    test_emplace_aligned();
     unordered_map_destroy(NULL);
 }
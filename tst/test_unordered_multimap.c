@@ -24,6 +24,11 @@ static unsigned long bad_hash_int(const void *const key)
     return 5;
 }
 
+static unsigned long clustered_hash_int(const void *const key)
+{
+    return *(int *) key % 7;
+}
+
 static void test_invalid_init(void)
 {
     const size_t max_size = -1;
@@ -356,11 +361,16 @@ static void test_put_out_of_memory(void)
                                                     compare_int);
     assert(me);
     fail_malloc = 1;
-    assert(unordered_multimap_put(me, &key, &value) == -ENOMEM);
+    fail_calloc = 1;
+    assert(unordered_multimap_put(me, &key, &value) == 0);
     assert(unordered_multimap_put(me, &key, &value) == 0);
     key = 7;
-    fail_malloc = 1;
-    assert(unordered_multimap_put(me, &key, &value) == -ENOMEM);
+    assert(unordered_multimap_put(me, &key, &value) == 0);
+    assert(fail_malloc == 1);
+    assert(fail_calloc == 1);
+    fail_malloc = 0;
+    fail_calloc = 0;
+    assert(unordered_multimap_size(me) == 3);
     assert(!unordered_multimap_destroy(me));
 }
 #endif
@@ -428,6 +438,39 @@ static int compare_placeholder(const void *const one, const void *const two)
     return 5;
 }
 
+/*
+ * Removes every value of keys whose entries are interleaved in the same runs of
+ * slots, so that each removal shifts later entries of the same key back.
+ */
+static void test_remove_all_shifted(void)
+{
+    struct bk_probe_histogram histogram;
+    int i;
+    unordered_multimap me = unordered_multimap_init(sizeof(int), sizeof(int),
+                                                    clustered_hash_int,
+                                                    compare_int, compare_int);
+    assert(me);
+    for (i = 0; i < 300; i++) {
+        int key = i % 30;
+        assert(unordered_multimap_put(me, &key, &i) == BK_OK);
+    }
+    for (i = 0; i < 30; i += 2) {
+        assert(unordered_multimap_count(me, &i) == 10);
+        assert(unordered_multimap_remove_all(me, &i));
+        assert(!unordered_multimap_contains(me, &i));
+    }
+    for (i = 1; i < 30; i += 2) {
+        int value = i + 150;
+        assert(unordered_multimap_count(me, &i) == 10);
+        assert(unordered_multimap_remove(me, &i, &value));
+        assert(unordered_multimap_count(me, &i) == 9);
+    }
+    assert(unordered_multimap_size(me) == 135);
+    unordered_multimap_probe_histogram(me, &histogram);
+    assert(histogram.full == 135);
+    assert(!unordered_multimap_destroy(me));
+}
+
 static void test_big_object(void)
 {
     int i;
@@ -467,13 +510,179 @@ static void test_big_object(void)
     assert(!unordered_multimap_destroy(me));
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    unordered_multimap me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = unordered_multimap_init_with_allocator(sizeof(int), sizeof(int),
+                                                hash_int, compare_int,
+                                                compare_int, &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multimap_put(me, &i, &i) == BK_OK);
+        assert(unordered_multimap_put(me, &i, &i) == BK_OK);
+    }
+    i = 500;
+    assert(unordered_multimap_count(me, &i) == 2);
+    assert(unordered_multimap_remove_all(me, &i));
+    assert(unordered_multimap_clear(me) == BK_OK);
+    assert(!unordered_multimap_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = unordered_multimap_init_with_allocator(sizeof(int), sizeof(int),
+                                                hash_int, compare_int,
+                                                compare_int, &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multimap_put(me, &i, &i) == BK_OK);
+        assert(unordered_multimap_put(me, &i, &i) == BK_OK);
+    }
+    i = 500;
+    assert(unordered_multimap_count(me, &i) == 2);
+    assert(!unordered_multimap_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = unordered_multimap_init_with_allocator(sizeof(int), sizeof(int),
+                                                hash_int, compare_int,
+                                                compare_int, &allocator);
+    assert(!me);
+}
+
+static void test_init_ex(void)
+{
+    struct bk_probe_histogram histogram;
+    size_t capacity;
+    int triple[3];
+    int i;
+    unordered_multimap me;
+    assert(!unordered_multimap_init_ex(sizeof(int), sizeof(int), hash_int,
+                                       compare_int, compare_int, 10, 0, 2));
+    assert(!unordered_multimap_init_ex(sizeof(int), sizeof(int), hash_int,
+                                       compare_int, compare_int, 10, 1, 2));
+    assert(!unordered_multimap_init_ex(sizeof(int), sizeof(int), hash_int,
+                                       compare_int, compare_int, 10, 0.5, 1));
+    me = unordered_multimap_init_ex(sizeof(int), sizeof(int), hash_int,
+                                    compare_int, compare_int, 1000, 0.5, 1.5);
+    assert(me);
+    unordered_multimap_probe_histogram(me, &histogram);
+    capacity = histogram.capacity;
+    assert(capacity >= 2000);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multimap_put(me, &i, &i) == BK_OK);
+    }
+    unordered_multimap_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    assert(unordered_multimap_clear(me) == BK_OK);
+    unordered_multimap_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    assert(!unordered_multimap_destroy(me));
+    me = unordered_multimap_init_ex(sizeof(int), sizeof(int), NULL,
+                                    compare_int, compare_int, 0, 0.75, 2);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multimap_put(me, &i, &i) == BK_OK);
+    }
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multimap_contains(me, &i));
+    }
+    i = 1000;
+    assert(!unordered_multimap_contains(me, &i));
+    assert(!unordered_multimap_destroy(me));
+    me = unordered_multimap_init_ex(sizeof(triple), sizeof(int), NULL,
+                                    NULL, compare_int, 0, 0.75, 2);
+    assert(me);
+    memset(triple, 0, sizeof(triple));
+    for (i = 0; i < 1000; i++) {
+        triple[i % 3] = i;
+        assert(unordered_multimap_put(me, triple, &i) == BK_OK);
+        assert(unordered_multimap_contains(me, triple));
+    }
+    triple[0] = -1;
+    assert(!unordered_multimap_contains(me, triple));
+    assert(!unordered_multimap_destroy(me));
+}
+
+static void test_reserve(void)
+{
+    struct bk_probe_histogram histogram;
+    size_t capacity;
+    int i;
+    unordered_multimap me;
+    me = unordered_multimap_init(sizeof(int), sizeof(int), hash_int,
+                                 compare_int, compare_int);
+    assert(me);
+    assert(unordered_multimap_reserve(me, 0) == BK_OK);
+    assert(unordered_multimap_reserve(me, 5000) == BK_OK);
+    unordered_multimap_probe_histogram(me, &histogram);
+    capacity = histogram.capacity;
+    assert(capacity > 5000);
+    for (i = 0; i < 5000; i++) {
+        assert(unordered_multimap_put(me, &i, &i) == BK_OK);
+    }
+    assert(unordered_multimap_reserve(me, 10) == BK_OK);
+    unordered_multimap_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    assert(histogram.full == 5000);
+    assert(unordered_multimap_reserve(me, (size_t) -1) == -BK_ENOMEM);
+    assert(!unordered_multimap_destroy(me));
+}
+
+static void test_probe_histogram(void)
+{
+    struct bk_probe_histogram histogram;
+    size_t total = 0;
+    int i;
+    unordered_multimap me = unordered_multimap_init(sizeof(int), sizeof(int),
+                                                    hash_int, compare_int,
+                                                    compare_int);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multimap_put(me, &i, &i) == BK_OK);
+    }
+    for (i = 0; i < 100; i++) {
+        assert(unordered_multimap_remove(me, &i, &i));
+    }
+    unordered_multimap_probe_histogram(me, &histogram);
+    assert(histogram.full == 900);
+    assert(histogram.capacity >= histogram.full);
+    for (i = 0; i < BK_PROBE_HISTOGRAM_BUCKETS; i++) {
+        total += histogram.counts[i];
+    }
+    assert(total == histogram.full);
+    assert(histogram.average_probe >= 1.0);
+    assert(histogram.average_probe <= (double) histogram.longest_probe);
+    assert(histogram.counts[0] >= histogram.full * 9 / 10);
+    assert(!unordered_multimap_destroy(me));
+    me = unordered_multimap_init(sizeof(int), sizeof(int), bad_hash_int,
+                                 compare_int, compare_int);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multimap_put(me, &i, &i) == BK_OK);
+    }
+    unordered_multimap_probe_histogram(me, &histogram);
+    assert(histogram.full == 1000);
+    assert(histogram.longest_probe >= 1000 / 16);
+    assert(histogram.counts[BK_PROBE_HISTOGRAM_BUCKETS - 1] > 0);
+    assert(histogram.average_probe > BK_PROBE_HISTOGRAM_BUCKETS);
+    assert(!unordered_multimap_destroy(me));
+}
+
 void test_unordered_multimap(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
+    test_init_ex();
+    test_reserve();
+    test_probe_histogram();
     test_basic();
     test_bad_hash();
     test_collision();
     test_bad_hash_collision();
+    test_remove_all_shifted();
 #if STUB_MALLOC
     test_init_out_of_memory();
     test_rehash_out_of_memory();
@@ -24,6 +24,11 @@ static unsigned long bad_hash_int(const void *const key)
     return 5;
 }
 
+static unsigned long clustered_hash_int(const void *const key)
+{
+    return *(int *) key % 7;
+}
+
 static void test_invalid_init(void)
 {
     const size_t max_size = -1;
@@ -284,15 +289,16 @@ static void test_put_out_of_memory(void)
                                                     compare_int);
     assert(me);
     fail_malloc = 1;
-    assert(unordered_multiset_put(me, &key) == -ENOMEM);
-    fail_malloc = 1;
-    assert(unordered_multiset_put(me, &key) == -ENOMEM);
+    fail_calloc = 1;
+    assert(unordered_multiset_put(me, &key) == 0);
     assert(unordered_multiset_put(me, &key) == 0);
     key = 7;
-    fail_malloc = 1;
-    assert(unordered_multiset_put(me, &key) == -ENOMEM);
-    fail_malloc = 1;
-    assert(unordered_multiset_put(me, &key) == -ENOMEM);
+    assert(unordered_multiset_put(me, &key) == 0);
+    assert(fail_malloc == 1);
+    assert(fail_calloc == 1);
+    fail_malloc = 0;
+    fail_calloc = 0;
+    assert(unordered_multiset_size(me) == 3);
     assert(!unordered_multiset_destroy(me));
 }
 #endif
@@ -349,6 +355,42 @@ static int compare_big_object(const void *const one, const void *const two)
     return a->n - b->n;
 }
 
+/*
+ * Removes keys which share a few long runs of slots, so that the entries after
+ * each removed one are shifted back, and checks the counts of the others.
+ */
+static void test_remove_shifted(void)
+{
+    struct bk_probe_histogram histogram;
+    int i;
+    int j;
+    unordered_multiset me = unordered_multiset_init(sizeof(int),
+                                                    clustered_hash_int,
+                                                    compare_int);
+    assert(me);
+    for (i = 0; i < 100; i++) {
+        for (j = 0; j <= i % 3; j++) {
+            assert(unordered_multiset_put(me, &i) == BK_OK);
+        }
+    }
+    for (i = 0; i < 100; i += 2) {
+        if (i % 4 == 0) {
+            assert(unordered_multiset_remove_all(me, &i));
+        } else {
+            for (j = 0; j <= i % 3; j++) {
+                assert(unordered_multiset_remove(me, &i));
+            }
+        }
+        assert(!unordered_multiset_contains(me, &i));
+    }
+    for (i = 1; i < 100; i += 2) {
+        assert(unordered_multiset_count(me, &i) == (size_t) (i % 3 + 1));
+    }
+    unordered_multiset_probe_histogram(me, &histogram);
+    assert(histogram.full == 50);
+    assert(!unordered_multiset_destroy(me));
+}
+
 static void test_big_object(void)
 {
     int i;
@@ -389,12 +431,171 @@ static void test_big_object(void)
     assert(!unordered_multiset_destroy(me));
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    unordered_multiset me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = unordered_multiset_init_with_allocator(sizeof(int), hash_int,
+                                                compare_int, &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multiset_put(me, &i) == BK_OK);
+        assert(unordered_multiset_put(me, &i) == BK_OK);
+    }
+    i = 500;
+    assert(unordered_multiset_count(me, &i) == 2);
+    assert(unordered_multiset_remove_all(me, &i));
+    assert(unordered_multiset_clear(me) == BK_OK);
+    assert(!unordered_multiset_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = unordered_multiset_init_with_allocator(sizeof(int), hash_int,
+                                                compare_int, &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multiset_put(me, &i) == BK_OK);
+        assert(unordered_multiset_put(me, &i) == BK_OK);
+    }
+    i = 500;
+    assert(unordered_multiset_count(me, &i) == 2);
+    assert(!unordered_multiset_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = unordered_multiset_init_with_allocator(sizeof(int), hash_int,
+                                                compare_int, &allocator);
+    assert(!me);
+}
+
+static void test_init_ex(void)
+{
+    struct bk_probe_histogram histogram;
+    size_t capacity;
+    int triple[3];
+    int i;
+    unordered_multiset me;
+    assert(!unordered_multiset_init_ex(sizeof(int), hash_int, compare_int,
+                                       10, 0, 2));
+    assert(!unordered_multiset_init_ex(sizeof(int), hash_int, compare_int,
+                                       10, 1, 2));
+    assert(!unordered_multiset_init_ex(sizeof(int), hash_int, compare_int,
+                                       10, 0.5, 1));
+    me = unordered_multiset_init_ex(sizeof(int), hash_int, compare_int,
+                                    1000, 0.5, 1.5);
+    assert(me);
+    unordered_multiset_probe_histogram(me, &histogram);
+    capacity = histogram.capacity;
+    assert(capacity >= 2000);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multiset_put(me, &i) == BK_OK);
+    }
+    unordered_multiset_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    assert(unordered_multiset_clear(me) == BK_OK);
+    unordered_multiset_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    assert(!unordered_multiset_destroy(me));
+    me = unordered_multiset_init_ex(sizeof(int), NULL, compare_int, 0, 0.75, 2);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multiset_put(me, &i) == BK_OK);
+    }
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multiset_contains(me, &i));
+    }
+    i = 1000;
+    assert(!unordered_multiset_contains(me, &i));
+    assert(!unordered_multiset_destroy(me));
+    me = unordered_multiset_init_ex(sizeof(triple), NULL, NULL, 0, 0.75,
+                                    2);
+    assert(me);
+    memset(triple, 0, sizeof(triple));
+    for (i = 0; i < 1000; i++) {
+        triple[i % 3] = i;
+        assert(unordered_multiset_put(me, triple) == BK_OK);
+        assert(unordered_multiset_contains(me, triple));
+    }
+    triple[0] = -1;
+    assert(!unordered_multiset_contains(me, triple));
+    assert(!unordered_multiset_destroy(me));
+}
+
+static void test_reserve(void)
+{
+    struct bk_probe_histogram histogram;
+    size_t capacity;
+    int i;
+    unordered_multiset me = unordered_multiset_init(sizeof(int), hash_int,
+                                                    compare_int);
+    assert(me);
+    assert(unordered_multiset_reserve(me, 0) == BK_OK);
+    assert(unordered_multiset_reserve(me, 5000) == BK_OK);
+    unordered_multiset_probe_histogram(me, &histogram);
+    capacity = histogram.capacity;
+    assert(capacity > 5000);
+    for (i = 0; i < 5000; i++) {
+        assert(unordered_multiset_put(me, &i) == BK_OK);
+    }
+    assert(unordered_multiset_reserve(me, 10) == BK_OK);
+    unordered_multiset_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    assert(histogram.full == 5000);
+    assert(unordered_multiset_reserve(me, (size_t) -1) == -BK_ENOMEM);
+    assert(!unordered_multiset_destroy(me));
+}
+
+static void test_probe_histogram(void)
+{
+    struct bk_probe_histogram histogram;
+    size_t total = 0;
+    int i;
+    unordered_multiset me = unordered_multiset_init(sizeof(int), hash_int,
+                                                    compare_int);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multiset_put(me, &i) == BK_OK);
+    }
+    for (i = 0; i < 100; i++) {
+        assert(unordered_multiset_remove(me, &i));
+    }
+    unordered_multiset_probe_histogram(me, &histogram);
+    assert(histogram.full == 900);
+    assert(histogram.capacity >= histogram.full);
+    for (i = 0; i < BK_PROBE_HISTOGRAM_BUCKETS; i++) {
+        total += histogram.counts[i];
+    }
+    assert(total == histogram.full);
+    assert(histogram.average_probe >= 1.0);
+    assert(histogram.average_probe <= (double) histogram.longest_probe);
+    assert(histogram.counts[0] >= histogram.full * 9 / 10);
+    assert(!unordered_multiset_destroy(me));
+    me = unordered_multiset_init(sizeof(int), bad_hash_int, compare_int);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_multiset_put(me, &i) == BK_OK);
+    }
+    unordered_multiset_probe_histogram(me, &histogram);
+    assert(histogram.full == 1000);
+    assert(histogram.longest_probe >= 1000 / 16);
+    assert(histogram.counts[BK_PROBE_HISTOGRAM_BUCKETS - 1] > 0);
+    assert(histogram.average_probe > BK_PROBE_HISTOGRAM_BUCKETS);
+    assert(!unordered_multiset_destroy(me));
+}
+
 void test_unordered_multiset(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
+    test_init_ex();
+    test_reserve();
+    test_probe_histogram();
     test_basic();
     test_bad_hash();
     test_collision();
+    test_remove_shifted();
 #if STUB_MALLOC
     test_init_out_of_memory();
     test_rehash_out_of_memory();
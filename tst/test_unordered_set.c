@@ -24,6 +24,11 @@ static unsigned long bad_hash_int(const void *const key)
     return 5;
 }
 
+static unsigned long clustered_hash_int(const void *const key)
+{
+    return *(int *) key % 7;
+}
+
 static void test_invalid_init(void)
 {
     const size_t max_size = -1;
@@ -228,20 +233,41 @@ static void test_put_out_of_memory(void)
                                           compare_int);
     assert(me);
     fail_malloc = 1;
-    assert(unordered_set_put(me, &key) == -ENOMEM);
-    fail_malloc = 1;
-    assert(unordered_set_put(me, &key) == -ENOMEM);
+    fail_calloc = 1;
+    assert(unordered_set_put(me, &key) == 0);
     assert(unordered_set_put(me, &key) == 0);
     key = 7;
-    fail_malloc = 1;
-    assert(unordered_set_put(me, &key) == -ENOMEM);
-    fail_malloc = 1;
-    assert(unordered_set_put(me, &key) == -ENOMEM);
+    assert(unordered_set_put(me, &key) == 0);
+    assert(fail_malloc == 1);
+    assert(fail_calloc == 1);
+    fail_malloc = 0;
+    fail_calloc = 0;
+    assert(unordered_set_size(me) == 2);
     assert(!unordered_set_destroy(me));
 }
 #endif
 
 #if STUB_MALLOC
+static void test_put_all_out_of_memory(void)
+{
+    int keys[100];
+    int i;
+    unordered_set me = unordered_set_init(sizeof(int), hash_int, compare_int);
+    assert(me);
+    for (i = 0; i < 100; i++) {
+        keys[i] = i;
+    }
+    fail_malloc = 1;
+    fail_calloc = 1;
+    assert(unordered_set_put_all(me, keys, 100) == -BK_ENOMEM);
+    fail_malloc = 0;
+    fail_calloc = 0;
+    assert(unordered_set_is_empty(me));
+    assert(unordered_set_put_all(me, keys, 100) == BK_OK);
+    assert(unordered_set_size(me) == 100);
+    assert(!unordered_set_destroy(me));
+}
+
 static void test_resize_out_of_memory(void)
 {
     int i;
@@ -291,6 +317,40 @@ static int compare_big_object(const void *const one, const void *const two)
     return a->n - b->n;
 }
 
+/*
+ * Removes and re-adds keys which share a few long runs of slots, so that the
+ * entries after each removed one are shifted back, and checks that every key
+ * is still found and that only the live entries occupy slots.
+ */
+static void test_churn_without_tombstones(void)
+{
+    struct bk_probe_histogram histogram;
+    int round;
+    int i;
+    unordered_set me = unordered_set_init(sizeof(int), clustered_hash_int,
+                                          compare_int);
+    assert(me);
+    for (i = 0; i < 200; i++) {
+        assert(unordered_set_put(me, &i) == BK_OK);
+    }
+    for (round = 0; round < 50; round++) {
+        for (i = 0; i < 200; i++) {
+            int key = (i * 79 + round) % 200;
+            if (key % 3 == round % 3) {
+                assert(unordered_set_remove(me, &key));
+                assert(!unordered_set_contains(me, &key));
+            }
+        }
+        for (i = 0; i < 200; i++) {
+            assert(unordered_set_contains(me, &i) == (i % 3 != round % 3));
+            assert(unordered_set_put(me, &i) == BK_OK);
+        }
+        unordered_set_probe_histogram(me, &histogram);
+        assert(histogram.full == 200);
+    }
+    assert(!unordered_set_destroy(me));
+}
+
 static void test_big_object(void)
 {
     int i;
@@ -330,15 +390,269 @@ static void test_big_object(void)
     assert(!unordered_set_destroy(me));
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    unordered_set me;
+    int i;
+    test_counting_allocator(&allocator, &live);
+    me = unordered_set_init_with_allocator(sizeof(int), hash_int, compare_int,
+                                           &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_set_put(me, &i) == BK_OK);
+    }
+    i = 500;
+    assert(unordered_set_contains(me, &i));
+    assert(unordered_set_remove(me, &i));
+    assert(unordered_set_clear(me) == BK_OK);
+    assert(!unordered_set_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = unordered_set_init_with_allocator(sizeof(int), hash_int, compare_int,
+                                           &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_set_put(me, &i) == BK_OK);
+    }
+    i = 500;
+    assert(unordered_set_contains(me, &i));
+    assert(!unordered_set_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = unordered_set_init_with_allocator(sizeof(int), hash_int, compare_int,
+                                           &allocator);
+    assert(!me);
+}
+
+static void test_init_ex(void)
+{
+    struct bk_probe_histogram histogram;
+    size_t capacity;
+    int triple[3];
+    int i;
+    unordered_set me;
+    assert(!unordered_set_init_ex(sizeof(int), hash_int, compare_int,
+                                  10, 0, 2));
+    assert(!unordered_set_init_ex(sizeof(int), hash_int, compare_int,
+                                  10, 1, 2));
+    assert(!unordered_set_init_ex(sizeof(int), hash_int, compare_int,
+                                  10, 0.5, 1));
+    me = unordered_set_init_ex(sizeof(int), hash_int, compare_int,
+                               1000, 0.5, 1.5);
+    assert(me);
+    unordered_set_probe_histogram(me, &histogram);
+    capacity = histogram.capacity;
+    assert(capacity >= 2000);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_set_put(me, &i) == BK_OK);
+    }
+    unordered_set_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    assert(unordered_set_clear(me) == BK_OK);
+    unordered_set_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    assert(!unordered_set_destroy(me));
+    me = unordered_set_init_ex(sizeof(int), NULL, NULL, 0, 0.75, 2);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_set_put(me, &i) == BK_OK);
+    }
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_set_contains(me, &i));
+    }
+    i = 1000;
+    assert(!unordered_set_contains(me, &i));
+    assert(!unordered_set_destroy(me));
+    me = unordered_set_init_ex(sizeof(triple), NULL, NULL, 0, 0.75, 2);
+    assert(me);
+    memset(triple, 0, sizeof(triple));
+    for (i = 0; i < 1000; i++) {
+        triple[i % 3] = i;
+        assert(unordered_set_put(me, triple) == BK_OK);
+        assert(unordered_set_contains(me, triple));
+    }
+    triple[0] = -1;
+    assert(!unordered_set_contains(me, triple));
+    assert(!unordered_set_destroy(me));
+}
+
+static void test_reserve(void)
+{
+    struct bk_probe_histogram histogram;
+    size_t capacity;
+    int i;
+    unordered_set me = unordered_set_init(sizeof(int), hash_int, compare_int);
+    assert(me);
+    assert(unordered_set_reserve(me, 0) == BK_OK);
+    assert(unordered_set_reserve(me, 5000) == BK_OK);
+    unordered_set_probe_histogram(me, &histogram);
+    capacity = histogram.capacity;
+    assert(capacity > 5000);
+    for (i = 0; i < 5000; i++) {
+        assert(unordered_set_put(me, &i) == BK_OK);
+    }
+    assert(unordered_set_reserve(me, 10) == BK_OK);
+    unordered_set_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    assert(histogram.full == 5000);
+    assert(unordered_set_reserve(me, (size_t) -1) == -BK_ENOMEM);
+    assert(!unordered_set_destroy(me));
+}
+
+static void test_batch(void)
+{
+    int keys[1500];
+    bk_bool found[1500];
+    int i;
+    unordered_set me = unordered_set_init(sizeof(int), hash_int, compare_int);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_set_put(me, &i) == BK_OK);
+    }
+    for (i = 0; i < 1500; i++) {
+        keys[i] = 1499 - i;
+    }
+    assert(unordered_set_contains_batch(found, me, keys, 1500) == 1000);
+    for (i = 0; i < 1500; i++) {
+        assert(found[i] == (keys[i] < 1000));
+    }
+    assert(unordered_set_contains_batch(NULL, me, keys, 1500) == 1000);
+    assert(unordered_set_contains_batch(found, me, keys, 0) == 0);
+    assert(!unordered_set_destroy(me));
+}
+
+static void test_put_all(void)
+{
+    struct bk_probe_histogram histogram;
+    int keys[1000];
+    size_t capacity;
+    int i;
+    unordered_set me = unordered_set_init(sizeof(int), hash_int, compare_int);
+    assert(me);
+    assert(unordered_set_put_all(me, keys, 0) == BK_OK);
+    assert(unordered_set_is_empty(me));
+    for (i = 0; i < 1000; i++) {
+        keys[i] = i;
+    }
+    assert(unordered_set_put_all(me, keys, 1000) == BK_OK);
+    assert(unordered_set_size(me) == 1000);
+    unordered_set_probe_histogram(me, &histogram);
+    capacity = histogram.capacity;
+    for (i = 0; i < 1000; i += 2) {
+        assert(unordered_set_remove(me, &i));
+    }
+    for (i = 0; i < 1000; i++) {
+        keys[i] = i / 2;
+    }
+    assert(unordered_set_put_all(me, keys, 1000) == BK_OK);
+    assert(unordered_set_size(me) == 750);
+    unordered_set_probe_histogram(me, &histogram);
+    assert(histogram.capacity == capacity);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_set_contains(me, &i) == (i < 500 || i % 2 == 1));
+    }
+    assert(unordered_set_put_all(me, keys, (size_t) -1) == -BK_ENOMEM);
+    assert(unordered_set_size(me) == 750);
+    assert(!unordered_set_destroy(me));
+}
+
+static void sum_keys(const void *const key, void *const context)
+{
+    long *const sum = context;
+    *sum += *(const int *) key;
+}
+
+static void test_iteration(void)
+{
+    struct unordered_set_iter iter;
+    char seen[1000];
+    void *key;
+    long sum = 0;
+    int visited = 0;
+    int i;
+    unordered_set me = unordered_set_init(sizeof(int), hash_int, compare_int);
+    assert(me);
+    unordered_set_iter_init(&iter, me);
+    assert(!unordered_set_iter_next(&key, &iter));
+    unordered_set_for_each(me, sum_keys, &sum);
+    assert(sum == 0);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_set_put(me, &i) == BK_OK);
+    }
+    memset(seen, 0, sizeof(seen));
+    unordered_set_iter_init(&iter, me);
+    while (unordered_set_iter_next(&key, &iter)) {
+        const int k = *(int *) key;
+        assert(k >= 0 && k < 1000);
+        assert(!seen[k]);
+        seen[k] = 1;
+        visited++;
+    }
+    assert(visited == 1000);
+    assert(!unordered_set_iter_next(&key, &iter));
+    unordered_set_for_each(me, sum_keys, &sum);
+    assert(sum == 999 * 1000 / 2);
+    assert(!unordered_set_destroy(me));
+}
+
+static void test_probe_histogram(void)
+{
+    struct bk_probe_histogram histogram;
+    size_t total = 0;
+    int i;
+    unordered_set me = unordered_set_init(sizeof(int), hash_int, compare_int);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_set_put(me, &i) == BK_OK);
+    }
+    for (i = 0; i < 100; i++) {
+        assert(unordered_set_remove(me, &i));
+    }
+    unordered_set_probe_histogram(me, &histogram);
+    assert(histogram.full == 900);
+    assert(histogram.capacity >= histogram.full);
+    for (i = 0; i < BK_PROBE_HISTOGRAM_BUCKETS; i++) {
+        total += histogram.counts[i];
+    }
+    assert(total == histogram.full);
+    assert(histogram.average_probe >= 1.0);
+    assert(histogram.average_probe <= (double) histogram.longest_probe);
+    assert(histogram.counts[0] >= histogram.full * 9 / 10);
+    assert(!unordered_set_destroy(me));
+    me = unordered_set_init(sizeof(int), bad_hash_int, compare_int);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(unordered_set_put(me, &i) == BK_OK);
+    }
+    unordered_set_probe_histogram(me, &histogram);
+    assert(histogram.full == 1000);
+    assert(histogram.longest_probe >= 1000 / 16);
+    assert(histogram.counts[BK_PROBE_HISTOGRAM_BUCKETS - 1] > 0);
+    assert(histogram.average_probe > BK_PROBE_HISTOGRAM_BUCKETS);
+    assert(!unordered_set_destroy(me));
+}
+
 void test_unordered_set(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
+    test_init_ex();
+    test_reserve();
+    test_batch();
+    test_put_all();
+    test_iteration();
+    test_probe_histogram();
     test_basic();
     test_bad_hash();
+    test_churn_without_tombstones();
 #if STUB_MALLOC
     test_init_out_of_memory();
     test_rehash_out_of_memory();
     test_put_out_of_memory();
+    test_put_all_out_of_memory();
     test_resize_out_of_memory();
     test_clear_out_of_memory();
 #endif
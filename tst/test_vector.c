@@ -287,6 +287,31 @@ struct big_object {
     signed char c[8];
 };
 
+static void test_get_at_ptr(void)
+{
+    int i;
+    int *element;
+    vector me = vector_init(sizeof(int));
+    assert(me);
+    assert(!vector_get_at_ptr(me, 0));
+    for (i = 0; i < 10; i++) {
+        assert(vector_add_last(me, &i) == BK_OK);
+    }
+    assert(!vector_get_at_ptr(me, 10));
+    for (i = 0; i < 10; i++) {
+        element = vector_get_at_ptr(me, i);
+        assert(element);
+        assert(*element == i);
+        *element *= 3;
+    }
+    for (i = 0; i < 10; i++) {
+        int value = 0;
+        assert(vector_get_at(&value, me, i) == BK_OK);
+        assert(value == 3 * i);
+    }
+    assert(!vector_destroy(me));
+}
+
 static void test_big_object(void)
 {
     int i;
@@ -340,9 +365,65 @@ static void test_add_all(void)
     vector_destroy(me);
 }
 
+static void test_init_with_allocator(void)
+{
+    long live;
+    struct bk_allocator allocator;
+    vector me;
+    int i;
+    int get = 0;
+    test_counting_allocator(&allocator, &live);
+    me = vector_init_with_allocator(sizeof(int), &allocator);
+    assert(me);
+    assert(live > 0);
+    for (i = 0; i < 1000; i++) {
+        assert(vector_add_last(me, &i) == BK_OK);
+    }
+    assert(vector_get_at(&get, me, 500) == BK_OK);
+    assert(get == 500);
+    assert(!vector_destroy(me));
+    assert(live == 0);
+    allocator.reallocate = NULL;
+    me = vector_init_with_allocator(sizeof(int), &allocator);
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(vector_add_last(me, &i) == BK_OK);
+    }
+    assert(vector_get_at(&get, me, 500) == BK_OK);
+    assert(get == 500);
+    assert(!vector_destroy(me));
+    assert(live == 0);
+    allocator.allocate = NULL;
+    me = vector_init_with_allocator(sizeof(int), &allocator);
+    assert(!me);
+}
+
+static void test_stats(void)
+{
+    struct bk_stats stats;
+    int i;
+    vector me = vector_init(sizeof(int));
+    assert(me);
+    for (i = 0; i < 1000; i++) {
+        assert(vector_add_last(me, &i) == BK_OK);
+    }
+    vector_get_stats(me, &stats);
+#ifdef BK_STATS
+    assert(stats.resizes > 0);
+    assert(stats.bytes_allocated > 1000 * sizeof(int));
+#else
+    assert(stats.resizes == 0);
+    assert(stats.bytes_allocated == 0);
+#endif
+    assert(stats.comparator_calls == 0);
+    assert(!vector_destroy(me));
+}
+
 void test_vector(void)
 {
     test_invalid_init();
+    test_init_with_allocator();
+    test_stats();
     test_basic();
     test_vector_of_vectors();
     test_dynamic();
@@ -353,6 +434,7 @@ void test_vector(void)
     test_add_out_of_memory();
 #endif
     test_big_object();
+    test_get_at_ptr();
     test_add_all();
     vector_destroy(NULL);
 }